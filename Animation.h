@@ -1,9 +1,19 @@
 #pragma once
+#include <vector>
+#include "SyncMarkers.h"
+#include "PoseMatching.h"
+
 namespace gef
 {
 	class Animation;
 }
 
+namespace AsdfAnim
+{
+	class CompressedClip;
+	class ResampledClip;
+}
+
 namespace AsdfAnim
 {
 	enum class AnimationType {
@@ -28,11 +38,31 @@ namespace AsdfAnim
 		Transition_Type_Smooth
 	};
 
+	enum class ClipRepresentation {
+		Clip_Representation_Source = 0,		// Full precision gef keys
+		Clip_Representation_Compressed,		// Reduced and quantised keys, the source keys are released
+		Clip_Representation_Resampled		// Uniform frames, no key search, larger than the compressed keys
+	};
+
+	// Pose an additive clip is the difference against
+	enum class AdditiveReference {
+		Additive_Reference_None = 0,		// Not an additive clip
+		Additive_Reference_Bind_Pose,
+		Additive_Reference_First_Frame
+	};
+
 	struct Clip {
-		gef::Animation* clip;
+		gef::Animation* clip;			// Null once the clip has been compressed
 		ClipType type;
 		std::string name;
 		uint32_t id;
+		float duration;
+		CompressedClip* compressed;
+		ResampledClip* resampled;
+		ClipRepresentation representation;	// Used for playback, only representations whose data exists can be selected
+		ResampledClip* additive;			// Difference against the reference set in the manifest, null when the clip is not additive
+		std::vector<SyncMarker> markers;	// Foot contacts the synchronised blends and transitions keep in step, extracted on load
+		PoseFeatures features;				// Searched by the pose matched transitions, extracted on load
 	};
 
 	class Animation
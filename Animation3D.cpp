@@ -2,39 +2,75 @@
 #include "system/platform.h"
 #include "graphics/scene.h"
 #include "graphics/mesh.h"
+#include "graphics/mesh_data.h"
 #include "graphics/renderer_3d.h"
+#include "graphics/material.h"
+#include "graphics/texture.h"
 #include "animation/skeleton.h"
 #include "animation/animation.h"
 #include "system/string_id.h"
+#include "AssetManifest.h"
+#include "ClipCompression.h"
+#include "ResampledClip.h"
+#include "BlendTreeFile.h"
 #include <filesystem>
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 
-AsdfAnim::Animation3D::Animation3D() : p_Scene(nullptr), p_Mesh(nullptr), p_MeshInstance(nullptr), p_CurrentAnimation(nullptr),
-p_BlendTree(nullptr), p_Ragdoll(nullptr), m_NeedsPhysicsUpdate(false)
+namespace
+{
+    // Masks built for every skeleton from subtrees of the Mixamo rig, a mask is skipped when its subtree is not in the skeleton
+    struct BoneMaskDefinition
+    {
+        const char* name;
+        const char* subtree;
+        const char* excludedSubtree;
+    };
+    const BoneMaskDefinition k_BoneMasks[] = {
+        { "Upper body",     "mixamorig:Spine",          nullptr },
+        { "Lower body",     "mixamorig:Hips",           "mixamorig:Spine" },
+        { "Left arm",       "mixamorig:LeftShoulder",   nullptr },
+        { "Right arm",      "mixamorig:RightShoulder",  nullptr },
+        { "Head",           "mixamorig:Neck",           nullptr }
+    };
+}
+
+AsdfAnim::Animation3D::Animation3D() : p_Scene(nullptr), p_Mesh(nullptr), p_MeshInstance(nullptr), p_MirrorMap(nullptr), p_CurrentAnimation(nullptr),
+p_BlendTreeTemplate(nullptr), p_BlendTree(nullptr), p_Ragdoll(nullptr), m_NeedsPhysicsUpdate(false),
+m_RenderDataBytes(0u), m_ClipBytes(0u), m_PeakResidentBytes(0u), m_LastActiveFrame(0u)
 {
 }
 
 AsdfAnim::Animation3D::~Animation3D()
 {
-    if (p_Scene)        delete p_Scene, p_Scene = nullptr;
     if (p_Mesh)         delete p_Mesh, p_Mesh = nullptr;
+    if (p_Scene)        delete p_Scene, p_Scene = nullptr;
     if (p_MeshInstance) delete p_MeshInstance, p_MeshInstance = nullptr;
     if (p_BlendTree)    delete p_BlendTree, p_BlendTree = nullptr;
+    if (p_BlendTreeTemplate) delete p_BlendTreeTemplate, p_BlendTreeTemplate = nullptr;
     if (p_Ragdoll)      delete p_Ragdoll, p_Ragdoll = nullptr;
+    if (p_MirrorMap)    delete p_MirrorMap, p_MirrorMap = nullptr;
+    for (Clip& clip : v_Clips)
+    {
+        if (clip.clip)          delete clip.clip, clip.clip = nullptr;
+        if (clip.compressed)    delete clip.compressed, clip.compressed = nullptr;
+        if (clip.resampled)     delete clip.resampled, clip.resampled = nullptr;
+        if (clip.additive)      delete clip.additive, clip.additive = nullptr;
+    }
 }
 
-AsdfAnim::Animation3D* AsdfAnim::Animation3D::CreateFromSceneFile(gef::Platform& platform, const char* filepath)
+AsdfAnim::Animation3D* AsdfAnim::Animation3D::CreateFromManifest(gef::Platform& platform, const AssetManifest& manifest, const ManifestAsset& asset)
 {
     Animation3D* animation = new Animation3D();
-    animation->LoadScene(platform, filepath);
+    animation->LoadScene(platform, manifest, asset);
     animation->SetType(AnimationType::Animation_Type_3D);
     return animation;
 }
 
-void AsdfAnim::Animation3D::LoadScene(gef::Platform& platform, const char* filepath)
+void AsdfAnim::Animation3D::LoadScene(gef::Platform& platform, const AssetManifest& manifest, const ManifestAsset& asset)
 {
     // Change the current working directory, and restore it at the end
+    const std::string filepath = manifest.GetFullPath(asset.scene);
     std::filesystem::path file(filepath);
     if (!std::filesystem::exists(file))
     {
@@ -44,7 +80,7 @@ void AsdfAnim::Animation3D::LoadScene(gef::Platform& platform, const char* filep
 
     // Read the data from the file
     p_Scene = new gef::Scene();
-    p_Scene->ReadSceneFromFile(platform, filepath);
+    p_Scene->ReadSceneFromFile(platform, filepath.c_str());
     if (!p_Scene->mesh_data.size() || !p_Scene->skeletons.size())
     {
         MessageBox(NULL, L"Could not load the animation: file does not contain any mesh or skeleton.", L"Error!", NULL);
@@ -52,77 +88,135 @@ void AsdfAnim::Animation3D::LoadScene(gef::Platform& platform, const char* filep
     }
 
     // Read the filename
-    s_Filename = file.filename().replace_extension("").string();
+    s_Filename = asset.name;
 
     // Initialise the animation data from the scene data
-    p_Scene->CreateMaterials(platform);
-    p_Mesh = p_Scene->CreateMesh(platform, p_Scene->mesh_data.front());
+    // The mesh and materials are only created on the first activation, see CreateRenderData()
     gef::Skeleton* skeleton = p_Scene->skeletons.front();
     p_MeshInstance = new gef::SkinnedMeshInstance(*skeleton);
-    p_MeshInstance->set_mesh(p_Mesh);
     gef::Matrix44 identity;
     identity.SetIdentity();
     p_MeshInstance->set_transform(identity);
+    CreateBoneMasks(*skeleton);
+    // Joints paired by their names in the scene, a clip authored for one side plays on the other through a mirror node
+    p_MirrorMap = new MirrorMap(p_MeshInstance->bind_pose(), p_Scene->string_id_table);
 
-    // Load all the animations for that filname
-    for (const auto& entry : std::filesystem::directory_iterator(file.parent_path()))
-    {
-        // Get the current file in the directory
-        std::filesystem::path animationFile = entry.path().filename();
-        size_t temp = animationFile.string().find(s_Filename + "@");
-        if (temp == std::string::npos) continue;
+    // Work out what the render data will cost once created
+    const gef::MeshData& meshData = p_Scene->mesh_data.front();
+    m_RenderDataBytes = static_cast<size_t>(meshData.vertex_data.num_vertices) * meshData.vertex_data.vertex_byte_size;
+    for (const gef::PrimitiveData* primitive : meshData.primitives)
+        m_RenderDataBytes += static_cast<size_t>(primitive->num_indices) * primitive->index_byte_size;
+    for (const ManifestTexture& texture : asset.textures)
+        m_RenderDataBytes += static_cast<size_t>(texture.width) * texture.height * 4u;     // Textures are created as RGBA8
 
-        // If the file contains the same name as the scene file and '@', this is a valid animation file and all the information it contains should be loaded
+    // Load all the animations listed by the manifest for this asset, their type and name were resolved when the manifest was generated
+    for (const ManifestClip& manifestClip : asset.clips)
+    {
         gef::Scene tempScene;
-        tempScene.ReadSceneFromFile(platform, entry.path().string().c_str());
+        tempScene.ReadSceneFromFile(platform, manifest.GetFullPath(manifestClip.file).c_str());
         for (auto& animIterator : tempScene.animations)
         {
-            //Determine the type of this clip if possible
-            ClipType clipType = ClipType::Clip_Type_Undefined;
-            std::string name;
             static uint32_t id = 0u;
-            //Brut force, very bad
-            if(animationFile.string().find("idle", s_Filename.size() + 1) != std::string::npos)         {   clipType = ClipType::Clip_Type_Idle;    name = "idle";     }
-            else if(animationFile.string().find("walking", s_Filename.size() + 1) != std::string::npos) {   clipType = ClipType::Clip_Type_Walk;    name = "walking";  }
-            else if(animationFile.string().find("running", s_Filename.size() + 1) != std::string::npos) {   clipType = ClipType::Clip_Type_Run;     name = "running";  }
-            else if(animationFile.string().find("jump", s_Filename.size() + 1) != std::string::npos)    {   clipType = ClipType::Clip_Type_Jump;    name = "jump";     }
-            else if(animationFile.string().find("fall", s_Filename.size() + 1) != std::string::npos)    {   clipType = ClipType::Clip_Type_Fall;    name = "fall";     }
 
             // Create a new clip
             Clip clip{
                 new gef::Animation(std::move(*animIterator.second)),
-                clipType,
-                name,
+                manifestClip.type,
+                manifestClip.name,
                 id++
             };
+            clip.duration = clip.clip->duration();
+
+            // Foot contacts keeping the synchronised blends in step, measured on the source keys before they are compressed
+            clip.markers = SyncMarkers::Extract(*clip.clip, p_MeshInstance->bind_pose());
+            // Poses the transitions can start the clip on, from the source keys as well
+            clip.features = PoseMatching::Extract(*clip.clip, p_MeshInstance->bind_pose());
+
+            // Locomotion clips play all the time, resample them so they can be sampled without any key search
+            // The compressed version is kept as well so the representation can still be switched at runtime
+            if (IsHotClip(clip.type))
+            {
+                clip.resampled = ResampledClip::Resample(*clip.clip, p_MeshInstance->bind_pose());
+                if (clip.resampled)
+                    m_ClipBytes += clip.resampled->GetBytes();
+            }
+
+            // Additive clips store their difference with the reference, so additive nodes never subtract poses at runtime
+            if (manifestClip.additive != AdditiveReference::Additive_Reference_None)
+            {
+                clip.additive = ResampledClip::ResampleAdditive(*clip.clip, p_MeshInstance->bind_pose(), manifestClip.additive);
+                if (clip.additive)
+                    m_ClipBytes += clip.additive->GetBytes();
+            }
+
+            // Compress the clip against this skeleton, the result is cached next to the source and rebuilt when the source content changes
+            // A clip that does not fit in the error budget is not compressed and keeps its source keys
+            const std::string cachePath = std::filesystem::path(manifest.GetFullPath(manifestClip.file)).replace_extension(CLIP_COMPRESSION_CACHE_EXTENSION).string();
+            clip.compressed = CompressedClip::LoadOrCompress(cachePath, manifestClip.file.hash, *clip.clip, p_MeshInstance->bind_pose());
+            if (clip.compressed)
+            {
+                // The source keys are no longer needed for playback
+                delete clip.clip, clip.clip = nullptr;
+                clip.representation = ClipRepresentation::Clip_Representation_Compressed;
+                m_ClipBytes += clip.compressed->GetBytes();
+            }
+            else m_ClipBytes += CompressedClip::GetSourceBytes(*clip.clip);
+            if (clip.resampled) clip.representation = ClipRepresentation::Clip_Representation_Resampled;
             v_Clips.push_back(std::move(clip));
             //v_AvailableAnimations.push_back(tempScene.string_id_table.table().at(animIterator.first));    // This won't work cause the gef loader only saves one animation
-            v_AvailableClips.push_back(entry.path().filename().replace_extension("").string());             // Save the filename instead
+            v_AvailableClips.push_back(std::filesystem::path(manifestClip.file.path).filename().replace_extension("").string());   // Save the filename instead
         }
     }
 
-    // Init blend tree
-    p_BlendTree = new BlendTree(p_MeshInstance->bind_pose());
-
     // If one or multiple animation is present, assign the first loaded animation as the default one
     if (v_Clips.size())
-    {
-        // Initialise the first clip player on the first loaded animation
         p_CurrentAnimation = &v_Clips.front();
 
-        // Add a default clip node to the blendTree
-        // This will be the first loaded clip
-        uint32_t defaultNodeID = p_BlendTree->AddNode(NodeType_::NodeType_Clip);
-        ClipNode* defaultNode = reinterpret_cast<ClipNode*>(p_BlendTree->GetNode(defaultNodeID));
-        defaultNode->SetClip(p_CurrentAnimation);
-        p_BlendTree->ConnectToRoot(defaultNodeID);
+    // Init blend tree from the graph saved for this character, a JSON mirror edited since the binary file was written takes precedence
+    s_BlendTreePath = std::filesystem::path(filepath).replace_extension("").string();
+    BlendTreeBindings bindings;
+    for (const Clip& clip : v_Clips) bindings.clips.push_back(&clip);
+    for (const BoneMask& mask : v_BoneMasks) bindings.masks.push_back(&mask);
+    bindings.mirrorMap = p_MirrorMap;
+    const std::string binaryPath = s_BlendTreePath + BLENDTREE_FILE_EXTENSION;
+    const std::string jsonPath = s_BlendTreePath + BLENDTREE_JSON_EXTENSION;
+    std::error_code error;
+    const bool jsonEdited = std::filesystem::exists(jsonPath, error) &&
+        (!std::filesystem::exists(binaryPath, error) || std::filesystem::last_write_time(jsonPath, error) > std::filesystem::last_write_time(binaryPath, error));
+    p_BlendTreeTemplate = jsonEdited ? BlendTreeFile::LoadJson(jsonPath, p_MeshInstance->bind_pose(), bindings) : BlendTreeFile::Load(binaryPath, p_MeshInstance->bind_pose(), bindings);
+    if (!p_BlendTreeTemplate)
+        p_BlendTreeTemplate = jsonEdited ? BlendTreeFile::Load(binaryPath, p_MeshInstance->bind_pose(), bindings) : BlendTreeFile::LoadJson(jsonPath, p_MeshInstance->bind_pose(), bindings);
+    if (!p_BlendTreeTemplate)
+    {
+        // Otherwise start from a default clip node playing the first loaded clip
+        p_BlendTreeTemplate = new BlendTreeTemplate(p_MeshInstance->bind_pose());
+        if (p_CurrentAnimation)
+        {
+            NodeHandle defaultNodeID = p_BlendTreeTemplate->AddNode(NodeType_::NodeType_Clip);
+            ClipNode* defaultNode = reinterpret_cast<ClipNode*>(p_BlendTreeTemplate->GetNode(defaultNodeID));
+            defaultNode->SetClip(p_CurrentAnimation);
+            p_BlendTreeTemplate->ConnectToRoot(defaultNodeID);
+        }
     }
+
+    // This character is the only instance of the template
+    p_BlendTree = new BlendTree(*p_BlendTreeTemplate);
 }
 
 void AsdfAnim::Animation3D::LoadRagdoll(btDiscreteDynamicsWorld* pbtDynamicWorld, const char* filepath)
 {
     p_Ragdoll = new Ragdoll;
-    p_Ragdoll->Init(p_BlendTree->GetBindPose(), pbtDynamicWorld, filepath);
+    p_Ragdoll->Init(p_BlendTreeTemplate->GetBindPose(), pbtDynamicWorld, filepath);
+
+    // The ragdoll nodes of a loaded graph are bound now, the tree is compiled again on the next update
+    p_BlendTreeTemplate->SetRagdoll(p_Ragdoll);
+}
+
+bool AsdfAnim::Animation3D::SaveBlendTree()
+{
+    // The mirror is written first so that it is not newer than the binary file
+    return BlendTreeFile::SaveJson(*p_BlendTreeTemplate, s_BlendTreePath + BLENDTREE_JSON_EXTENSION) &&
+        BlendTreeFile::Save(*p_BlendTreeTemplate, s_BlendTreePath + BLENDTREE_FILE_EXTENSION);
 }
 
 void AsdfAnim::Animation3D::Update(float frameTime)
@@ -134,9 +228,75 @@ void AsdfAnim::Animation3D::Update(float frameTime)
 
 void AsdfAnim::Animation3D::Draw(gef::Renderer3D* renderer) const
 {
+    if (!IsResident()) return;
     renderer->DrawSkinnedMesh(*p_MeshInstance, p_MeshInstance->bone_matrices());
 }
 
+void AsdfAnim::Animation3D::CreateRenderData(gef::Platform& platform)
+{
+    if (IsResident() || !p_MeshInstance || p_Scene->mesh_data.empty()) return;
+
+    p_Scene->CreateMaterials(platform);
+    p_Mesh = p_Scene->CreateMesh(platform, p_Scene->mesh_data.front());
+    p_MeshInstance->set_mesh(p_Mesh);
+    if (GetResidentBytes() > m_PeakResidentBytes) m_PeakResidentBytes = GetResidentBytes();
+}
+
+void AsdfAnim::Animation3D::ReleaseRenderData()
+{
+    if (!IsResident()) return;
+
+    // The mesh references the materials, release it first
+    // The scene keeps the mesh and material data around so everything can be created again on the next activation
+    p_MeshInstance->set_mesh(nullptr);
+    delete p_Mesh, p_Mesh = nullptr;
+    for (gef::Material*& material : p_Scene->materials)
+        delete material, material = nullptr;
+    for (gef::Texture*& texture : p_Scene->textures)
+        delete texture, texture = nullptr;
+    p_Scene->materials.clear();
+    p_Scene->textures.clear();
+    p_Scene->materials_map.clear();
+}
+
+bool AsdfAnim::Animation3D::SetClipRepresentation(size_t clipIndex, ClipRepresentation representation)
+{
+    // Called between updates, the samplers of the blend tree are rebound here rather than while sampling
+    Clip& clip = v_Clips[clipIndex];
+    if (!HasClipRepresentation(clip, representation)) return false;
+    clip.representation = representation;
+    if (p_BlendTreeTemplate) p_BlendTreeTemplate->RebindClip(&clip);
+    return true;
+}
+
+bool AsdfAnim::Animation3D::HasClipRepresentation(const Clip& clip, ClipRepresentation representation)
+{
+    switch (representation)
+    {
+    case ClipRepresentation::Clip_Representation_Source:        return clip.clip != nullptr;
+    case ClipRepresentation::Clip_Representation_Compressed:    return clip.compressed != nullptr;
+    case ClipRepresentation::Clip_Representation_Resampled:     return clip.resampled != nullptr;
+    default:                                                    return false;
+    }
+}
+
+void AsdfAnim::Animation3D::CreateBoneMasks(const gef::Skeleton& skeleton)
+{
+    v_BoneMasks.clear();
+    for (const BoneMaskDefinition& definition : k_BoneMasks)
+    {
+        BoneMask mask(definition.name, skeleton);
+        if (!mask.AddSubtree(definition.subtree)) continue;
+        if (definition.excludedSubtree) mask.AddSubtree(definition.excludedSubtree, 0.f);
+        v_BoneMasks.push_back(std::move(mask));
+    }
+}
+
+bool AsdfAnim::Animation3D::IsHotClip(ClipType type)
+{
+    return type == ClipType::Clip_Type_Idle || type == ClipType::Clip_Type_Walk || type == ClipType::Clip_Type_Run;
+}
+
 const AsdfAnim::Clip* AsdfAnim::Animation3D::GetDefaultClip() const
 {
     if (!v_Clips.empty())
@@ -2,6 +2,8 @@
 #include "motion_clip_player.h"
 #include "Animation.h"
 #include "BlendNode.h"
+#include "BoneMask.h"
+#include "MirrorMap.h"
 #include <vector>
 #include <array>
 #include "ragdoll.h"
@@ -19,22 +21,38 @@ namespace gef
 
 namespace AsdfAnim
 {
+	class AssetManifest;
+	struct ManifestAsset;
+
 	class Animation3D : public Animation
 	{
 	public:
 		Animation3D();
 		~Animation3D();
-		static Animation3D* CreateFromSceneFile(gef::Platform& platform, const char* folderpath);
+		static Animation3D* CreateFromManifest(gef::Platform& platform, const AssetManifest& manifest, const ManifestAsset& asset);
 
-		void LoadScene(gef::Platform& platform, const char* filepath);
+		void LoadScene(gef::Platform& platform, const AssetManifest& manifest, const ManifestAsset& asset);
 		void LoadRagdoll(btDiscreteDynamicsWorld* pbtDynamicWorld, const char* filepath);
 
 		virtual void Update(float frameTime) final override;
 		void Draw(gef::Renderer3D* renderer) const;
 
+		// Residency of the heavy render data (mesh, materials and textures), driven by the AnimationManager
+		void CreateRenderData(gef::Platform& platform);
+		void ReleaseRenderData();
+		bool IsResident() const { return p_Mesh != nullptr; }
+		size_t GetResidentBytes() const { return m_ClipBytes + (IsResident() ? m_RenderDataBytes : 0u); }
+		size_t GetPeakResidentBytes() const { return m_PeakResidentBytes; }
+		size_t GetRenderDataBytes() const { return m_RenderDataBytes; }
+		void SetLastActiveFrame(uint64_t frame) { m_LastActiveFrame = frame; }
+		uint64_t GetLastActiveFrame() const { return m_LastActiveFrame; }
+
 		const std::vector<std::string>& AvailableClips() const { return v_AvailableClips; }
 		const Clip* GetDefaultClip() const;
 		const Clip* GetClip(const size_t animIndex) const { return &v_Clips[animIndex]; }
+		size_t GetClipCount() const { return v_Clips.size(); }
+		bool SetClipRepresentation(size_t clipIndex, ClipRepresentation representation);
+		static bool HasClipRepresentation(const Clip& clip, ClipRepresentation representation);
 		const gef::Matrix44& GetMeshTransform() const { return p_MeshInstance->transform(); }
 		void SetMeshTransform(const gef::Matrix44& transform) { p_MeshInstance->set_transform(transform); }
 		const std::string& GetFileName() const { return s_Filename; }
@@ -42,7 +60,18 @@ namespace AsdfAnim
 		Ragdoll* GetRagdoll() const { return p_Ragdoll; }
 		bool RequirePhysics() const { return m_NeedsPhysicsUpdate; }
 
+		BlendTreeTemplate* GetBlendTreeTemplate() const { return p_BlendTreeTemplate; }
+		// Writes the graph next to the scene, it is loaded instead of the default tree from then on
+		bool SaveBlendTree();
 		BlendTree* GetBlendTree() const { return p_BlendTree; }
+		size_t GetBoneMaskCount() const { return v_BoneMasks.size(); }
+		const BoneMask* GetBoneMask(size_t index) const { return &v_BoneMasks[index]; }
+		const MirrorMap* GetMirrorMap() const { return p_MirrorMap; }
+
+	private:
+		// Clips played often enough to be worth the memory of the resampled representation
+		static bool IsHotClip(ClipType type);
+		void CreateBoneMasks(const gef::Skeleton& skeleton);
 
 	private:
 		gef::Scene* p_Scene;
@@ -50,6 +79,8 @@ namespace AsdfAnim
 		gef::SkinnedMeshInstance* p_MeshInstance;
 		std::vector<Clip> v_Clips;
 		std::vector<std::string> v_AvailableClips;
+		std::vector<BoneMask> v_BoneMasks;			// Filled once when loading, the masked blend nodes point to them
+		MirrorMap* p_MirrorMap;						// Likewise for the mirror nodes
 		Clip* p_CurrentAnimation;
 		std::string s_Filename;
 
@@ -58,7 +89,15 @@ namespace AsdfAnim
 		bool m_NeedsPhysicsUpdate;
 
 		// BlendTrees
+		BlendTreeTemplate* p_BlendTreeTemplate;
 		BlendTree* p_BlendTree;
+		std::string s_BlendTreePath;		// Scene path without its extension
+
+		// Residency
+		size_t m_RenderDataBytes;		// Estimated from the mesh data and the texture sizes listed in the manifest
+		size_t m_ClipBytes;				// Clips always stay resident, they are needed as soon as the character is activated. Counts the compressed data when available
+		size_t m_PeakResidentBytes;
+		uint64_t m_LastActiveFrame;
 
 	};
 
@@ -8,7 +8,8 @@
 // No need to include gef::Platform because it is unused in this manager
 
 
-AsdfAnim::AnimationManager::AnimationManager(gef::Platform& platform) : r_Platform(platform), p_btDynamicWorld(nullptr), m_NeedsPhysicsUpdate(false)
+AsdfAnim::AnimationManager::AnimationManager(gef::Platform& platform) : r_Platform(platform), p_btDynamicWorld(nullptr), m_NeedsPhysicsUpdate(false),
+m_ResidencyBudget(ANIMATIONMANAGER_DEFAULT_RESIDENCY_BUDGET), m_PeakResidentBytes(0u), m_FrameCount(0u)
 {
 }
 
@@ -26,12 +27,49 @@ void AsdfAnim::AnimationManager::Update(float frameTime)
         if(anim->IsActive())
             anim->Update(frameTime);
     m_NeedsPhysicsUpdate = false;   // Reset in the event that all animations do not require physics anymore
+    ++m_FrameCount;
+    bool residencyChanged = false;
     for (auto& anim : v_LoadedAnimations3D)
         if (anim->IsActive())
         {
+            // Heavy render data is only created once the animation is switched on
+            if (!anim->IsResident())
+            {
+                anim->CreateRenderData(r_Platform);
+                residencyChanged = true;
+            }
+            anim->SetLastActiveFrame(m_FrameCount);
             anim->Update(frameTime);
             m_NeedsPhysicsUpdate |= anim->RequirePhysics();
         }
+
+    if (residencyChanged) EnforceResidencyBudget();
+}
+
+size_t AsdfAnim::AnimationManager::GetResidentBytes() const
+{
+    size_t bytes = 0u;
+    for (const auto& anim : v_LoadedAnimations3D)
+        bytes += anim->GetResidentBytes();
+    return bytes;
+}
+
+void AsdfAnim::AnimationManager::EnforceResidencyBudget()
+{
+    size_t residentBytes = GetResidentBytes();
+    if (residentBytes > m_PeakResidentBytes) m_PeakResidentBytes = residentBytes;
+    while (residentBytes > m_ResidencyBudget)
+    {
+        // Evict the least recently active animation that is not active anymore
+        Animation3D* leastRecent = nullptr;
+        for (auto& anim : v_LoadedAnimations3D)
+            if (anim->IsResident() && !anim->IsActive() && (!leastRecent || anim->GetLastActiveFrame() < leastRecent->GetLastActiveFrame()))
+                leastRecent = anim;
+        if (!leastRecent) break;    // Only active animations left, the budget cannot be met
+
+        residentBytes -= leastRecent->GetRenderDataBytes();
+        leastRecent->ReleaseRenderData();
+    }
 }
 
 
@@ -49,41 +87,23 @@ void AsdfAnim::AnimationManager::Draw3D(gef::Renderer3D* pRenderer3D) const
             anim->Draw(pRenderer3D);
 }
 
-void AsdfAnim::AnimationManager::LoadGef3D(const char* filename)
+void AsdfAnim::AnimationManager::LoadGef3D(const ManifestAsset& asset)
 {
-	Animation3D* animation = Animation3D::CreateFromSceneFile(r_Platform, filename);
+	Animation3D* animation = Animation3D::CreateFromManifest(r_Platform, m_Manifest, asset);
     v_LoadedAnimations3D.push_back(animation);
     v_AvailableFiles.push_back(&animation->GetFileName());
+
+    // The manifest already resolved the ragdoll of this asset, if it has one
+    if (p_btDynamicWorld && asset.HasRagdoll())
+        animation->LoadRagdoll(p_btDynamicWorld, m_Manifest.GetFullPath(asset.ragdoll).c_str());
 }
 
 void AsdfAnim::AnimationManager::LoadAllGef3DFromFolder(const char* folderpath, bool recursiveSearch)
 {
-    std::filesystem::path folder(folderpath);
-    if (folder.empty()) folder = std::filesystem::current_path();
-    for (const auto& entry : std::filesystem::directory_iterator(folder))
-    {
-        const std::string& entryPath(entry.path().string());
-        const std::string& entryName(entry.path().filename().string());
-        const std::string& entryExt(entry.path().filename().extension().string());
-
-        if (entry.is_directory() && recursiveSearch)
-            LoadAllGef3DFromFolder(entryPath.c_str(), recursiveSearch);
-
-        if (!entryExt.compare(".scn") && entryName.find('@') == std::string::npos)  // compare() returns 0 when equal
-        {
-            LoadGef3D(entryPath.c_str());
-
-            // Search for any ragdoll
-            if (!p_btDynamicWorld) continue;
-            for (const auto& ragdollEntry : std::filesystem::directory_iterator(folder))
-            {
-                const std::string& ragdollEntryPath(ragdollEntry.path().string());
-                const std::string& ragdollEntryExt(ragdollEntry.path().filename().extension().string());
-                if (!ragdollEntryExt.compare(".bullet"))
-                    v_LoadedAnimations3D.back()->LoadRagdoll(p_btDynamicWorld, ragdollEntryPath.c_str());
-            }
-        }
-    }
+    // Only the folders and files that changed since the last run are looked at again
+    m_Manifest.Refresh(r_Platform, folderpath, recursiveSearch);
+    for (const ManifestAsset& asset : m_Manifest.GetAssets())
+        LoadGef3D(asset);
 }
 
 void AsdfAnim::AnimationManager::LoadDragronbone2DJson(const char* filename)
@@ -2,9 +2,13 @@
 #include <vector>
 #include <string>
 #include <tuple>
+#include "AssetManifest.h"
 
 class btDiscreteDynamicsWorld;
 
+// Default budget for the render data of the 3D animations, least recently active characters are evicted above it
+#define ANIMATIONMANAGER_DEFAULT_RESIDENCY_BUDGET (256u * 1024u * 1024u)
+
 namespace gef
 {
 	class Platform;
@@ -30,8 +34,8 @@ namespace AsdfAnim
 		void Draw2D(gef::SpriteRenderer* pRenderer2D) const;
 		void Draw3D(gef::Renderer3D* pRenderer3D) const;
 
-		void LoadGef3D(const char* filename);
-		void LoadAllGef3DFromFolder(const char* folderpath, bool recursiveSearch = false);
+		void LoadGef3D(const ManifestAsset& asset);
+		void LoadAllGef3DFromFolder(const char* folderpath, bool recursiveSearch = false);	// Refreshes the asset manifest of the folder, then loads every 3D asset it lists
 
 		void LoadDragronbone2DJson(const char* filename);
 		void LoadAllDragonbone2DJsonFromFolder(const char* folderpath, bool recursiveSearch = false);
@@ -39,15 +43,29 @@ namespace AsdfAnim
 		const std::vector<const std::string*>& GetAvailableFileNames() const { return v_AvailableFiles; } // This function should be called by the GUI to list all the available animators
 		const std::vector<Animation2D*>& GetAvailable2DDatas() const { return v_LoadedAnimations2D; }
 		const std::vector<Animation3D*>& GetAvailable3DDatas() const { return v_LoadedAnimations3D; }
+		const AssetManifest& GetManifest() const { return m_Manifest; }
 		bool RequirePhysics() const { return m_NeedsPhysicsUpdate; }
 
+		// Residency of the 3D animations render data
+		void SetResidencyBudget(size_t bytes) { m_ResidencyBudget = bytes; EnforceResidencyBudget(); }
+		size_t GetResidencyBudget() const { return m_ResidencyBudget; }
+		size_t GetResidentBytes() const;
+		size_t GetPeakResidentBytes() const { return m_PeakResidentBytes; }
+
+	private:
+		void EnforceResidencyBudget();
+
 	private:
 		gef::Platform&							r_Platform;
 		std::vector<Animation2D*>				v_LoadedAnimations2D;
 		std::vector<Animation3D*>				v_LoadedAnimations3D;
 		std::vector<const std::string*>			v_AvailableFiles;		// Storing the name as a string so it can be listed in the gui
+		AssetManifest							m_Manifest;				// Index of the 3D assets on disk, avoids scanning folders on every load
 		btDiscreteDynamicsWorld*				p_btDynamicWorld;		// A pointer to any physics world that exist. Must be set to load ragdolls
 		bool									m_NeedsPhysicsUpdate;	// A bool that will be set to true if any animation requires a physics update
+		size_t									m_ResidencyBudget;		// In bytes, only inactive animations are ever evicted so it can be exceeded by active ones
+		size_t									m_PeakResidentBytes;
+		uint64_t								m_FrameCount;			// Used to find the least recently active animations
 	};
 
 }
\ No newline at end of file
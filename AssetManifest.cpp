@@ -0,0 +1,528 @@
+#include "AssetManifest.h"
+#include "system/platform.h"
+#include "system/debug_log.h"
+#include "graphics/scene.h"
+#include "animation/animation.h"
+#include "rapidjson/document.h"
+#include "rapidjson/prettywriter.h"
+#include "rapidjson/stringbuffer.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+using namespace AsdfAnim;
+
+namespace
+{
+	// Clip types are read from the clip file name once, when the clip first enters the manifest
+	// After that the type stored in the manifest is authoritative and can be edited by hand
+	struct ClipTypeName
+	{
+		ClipType type;
+		const char* typeName;	// Name written in the manifest
+		const char* keyword;	// Keyword searched for in the clip file name
+	};
+	const ClipTypeName k_ClipTypeNames[] = {
+		{ ClipType::Clip_Type_Undefined,	"undefined",	nullptr },
+		{ ClipType::Clip_Type_Idle,			"idle",			"idle" },
+		{ ClipType::Clip_Type_Walk,			"walk",			"walking" },
+		{ ClipType::Clip_Type_Run,			"run",			"running" },
+		{ ClipType::Clip_Type_Jump,			"jump",			"jump" },
+		{ ClipType::Clip_Type_Fall,			"fall",			"fall" }
+	};
+	const char* const k_AdditiveReferenceNames[] = { "none", "bind_pose", "first_frame" };
+
+	int64_t GetWriteTime(const std::filesystem::path& path)
+	{
+		std::error_code error;
+		const auto time = std::filesystem::last_write_time(path, error);
+		return error ? 0 : static_cast<int64_t>(time.time_since_epoch().count());
+	}
+
+	std::string JoinRelative(const std::string& folder, const std::string& name)
+	{
+		return folder.empty() ? name : folder + "/" + name;
+	}
+
+	std::string ParentOf(const std::string& relativePath)
+	{
+		const size_t separator = relativePath.find_last_of('/');
+		return separator == std::string::npos ? std::string() : relativePath.substr(0u, separator);
+	}
+
+	void WriteFile(rapidjson::PrettyWriter<rapidjson::StringBuffer>& writer, const ManifestFile& file)
+	{
+		char hash[17];
+		snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(file.hash));
+		writer.Key("path");		writer.String(file.path.c_str());
+		writer.Key("size");		writer.Uint64(file.size);
+		writer.Key("time");		writer.Int64(file.writeTime);
+		writer.Key("hash");		writer.String(hash);
+	}
+
+	void ReadFile(const rapidjson::Value& value, ManifestFile& file)
+	{
+		file = {};
+		if (value.HasMember("path"))	file.path = value["path"].GetString();
+		if (value.HasMember("size"))	file.size = value["size"].GetUint64();
+		if (value.HasMember("time"))	file.writeTime = value["time"].GetInt64();
+		if (value.HasMember("hash"))	file.hash = std::stoull(value["hash"].GetString(), nullptr, 16);
+	}
+}
+
+AssetManifest::AssetManifest() : m_Dirty(false)
+{
+}
+
+bool AssetManifest::Refresh(gef::Platform& platform, const char* folderpath, bool recursiveSearch)
+{
+	std::filesystem::path folder(folderpath);
+	if (folder.empty()) folder = std::filesystem::current_path();
+
+	// Switching root discards everything, the manifest of the new root is read from disk if there is one
+	m_Dirty = false;
+	if (s_Root != folder.string())
+	{
+		s_Root = folder.string();
+		v_Folders.clear();
+		v_Assets.clear();
+		m_Dirty = !Load();
+	}
+
+	// Folder pass: only folders whose write time changed (files added, removed or renamed) are iterated
+	if (v_Folders.empty())
+		ScanFolder("", recursiveSearch);
+	else
+		for (size_t i = 0u; i < v_Folders.size(); ++i)
+			if (!RefreshFolder(v_Folders[i].path, recursiveSearch)) --i;	// Can append newly found sub folders, which are scanned straight away
+
+	// File pass: only files whose size or write time changed are hashed, and only files whose content changed are parsed
+	bool contentChanged = false;
+	for (size_t i = 0u; i < v_Assets.size(); ++i)
+	{
+		ManifestAsset& asset = v_Assets[i];
+		if (!UpdateFile(asset.scene, contentChanged))
+		{
+			v_Assets.erase(v_Assets.begin() + i--);
+			m_Dirty = true;
+			continue;
+		}
+		if (contentChanged) ParseScene(platform, asset);
+
+		if (asset.HasRagdoll() && !UpdateFile(asset.ragdoll, contentChanged))
+		{
+			asset.ragdoll = {};
+			m_Dirty = true;
+		}
+
+		for (size_t j = 0u; j < asset.textures.size(); ++j)
+		{
+			ManifestTexture& texture = asset.textures[j];
+			if (!UpdateFile(texture.file, contentChanged))
+			{
+				asset.textures.erase(asset.textures.begin() + j--);
+				m_Dirty = true;
+			}
+			else if (contentChanged) ReadPNGSize(GetFullPath(texture.file), texture.width, texture.height);
+		}
+
+		for (size_t j = 0u; j < asset.clips.size(); ++j)
+		{
+			ManifestClip& clip = asset.clips[j];
+			if (!UpdateFile(clip.file, contentChanged))
+			{
+				asset.clips.erase(asset.clips.begin() + j--);
+				m_Dirty = true;
+			}
+			else if (contentChanged) ParseClip(platform, clip);
+		}
+	}
+
+	if (m_Dirty) Save();
+	return m_Dirty;
+}
+
+bool AssetManifest::RefreshFolder(std::string relativePath, bool recursiveSearch)
+{
+	auto it = std::find_if(v_Folders.begin(), v_Folders.end(), [&relativePath](const ManifestFolder& f) { return f.path == relativePath; });
+	const std::filesystem::path fullPath = std::filesystem::path(s_Root) / relativePath;
+	if (!std::filesystem::is_directory(fullPath))
+	{
+		// The folder is gone, forget it and everything that was found in it
+		v_Folders.erase(it);
+		v_Assets.erase(std::remove_if(v_Assets.begin(), v_Assets.end(), [&relativePath](const ManifestAsset& a) { return ParentOf(a.scene.path) == relativePath; }), v_Assets.end());
+		m_Dirty = true;
+		return false;
+	}
+
+	if (it->writeTime != GetWriteTime(fullPath))
+		ScanFolder(relativePath, recursiveSearch);
+	return true;
+}
+
+void AssetManifest::ScanFolder(std::string relativePath, bool recursiveSearch)
+{
+	const std::filesystem::path fullPath = std::filesystem::path(s_Root) / relativePath;
+	m_Dirty = true;
+
+	// Record the folder
+	auto folderIt = std::find_if(v_Folders.begin(), v_Folders.end(), [&relativePath](const ManifestFolder& f) { return f.path == relativePath; });
+	if (folderIt == v_Folders.end())
+		v_Folders.push_back({ relativePath, GetWriteTime(fullPath) });
+	else
+		folderIt->writeTime = GetWriteTime(fullPath);
+
+	// A single pass over the folder sorts every file of interest
+	std::vector<std::string> scenes, clips, ragdolls, subFolders;
+	for (const auto& entry : std::filesystem::directory_iterator(fullPath))
+	{
+		const std::string& entryName(entry.path().filename().string());
+		const std::string& entryExt(entry.path().filename().extension().string());
+
+		if (entry.is_directory())
+		{
+			if (recursiveSearch) subFolders.push_back(JoinRelative(relativePath, entryName));
+			continue;
+		}
+
+		if (!entryExt.compare(".scn"))	(entryName.find('@') == std::string::npos ? scenes : clips).push_back(entryName);
+		else if (!entryExt.compare(".bullet"))	ragdolls.push_back(entryName);
+	}
+
+	// Drop the assets of this folder whose scene file is gone
+	v_Assets.erase(std::remove_if(v_Assets.begin(), v_Assets.end(), [&](const ManifestAsset& a) {
+		return ParentOf(a.scene.path) == relativePath && std::find(scenes.begin(), scenes.end(), a.name + ".scn") == scenes.end();
+	}), v_Assets.end());
+
+	for (const std::string& sceneName : scenes)
+	{
+		const std::string scenePath = JoinRelative(relativePath, sceneName);
+		auto assetIt = std::find_if(v_Assets.begin(), v_Assets.end(), [&scenePath](const ManifestAsset& a) { return a.scene.path == scenePath; });
+		if (assetIt == v_Assets.end())
+		{
+			ManifestAsset asset{};
+			asset.name = std::filesystem::path(sceneName).replace_extension("").string();
+			asset.scene.path = scenePath;
+			v_Assets.push_back(std::move(asset));
+			assetIt = v_Assets.end() - 1;
+		}
+		ManifestAsset& asset = *assetIt;
+
+		// Ragdoll: one named after the asset wins, otherwise the first one of the folder
+		std::string ragdollPath;
+		if (std::find(ragdolls.begin(), ragdolls.end(), asset.name + ".bullet") != ragdolls.end())	ragdollPath = JoinRelative(relativePath, asset.name + ".bullet");
+		else if (!ragdolls.empty())																	ragdollPath = JoinRelative(relativePath, ragdolls.front());
+		if (ragdollPath != asset.ragdoll.path)
+		{
+			asset.ragdoll = {};
+			asset.ragdoll.path = ragdollPath;
+		}
+
+		// Clips: anything named "<asset>@<clip>.scn" in the same folder
+		const std::string clipPrefix = asset.name + "@";
+		asset.clips.erase(std::remove_if(asset.clips.begin(), asset.clips.end(), [&](const ManifestClip& c) {
+			return std::find(clips.begin(), clips.end(), std::filesystem::path(c.file.path).filename().string()) == clips.end();
+		}), asset.clips.end());
+		for (const std::string& clipName : clips)
+		{
+			if (clipName.compare(0u, clipPrefix.size(), clipPrefix)) continue;
+			const std::string clipPath = JoinRelative(relativePath, clipName);
+			if (std::find_if(asset.clips.begin(), asset.clips.end(), [&clipPath](const ManifestClip& c) { return c.file.path == clipPath; }) != asset.clips.end()) continue;
+
+			ManifestClip clip{};
+			clip.file.path = clipPath;
+			const std::string clipSuffix = std::filesystem::path(clipName).replace_extension("").string().substr(clipPrefix.size());
+			clip.type = ClipTypeFromFileName(clipSuffix, clip.name);
+			if (clipSuffix.find("additive") != std::string::npos) clip.additive = AdditiveReference::Additive_Reference_First_Frame;
+			asset.clips.push_back(std::move(clip));
+		}
+
+		// Keep a stable order, the first clip is the default clip of the asset
+		std::sort(asset.clips.begin(), asset.clips.end(), [](const ManifestClip& a, const ManifestClip& b) { return a.file.path < b.file.path; });
+	}
+
+	for (const std::string& subFolder : subFolders)
+		if (std::find_if(v_Folders.begin(), v_Folders.end(), [&subFolder](const ManifestFolder& f) { return f.path == subFolder; }) == v_Folders.end())
+			ScanFolder(subFolder, recursiveSearch);
+}
+
+bool AssetManifest::UpdateFile(ManifestFile& file, bool& contentChanged)
+{
+	contentChanged = false;
+	const std::filesystem::path fullPath = GetFullPath(file);
+	std::error_code error;
+	const uint64_t size = std::filesystem::file_size(fullPath, error);
+	if (error) return false;
+
+	const int64_t writeTime = GetWriteTime(fullPath);
+	if (size == file.size && writeTime == file.writeTime) return true;
+
+	// Only hash when the cheap checks failed, a touched but identical file is not parsed again
+	const uint64_t hash = HashFile(fullPath.string());
+	contentChanged = hash != file.hash || !file.size;
+	file.size = size;
+	file.writeTime = writeTime;
+	file.hash = hash;
+	m_Dirty = true;
+	return true;
+}
+
+void AssetManifest::ParseScene(gef::Platform& platform, ManifestAsset& asset)
+{
+	gef::Scene scene;
+	if (!scene.ReadSceneFromFile(platform, GetFullPath(asset.scene).c_str())) return;
+
+	// Textures are looked up next to the scene first, then from the manifest root
+	asset.textures.clear();
+	const std::string sceneFolder = ParentOf(asset.scene.path);
+	for (const gef::MaterialData& material : scene.material_data)
+	{
+		if (material.diffuse_texture.empty()) continue;
+
+		ManifestTexture texture{};
+		texture.file.path = JoinRelative(sceneFolder, material.diffuse_texture);
+		if (!std::filesystem::exists(GetFullPath(texture.file))) texture.file.path = std::filesystem::path(material.diffuse_texture).generic_string();
+		if (!std::filesystem::exists(GetFullPath(texture.file)))
+		{
+			gef::DebugOut("AssetManifest: texture %s of %s could not be found\n", material.diffuse_texture.c_str(), asset.name.c_str());
+			continue;
+		}
+
+		bool unused;
+		if (std::find_if(asset.textures.begin(), asset.textures.end(), [&texture](const ManifestTexture& t) { return t.file.path == texture.file.path; }) == asset.textures.end()
+			&& UpdateFile(texture.file, unused))
+		{
+			ReadPNGSize(GetFullPath(texture.file), texture.width, texture.height);
+			asset.textures.push_back(std::move(texture));
+		}
+	}
+}
+
+void AssetManifest::ParseClip(gef::Platform& platform, ManifestClip& clip)
+{
+	gef::Scene scene;
+	clip.duration = 0.f;
+	if (!scene.ReadSceneFromFile(platform, GetFullPath(clip.file).c_str()) || scene.animations.empty()) return;
+
+	// The gef loader only keeps one animation per file
+	clip.duration = scene.animations.begin()->second->duration();
+}
+
+bool AssetManifest::Load()
+{
+	std::ifstream file(GetFullPath({ ASSET_MANIFEST_FILENAME }), std::ios::binary);
+	if (!file) return false;
+	std::stringstream content;
+	content << file.rdbuf();
+
+	rapidjson::Document doc;
+	doc.Parse(content.str().c_str());
+	if (doc.HasParseError() || !doc.IsObject()) return false;
+	if (!doc.HasMember("version") || doc["version"].GetUint() != ASSET_MANIFEST_VERSION) return false;
+
+	if (doc.HasMember("folders"))
+	{
+		const rapidjson::Value& folders = doc["folders"];
+		for (unsigned i = 0u; i < folders.Size(); ++i)
+			v_Folders.push_back({ folders[i]["path"].GetString(), folders[i]["time"].GetInt64() });
+	}
+
+	if (doc.HasMember("assets"))
+	{
+		const rapidjson::Value& assets = doc["assets"];
+		for (unsigned i = 0u; i < assets.Size(); ++i)
+		{
+			const rapidjson::Value& value = assets[i];
+			ManifestAsset asset{};
+			if (value.HasMember("name"))	asset.name = value["name"].GetString();
+			if (value.HasMember("scene"))	ReadFile(value["scene"], asset.scene);
+			if (value.HasMember("ragdoll"))	ReadFile(value["ragdoll"], asset.ragdoll);
+			if (value.HasMember("textures"))
+			{
+				const rapidjson::Value& textures = value["textures"];
+				asset.textures.resize(textures.Size());
+				for (unsigned j = 0u; j < textures.Size(); ++j)
+				{
+					ReadFile(textures[j], asset.textures[j].file);
+					if (textures[j].HasMember("width"))		asset.textures[j].width = textures[j]["width"].GetUint();
+					if (textures[j].HasMember("height"))	asset.textures[j].height = textures[j]["height"].GetUint();
+				}
+			}
+			if (value.HasMember("clips"))
+			{
+				const rapidjson::Value& clips = value["clips"];
+				asset.clips.resize(clips.Size());
+				for (unsigned j = 0u; j < clips.Size(); ++j)
+				{
+					ManifestClip& clip = asset.clips[j];
+					ReadFile(clips[j], clip.file);
+					if (clips[j].HasMember("name"))		clip.name = clips[j]["name"].GetString();
+					if (clips[j].HasMember("type"))		clip.type = ClipTypeFromString(clips[j]["type"].GetString());
+					if (clips[j].HasMember("additive"))	clip.additive = AdditiveReferenceFromString(clips[j]["additive"].GetString());
+					if (clips[j].HasMember("duration"))	clip.duration = clips[j]["duration"].GetFloat();
+				}
+			}
+			v_Assets.push_back(std::move(asset));
+		}
+	}
+	return true;
+}
+
+bool AssetManifest::Save() const
+{
+	rapidjson::StringBuffer buffer;
+	rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+	writer.StartObject();
+	writer.Key("version");
+	writer.Uint(ASSET_MANIFEST_VERSION);
+
+	writer.Key("folders");
+	writer.StartArray();
+	for (const ManifestFolder& folder : v_Folders)
+	{
+		writer.StartObject();
+		writer.Key("path");	writer.String(folder.path.c_str());
+		writer.Key("time");	writer.Int64(folder.writeTime);
+		writer.EndObject();
+	}
+	writer.EndArray();
+
+	writer.Key("assets");
+	writer.StartArray();
+	for (const ManifestAsset& asset : v_Assets)
+	{
+		writer.StartObject();
+		writer.Key("name");
+		writer.String(asset.name.c_str());
+		writer.Key("scene");
+		writer.StartObject();	WriteFile(writer, asset.scene);		writer.EndObject();
+		if (asset.HasRagdoll())
+		{
+			writer.Key("ragdoll");
+			writer.StartObject();	WriteFile(writer, asset.ragdoll);	writer.EndObject();
+		}
+
+		writer.Key("textures");
+		writer.StartArray();
+		for (const ManifestTexture& texture : asset.textures)
+		{
+			writer.StartObject();
+			WriteFile(writer, texture.file);
+			writer.Key("width");	writer.Uint(texture.width);
+			writer.Key("height");	writer.Uint(texture.height);
+			writer.EndObject();
+		}
+		writer.EndArray();
+
+		writer.Key("clips");
+		writer.StartArray();
+		for (const ManifestClip& clip : asset.clips)
+		{
+			writer.StartObject();
+			WriteFile(writer, clip.file);
+			writer.Key("name");		writer.String(clip.name.c_str());
+			writer.Key("type");		writer.String(ClipTypeToString(clip.type));
+			writer.Key("additive");	writer.String(AdditiveReferenceToString(clip.additive));
+			writer.Key("duration");	writer.Double(clip.duration);
+			writer.EndObject();
+		}
+		writer.EndArray();
+		writer.EndObject();
+	}
+	writer.EndArray();
+	writer.EndObject();
+
+	std::ofstream file(GetFullPath({ ASSET_MANIFEST_FILENAME }), std::ios::binary | std::ios::trunc);
+	if (!file) return false;
+	file.write(buffer.GetString(), buffer.GetSize());
+	return file.good();
+}
+
+const ManifestAsset* AssetManifest::FindAsset(const std::string& name) const
+{
+	for (const ManifestAsset& asset : v_Assets)
+		if (asset.name == name)
+			return &asset;
+	return nullptr;
+}
+
+std::string AssetManifest::GetFullPath(const ManifestFile& file) const
+{
+	return (std::filesystem::path(s_Root) / file.path).string();
+}
+
+const char* AssetManifest::ClipTypeToString(ClipType type)
+{
+	for (const ClipTypeName& item : k_ClipTypeNames)
+		if (item.type == type)
+			return item.typeName;
+	return k_ClipTypeNames[0].typeName;
+}
+
+ClipType AssetManifest::ClipTypeFromString(const std::string& type)
+{
+	for (const ClipTypeName& item : k_ClipTypeNames)
+		if (type == item.typeName)
+			return item.type;
+	return ClipType::Clip_Type_Undefined;
+}
+
+ClipType AssetManifest::ClipTypeFromFileName(const std::string& clipFileName, std::string& clipName)
+{
+	for (const ClipTypeName& item : k_ClipTypeNames)
+		if (item.keyword && clipFileName.find(item.keyword) != std::string::npos)
+		{
+			clipName = item.keyword;
+			return item.type;
+		}
+
+	// Unknown clips keep their file name so they can still be told apart in the editor
+	clipName = clipFileName;
+	return ClipType::Clip_Type_Undefined;
+}
+
+const char* AssetManifest::AdditiveReferenceToString(AdditiveReference reference)
+{
+	return k_AdditiveReferenceNames[static_cast<size_t>(reference)];
+}
+
+AdditiveReference AssetManifest::AdditiveReferenceFromString(const std::string& reference)
+{
+	for (size_t i = 0u; i < sizeof(k_AdditiveReferenceNames) / sizeof(k_AdditiveReferenceNames[0]); ++i)
+		if (reference == k_AdditiveReferenceNames[i])
+			return static_cast<AdditiveReference>(i);
+	return AdditiveReference::Additive_Reference_None;
+}
+
+uint64_t AssetManifest::HashFile(const std::string& filepath)
+{
+	// FNV-1a, 64 bits
+	uint64_t hash = 14695981039346656037ull;
+	std::ifstream file(filepath, std::ios::binary);
+	char buffer[4096];
+	while (file)
+	{
+		file.read(buffer, sizeof(buffer));
+		const std::streamsize count = file.gcount();
+		for (std::streamsize i = 0; i < count; ++i)
+		{
+			hash ^= static_cast<uint8_t>(buffer[i]);
+			hash *= 1099511628211ull;
+		}
+	}
+	return hash;
+}
+
+bool AssetManifest::ReadPNGSize(const std::string& filepath, uint32_t& width, uint32_t& height)
+{
+	// The IHDR chunk always comes first: 8 bytes signature, 8 bytes chunk header, then big endian width and height
+	width = height = 0u;
+	uint8_t header[24];
+	std::ifstream file(filepath, std::ios::binary);
+	if (!file.read(reinterpret_cast<char*>(header), sizeof(header))) return false;
+	if (header[0] != 0x89 || header[1] != 'P' || header[2] != 'N' || header[3] != 'G') return false;
+
+	width = (header[16] << 24) | (header[17] << 16) | (header[18] << 8) | header[19];
+	height = (header[20] << 24) | (header[21] << 16) | (header[22] << 8) | header[23];
+	return true;
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "Animation.h"
+
+// Name of the manifest file generated at the root of the scanned asset folder
+#define ASSET_MANIFEST_FILENAME "asset_manifest.json"
+// Bump this whenever the layout of the manifest changes, older manifests are then fully regenerated
+#define ASSET_MANIFEST_VERSION 3
+
+namespace gef
+{
+	class Platform;
+}
+
+namespace AsdfAnim
+{
+	// A file tracked by the manifest
+	// The size and write time are used to cheaply detect changes, the content hash is only recomputed when they differ
+	struct ManifestFile
+	{
+		std::string path;		// Relative to the manifest root, generic format
+		uint64_t size;
+		int64_t writeTime;
+		uint64_t hash;			// FNV-1a 64 of the file content
+	};
+
+	struct ManifestTexture
+	{
+		ManifestFile file;
+		uint32_t width;			// Read from the PNG header, used to budget the texture memory before it is created
+		uint32_t height;
+	};
+
+	struct ManifestClip
+	{
+		ManifestFile file;
+		std::string name;
+		ClipType type;
+		AdditiveReference additive;		// Clips with "additive" in their file name are made additive against their first frame
+		float duration;
+	};
+
+	struct ManifestAsset
+	{
+		std::string name;
+		ManifestFile scene;
+		ManifestFile ragdoll;					// Empty path when the asset has no ragdoll
+		std::vector<ManifestTexture> textures;	// Diffuse textures referenced by the scene materials
+		std::vector<ManifestClip> clips;
+
+		bool HasRagdoll() const { return !ragdoll.path.empty(); }
+	};
+
+	class AssetManifest
+	{
+	public:
+		AssetManifest();
+
+		// Bring the manifest up to date with the content of the folder and save it if anything changed
+		// Only folders whose write time changed are iterated, only files whose size or write time changed are re-hashed and re-parsed
+		bool Refresh(gef::Platform& platform, const char* folderpath, bool recursiveSearch);
+
+		bool Load();
+		bool Save() const;
+
+		const ManifestAsset* FindAsset(const std::string& name) const;
+		const std::vector<ManifestAsset>& GetAssets() const { return v_Assets; }
+		std::string GetFullPath(const ManifestFile& file) const;
+
+		static const char* ClipTypeToString(ClipType type);
+		static ClipType ClipTypeFromString(const std::string& type);
+		static ClipType ClipTypeFromFileName(const std::string& clipFileName, std::string& clipName);
+		static const char* AdditiveReferenceToString(AdditiveReference reference);
+		static AdditiveReference AdditiveReferenceFromString(const std::string& reference);
+		static uint64_t HashFile(const std::string& filepath);
+		static bool ReadPNGSize(const std::string& filepath, uint32_t& width, uint32_t& height);
+
+	private:
+		struct ManifestFolder
+		{
+			std::string path;
+			int64_t writeTime;
+		};
+
+		// Paths are taken by copy, scanning can grow v_Folders
+		bool RefreshFolder(std::string relativePath, bool recursiveSearch);
+		void ScanFolder(std::string relativePath, bool recursiveSearch);
+		bool UpdateFile(ManifestFile& file, bool& contentChanged);
+		void ParseScene(gef::Platform& platform, ManifestAsset& asset);
+		void ParseClip(gef::Platform& platform, ManifestClip& clip);
+
+	private:
+		std::string s_Root;
+		std::vector<ManifestFolder> v_Folders;
+		std::vector<ManifestAsset> v_Assets;
+		bool m_Dirty;
+	};
+}
@@ -0,0 +1,630 @@
+#include "Benchmarks.h"
+#include "AssetManifest.h"
+#include "ClipSampler.h"
+#include "ClipCompression.h"
+#include "ResampledClip.h"
+#include "SoaPose.h"
+#include "BlendNode.h"
+#include "StateMachineNode.h"
+#include "JobSystem.h"
+#include "PoseMatching.h"
+#include "MirrorMap.h"
+#include "graphics/scene.h"
+#include "graphics/skinned_mesh_instance.h"
+#include "animation/skeleton.h"
+#include "animation/animation.h"
+#include "system/debug_log.h"
+#include <filesystem>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <memory>
+using namespace AsdfAnim;
+
+namespace
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	// Plays the clip at 60Hz like the blend tree would and returns the average cost of a frame in nanoseconds
+	template<typename SampleFunction>
+	double TimeSampling(float duration, uint32_t iterations, const gef::SkeletonPose& pose, SampleFunction sample)
+	{
+		float time = 0.f;
+		const Clock::time_point start = Clock::now();
+		for (uint32_t i = 0u; i < iterations; ++i)
+		{
+			sample(time);
+			time = std::fmodf(time + 1.f / 60.f, duration);
+		}
+		const Clock::time_point end = Clock::now();
+
+		// Read the result so the work cannot be optimised away
+		volatile float sink = pose.global_pose().back().GetTranslation().x();
+		(void)sink;
+		return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+	}
+
+	// Average cost of a call in nanoseconds, the call receives a weight that changes every iteration
+	template<typename Function>
+	double TimeCalls(uint32_t iterations, Function function)
+	{
+		const Clock::time_point start = Clock::now();
+		for (uint32_t i = 0u; i < iterations; ++i) function(static_cast<float>(i % 100u) / 100.f);
+		const Clock::time_point end = Clock::now();
+		return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+	}
+
+	// The clip file is given without extension
+	const ManifestClip* FindClipFile(const ManifestAsset& asset, const std::string& clipFile)
+	{
+		for (const ManifestClip& clip : asset.clips)
+			if (std::filesystem::path(clip.file.path).stem().string() == clipFile) return &clip;
+		return nullptr;
+	}
+
+	// Skeleton of an asset and full precision clips, the animations loaded by the manager only keep the compressed keys
+	struct LoadedAsset
+	{
+		gef::Scene scene;
+		std::unique_ptr<gef::SkinnedMeshInstance> meshInstance;
+		std::vector<std::unique_ptr<gef::Scene>> clipScenes;
+		std::vector<Clip> clips;		// Played from the source keys, without markers or features
+
+		const gef::SkeletonPose& GetBindPose() const { return meshInstance->bind_pose(); }
+		const gef::Animation& GetAnimation(size_t clip) const { return *clips[clip].clip; }
+	};
+
+	// The clip files are given without extension, e.g. "xbot@running". Returns false when the asset or one of the clips could not be loaded
+	bool LoadAsset(gef::Platform& platform, const AssetManifest& manifest, const char* assetName, const std::vector<std::string>& clipFiles, LoadedAsset& loaded)
+	{
+		const ManifestAsset* asset = manifest.FindAsset(assetName);
+		if (!asset) return false;
+		loaded.scene.ReadSceneFromFile(platform, manifest.GetFullPath(asset->scene).c_str());
+		if (loaded.scene.skeletons.empty()) return false;
+		loaded.meshInstance.reset(new gef::SkinnedMeshInstance(*loaded.scene.skeletons.front()));
+
+		// The nodes keep pointers to the clips, they must not move once loaded
+		loaded.clips.reserve(clipFiles.size());
+		for (const std::string& clipFile : clipFiles)
+		{
+			const ManifestClip* manifestClip = FindClipFile(*asset, clipFile);
+			if (!manifestClip) return false;
+			loaded.clipScenes.emplace_back(new gef::Scene);
+			gef::Scene& clipScene = *loaded.clipScenes.back();
+			clipScene.ReadSceneFromFile(platform, manifest.GetFullPath(manifestClip->file).c_str());
+			if (clipScene.animations.empty()) return false;
+			gef::Animation* animation = clipScene.animations.begin()->second;
+			loaded.clips.push_back({ animation, ClipType::Clip_Type_Undefined, clipFile, static_cast<uint32_t>(loaded.clips.size()), animation->duration(),
+				nullptr, nullptr, ClipRepresentation::Clip_Representation_Source, nullptr });
+		}
+		return true;
+	}
+
+	float MaxDifference(const SoaPose& a, const SoaPose& b)
+	{
+		float difference = 0.f;
+		for (uint32_t stream = 0u; stream < SoaPose::Stream_Count; ++stream)
+			for (size_t joint = 0u; joint < a.GetJointCount(); ++joint)
+				difference = std::max(difference, std::fabs(a.GetStream(static_cast<SoaPose::Stream_>(stream))[joint] - b.GetStream(static_cast<SoaPose::Stream_>(stream))[joint]));
+		return difference;
+	}
+
+	// Largest distance between the same joint in both poses, the global poses must be up to date
+	float MaxJointDistance(const gef::SkeletonPose& a, const gef::SkeletonPose& b)
+	{
+		float distance = 0.f;
+		for (size_t joint = 0u; joint < a.global_pose().size(); ++joint)
+			distance = std::max(distance, (a.global_pose()[joint].GetTranslation() - b.global_pose()[joint].GetTranslation()).Length());
+		return distance;
+	}
+
+	const char* GetResult(bool passed)
+	{
+		return passed ? "passed" : "failed";
+	}
+}
+
+bool Benchmarks::Run(gef::Platform& platform, const AssetManifest& manifest)
+{
+	const std::array<bool, 9> results = {
+		ClipSampling(platform, manifest, "xbot", "xbot@running"),
+		ClipSampling(platform, manifest, "ybot", "ybot@running"),
+		PoseBlending(platform, manifest, "xbot", "xbot@running"),
+		SyncBlend(platform, manifest, "xbot", "xbot@walking_inplace", "xbot@running_inplace"),
+		StateMachine(platform, manifest, "xbot"),
+		LazyEvaluation(platform, manifest, "xbot", "xbot@idle", "xbot@walking_inplace"),
+		ParallelEvaluation(platform, manifest, "xbot", "xbot@walking_inplace", "xbot@running_inplace"),
+		PoseMatchedTransition(platform, manifest, "xbot", "xbot@walking_inplace", "xbot@running_inplace"),
+		PoseMirroring(platform, manifest, "xbot", "xbot@running")
+	};
+	const size_t failed = std::count(results.begin(), results.end(), false);
+	gef::DebugOut("Benchmarks: %zu of %zu checks failed\n", failed, results.size());
+	return failed == 0u;
+}
+
+bool Benchmarks::ClipSampling(gef::Platform& platform, const AssetManifest& manifest, const char* assetName, const char* clipFile, uint32_t iterations)
+{
+	LoadedAsset loaded;
+	if (!LoadAsset(platform, manifest, assetName, { clipFile }, loaded)) return false;
+	const gef::SkeletonPose& bindPose = loaded.GetBindPose();
+	const gef::Animation& animation = loaded.GetAnimation(0u);
+	std::unique_ptr<CompressedClip> compressed(CompressedClip::Compress(animation, bindPose));
+	std::unique_ptr<ResampledClip> resampled(ResampledClip::Resample(animation, bindPose));
+	if (!compressed || !resampled) return false;
+
+	gef::SkeletonPose pose = bindPose;
+	const double gefTime = TimeSampling(animation.duration(), iterations, pose, [&](float time)
+	{
+		pose.SetPoseFromAnim(animation, bindPose, time + animation.start_time());
+	});
+
+	ClipSampler sampler;
+	sampler.SetAnimation(&animation, bindPose);
+	pose = bindPose;
+	const double sourceTime = TimeSampling(animation.duration(), iterations, pose, [&](float time)
+	{
+		sampler.Sample(time, pose);
+		pose.CalculateGlobalPose();
+	});
+
+	// The source keys through the sampler give the joints gef gives
+	float difference = 0.f;
+	gef::SkeletonPose reference = bindPose;
+	for (float time = 0.f; time < animation.duration(); time += 0.1f)
+	{
+		reference.SetPoseFromAnim(animation, bindPose, time + animation.start_time());
+		sampler.Sample(time, pose);
+		pose.CalculateGlobalPose();
+		difference = std::max(difference, MaxJointDistance(reference, pose));
+	}
+
+	Clip clip{ nullptr, ClipType::Clip_Type_Undefined, clipFile, 0u, animation.duration(), compressed.get(), resampled.get(), ClipRepresentation::Clip_Representation_Compressed };
+	sampler.SetClip(&clip, bindPose);
+	pose = bindPose;
+	const double compressedTime = TimeSampling(animation.duration(), iterations, pose, [&](float time)
+	{
+		sampler.Sample(time, pose);
+		pose.CalculateGlobalPose();
+	});
+
+	clip.representation = ClipRepresentation::Clip_Representation_Resampled;
+	sampler.SetClip(&clip, bindPose);
+	pose = bindPose;
+	const double resampledTime = TimeSampling(animation.duration(), iterations, pose, [&](float time)
+	{
+		sampler.Sample(time, pose);
+		pose.CalculateGlobalPose();
+	});
+
+	const bool passed = difference <= BENCHMARKS_TOLERANCE;
+	gef::DebugOut("Benchmark %s, %u frames: SetPoseFromAnim %.0f ns, cursor sampler %.0f ns (%.2fx), compressed cursor sampler %.0f ns (%.2fx), resampled %.0f ns (%.2fx), "
+		"largest difference to SetPoseFromAnim %g, %s\n", clipFile, iterations, gefTime, sourceTime, gefTime / sourceTime, compressedTime, gefTime / compressedTime,
+		resampledTime, gefTime / resampledTime, difference, GetResult(passed));
+	return passed;
+}
+
+bool Benchmarks::PoseBlending(gef::Platform& platform, const AssetManifest& manifest, const char* assetName, const char* clipFile, uint32_t iterations)
+{
+	LoadedAsset loaded;
+	if (!LoadAsset(platform, manifest, assetName, { clipFile }, loaded)) return false;
+	const gef::SkeletonPose& bindPose = loaded.GetBindPose();
+	const gef::Animation& animation = loaded.GetAnimation(0u);
+	// Two frames half a clip apart, and the difference between them for the additive kernel
+	gef::SkeletonPose poseA = bindPose, poseB = bindPose, pose = bindPose;
+	poseA.SetPoseFromAnim(animation, bindPose, animation.start_time());
+	poseB.SetPoseFromAnim(animation, bindPose, animation.start_time() + animation.duration() * 0.5f);
+	const SoaPose soaA(poseA.local_pose()), soaB(poseB.local_pose());
+	SoaPose delta(poseB.local_pose());
+	for (size_t joint = 0u; joint < delta.GetJointCount(); ++joint)
+	{
+		// Only the rotation needs a positive w, the offsets are whatever the frame holds
+		if (delta.GetStream(SoaPose::Stream_RotationW)[joint] < 0.f)
+			for (uint32_t stream = SoaPose::Stream_RotationX; stream <= SoaPose::Stream_RotationW; ++stream)
+				delta.GetStream(static_cast<SoaPose::Stream_>(stream))[joint] *= -1.f;
+	}
+	SoaPose scalarPose = soaA, simdPose = soaA;
+	// The same two frames through the blend space kernel, the output is not one of the inputs
+	const SoaPose* poses[] = { &soaA, &soaB };
+	float weights[2];
+
+	const double gefTime = TimeCalls(iterations, [&](float weight) { pose.Linear2PoseBlend(poseA, poseB, weight); });
+	const double scalarTime = TimeCalls(iterations, [&](float weight) { BlendPosesScalar(soaA, soaB, weight, scalarPose); });
+	const double scalarWeightedTime = TimeCalls(iterations, [&](float weight)
+	{
+		weights[0] = 1.f - weight, weights[1] = weight;
+		BlendPosesScalar(poses, weights, 2u, scalarPose);
+	});
+	const double scalarAddTime = TimeCalls(iterations, [&](float weight) { AddPoseScalar(soaA, delta, weight, scalarPose); });
+	volatile float sink = pose.global_pose().back().GetTranslation().x() + scalarPose.GetStream(SoaPose::Stream_TranslationX)[0];
+
+#if SOA_POSE_SIMD
+	const double simdTime = TimeCalls(iterations, [&](float weight) { BlendPosesSimd(soaA, soaB, weight, simdPose); });
+	const double simdWeightedTime = TimeCalls(iterations, [&](float weight)
+	{
+		weights[0] = 1.f - weight, weights[1] = weight;
+		BlendPosesSimd(poses, weights, 2u, simdPose);
+	});
+	const double simdAddTime = TimeCalls(iterations, [&](float weight) { AddPoseSimd(soaA, delta, weight, simdPose); });
+	sink = simdPose.GetStream(SoaPose::Stream_TranslationX)[0];
+
+	// Same inputs through both paths
+	float difference = 0.f;
+	for (float weight = 0.f; weight <= 1.f; weight += 0.125f)
+	{
+		BlendPosesScalar(soaA, soaB, weight, scalarPose);
+		BlendPosesSimd(soaA, soaB, weight, simdPose);
+		difference = std::max(difference, MaxDifference(scalarPose, simdPose));
+		AddPoseScalar(soaA, delta, weight, scalarPose);
+		AddPoseSimd(soaA, delta, weight, simdPose);
+		difference = std::max(difference, MaxDifference(scalarPose, simdPose));
+		weights[0] = 1.f - weight, weights[1] = weight;
+		BlendPosesScalar(poses, weights, 2u, scalarPose);
+		BlendPosesSimd(poses, weights, 2u, simdPose);
+		difference = std::max(difference, MaxDifference(scalarPose, simdPose));
+	}
+
+	const bool passed = difference <= BENCHMARKS_TOLERANCE;
+	gef::DebugOut("Benchmark %s, %d joints, %u blends: Linear2PoseBlend %.0f ns, scalar blend %.0f ns (%.2fx), SIMD blend %.0f ns (%.2fx), "
+		"scalar weighted blend %.0f ns, SIMD weighted blend %.0f ns, scalar additive %.0f ns, SIMD additive %.0f ns, largest scalar to SIMD difference %g, %s\n",
+		assetName, bindPose.skeleton()->joint_count(), iterations, gefTime, scalarTime, gefTime / scalarTime, simdTime, gefTime / simdTime,
+		scalarWeightedTime, simdWeightedTime, scalarAddTime, simdAddTime, difference, GetResult(passed));
+#else
+	// Nothing to compare without the SIMD kernels
+	const bool passed = true;
+	gef::DebugOut("Benchmark %s, %d joints, %u blends: Linear2PoseBlend %.0f ns, scalar blend %.0f ns (%.2fx), scalar weighted blend %.0f ns, scalar additive %.0f ns\n",
+		assetName, bindPose.skeleton()->joint_count(), iterations, gefTime, scalarTime, gefTime / scalarTime, scalarWeightedTime, scalarAddTime);
+#endif
+	(void)sink;
+	return passed;
+}
+
+bool Benchmarks::SyncBlend(gef::Platform& platform, const AssetManifest& manifest, const char* assetName, const char* clipFile1, const char* clipFile2, uint32_t frames)
+{
+	LoadedAsset loaded;
+	if (!LoadAsset(platform, manifest, assetName, { clipFile1, clipFile2 }, loaded)) return false;
+	std::vector<Clip>& clips = loaded.clips;
+	for (Clip& clip : clips)
+	{
+		clip.markers = SyncMarkers::Extract(*clip.clip, loaded.GetBindPose());
+
+		// Walk and run cycles are expected to alternate the feet
+		uint32_t alternations = 0u;
+		const std::vector<SyncMarker>& markers = clip.markers;
+		for (size_t m = 0u; m < markers.size(); ++m) alternations += markers[m].foot != markers[(m + 1u) % markers.size()].foot;
+		gef::DebugOut("Benchmark %s sync markers: %zu over %.3fs, %u of them followed by the other foot\n", clip.name.c_str(), markers.size(), clip.duration, alternations);
+	}
+
+	// Half way between the clips, the foot each clip last put down must be the same on every frame
+	SyncPhase phase = {};
+	uint32_t mismatches = 0u;
+	for (uint32_t frame = 0u; frame < frames; ++frame)
+	{
+		const float stepDuration = 0.5f * (SyncMarkers::GetStepDuration(clips[0], phase.step) + SyncMarkers::GetStepDuration(clips[1], phase.step));
+		SyncMarkers::Advance(phase, 1.f / 60.f, stepDuration);
+
+		std::array<int32_t, 2> feet = { -1, -1 };
+		for (size_t i = 0u; i < clips.size(); ++i)
+		{
+			const std::vector<SyncMarker>& markers = clips[i].markers;
+			if (markers.empty()) continue;
+			const float time = SyncMarkers::GetTime(clips[i], phase);
+			feet[i] = static_cast<int32_t>(markers.back().foot);
+			for (const SyncMarker& marker : markers)
+				if (marker.time <= time) feet[i] = static_cast<int32_t>(marker.foot);
+		}
+		if (feet[0] != feet[1]) ++mismatches;
+	}
+
+	const bool passed = mismatches == 0u && !clips[0].markers.empty() && !clips[1].markers.empty();
+	gef::DebugOut("Benchmark %s sync blend of %s and %s, %u frames: %u frames on different feet, %s\n", assetName, clipFile1, clipFile2, frames, mismatches,
+		GetResult(passed));
+	return passed;
+}
+
+bool Benchmarks::StateMachine(gef::Platform& platform, const AssetManifest& manifest, const char* assetName, uint32_t frames)
+{
+	// Idle, walk, run and jump
+	const std::string prefix = std::string(assetName) + "@";
+	LoadedAsset loaded;
+	if (!LoadAsset(platform, manifest, assetName, { prefix + "idle", prefix + "walking_inplace", prefix + "running_inplace", prefix + "jump" }, loaded)) return false;
+	const gef::SkeletonPose& bindPose = loaded.GetBindPose();
+	std::vector<Clip>& clips = loaded.clips;
+	for (Clip& clip : clips) clip.markers = SyncMarkers::Extract(*clip.clip, bindPose);
+
+	// States: idle, locomotion blending walk and run by the speed, and jump
+	constexpr ParameterKey k_Speed = HashParameter("speed");
+	constexpr ParameterKey k_Jump = HashParameter("jump");
+	BlendTreeTemplate blendTree(bindPose);
+	blendTree.AddParameter("speed", ParameterType_::ParameterType_Float);
+	blendTree.AddParameter("jump", ParameterType_::ParameterType_Trigger);
+	const auto addClip = [&](const Clip& clip, bool looping)
+	{
+		ClipNode* node = static_cast<ClipNode*>(blendTree.GetNode(blendTree.AddNode(NodeType_::NodeType_Clip)));
+		node->SetClip(&clip);
+		node->SetLooping(looping);
+		return node;
+	};
+	ClipNode* idle = addClip(clips[0], true);
+	ClipNode* walk = addClip(clips[1], true);
+	ClipNode* run = addClip(clips[2], true);
+	ClipNode* jump = addClip(clips[3], false);
+	LinearBlendNodeSync* locomotion = static_cast<LinearBlendNodeSync*>(blendTree.GetNode(blendTree.AddNode(NodeType_::NodeType_LinearBlendSync)));
+	locomotion->SetInput(0u, walk);
+	locomotion->SetInput(1u, run);
+	locomotion->BindParameter(0u, k_Speed);
+	const std::array<uint32_t, 3> branchSizes = { 1u, 3u, 1u };		// Instructions of each state
+
+	const NodeHandle stateMachineID = blendTree.AddNode(NodeType_::NodeType_StateMachine);
+	StateMachineNode* stateMachine = static_cast<StateMachineNode*>(blendTree.GetNode(stateMachineID));
+	stateMachine->SetInput(idle, locomotion, jump, nullptr);
+	uint32_t transition = stateMachine->AddTransition(0u, 1u, 0.25f, TransitionType_::TransitionType_Smooth);
+	stateMachine->AddCondition(transition, ConditionOp_::ConditionOp_Greater, k_Speed, 0.05f);
+	transition = stateMachine->AddTransition(1u, 0u, 0.25f, TransitionType_::TransitionType_Inertialized);
+	stateMachine->AddCondition(transition, ConditionOp_::ConditionOp_Less, k_Speed, 0.05f);
+	transition = stateMachine->AddTransition(STATEMACHINE_ANY_STATE, 2u, 0.2f, TransitionType_::TransitionType_Frozen);
+	stateMachine->AddCondition(transition, ConditionOp_::ConditionOp_Trigger, k_Jump);
+	transition = stateMachine->AddTransition(2u, 0u, 0.3f, TransitionType_::TransitionType_Smooth);
+	stateMachine->AddCondition(transition, ConditionOp_::ConditionOp_StateTime, BLEND_PARAMETER_NONE, std::max(clips[3].duration - 0.3f, 0.f));
+	blendTree.ConnectToRoot(stateMachineID);
+
+	// Script: idle, speed up from walk to run, jump with an event while running, slow down to idle, jump with the trigger
+	BlendTree instance(blendTree);
+	uint32_t overBudget = 0u, visited = 0u;
+	for (uint32_t frame = 0u; frame < frames; ++frame)
+	{
+		const float time = static_cast<float>(frame) / 60.f;
+		instance.SetFloat(k_Speed, time < 1.f ? 0.f : time < 5.f ? std::min((time - 1.f) / 2.f, 1.f) : 0.f);
+		if (frame == 150u) instance.PostEvent(k_Jump);
+		if (frame == 420u) instance.SetTrigger(k_Jump);
+
+		bool needsPhysicsUpdate = false;
+		instance.Update(1.f / 60.f, needsPhysicsUpdate);
+
+		// The machine itself, its current state, and the state left by a smooth transition, nothing else
+		uint32_t outgoing;
+		const uint32_t state = instance.GetActiveState(stateMachine, outgoing);
+		const uint32_t expected = 1u + branchSizes[state] + (outgoing != UINT32_MAX ? branchSizes[outgoing] : 0u);
+		const uint32_t evaluated = instance.GetEvaluatedCount();
+		visited |= 1u << state;
+		if (evaluated > expected) ++overBudget;
+	}
+
+	const bool passed = overBudget == 0u && visited == 0b111u;
+	gef::DebugOut("Benchmark %s state machine, %u frames: %u frames evaluated more than the active and outgoing states, %s\n", assetName, frames, overBudget,
+		GetResult(passed));
+	return passed;
+}
+
+bool Benchmarks::LazyEvaluation(gef::Platform& platform, const AssetManifest& manifest, const char* assetName, const char* clipFile1, const char* clipFile2,
+	uint32_t instances, uint32_t frames)
+{
+	LoadedAsset loaded;
+	if (!LoadAsset(platform, manifest, assetName, { clipFile1, clipFile2 }, loaded)) return false;
+	const gef::SkeletonPose& bindPose = loaded.GetBindPose();
+	const std::vector<Clip>& clips = loaded.clips;
+
+	// A crowd holding a pose half way between two paused clips
+	BlendTreeTemplate blendTree(bindPose);
+	const NodeHandle blendID = blendTree.AddNode(NodeType_::NodeType_LinearBlend);
+	LinearBlendNode* blend = static_cast<LinearBlendNode*>(blendTree.GetNode(blendID));
+	for (uint32_t slot = 0u; slot < clips.size(); ++slot)
+	{
+		ClipNode* clipNode = static_cast<ClipNode*>(blendTree.GetNode(blendTree.AddNode(NodeType_::NodeType_Clip)));
+		clipNode->SetClip(&clips[slot]);
+		clipNode->SetPlaybackSpeed(0.f);
+		blend->SetInput(slot, clipNode);
+	}
+	blend->SetBlendValue(0.5f);
+	blendTree.ConnectToRoot(blendID);
+	std::vector<std::unique_ptr<BlendTree>> crowd;
+	for (uint32_t i = 0u; i < instances; ++i) crowd.emplace_back(new BlendTree(blendTree));
+
+	// Every instance evaluates the whole tree, then only its first update
+	std::array<double, 2> costs;
+	std::array<SoaPose, 2> outputs;
+	uint32_t reused = 0u;
+	for (uint32_t lazy = 0u; lazy < 2u; ++lazy)
+	{
+		blendTree.SetLazyEvaluation(lazy != 0u);
+		const Clock::time_point start = Clock::now();
+		for (uint32_t frame = 0u; frame < frames; ++frame)
+			for (const std::unique_ptr<BlendTree>& instance : crowd)
+			{
+				bool needsPhysicsUpdate = false;
+				instance->Update(1.f / 60.f, needsPhysicsUpdate);
+			}
+		const Clock::time_point end = Clock::now();
+		costs[lazy] = std::chrono::duration<double, std::nano>(end - start).count() / (static_cast<double>(frames) * instances);
+		outputs[lazy].FromLocalPose(crowd.front()->GetOutputPose().local_pose());
+		reused = crowd.front()->GetReusedCount();
+	}
+
+	const float difference = MaxDifference(outputs[0], outputs[1]);
+	const bool passed = reused > 0u && difference <= BENCHMARKS_TOLERANCE;
+	gef::DebugOut("Benchmark %s lazy evaluation, %u held instances: %.0f ns -> %.0f ns per update (%.2fx), %u of %u instructions reused, max difference %.6f, %s\n",
+		assetName, instances, costs[0], costs[1], costs[0] / costs[1], reused, crowd.front()->GetEvaluatedCount(), difference, GetResult(passed));
+	return passed;
+}
+
+bool Benchmarks::ParallelEvaluation(gef::Platform& platform, const AssetManifest& manifest, const char* assetName, const char* clipFile1, const char* clipFile2,
+	uint32_t frames)
+{
+	LoadedAsset loaded;
+	if (!LoadAsset(platform, manifest, assetName, { clipFile1, clipFile2 }, loaded)) return false;
+	const gef::SkeletonPose& bindPose = loaded.GetBindPose();
+	const std::vector<Clip>& clips = loaded.clips;
+
+	// Balanced trees of two-way blends over more and more clips, every pose recomputed on every update
+	bool passed = true;
+	for (uint32_t width : { 4u, 16u, 64u, 256u })
+	{
+		BlendTreeTemplate blendTree(bindPose);
+		blendTree.SetLazyEvaluation(false);
+		std::vector<NodeHandle> layer;
+		for (uint32_t leaf = 0u; leaf < width; ++leaf)
+		{
+			const NodeHandle clipID = blendTree.AddNode(NodeType_::NodeType_Clip);
+			ClipNode* clipNode = static_cast<ClipNode*>(blendTree.GetNode(clipID));
+			clipNode->SetClip(&clips[leaf % clips.size()]);
+			clipNode->SetPlaybackSpeed(1.f + 0.01f * leaf);
+			layer.push_back(clipID);
+		}
+		while (layer.size() > 1u)
+		{
+			std::vector<NodeHandle> parents;
+			for (size_t i = 0u; i < layer.size(); i += 2u)
+			{
+				const NodeHandle blendID = blendTree.AddNode(NodeType_::NodeType_LinearBlend);
+				LinearBlendNode* blend = static_cast<LinearBlendNode*>(blendTree.GetNode(blendID));
+				blend->SetInput(0u, blendTree.GetNode(layer[i]));
+				blend->SetInput(1u, blendTree.GetNode(layer[i + 1u]));
+				blend->SetBlendValue(0.3f);
+				parents.push_back(blendID);
+			}
+			layer.swap(parents);
+		}
+		blendTree.ConnectToRoot(layer.front());
+		blendTree.Compile();
+
+		// Each run starts a new instance, both play the same frames
+		std::array<double, 2> costs;
+		std::array<SoaPose, 2> outputs;
+		for (uint32_t parallel = 0u; parallel < 2u; ++parallel)
+		{
+			blendTree.SetParallelEvaluation(parallel != 0u);
+			BlendTree instance(blendTree);
+			const Clock::time_point start = Clock::now();
+			for (uint32_t frame = 0u; frame < frames; ++frame)
+			{
+				bool needsPhysicsUpdate = false;
+				instance.Update(1.f / 60.f, needsPhysicsUpdate);
+			}
+			const Clock::time_point end = Clock::now();
+			costs[parallel] = std::chrono::duration<double, std::nano>(end - start).count() / frames;
+			outputs[parallel].FromLocalPose(instance.GetOutputPose().local_pose());
+		}
+
+		const float difference = MaxDifference(outputs[0], outputs[1]);
+		passed &= difference <= BENCHMARKS_TOLERANCE;
+		gef::DebugOut("Benchmark %s parallel evaluation, %u clips, %zu instructions, cost %u, %zu branches on %u workers: %.0f ns -> %.0f ns per update (%.2fx), max difference %.6f, %s\n",
+			assetName, width, blendTree.GetInstructionCount(), blendTree.GetEstimatedCost(), blendTree.GetTaskCount(), JobSystem::Get().GetWorkerCount(),
+			costs[0], costs[1], costs[0] / costs[1], difference, GetResult(difference <= BENCHMARKS_TOLERANCE));
+	}
+	return passed;
+}
+
+bool Benchmarks::PoseMatchedTransition(gef::Platform& platform, const AssetManifest& manifest, const char* assetName, const char* clipFile1, const char* clipFile2,
+	float transitionTime, uint32_t trials)
+{
+	LoadedAsset loaded;
+	if (!LoadAsset(platform, manifest, assetName, { clipFile1, clipFile2 }, loaded)) return false;
+	const gef::SkeletonPose& bindPose = loaded.GetBindPose();
+	std::vector<Clip>& clips = loaded.clips;
+	for (Clip& clip : clips) clip.features = PoseMatching::Extract(*clip.clip, bindPose);
+	if (clips[0].features.IsEmpty() || clips[1].features.IsEmpty()) return false;
+
+	// Cost of a search over the whole second clip
+	const uint32_t searches = 10000u;
+	float found = 0.f;
+	const Clock::time_point start = Clock::now();
+	for (uint32_t i = 0u; i < searches; ++i)
+	{
+		float time;
+		PoseMatching::FindBestTime(clips[0].features, clips[0].duration * i / searches, clips[1].features, clips[1].duration, time);
+		found += time;
+	}
+	const Clock::time_point end = Clock::now();
+	const double searchCost = std::chrono::duration<double, std::nano>(end - start).count() / searches;
+
+	BlendTreeTemplate blendTree(bindPose);
+	const NodeHandle transitionID = blendTree.AddNode(NodeType_::NodeType_Transition);
+	TransitionNode* transition = static_cast<TransitionNode*>(blendTree.GetNode(transitionID));
+	for (uint32_t slot = 0u; slot < clips.size(); ++slot)
+	{
+		ClipNode* clipNode = static_cast<ClipNode*>(blendTree.GetNode(blendTree.AddNode(NodeType_::NodeType_Clip)));
+		clipNode->SetClip(&clips[slot]);
+		transition->SetInput(slot, clipNode);
+	}
+	transition->SetTransitionType(TransitionType_::TransitionType_Smooth);
+	transition->SetTransitionTime(transitionTime);
+	blendTree.ConnectToRoot(transitionID);
+
+	// Largest movement of a joint relative to the root over one frame, from the start of the transition until it is over
+	const uint32_t transitionFrames = static_cast<uint32_t>(std::ceil(transitionTime * 60.f)) + 1u;
+	std::array<float, 2> pops = { 0.f, 0.f };
+	for (uint32_t matching = 0u; matching < 2u; ++matching)
+	{
+		transition->SetPoseMatching(matching != 0u);
+		for (uint32_t trial = 0u; trial < trials; ++trial)
+		{
+			BlendTree instance(blendTree);
+			bool needsPhysicsUpdate = false;
+			const uint32_t leadFrames = static_cast<uint32_t>(clips[0].duration * 60.f * trial / trials) + 1u;
+			for (uint32_t frame = 0u; frame < leadFrames; ++frame) instance.Update(1.f / 60.f, needsPhysicsUpdate);
+			gef::SkeletonPose previous = instance.GetOutputPose();
+
+			instance.StartTransition(transition);
+			float pop = 0.f;
+			for (uint32_t frame = 0u; frame < transitionFrames; ++frame)
+			{
+				instance.Update(1.f / 60.f, needsPhysicsUpdate);
+				const std::vector<gef::Matrix44>& pose = instance.GetOutputPose().global_pose();
+				const std::vector<gef::Matrix44>& last = previous.global_pose();
+				for (size_t joint = 1u; joint < pose.size(); ++joint)
+				{
+					const gef::Vector4 movement = (pose[joint].GetTranslation() - pose[0].GetTranslation()) - (last[joint].GetTranslation() - last[0].GetTranslation());
+					pop = std::max(pop, movement.Length());
+				}
+				previous = instance.GetOutputPose();
+			}
+			pops[matching] += pop / trials;
+		}
+	}
+
+	// Starting on the matching pose never pops more than starting the clip over
+	const bool passed = pops[1] <= pops[0];
+	gef::DebugOut("Benchmark %s pose matching from %s to %s, %zu frames indexed: search %.0f ns (mean time found %.2fs), %.2fs transitions, mean pop %.3f from time 0, %.3f matched, %s\n",
+		assetName, clipFile1, clipFile2, clips[1].features.GetFrameCount(), searchCost, found / searches, transitionTime, pops[0], pops[1], GetResult(passed));
+	return passed;
+}
+
+bool Benchmarks::PoseMirroring(gef::Platform& platform, const AssetManifest& manifest, const char* assetName, const char* clipFile, uint32_t iterations)
+{
+	LoadedAsset loaded;
+	if (!LoadAsset(platform, manifest, assetName, { clipFile }, loaded)) return false;
+	const gef::SkeletonPose& bindPose = loaded.GetBindPose();
+	const gef::Animation& animation = loaded.GetAnimation(0u);
+	const MirrorMap mirrorMap(bindPose, loaded.scene.string_id_table);
+
+	gef::SkeletonPose frame = bindPose;
+	frame.SetPoseFromAnim(animation, bindPose, animation.start_time() + animation.duration() * 0.25f);
+	const SoaPose pose(frame.local_pose()), bind(bindPose.local_pose());
+	SoaPose scalarPose, simdPose, twice;
+
+	const double scalarTime = TimeCalls(iterations, [&](float) { mirrorMap.MirrorScalar(pose, scalarPose); });
+	mirrorMap.MirrorScalar(scalarPose, twice);
+	float twiceDifference = MaxDifference(pose, twice);
+	mirrorMap.MirrorScalar(bind, twice);
+	const float bindDifference = MaxDifference(bind, twice);
+	volatile float sink = scalarPose.GetStream(SoaPose::Stream_TranslationX)[0];
+
+#if SOA_POSE_SIMD
+	const double simdTime = TimeCalls(iterations, [&](float) { mirrorMap.MirrorSimd(pose, simdPose); });
+	sink = simdPose.GetStream(SoaPose::Stream_TranslationX)[0];
+	mirrorMap.MirrorSimd(simdPose, twice);
+	twiceDifference = std::max(twiceDifference, MaxDifference(pose, twice));
+	const float simdDifference = MaxDifference(scalarPose, simdPose);
+
+	const bool passed = simdDifference <= BENCHMARKS_TOLERANCE && twiceDifference <= BENCHMARKS_TOLERANCE && bindDifference <= BENCHMARKS_TOLERANCE;
+	gef::DebugOut("Benchmark %s, %d joints, %zu pairs, %u mirrors: scalar %.0f ns, SIMD %.0f ns (%.2fx), largest scalar to SIMD difference %g, "
+		"mirrored twice %g, mirrored bind pose %g, %s\n", assetName, bindPose.skeleton()->joint_count(), mirrorMap.GetPairCount(), iterations,
+		scalarTime, simdTime, scalarTime / simdTime, simdDifference, twiceDifference, bindDifference, GetResult(passed));
+#else
+	const bool passed = twiceDifference <= BENCHMARKS_TOLERANCE && bindDifference <= BENCHMARKS_TOLERANCE;
+	gef::DebugOut("Benchmark %s, %d joints, %zu pairs, %u mirrors: scalar %.0f ns, mirrored twice %g, mirrored bind pose %g, %s\n",
+		assetName, bindPose.skeleton()->joint_count(), mirrorMap.GetPairCount(), iterations, scalarTime, twiceDifference, bindDifference, GetResult(passed));
+#endif
+	(void)sink;
+	return passed;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <stdint.h>
+
+// Set to 1 to run the micro benchmarks once the assets are loaded, results are printed with gef::DebugOut
+#define ASDFANIM_BENCHMARKS 0
+// Frames sampled by each benchmark, at 60Hz
+#define BENCHMARKS_DEFAULT_ITERATIONS 100000u
+// Largest difference between two results expected to match, e.g. the scalar and SIMD kernels
+#define BENCHMARKS_TOLERANCE 1e-4f
+
+namespace gef
+{
+	class Platform;
+}
+
+namespace AsdfAnim
+{
+	class AssetManifest;
+
+	namespace Benchmarks
+	{
+		// Each benchmark returns whether its checks passed, false as well when its assets could not be loaded
+		// Returns whether all of them passed
+		bool Run(gef::Platform& platform, const AssetManifest& manifest);
+
+		// Compares gef::SkeletonPose::SetPoseFromAnim with the ClipSampler on the source, compressed and resampled versions of a clip
+		// Checks that the sampler gives the joints SetPoseFromAnim gives on the source keys
+		// The clip file is given without extension, e.g. "xbot@running"
+		bool ClipSampling(gef::Platform& platform, const AssetManifest& manifest, const char* assetName, const char* clipFile, uint32_t iterations = BENCHMARKS_DEFAULT_ITERATIONS);
+		// Compares gef::SkeletonPose::Linear2PoseBlend with the scalar and SIMD SoaPose kernels, on two frames of a clip
+		// Checks that the scalar and SIMD results match
+		bool PoseBlending(gef::Platform& platform, const AssetManifest& manifest, const char* assetName, const char* clipFile, uint32_t iterations = BENCHMARKS_DEFAULT_ITERATIONS);
+		// Extracts the sync markers of two clips, e.g. walk and run, and plays them half way between each other on a shared sync phase
+		// Checks on every frame that the foot each clip last put down is the same
+		bool SyncBlend(gef::Platform& platform, const AssetManifest& manifest, const char* assetName, const char* clipFile1, const char* clipFile2, uint32_t frames = 600u);
+		// Updates a crowd holding a pose, a blend of two paused clips, with and without lazy evaluation
+		// Prints the cost of an update and the instructions reused, checks that instructions were reused and that both outputs match
+		bool LazyEvaluation(gef::Platform& platform, const AssetManifest& manifest, const char* assetName, const char* clipFile1, const char* clipFile2,
+			uint32_t instances = 100u, uint32_t frames = 600u);
+		// Plays an idle, locomotion and jump state machine headless, driven by scripted parameters and events
+		// Checks on every frame that only the machine, its current state and the state left by a smooth transition were evaluated,
+		// and that every state was entered
+		bool StateMachine(gef::Platform& platform, const AssetManifest& manifest, const char* assetName, uint32_t frames = 600u);
+		// Updates balanced trees of two-way blends over more and more clips, on the calling thread then with their branches run as jobs
+		// Prints the cost of an update both ways, checks that both outputs match
+		bool ParallelEvaluation(gef::Platform& platform, const AssetManifest& manifest, const char* assetName, const char* clipFile1, const char* clipFile2,
+			uint32_t frames = 300u);
+		// Starts transitions from a clip at times spread over it, with the clip transitioned to starting at 0 then on its best matching pose
+		// Prints the cost of a search and the largest joint movement over one frame during the transitions, the pop, both ways
+		// Checks that the matched transitions pop no more than the others
+		bool PoseMatchedTransition(gef::Platform& platform, const AssetManifest& manifest, const char* assetName, const char* clipFile1, const char* clipFile2,
+			float transitionTime = 0.2f, uint32_t trials = 16u);
+		// Builds the mirror map of the skeleton and mirrors a frame of a clip with the scalar and SIMD kernels
+		// Prints the joint pairs found and the cost of both kernels. Checks that the two kernels match, that a pose mirrored twice
+		// gives the pose back, and that the bind pose mirrors to itself
+		bool PoseMirroring(gef::Platform& platform, const AssetManifest& manifest, const char* assetName, const char* clipFile, uint32_t iterations = BENCHMARKS_DEFAULT_ITERATIONS);
+	}
+}
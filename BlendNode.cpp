@@ -1,45 +1,119 @@
 #include "BlendNode.h"
+#include "BlendSpaceNode.h"
+#include "StateMachineNode.h"
+#include "ResampledClip.h"
+#include "BoneMask.h"
+#include "MirrorMap.h"
+#include "JobSystem.h"
 #include "animation/animation.h"
+#include <algorithm>
+#include <cassert>
+#include <unordered_set>
 using namespace AsdfAnim;
 
-BlendNode::BlendNode(const gef::SkeletonPose& bindPose) : a_Inputs{nullptr}, r_BindPose(bindPose), m_BlendedPose(bindPose), m_Type(NodeType_::NodeType_Undefined)
+BlendNode::BlendNode(const gef::SkeletonPose& bindPose) : a_Inputs{nullptr}, m_Handle{ UINT32_MAX, 0u },
+a_Parameters{ BLEND_PARAMETER_NONE, BLEND_PARAMETER_NONE }, r_BindPose(bindPose), m_Type(NodeType_::NodeType_Undefined), p_GraphVersion(nullptr), m_Version(0u)
 {
 }
 
+bool BlendNode::SetInput(uint32_t slot, BlendNode* input)
+{
+	if (input && (input == this || input->DependsOn(this))) return false;
+
+	Connect(slot, input);
+	GraphChanged();
+	return true;
+}
+
+bool BlendNode::SetInput(BlendNode* input1, BlendNode* input2, BlendNode* input3, BlendNode* input4)
+{
+	// Each slot is checked like one set on its own, a refused input leaves its slot as it was
+	const std::array<BlendNode*, 4> inputs = { input1, input2, input3, input4 };
+	bool accepted = true;
+	for (uint32_t slot = 0u; slot < inputs.size(); ++slot) accepted &= SetInput(slot, inputs[slot]);
+	return accepted;
+}
+
 void BlendNode::AddInput(BlendNode * input)
 {
-	for (auto& item : a_Inputs)
-		if (item == nullptr)
+	if (input && (input == this || input->DependsOn(this))) return;
+
+	for (uint32_t slot = 0u; slot < a_Inputs.size(); ++slot)
+		if (a_Inputs[slot] == nullptr)
 		{
-			item = input;
+			Connect(slot, input);
+			GraphChanged();
 			break;
 		}
 }
 
 void BlendNode::RemoveInput(BlendNode * input)
 {
-	for(auto& item : a_Inputs)
-		if (item == input)
+	for (uint32_t slot = 0u; slot < a_Inputs.size(); ++slot)
+		if (a_Inputs[slot] == input)
 		{
-			item = nullptr;
+			Connect(slot, nullptr);
+			GraphChanged();
 			break;
 		}
 }
 
-bool BlendNode::Update(float frameTime, bool& needPhysicsUpdate)
+void BlendNode::Connect(uint32_t slot, BlendNode* input)
+{
+	BlendNode* previous = a_Inputs[slot];
+	if (previous == input) return;
+
+	// A node read through two slots is in the readers of its input twice
+	if (previous) previous->v_Readers.erase(std::find(previous->v_Readers.begin(), previous->v_Readers.end(), this));
+	a_Inputs[slot] = input;
+	if (input) input->v_Readers.push_back(this);
+}
+
+bool BlendNode::DependsOn(const BlendNode* node) const
+{
+	// Depth first walk over the inputs, a node shared by several branches is only walked once
+	std::vector<const BlendNode*> path(1u, this);
+	std::unordered_set<const BlendNode*> visited;
+	while (!path.empty())
+	{
+		const BlendNode* current = path.back();
+		path.pop_back();
+		for (const BlendNode* input : current->a_Inputs)
+		{
+			if (!input || !visited.insert(input).second) continue;
+			if (input == node) return true;
+			path.push_back(input);
+		}
+	}
+	return false;
+}
+
+uint32_t BlendNode::GetParameterSlotCount() const
 {
-	// Track and update all the parameters before processing its own data to follow a post-order traversal
-	bool success = true;
-	for (uint32_t i = 0u; i < a_Inputs.size(); ++i)
+	switch (m_Type)
 	{
-		// Recursively call the update of each input node
-		// This will create a post-order traversal on the entire tree
-		// The last nodes of the tree will have no parameter to update
-		if (a_Inputs[i]) success &= a_Inputs[i]->Update(frameTime, needPhysicsUpdate);
+	case NodeType_::NodeType_LinearBlend:
+	case NodeType_::NodeType_LinearBlendSync:
+	case NodeType_::NodeType_Transition:
+	case NodeType_::NodeType_Ragdoll:
+	case NodeType_::NodeType_BlendSpace1D:
+	case NodeType_::NodeType_Additive:
+	case NodeType_::NodeType_MaskedBlend:
+	case NodeType_::NodeType_Mirror:		return 1u;
+	case NodeType_::NodeType_BlendSpace2D:	return 2u;
+	default:								return 0u;
 	}
+}
 
-	if (success)	return ProcessData(frameTime);
-	else			return false;
+ParameterType_ BlendNode::GetParameterSlotType(uint32_t slot) const
+{
+	switch (m_Type)
+	{
+	case NodeType_::NodeType_Transition:	return ParameterType_::ParameterType_Trigger;
+	case NodeType_::NodeType_Ragdoll:
+	case NodeType_::NodeType_Mirror:		return ParameterType_::ParameterType_Bool;
+	default:								return ParameterType_::ParameterType_Float;
+	}
 }
 
 /// <summary>
@@ -51,68 +125,60 @@ OutputNode::OutputNode(const gef::SkeletonPose& bindPose) : BlendNode(bindPose)
 	m_Type = NodeType_::NodeType_Output;
 }
 
-bool OutputNode::ProcessData(float frameTime)
-{
-	// Pass the input pose as the final output pose
-	// This node should only have one input
-	if (!a_Inputs[0]) return false;
-
-	m_BlendedPose = a_Inputs[0]->GetPose();
-	return true;
-}
-
 /// <summary>
 /// Clip
 /// </summary>
 /// <param name="bindPose"></param>
-ClipNode::ClipNode(const gef::SkeletonPose& bindPose) : BlendNode(bindPose), m_AnimationTime(0.f), m_ClipPlaybackSpeed(1.f), m_ClipLooping(true), p_Clip(nullptr)
+ClipNode::ClipNode(const gef::SkeletonPose& bindPose) : BlendNode(bindPose), m_ClipPlaybackSpeed(1.f), m_ClipLooping(true), p_Clip(nullptr)
 {
 	m_Type = NodeType_::NodeType_Clip;
 }
 
-bool ClipNode::ProcessData(float frameTime)
+void ClipNode::SetClip(const AsdfAnim::Clip* clip)
+{
+	p_Clip = clip;
+	m_Sampler.SetClip(clip, r_BindPose);
+	Changed();
+}
+
+bool ClipNode::Advance(State& state, float frameTime) const
 {
 	bool finished = false;
 
-	if (p_Clip)
+	// A synchronised blend or transition already placed the clip for this frame
+	if (p_Clip && state.synchronised) state.synchronised = false;
+	else if (p_Clip)
 	{
-		gef::Animation* gefClip = p_Clip->clip;
+		const float duration = p_Clip->duration;
 		// update the animation playback time
-		m_AnimationTime += frameTime * m_ClipPlaybackSpeed;
+		state.animationTime += frameTime * m_ClipPlaybackSpeed;
 
 		// check to see if the playback has reached the end of the animation
-		if (m_AnimationTime > gefClip->duration())
+		if (state.animationTime > duration)
 		{
 			// if the animation is looping then wrap the playback time round to the beginning of the animation
 			// other wise set the playback time to the end of the animation and flag that we have reached the end
 			if (m_ClipLooping)
-				m_AnimationTime = std::fmodf(m_AnimationTime, gefClip->duration());
+				state.animationTime = std::fmodf(state.animationTime, duration);
 			else
 			{
-				m_AnimationTime = gefClip->duration();
+				state.animationTime = duration;
 				finished = true;
 			}
 		}
-
-		// add the clip start time to the playback time to calculate the final time
-		// that will be used to sample the animation data
-		float time = m_AnimationTime + gefClip->start_time();
-
-		// sample the animation data at the calculated time
-		// any bones that don't have animation data are set to the bind pose
-		m_BlendedPose.SetPoseFromAnim(*gefClip, r_BindPose, time);
-	}
-	else
-	{
-		// no animation associated with this player
-		// just set the pose to the bind pose
-		m_BlendedPose = r_BindPose;
 	}
 
 	// return true if we have reached the end of the animation, always false when playback is looped
 	return !finished;
 }
 
+void ClipNode::SamplePose(const State& state, uint32_t* cursors, SoaPose& pose, const BoneMask* mask) const
+{
+	// sample the animation data at the current time
+	// any bones that don't have animation data are set to the bind pose
+	m_Sampler.Sample(state.animationTime, pose, cursors, mask);
+}
+
 /// <summary>
 /// Linear Blend
 /// </summary>
@@ -122,104 +188,62 @@ LinearBlendNode::LinearBlendNode(const gef::SkeletonPose& bindPose) : BlendNode(
 	m_Type = NodeType_::NodeType_LinearBlend;
 }
 
-bool LinearBlendNode::ProcessData(float frameTime)
-{
-	// This blend node only process the two first inputs
-	if (a_Inputs[0] && a_Inputs[1])			m_BlendedPose.Linear2PoseBlend(a_Inputs[0]->GetPose(), a_Inputs[1]->GetPose(), m_BlendValue);
-	else if (!a_Inputs[0] && a_Inputs[1])	m_BlendedPose = a_Inputs[1]->GetPose();
-	else if (a_Inputs[0] && !a_Inputs[1])	m_BlendedPose = a_Inputs[0]->GetPose();
-	else									return false;
-	return true;
-}
-
 /// <summary>
 /// Linear Blend Synchronised
-/// Scales the clips durations to be synchronised, ideal for walk <-> run animations
+/// Keeps the clips in step by their sync markers, ideal for walk <-> run animations
 /// </summary>
 /// <param name="bindPose"></param>
-LinearBlendNodeSync::LinearBlendNodeSync(const gef::SkeletonPose& bindPose) : LinearBlendNode(bindPose),
-a_ClipIDs{ UINT32_MAX, UINT32_MAX },
-a_ClipsMaxMin{0.f, 0.f}
+LinearBlendNodeSync::LinearBlendNodeSync(const gef::SkeletonPose& bindPose) : LinearBlendNode(bindPose)
 {
 	m_Type = NodeType_::NodeType_LinearBlendSync;
 }
 
-bool LinearBlendNodeSync::ProcessData(float frameTime)
-{
-	// Scale the two input clips to be the same lengh
-	if (a_Inputs[0] && a_Inputs[1])			CalculateBlendedSyncPose();
-	else if (!a_Inputs[0] && a_Inputs[1])	m_BlendedPose = a_Inputs[1]->GetPose();
-	else if (a_Inputs[0] && !a_Inputs[1])	m_BlendedPose = a_Inputs[0]->GetPose();
-	else return false;
-
-	return true;
-}
-
 bool LinearBlendNodeSync::SetInput(uint32_t slot, BlendNode* input)
 {
 	// Refuse any input that is not a clip
 	if (input->GetType() != NodeType_::NodeType_Clip) return false;
-
-	BlendNode::SetInput(slot, input);
-
-	// When there are two inputs, it means the node can operate
-	// Take advantage to do only-once initialisations
-	if (a_Inputs[0] && a_Inputs[1])
-	{
-		ClipNode* input1 = reinterpret_cast<ClipNode*>(a_Inputs[0]);
-		ClipNode* input2 = reinterpret_cast<ClipNode*>(a_Inputs[1]);
-		input1->Reset();
-		input2->Reset();
-		a_ClipIDs = { input1->GetClip()->id, input2->GetClip()->id };
-		CalculateClipsMaxMin();
-	}
-
-	// Input accepted
-	return true;
+	return BlendNode::SetInput(slot, input);
 }
 
-void LinearBlendNodeSync::CalculateClipsMaxMin()
+const ClipNode* LinearBlendNodeSync::GetClipInput(uint32_t slot) const
 {
-	// Initialise the clip1 and clip2 playback speed min and max respectively for a synchronised blend
-	// array = { clip1_maxSpeed, clip2_minSpeed }
-	// clip1_maxSpeed determines the maximum speed clip1 needs to be at when clip2 is at normal speed (1)
-	// clip2_minSpeed determines the minimum speed clip2 needs to be at when clip1 is at normal speed (1)
-	ClipNode* input1 = reinterpret_cast<ClipNode*>(a_Inputs[0]);
-	ClipNode* input2 = reinterpret_cast<ClipNode*>(a_Inputs[1]);
-	const float duration1 = input1->GetClip()->clip->duration();
-	const float duration2 = input2->GetClip()->clip->duration();
-	a_ClipsMaxMin = { duration1 / duration2, duration2 / duration1 };
+	const BlendNode* input = a_Inputs[slot];
+	if (!input || input->GetType() != NodeType_::NodeType_Clip) return nullptr;
+	const ClipNode* clipNode = static_cast<const ClipNode*>(input);
+	return clipNode->HasClip() ? clipNode : nullptr;
 }
 
-void LinearBlendNodeSync::CalculateBlendedSyncPose()
+void LinearBlendNodeSync::Synchronise(SyncPhase& phase, float blendValue, const ClipStates& clips, float frameTime) const
 {
-	ClipNode* input1 = reinterpret_cast<ClipNode*>(a_Inputs[0]);
-	ClipNode* input2 = reinterpret_cast<ClipNode*>(a_Inputs[1]);
-
-	// Check if the clips have changed, in which case the maxmin needs to be recalculated
-	// The clips animation times also need to be resynchronised
-	const uint32_t inputID1 = input1->GetClip()->id;
-	const uint32_t inputID2 = input2->GetClip()->id;
-	if (inputID1 != a_ClipIDs[0] || inputID2 != a_ClipIDs[1])
+	// A step lasts as long as the weighted step durations of the clips at their playback speed
+	const std::array<float, 2> weights = { 1.f - blendValue, blendValue };
+	float stepDuration = 0.f, totalWeight = 0.f;
+	for (uint32_t slot = 0u; slot < clips.size(); ++slot)
 	{
-		a_ClipIDs = { inputID1, inputID2 };
-		input1->Reset();
-		input2->Reset();
-		CalculateClipsMaxMin();
+		const ClipNode* input = GetClipInput(slot);
+		if (!clips[slot] || !input || input->GetPlaybackSpeed() <= 0.f) continue;
+		stepDuration += weights[slot] * SyncMarkers::GetStepDuration(*input->GetClip(), phase.step) / input->GetPlaybackSpeed();
+		totalWeight += weights[slot];
 	}
+	if (totalWeight > 0.f) SyncMarkers::Advance(phase, frameTime, stepDuration / totalWeight);
 
-	AssignNewClipSpeeds(input1, input2);
-
-	m_BlendedPose.Linear2PoseBlend(a_Inputs[0]->GetPose(), a_Inputs[1]->GetPose(), m_BlendValue);
+	for (uint32_t slot = 0u; slot < clips.size(); ++slot)
+	{
+		const ClipNode* input = GetClipInput(slot);
+		if (!clips[slot] || !input) continue;
+		clips[slot]->animationTime = SyncMarkers::GetTime(*input->GetClip(), phase);
+		clips[slot]->synchronised = true;
+	}
 }
 
-inline void AsdfAnim::LinearBlendNodeSync::AssignNewClipSpeeds(ClipNode* input1, ClipNode* input2)
+void LinearBlendNodeSync::AlignClips(SyncPhase& phase, const ClipStates& clips) const
 {
-	const float input1_mod = (a_ClipsMaxMin[0] - 1.f) * m_BlendValue;	// With mock values: 1.38 - 1 * 0.5 -> 0.38 * 0.5 -> 38 percent speed, but halfed cause of blend
-	const float input2_mod = (1.f - a_ClipsMaxMin[1]) * m_BlendValue;	// 
+	const ClipNode* input1 = GetClipInput(0u);
+	const ClipNode* input2 = GetClipInput(1u);
+	if (!clips[0] || !clips[1] || !input1 || !input2) return;
 
-	input1->SetPlaybackSpeed(1.f + input1_mod);							// With mock values: 1
-	input2->SetPlaybackSpeed(a_ClipsMaxMin[1] + input2_mod);			// 
+	phase = SyncMarkers::GetPhase(*input1->GetClip(), clips[0]->animationTime);
+	clips[1]->animationTime = SyncMarkers::GetTime(*input2->GetClip(), phase);
 }
 
 ///
@@ -227,173 +251,319 @@ inline void AsdfAnim::LinearBlendNodeSync::AssignNewClipSpeeds(ClipNode* input1,
 /// 
 TransitionNode::TransitionNode(const gef::SkeletonPose& bindPose) : LinearBlendNodeSync(bindPose),
 m_TransitionType(TransitionType_::TransitionType_Undefined),
-m_Transitioning(false),
 m_TransitionTime(1.f),
-m_CurrentTime(0.f)
+m_PoseMatching(false)
 {
 	m_Type = NodeType_::NodeType_Transition;
 }
 
-bool TransitionNode::Update(float frameTime, bool& needPhysicsUpdate)
+void TransitionNode::InitState(State& state) const
 {
-	// Track and update all the parameters before processing its own data to follow a post-order traversal
-	bool success = true;
+	state = {};
+	state.type = m_TransitionType;
+}
 
-	if (a_Inputs[0] && a_Inputs[1])
+uint32_t TransitionNode::Advance(State& state, Poses& poses, const ClipStates& clips, float frameTime) const
+{
+	// The inertialized transition tracks its target rather than the clock, start over when switching to or from it
+	if (state.type != m_TransitionType)
 	{
-		// Needs to transition from input1 to input2 within the transition time set
-		// Time: 0 <= m_CurrentTime <= m_TransitionTime
-		if (m_Transitioning)
-		{
-			m_CurrentTime += frameTime;
-			m_Transitioning = m_CurrentTime < m_TransitionTime;	// Stop if over endTime
-
-			switch (m_TransitionType)
-			{
-			case TransitionType_::TransitionType_Smooth:
-			case TransitionType_::TransitionType_Smooth_Sync:
-				// The smooth transition updates both clips
-				success &= a_Inputs[0]->Update(frameTime, needPhysicsUpdate);
-			case TransitionType_::TransitionType_Frozen:
-			case TransitionType_::TransitionType_Frozen_Sync:
-				success &= a_Inputs[1]->Update(frameTime, needPhysicsUpdate);
-				break;
-			default:
-				// No transition, so just update the first input
-				success &= a_Inputs[0]->Update(frameTime, needPhysicsUpdate);
-				break;
-			}
-		}
-		// If the transition completed
-		else if (m_CurrentTime > 0.f) success &= a_Inputs[1]->Update(frameTime, needPhysicsUpdate);
-		// If the transition has not yet begun
-		else success &= a_Inputs[0]->Update(frameTime, needPhysicsUpdate);
+		const bool wasInertialized = state.type == TransitionType_::TransitionType_Inertialized;
+		state.type = m_TransitionType;
+		if (IsInertialized() != wasInertialized) Reset(state, clips);
 	}
-	else if (!a_Inputs[0] && a_Inputs[1])	success &= a_Inputs[1]->Update(frameTime, needPhysicsUpdate);
-	else if (a_Inputs[0] && !a_Inputs[1])	success &= a_Inputs[0]->Update(frameTime, needPhysicsUpdate);
-	else return false;
 
-	if (success)	return ProcessData(frameTime);
-	else			return false;
-}
+	// The poses are not kept when the template is recompiled
+	if (poses.frozen.GetJointCount() == 0u) state.frozenPoseCaptured = false;
+	if (!poses.last) state.historyCount = 0u;
 
-bool TransitionNode::ProcessData(float frameTime)
-{
-	// Check inputs
-	if (a_Inputs[0] && a_Inputs[1])
+	// The poses kept from the last frame are out of date when the node was not evaluated
+	const bool evaluated = state.evaluated;
+	state.evaluated = false;
+
+	// An inertialized transition only ever needs its target, the offset to the previous input was captured when it started
+	if (IsInertialized())
 	{
-		// Needs to transition from input1 to input2 within the transition time set
-		// Time: 0 <= m_CurrentTime <= m_TransitionTime
-		if (m_Transitioning)
+		// The velocity is measured on consecutive outputs
+		if (!evaluated) state.historyCount = 0u;
+		state.frameTime = frameTime;
+		if (state.transitioning)
 		{
-			// If the transition should stop, blendVal = 1. Otherwise blendVal = currTime / tranTime
-			m_BlendValue = !m_Transitioning + m_Transitioning * (m_CurrentTime / m_TransitionTime);
-
-			switch (m_TransitionType)
-			{
-			case TransitionType_::TransitionType_Smooth:
-			case TransitionType_::TransitionType_Frozen:
-				m_BlendedPose.Linear2PoseBlend(a_Inputs[0]->GetPose(), a_Inputs[1]->GetPose(), m_BlendValue);
-				break;
-			case TransitionType_::TransitionType_Smooth_Sync:
-			case TransitionType_::TransitionType_Frozen_Sync:
-				CalculateBlendedSyncPose();
-				break;
-			default:
-				// Undefined
-				m_BlendedPose = a_Inputs[0]->GetPose();
-				break;
-			}
+			state.currentTime += frameTime;
+			state.transitioning = state.currentTime < m_TransitionTime;
 		}
-		// If the transition completed
-		else if(m_CurrentTime > 0.f) m_BlendedPose = m_BlendedPose = a_Inputs[1]->GetPose();
-		// If the transition has not yet begun
-		else m_BlendedPose = a_Inputs[0]->GetPose();
+		return 1u << state.target;
 	}
-	else if (!a_Inputs[0] && a_Inputs[1])	m_BlendedPose = a_Inputs[1]->GetPose();
-	else if (a_Inputs[0] && !a_Inputs[1])	m_BlendedPose = a_Inputs[0]->GetPose();
-	else return false;
 
-	return true;
+	// Both inputs are present, the tree compiles a transition with a single input as a pass-through
+	// Needs to transition from input1 to input2 within the transition time set
+	// Time: 0 <= currentTime <= m_TransitionTime
+	if (state.transitioning)
+	{
+		state.currentTime += frameTime;
+		state.transitioning = state.currentTime < m_TransitionTime;	// Stop if over endTime
+
+		switch (m_TransitionType)
+		{
+		case TransitionType_::TransitionType_Smooth_Sync:
+			// Both clips play at the phase, the frozen one only took it when the transition started
+			if (state.transitioning && IsSynchronised()) Synchronise(state.phase, state.currentTime / m_TransitionTime, clips, frameTime);
+		case TransitionType_::TransitionType_Smooth:
+			// The smooth transition updates both clips
+			return 0b11u;
+		case TransitionType_::TransitionType_Frozen:
+		case TransitionType_::TransitionType_Frozen_Sync:
+			// The frozen transition blends from a snapshot of the first input, the whole branch is suspended
+			// It is evaluated one last time on the first frame, to take the snapshot
+			return state.frozenPoseCaptured ? 0b10u : 0b11u;
+		default:
+			// No transition, so just update the first input
+			return 0b01u;
+		}
+	}
+	// If the transition completed
+	else if (state.currentTime > 0.f) return 0b10u;
+	// If the transition has not yet begun
+	else return 0b01u;
 }
 
-bool TransitionNode::SetInput(uint32_t slot, BlendNode* input)
+const SoaPose* TransitionNode::Evaluate(State& state, Poses& poses, const ClipStates& clips, const SoaPose* pose1, const SoaPose* pose2, const SoaPose*& blendFrom) const
 {
-	// Refuse any input that is not a clip
-	if (input->GetType() != NodeType_::NodeType_Clip) return false;
+	if (IsInertialized())
+	{
+		const SoaPose& target = state.target ? *pose2 : *pose1;
+		if (state.transitioning && !state.offsetCaptured)
+		{
+			CaptureOffset(*poses.last, state.historyCount > 1u ? *poses.secondLast : *poses.last, state.frameTime, m_TransitionTime, target, poses.curves);
+			state.offsetCaptured = true;
+		}
+		state.blendValue = state.transitioning ? state.currentTime / m_TransitionTime : 1.f;
 
-	BlendNode::SetInput(slot, input);
+		// The tree keeps the last two outputs, a transition started on the next frame measures its offset and velocity from them
+		state.historyCount = std::min(state.historyCount + 1u, 2u);
+		state.evaluated = true;
+		return state.transitioning ? nullptr : &target;
+	}
 
-	// When there are two inputs, it means the node can operate
-	// Take advantage to do only-once initialisations
-	if (a_Inputs[0] && a_Inputs[1])
+	// Needs to transition from input1 to input2 within the transition time set
+	// Time: 0 <= currentTime <= m_TransitionTime
+	if (state.transitioning)
 	{
-		ClipNode* input1 = reinterpret_cast<ClipNode*>(a_Inputs[0]);
-		ClipNode* input2 = reinterpret_cast<ClipNode*>(a_Inputs[1]);
-		input1->Reset();
-		input2->Reset();
-		a_ClipIDs = { input1->GetClip()->id, input2->GetClip()->id };
-		CalculateClipsMaxMin();
+		// If the transition should stop, blendVal = 1. Otherwise blendVal = currTime / tranTime
+		state.blendValue = !state.transitioning + state.transitioning * (state.currentTime / m_TransitionTime);
+
+		// Undefined
+		if (m_TransitionType == TransitionType_::TransitionType_Undefined) return pose1;
 
-		if (m_TransitionType == TransitionType_::TransitionType_Frozen_Sync || m_TransitionType == TransitionType_::TransitionType_Smooth_Sync)
-			AssignNewClipSpeeds(input1, input2);
+		// The frozen transitions blend from the pose the first input had when the transition started, the only copy they make
+		if (IsFrozen() && !state.frozenPoseCaptured)
+		{
+			poses.frozen = *pose1;
+			state.frozenPoseCaptured = true;
+		}
+		state.evaluated = true;
+		blendFrom = IsFrozen() ? &poses.frozen : pose1;
+		return nullptr;
 	}
+	// If the transition completed
+	else if (state.currentTime > 0.f) return pose2;
 
-	// Input accepted
-	return true;
+	// If the transition has not yet begun
+	return pose1;
+}
+
+bool TransitionNode::SetInput(uint32_t slot, BlendNode* input)
+{
+	// Any branch can be transitioned from and to, only clips can be synchronised
+	return BlendNode::SetInput(slot, input);
 }
 
-void TransitionNode::StartTransition()
+void TransitionNode::StartTransition(State& state, const ClipStates& clips) const
 {
 	// If no transition was defined, make it instant
 	if (m_TransitionType == TransitionType_::TransitionType_Undefined)
 	{
-		m_CurrentTime = m_TransitionTime;
+		state.currentTime = m_TransitionTime;
+		return;
+	}
+
+	// Switch to the other input, the offset is captured from the last output on the next evaluation
+	// Starting again before the end simply goes back from wherever the output is
+	if (IsInertialized())
+	{
+		if (!a_Inputs[0] || !a_Inputs[1]) return;
+		state.target ^= 1u;
+		state.currentTime = 0.f;
+		state.transitioning = state.historyCount > 0u && m_TransitionTime > 0.f;
+		state.offsetCaptured = false;
+		if (m_PoseMatching) MatchPose(state.target ^ 1u, state.target, clips);
 		return;
 	}
 
 	// Only start a transition if two inputs are available
-	m_Transitioning = a_Inputs[0] && a_Inputs[1];
+	// A frozen transition takes its snapshot of the first input on its first frame, one restarted halfway keeps the one it has
+	if (!state.transitioning) state.frozenPoseCaptured = false;
+	state.transitioning = a_Inputs[0] && a_Inputs[1];
+
+	// For sync, the second clip starts at the phase the first one is at, on the same foot
+	if (IsSynchronised())
+		AlignClips(state.phase, clips);
+	else if (m_PoseMatching && state.transitioning)
+		MatchPose(0u, 1u, clips);
+}
+
+void TransitionNode::MatchPose(uint32_t from, uint32_t to, const ClipStates& clips) const
+{
+	const ClipNode* fromNode = GetClipInput(from);
+	const ClipNode* toNode = GetClipInput(to);
+	if (!fromNode || !toNode || !fromNode->HasClip() || !toNode->HasClip() || !clips[from] || !clips[to]) return;
+
+	// A clip that does not loop must not run out before the transition ends
+	// The pose of the clip left is read from its index at its time, nothing is sampled
+	const Clip& toClip = *toNode->GetClip();
+	const float maxTime = toNode->IsLooping() ? toClip.duration : toClip.duration - m_TransitionTime;
+	float time;
+	if (PoseMatching::FindBestTime(fromNode->GetClip()->features, clips[from]->animationTime, toClip.features, maxTime, time))
+		*clips[to] = { time, false };
+}
+
+void TransitionNode::Reset(State& state, const ClipStates& clips) const
+{
+	InitState(state);
+
+	// Restart the clips, including one placed by a synchronised transition this frame
+	if (HasClipInputs())
+		for (ClipNode::State* clip : clips)
+			if (clip) *clip = { 0.f, false };
+}
 
-	// For sync, the second clip' animation time needs to be reajusted based on where it would be if it had started at the same instant as the first clip
-	if ((m_TransitionType == TransitionType_::TransitionType_Frozen_Sync || m_TransitionType == TransitionType_::TransitionType_Smooth_Sync) && a_Inputs[0] && a_Inputs[1])
+void TransitionNode::InertializationCurve::Fit(float offset, float velocity, float maxDuration)
+{
+	// A velocity moving away from the target would overshoot, it is dropped
+	// A fast approach shortens the curve so that it does not overshoot either
+	x0 = offset;
+	v0 = std::min(velocity, 0.f);
+	duration = v0 < 0.f ? std::min(maxDuration, -5.f * x0 / v0) : maxDuration;
+	if (duration <= 0.f)
 	{
-		ClipNode* input1 = reinterpret_cast<ClipNode*>(a_Inputs[0]);
-		ClipNode* input2 = reinterpret_cast<ClipNode*>(a_Inputs[1]);
-		input2->SetAnimationTime(a_ClipsMaxMin[1] * input1->GetAnimationTime());
+		a0 = a = b = c = 0.f;
+		return;
 	}
+
+	const float t2 = duration * duration, t3 = t2 * duration, t4 = t3 * duration, t5 = t4 * duration;
+	a0 = (-8.f * v0 * duration - 20.f * x0) / t2;
+	a = -(a0 * t2 + 6.f * v0 * duration + 12.f * x0) / (2.f * t5);
+	b = (3.f * a0 * t2 + 16.f * v0 * duration + 30.f * x0) / (2.f * t4);
+	c = -(3.f * a0 * t2 + 12.f * v0 * duration + 20.f * x0) / (2.f * t3);
 }
 
-void TransitionNode::Reset()
+float TransitionNode::InertializationCurve::Evaluate(float time) const
 {
-	m_CurrentTime = 0.f;
-	m_BlendValue = 0.f;
-	m_Transitioning = false;
+	if (time >= duration) return 0.f;
+	return ((((a * time + b) * time + c) * time + 0.5f * a0) * time + v0) * time + x0;
+}
 
-	// Reset the clip playback speeds if they have been tweaked by a synchronised transition
-	if (a_Inputs[0] && a_Inputs[1])
+namespace
+{
+	// Scaled axis of the rotation taking b to a, a * b^-1 on the shortest path
+	void RotationOffset(const SoaPose& a, const SoaPose& b, size_t joint, std::array<float, 3>& offset)
 	{
-		ClipNode* input1 = reinterpret_cast<ClipNode*>(a_Inputs[0]);
-		ClipNode* input2 = reinterpret_cast<ClipNode*>(a_Inputs[1]);
-		input1->Reset();
-		input2->Reset();
+		const float ax = a.GetStream(SoaPose::Stream_RotationX)[joint], ay = a.GetStream(SoaPose::Stream_RotationY)[joint];
+		const float az = a.GetStream(SoaPose::Stream_RotationZ)[joint], aw = a.GetStream(SoaPose::Stream_RotationW)[joint];
+		const float bx = b.GetStream(SoaPose::Stream_RotationX)[joint], by = b.GetStream(SoaPose::Stream_RotationY)[joint];
+		const float bz = b.GetStream(SoaPose::Stream_RotationZ)[joint], bw = b.GetStream(SoaPose::Stream_RotationW)[joint];
+
+		float x = -aw * bx + ax * bw - ay * bz + az * by;
+		float y = -aw * by + ax * bz + ay * bw - az * bx;
+		float z = -aw * bz - ax * by + ay * bx + az * bw;
+		float w = aw * bw + ax * bx + ay * by + az * bz;
+		if (w < 0.f) x = -x, y = -y, z = -z, w = -w;
+
+		const float sinHalfAngle = std::sqrt(x * x + y * y + z * z);
+		const float scale = sinHalfAngle > 1e-6f ? 2.f * std::atan2(sinHalfAngle, w) / sinHalfAngle : 2.f;
+		offset = { x * scale, y * scale, z * scale };
+	}
 
-		if(m_TransitionType == TransitionType_::TransitionType_Frozen_Sync || m_TransitionType == TransitionType_::TransitionType_Smooth_Sync)
-			AssignNewClipSpeeds(input1, input2);
+	void TranslationOffset(const SoaPose& a, const SoaPose& b, size_t joint, SoaPose::Stream_ first, std::array<float, 3>& offset)
+	{
+		for (uint32_t c = 0u; c < 3u; ++c)
+		{
+			const SoaPose::Stream_ stream = static_cast<SoaPose::Stream_>(first + c);
+			offset[c] = a.GetStream(stream)[joint] - b.GetStream(stream)[joint];
+		}
 	}
 }
 
-void AsdfAnim::TransitionNode::SetTransitionType(const TransitionType_& type)
+void TransitionNode::CaptureOffset(const SoaPose& last, const SoaPose& secondLast, float frameTime, float duration, const SoaPose& target, std::vector<InertializationCurve>& curves)
 {
-	m_TransitionType = type;
+	const float inverseFrameTime = frameTime > 0.f ? 1.f / frameTime : 0.f;
+	const size_t jointCount = target.GetJointCount();
+	curves.resize(jointCount * 3u);
+	for (size_t joint = 0u; joint < jointCount; ++joint)
+		for (uint32_t channel = 0u; channel < 3u; ++channel)
+		{
+			std::array<float, 3> offset, previousOffset;
+			if (channel == 0u)
+			{
+				RotationOffset(last, target, joint, offset);
+				RotationOffset(secondLast, target, joint, previousOffset);
+			}
+			else
+			{
+				const SoaPose::Stream_ first = channel == 1u ? SoaPose::Stream_TranslationX : SoaPose::Stream_ScaleX;
+				TranslationOffset(last, target, joint, first, offset);
+				TranslationOffset(secondLast, target, joint, first, previousOffset);
+			}
 
-	if ((m_TransitionType == TransitionType_::TransitionType_Frozen_Sync || m_TransitionType == TransitionType_::TransitionType_Smooth_Sync) && a_Inputs[0] && a_Inputs[1])
+			// Each channel decays along the direction of its offset, the velocity is projected on it
+			InertializationCurve& curve = curves[joint * 3u + channel];
+			const float length = std::sqrt(offset[0] * offset[0] + offset[1] * offset[1] + offset[2] * offset[2]);
+			if (length <= 1e-6f)
+			{
+				curve.direction = { 0.f, 0.f, 0.f };
+				curve.Fit(0.f, 0.f, 0.f);
+				continue;
+			}
+			curve.direction = { offset[0] / length, offset[1] / length, offset[2] / length };
+			float velocity = 0.f;
+			for (uint32_t c = 0u; c < 3u; ++c) velocity += (offset[c] - previousOffset[c]) * curve.direction[c];
+			curve.Fit(length, velocity * inverseFrameTime, duration);
+		}
+}
+
+void TransitionNode::ApplyOffset(const std::vector<InertializationCurve>& curves, float time, const SoaPose& target, SoaPose& pose)
+{
+	pose = target;
+	for (size_t joint = 0u; joint < target.GetJointCount(); ++joint)
 	{
-		ClipNode* input1 = reinterpret_cast<ClipNode*>(a_Inputs[0]);
-		ClipNode* input2 = reinterpret_cast<ClipNode*>(a_Inputs[1]);
-		input1->Reset();
-		input2->Reset();
-		AssignNewClipSpeeds(input1, input2);
+		const InertializationCurve* jointCurves = &curves[joint * 3u];
+
+		// Rotation: exp(direction * angle) * target
+		const float angle = jointCurves[0].Evaluate(time);
+		if (angle != 0.f)
+		{
+			const float sinHalfAngle = std::sin(angle * 0.5f);
+			const float ox = jointCurves[0].direction[0] * sinHalfAngle, oy = jointCurves[0].direction[1] * sinHalfAngle, oz = jointCurves[0].direction[2] * sinHalfAngle;
+			const float ow = std::cos(angle * 0.5f);
+			float& x = pose.GetStream(SoaPose::Stream_RotationX)[joint];
+			float& y = pose.GetStream(SoaPose::Stream_RotationY)[joint];
+			float& z = pose.GetStream(SoaPose::Stream_RotationZ)[joint];
+			float& w = pose.GetStream(SoaPose::Stream_RotationW)[joint];
+			const float tx = x, ty = y, tz = z, tw = w;
+			x = ow * tx + ox * tw + oy * tz - oz * ty;
+			y = ow * ty - ox * tz + oy * tw + oz * tx;
+			z = ow * tz + ox * ty - oy * tx + oz * tw;
+			w = ow * tw - ox * tx - oy * ty - oz * tz;
+		}
+
+		for (uint32_t channel = 1u; channel < 3u; ++channel)
+		{
+			const float distance = jointCurves[channel].Evaluate(time);
+			if (distance == 0.f) continue;
+			const SoaPose::Stream_ first = channel == 1u ? SoaPose::Stream_TranslationX : SoaPose::Stream_ScaleX;
+			for (uint32_t c = 0u; c < 3u; ++c)
+				pose.GetStream(static_cast<SoaPose::Stream_>(first + c))[joint] += jointCurves[channel].direction[c] * distance;
+		}
 	}
 }
 
@@ -405,119 +575,1429 @@ RagdollNode::RagdollNode(const gef::SkeletonPose & bindPose) : BlendNode(bindPos
 	m_Type = NodeType_::NodeType_Ragdoll;
 }
 
-bool RagdollNode::Update(float frameTime, bool & needPhysicsUpdate)
+bool RagdollNode::Drive(const State& state, const SoaPose* input) const
 {
-	// Track and update all the parameters before processing its own data to follow a post-order traversal
-	bool success = true;
+	// If the node is deactivated and there is an input, update the ragdoll according to the input
+	if (state.active || !input) return false;
 
-	// TODO: This is dumb cause there is only one input but I'll leave it in case it changes in the future
-	for (uint32_t i = 0u; i < a_Inputs.size(); ++i)
-	{
-		// Recursively call the update of each input node
-		// This will create a post-order traversal on the entire tree
-		// The last nodes of the tree will have no parameter to update
-		if (a_Inputs[i]) success &= a_Inputs[i]->Update(frameTime, needPhysicsUpdate);
-	}
+	// The ragdoll works on gef poses, the input is converted straight into the pose of the ragdoll
+	gef::SkeletonPose& ragdollPose = p_Ragdoll->pose();
+	input->ToLocalPose(ragdollPose.local_pose());
+	ragdollPose.CalculateGlobalPose();
+	p_Ragdoll->UpdateRagdollFromPose();
+	return true;
+}
+
+void RagdollNode::ReadPose(SoaPose& pose) const
+{
+	p_Ragdoll->UpdatePoseFromRagdoll();
+	pose.FromLocalPose(p_Ragdoll->pose().local_pose());
+}
+
+///
+/// Additive Node
+/// 
+AdditiveNode::AdditiveNode(const gef::SkeletonPose& bindPose) : LinearBlendNode(bindPose), m_ClipPlaybackSpeed(1.f), p_Clip(nullptr)
+{
+	m_Type = NodeType_::NodeType_Additive;
+	m_BlendValue = 1.f;
+}
 
-	// Ragdoll nodes will need a physics iteration
-	needPhysicsUpdate = m_Active;
+bool AdditiveNode::SetClip(const AsdfAnim::Clip* clip)
+{
+	if (clip && !clip->additive) return false;
+	p_Clip = clip;
+	Changed();
+	return true;
+}
 
-	if (success)	return ProcessData(frameTime);
-	else			return false;
+void AdditiveNode::Advance(State& state, float frameTime) const
+{
+	if (!p_Clip || p_Clip->duration <= 0.f) return;
+	state.animationTime = std::fmodf(state.animationTime + frameTime * m_ClipPlaybackSpeed, p_Clip->duration);
+	if (state.animationTime < 0.f) state.animationTime += p_Clip->duration;
 }
 
-bool RagdollNode::ProcessData(float frameTime)
+void AdditiveNode::Apply(const State& state, const SoaPose& input, SoaPose& pose) const
 {
-	if (!p_Ragdoll) return false;
+	// A difference is an identity rotation and zero offsets on the joints the clip does not animate
+	pose.SetZero();
+	std::fill(pose.GetStream(SoaPose::Stream_RotationW), pose.GetStream(SoaPose::Stream_RotationW) + pose.GetPaddedCount(), 1.f);
+	p_Clip->additive->SampleAdditive(state.animationTime, pose);
 
-	// If the node is deactivated and there is an input, update the ragdoll according to the input
-	if (!m_Active && a_Inputs[0])
+	// The kernels read each joint of the delta before writing it, the sum goes over it
+	AddPose(input, pose, state.blendValue, pose);
+}
+
+///
+/// Masked Blend Node
+/// 
+MaskedBlendNode::MaskedBlendNode(const gef::SkeletonPose& bindPose) : LinearBlendNode(bindPose), p_Mask(nullptr)
+{
+	m_Type = NodeType_::NodeType_MaskedBlend;
+	m_BlendValue = 1.f;
+}
+
+void MaskedBlendNode::Blend(const State& state, const SoaPose& base, const SoaPose& layer, SoaPose& pose) const
+{
+	// Every joint is blended, the joints outside of the mask have no weight and give the base back
+	// The layer was only sampled on the joints of the mask, the others hold whatever the buffer had but are never read
+	BlendPoses(base, layer, p_Mask->GetWeightStream(), state.blendValue, pose);
+}
+
+///
+/// Mirror Node
+/// 
+MirrorNode::MirrorNode(const gef::SkeletonPose& bindPose) : BlendNode(bindPose), p_MirrorMap(nullptr), m_Mirrored(true)
+{
+	m_Type = NodeType_::NodeType_Mirror;
+}
+
+void MirrorNode::Mirror(const SoaPose& input, SoaPose& pose) const
+{
+	p_MirrorMap->Mirror(input, pose);
+}
+
+/// <summary>
+/// Blend tree template
+/// </summary>
+/// <param name="bindPose"></param>
+BlendTreeTemplate::BlendTreeTemplate(const gef::SkeletonPose& bindPose) : m_BindPose(bindPose), m_PoseBufferCount(0u), m_TransitionCount(0u),
+m_GraphVersion(1u), m_CompiledVersion(0u), m_ProgramVersion(0u), m_ProgramValid(false), m_LazyEvaluation(true), m_ParallelEvaluation(true),
+m_EstimatedCost(0u), m_ParallelBufferCount(0u), m_StateSize(0u)
+{
+	// The root node will always be an output node
+	CreateNode(NodeType_::NodeType_Output);
+}
+
+NodeHandle BlendTreeTemplate::AddNode(NodeType_ type)
+{
+	const NodeHandle handle = CreateNode(type)->GetHandle();
+	++m_GraphVersion;
+	return handle;
+}
+
+BlendNode* BlendTreeTemplate::CreateNode(NodeType_ type)
+{
+	// The types are numbered from -1, the pools from 0
+	const uint32_t pool = static_cast<uint32_t>(static_cast<int32_t>(type) + 1);
+	NodeHandle handle;
+	BlendNode* node = nullptr;
+	switch (type)
 	{
-		m_BlendedPose = a_Inputs[0]->GetPose();
-		p_Ragdoll->set_pose(m_BlendedPose);
-		p_Ragdoll->UpdateRagdollFromPose();
+	case NodeType_::NodeType_Output:			node = m_Nodes.Create<OutputNode>(pool, handle, m_BindPose);			break;
+	case NodeType_::NodeType_Clip:				node = m_Nodes.Create<ClipNode>(pool, handle, m_BindPose);				break;
+	case NodeType_::NodeType_LinearBlend:		node = m_Nodes.Create<LinearBlendNode>(pool, handle, m_BindPose);		break;
+	case NodeType_::NodeType_LinearBlendSync:	node = m_Nodes.Create<LinearBlendNodeSync>(pool, handle, m_BindPose);	break;
+	case NodeType_::NodeType_Transition:		node = m_Nodes.Create<TransitionNode>(pool, handle, m_BindPose);		break;
+	case NodeType_::NodeType_Ragdoll:			node = m_Nodes.Create<RagdollNode>(pool, handle, m_BindPose);			break;
+	case NodeType_::NodeType_BlendSpace1D:		node = m_Nodes.Create<BlendSpace1DNode>(pool, handle, m_BindPose);		break;
+	case NodeType_::NodeType_BlendSpace2D:		node = m_Nodes.Create<BlendSpace2DNode>(pool, handle, m_BindPose);		break;
+	case NodeType_::NodeType_Additive:			node = m_Nodes.Create<AdditiveNode>(pool, handle, m_BindPose);			break;
+	case NodeType_::NodeType_MaskedBlend:		node = m_Nodes.Create<MaskedBlendNode>(pool, handle, m_BindPose);		break;
+	case NodeType_::NodeType_StateMachine:		node = m_Nodes.Create<StateMachineNode>(pool, handle, m_BindPose);		break;
+	case NodeType_::NodeType_Mirror:			node = m_Nodes.Create<MirrorNode>(pool, handle, m_BindPose);			break;
+	default:
+		throw std::logic_error("Tried to create a non-existant node!");
 	}
-	else
+	node->m_Handle = handle;
+	node->p_GraphVersion = &m_GraphVersion;
+	return node;
+}
+
+bool BlendTreeTemplate::RemoveAndFreeNode(NodeHandle handle)
+{
+	BlendNode* node = m_Nodes.Get(handle);
+	if (!node || node->m_Type == NodeType_::NodeType_Output) return false;
+
+	// Only the nodes next to it are touched, whatever the size of the graph
+	while (!node->v_Readers.empty())
 	{
-		p_Ragdoll->UpdatePoseFromRagdoll();
-		m_BlendedPose = p_Ragdoll->pose();
+		BlendNode* reader = node->v_Readers.back();
+		for (uint32_t slot = 0u; slot < reader->a_Inputs.size(); ++slot)
+			if (reader->a_Inputs[slot] == node) reader->Connect(slot, nullptr);
 	}
+	for (uint32_t slot = 0u; slot < node->a_Inputs.size(); ++slot) node->Connect(slot, nullptr);
+
+	m_Nodes.Destroy(handle);
+	++m_GraphVersion;
 	return true;
 }
 
-/// <summary>
-/// Blend tree
-/// </summary>
-/// <param name="bindPose"></param>
-BlendTree::BlendTree(const gef::SkeletonPose& bindPose) : m_BindPose(bindPose)
+void BlendTreeTemplate::ConnectToRoot(NodeHandle input)
 {
-	// The root node will always be an output node
-	v_Tree.reserve(BLENDTREE_MAXNODES);
-	v_Tree.push_back(new OutputNode(m_BindPose));
+	GetTree().front()->SetInput(0u, m_Nodes.Get(input));
 }
 
-BlendTree::~BlendTree()
+void BlendTreeTemplate::SetRagdoll(Ragdoll* ragdoll)
 {
-	for (auto& item : v_Tree)
-		delete item, item = nullptr;
-	v_Tree.clear();
+	for (BlendNode* node : GetTree())
+		if (node->m_Type == NodeType_::NodeType_Ragdoll) static_cast<RagdollNode*>(node)->SetRagdoll(ragdoll);
 }
 
-uint32_t BlendTree::AddNode(BlendNode* node)
+void BlendTreeTemplate::RebindClip(const Clip* clip)
 {
-	// Do not allow to add a node if we reached BLENDTREE_MAXNODES
-	if (v_Tree.size() >= BLENDTREE_MAXNODES)
-		return UINT32_MAX;
+	for (BlendNode* node : GetTree())
+	{
+		if (node->m_Type == NodeType_::NodeType_Clip)
+		{
+			ClipNode* clipNode = static_cast<ClipNode*>(node);
+			if (clipNode->GetClip() == clip) clipNode->RebindClip();
+		}
+		else if (node->m_Type == NodeType_::NodeType_BlendSpace1D || node->m_Type == NodeType_::NodeType_BlendSpace2D)
+			static_cast<BlendSpaceNode*>(node)->RebindClip(clip);
+	}
+}
 
-	v_Tree.push_back(node);
-	return v_Tree.size() - 1u;
+void BlendTreeTemplate::Compile()
+{
+	if (m_CompiledVersion == m_GraphVersion) return;
+
+	// The previous program tells where the state of each node was in the instance blocks
+	const std::vector<BlendInstruction> previousProgram = v_Program;
+	const size_t previousStateSize = m_StateSize;
+	v_Program.clear();
+	m_CompiledVersion = m_GraphVersion;
+	++m_ProgramVersion;
+
+	// Post-order traversal from the output node, each reachable node is compiled once
+	// The output node itself only designates the last instruction as the result of the tree
+	std::unordered_map<BlendNode*, uint32_t> compiled;
+	BlendNode* output = GetTree().front();
+	const uint32_t result = output->a_Inputs[0] ? CompileNode(output->a_Inputs[0], compiled) : UINT32_MAX;
+	m_ProgramValid = result != UINT32_MAX;
+	if (!m_ProgramValid) v_Program.clear();
+
+	map_Instructions.clear();
+	for (uint32_t i = 0u; i < v_Program.size(); ++i) map_Instructions[v_Program[i].handle] = i;
+	BindParameters();
+	PropagateMasks();
+	CountPoseBuffers();
+	PlanTasks();
+	LayOutState(previousProgram, previousStateSize);
 }
 
-uint32_t BlendTree::AddNode(NodeType_ type)
+void BlendTreeTemplate::PropagateMasks()
 {
-	// Do not allow to add a node if we reached BLENDTREE_MAXNODES
-	if (v_Tree.size() >= BLENDTREE_MAXNODES)
-		return UINT32_MAX;
+	// Walk back from the output so that every consumer is seen before the instructions it reads
+	// An instruction read through different masks, or through none, produces the whole pose
+	v_Masks.assign(v_Program.size(), nullptr);
+	v_MaskIntersections.clear();
+	std::vector<uint8_t> visited(v_Program.size(), 0u);
+	if (!visited.empty()) visited.back() = 1u;
+	for (size_t i = v_Program.size(); i-- > 0u;)
+	{
+		const BlendInstruction& instruction = v_Program[i];
+		for (uint32_t slot = 0u; slot < instruction.inputs.size(); ++slot)
+		{
+			const uint32_t input = instruction.inputs[slot];
+			if (input == UINT32_MAX) continue;
 
-	switch (type)
+			const BoneMask* mask = v_Masks[i];
+			if (instruction.op == BlendOp_::BlendOp_Ragdoll) mask = nullptr;		// The ragdoll is driven by the whole pose
+			else if (instruction.op == BlendOp_::BlendOp_Mirror) mask = nullptr;	// The joints read are those of the other side
+			else if (instruction.op == BlendOp_::BlendOp_MaskedBlend && slot == 1u)
+			{
+				const BoneMask* layerMask = static_cast<MaskedBlendNode*>(instruction.node)->GetMask();
+				mask = mask ? IntersectMasks(*layerMask, *mask) : layerMask;
+			}
+
+			if (!visited[input])
+			{
+				v_Masks[input] = mask;
+				visited[input] = 1u;
+			}
+			else if (v_Masks[input] != mask) v_Masks[input] = nullptr;
+		}
+	}
+}
+
+const BoneMask* BlendTreeTemplate::IntersectMasks(const BoneMask& mask, const BoneMask& other)
+{
+	if (&mask == &other) return &mask;
+	v_MaskIntersections.push_back(mask);
+	v_MaskIntersections.back().Intersect(other);
+	return &v_MaskIntersections.back();
+}
+
+void BlendTreeTemplate::CountPoseBuffers()
+{
+	// Replay the program with every instruction needed, a buffer is live from its instruction to its last reader
+	std::vector<uint32_t> readers(v_Program.size(), 0u);
+	for (const BlendInstruction& instruction : v_Program)
+		for (uint32_t input : instruction.inputs)
+			if (input != UINT32_MAX) ++readers[input];
+	if (!readers.empty()) ++readers.back();		// The result of the tree is read after the update
+
+	// The transitions and the state machines hold their last two outputs from one update to the next
+	uint32_t live = 0u, maxLive = 0u;
+	for (const BlendInstruction& instruction : v_Program)
+		if (instruction.op == BlendOp_::BlendOp_Transition || instruction.op == BlendOp_::BlendOp_StateMachine) live += 2u;
+	for (const BlendInstruction& instruction : v_Program)
 	{
-	case NodeType_::NodeType_Output:			v_Tree.push_back(new OutputNode(m_BindPose));				break;
-	case NodeType_::NodeType_Clip:				v_Tree.push_back(new ClipNode(m_BindPose));					break;
-	case NodeType_::NodeType_LinearBlend:		v_Tree.push_back(new LinearBlendNode(m_BindPose));			break;
-	case NodeType_::NodeType_LinearBlendSync:	v_Tree.push_back(new LinearBlendNodeSync(m_BindPose));		break;
-	case NodeType_::NodeType_Transition:		v_Tree.push_back(new TransitionNode(m_BindPose));			break;
-	case NodeType_::NodeType_Ragdoll:			v_Tree.push_back(new RagdollNode(m_BindPose));				break;
-	default:
-		throw std::logic_error("Tried to create a non-existant node!");
+		// A blend space also holds scratch buffers for its clips while it runs
+		const uint32_t scratch = instruction.op == BlendOp_::BlendOp_BlendSpace ? BLENDSPACE_MAX_WEIGHTS - 1u : 0u;
+		maxLive = std::max(maxLive, ++live + scratch);
+		for (uint32_t input : instruction.inputs)
+			if (input != UINT32_MAX && --readers[input] == 0u) --live;
 	}
-	return v_Tree.size() - 1u;
+	m_PoseBufferCount = maxLive;
 }
 
-void BlendTree::RemoveAndFreeNode(BlendNode* node)
+void BlendTreeTemplate::PlanTasks()
 {
-	// Ouch
-	for(auto it = v_Tree.begin(); it != v_Tree.end(); ++it)
-		if (*it == node)
+	v_Tasks.clear();
+	v_TaskInstructions.clear();
+	v_TaskDependents.clear();
+	m_EstimatedCost = 0u;
+	m_ParallelBufferCount = 0u;
+
+	const uint32_t instructionCount = static_cast<uint32_t>(v_Program.size());
+	std::vector<uint32_t> readers(instructionCount, 0u), reader(instructionCount, UINT32_MAX);
+	for (uint32_t i = 0u; i < instructionCount; ++i)
+		for (uint32_t input : v_Program[i].inputs)
+			if (input != UINT32_MAX)
+			{
+				++readers[input];
+				reader[input] = i;
+			}
+
+	// Cost of each instruction plus that of the inputs it runs with, in pose blends
+	// A branch starts at the output, at an instruction read by several others, or at a subtree worth a job
+	std::vector<uint32_t> branchCost(instructionCount, 0u);
+	std::vector<uint8_t> branchRoot(instructionCount, 0u);
+	bool hasRagdoll = false;
+	for (uint32_t i = 0u; i < instructionCount; ++i)
+	{
+		const BlendInstruction& instruction = v_Program[i];
+		uint32_t cost = 1u;
+		switch (instruction.op)
 		{
-			v_Tree.erase(it);
-			delete node;
-			node = nullptr;
+		case BlendOp_::BlendOp_Sample:		cost = 3u; break;		// Keys decoded and interpolated
+		case BlendOp_::BlendOp_Additive:	cost = 4u; break;		// A sample and its difference applied
+		case BlendOp_::BlendOp_Mirror:		cost = 2u; break;		// A gather and two rotations per joint
+		case BlendOp_::BlendOp_BlendSpace:
+			// Up to 3 samples around the parameter, accumulated
+			cost = 4u * static_cast<uint32_t>(std::min<size_t>(static_cast<BlendSpaceNode*>(instruction.node)->GetSampleCount(), 3u));
 			break;
+		case BlendOp_::BlendOp_Ragdoll:		hasRagdoll = true; break;
+		default: break;
+		}
+		m_EstimatedCost += cost;
+
+		branchCost[i] = cost;
+		for (uint32_t input : instruction.inputs)
+			if (input != UINT32_MAX && !branchRoot[input]) branchCost[i] += branchCost[input];
+		branchRoot[i] = i + 1u == instructionCount || readers[i] != 1u || branchCost[i] >= BLENDTREE_PARALLEL_GRAIN;
+	}
+	if (hasRagdoll || m_EstimatedCost < BLENDTREE_PARALLEL_MIN_COST) return;
+
+	// The branches can run in any order, so the pool is sized for every result, every blend space sampling and every history held at once
+	m_ParallelBufferCount = instructionCount;
+	for (const BlendInstruction& instruction : v_Program)
+	{
+		if (instruction.op == BlendOp_::BlendOp_BlendSpace) m_ParallelBufferCount += BLENDSPACE_MAX_WEIGHTS - 1u;
+		else if (instruction.op == BlendOp_::BlendOp_Transition || instruction.op == BlendOp_::BlendOp_StateMachine) m_ParallelBufferCount += 2u;
+	}
+
+	// The other instructions run in the branch of their only reader, which comes after them
+	std::vector<uint32_t> task(instructionCount, UINT32_MAX);
+	uint32_t taskCount = 0u;
+	for (uint32_t i = instructionCount; i-- > 0u;) task[i] = branchRoot[i] ? taskCount++ : task[reader[i]];
+	if (taskCount < 2u) return;
+
+	// A branch depends on every other branch it reads a pose of
+	std::vector<std::pair<uint32_t, uint32_t>> edges;
+	for (uint32_t i = 0u; i < instructionCount; ++i)
+		for (uint32_t input : v_Program[i].inputs)
+			if (input != UINT32_MAX && task[input] != task[i]) edges.push_back({ task[input], task[i] });
+	std::sort(edges.begin(), edges.end());
+	edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+	v_Tasks.assign(taskCount, { 0u, 0u, 0u, 0u, 0u });
+	for (uint32_t i = 0u; i < instructionCount; ++i) ++v_Tasks[task[i]].instructionCount;
+	for (const std::pair<uint32_t, uint32_t>& edge : edges)
+	{
+		++v_Tasks[edge.first].dependentCount;
+		++v_Tasks[edge.second].dependencies;
+	}
+	uint32_t firstInstruction = 0u, firstDependent = 0u;
+	for (BlendTask& blendTask : v_Tasks)
+	{
+		blendTask.firstInstruction = firstInstruction;
+		blendTask.firstDependent = firstDependent;
+		firstInstruction += blendTask.instructionCount;
+		firstDependent += blendTask.dependentCount;
+		blendTask.instructionCount = 0u;
+		blendTask.dependentCount = 0u;
+	}
+	v_TaskInstructions.resize(instructionCount);
+	for (uint32_t i = 0u; i < instructionCount; ++i)
+	{
+		BlendTask& blendTask = v_Tasks[task[i]];
+		v_TaskInstructions[blendTask.firstInstruction + blendTask.instructionCount++] = i;
+	}
+	v_TaskDependents.resize(edges.size());
+	for (const std::pair<uint32_t, uint32_t>& edge : edges)
+	{
+		BlendTask& blendTask = v_Tasks[edge.first];
+		v_TaskDependents[blendTask.firstDependent + blendTask.dependentCount++] = edge.second;
+	}
+}
+
+void BlendTreeTemplate::LayOutState(const std::vector<BlendInstruction>& previousProgram, size_t previousStateSize)
+{
+	// Every instruction has a state, the transitions and state machines have poses in the instance as well
+	m_StateSize = 0u;
+	m_TransitionCount = 0u;
+	for (BlendInstruction& instruction : v_Program)
+	{
+		if (instruction.op == BlendOp_::BlendOp_Transition || instruction.op == BlendOp_::BlendOp_StateMachine) instruction.poses = m_TransitionCount++;
+		instruction.state = static_cast<uint32_t>(m_StateSize);
+		instruction.stateSize = GetStateSize(instruction.op, instruction.node);
+		m_StateSize += instruction.stateSize;
+	}
+
+	v_DefaultState.assign(m_StateSize, 0u);
+	for (const BlendInstruction& instruction : v_Program) InitState(instruction, v_DefaultState.data());
+
+	// Carry the state of the instances over node by node, a node whose state changed size (e.g. a blend space with a new sample) starts over
+	// The nodes are matched by handle, a node created in the memory of a removed one starts from its defaults
+	std::unordered_map<NodeHandle, const BlendInstruction*, NodeHandleHash> previous;
+	for (const BlendInstruction& instruction : previousProgram) previous[instruction.handle] = &instruction;
+
+	std::vector<uint8_t> states(v_InstanceUsed.size() * m_StateSize);
+	for (size_t instance = 0u; instance < v_InstanceUsed.size(); ++instance)
+	{
+		uint8_t* block = states.data() + instance * m_StateSize;
+		std::copy(v_DefaultState.begin(), v_DefaultState.end(), block);
+		if (!v_InstanceUsed[instance]) continue;
+
+		const uint8_t* previousBlock = v_States.data() + instance * previousStateSize;
+		for (const BlendInstruction& instruction : v_Program)
+		{
+			const auto it = previous.find(instruction.handle);
+			if (it == previous.end() || it->second->op != instruction.op || it->second->stateSize != instruction.stateSize) continue;
+			std::copy(previousBlock + it->second->state, previousBlock + it->second->state + instruction.stateSize, block + instruction.state);
 		}
+	}
+	v_States.swap(states);
 }
 
-BlendNode* BlendTree::GetNode(uint32_t ID)
+uint32_t BlendTreeTemplate::GetStateSize(BlendOp_ op, const BlendNode* node)
 {
-	return v_Tree[ID];
+	size_t size = 0u;
+	switch (op)
+	{
+	case BlendOp_::BlendOp_Sample:			size = sizeof(ClipNode::State) + static_cast<const ClipNode*>(node)->GetCursorCount() * sizeof(uint32_t);				break;
+	case BlendOp_::BlendOp_Blend:
+	case BlendOp_::BlendOp_MaskedBlend:		size = sizeof(LinearBlendNode::State);																				break;
+	case BlendOp_::BlendOp_SyncBlend:		size = sizeof(LinearBlendNodeSync::State);																			break;
+	case BlendOp_::BlendOp_Transition:		size = sizeof(TransitionNode::State);																				break;
+	case BlendOp_::BlendOp_Ragdoll:			size = sizeof(RagdollNode::State);																					break;
+	case BlendOp_::BlendOp_BlendSpace:		size = sizeof(BlendSpaceNode::State) + static_cast<const BlendSpaceNode*>(node)->GetCursorCount() * sizeof(uint32_t);	break;
+	case BlendOp_::BlendOp_Additive:		size = sizeof(AdditiveNode::State);																					break;
+	case BlendOp_::BlendOp_StateMachine:	size = sizeof(StateMachineNode::State);																				break;
+	case BlendOp_::BlendOp_Mirror:			size = sizeof(MirrorNode::State);																					break;
+	}
+	// The members are all 4 bytes wide and so is the alignment of each state
+	return static_cast<uint32_t>((size + sizeof(uint32_t) - 1u) / sizeof(uint32_t) * sizeof(uint32_t));
 }
 
-void BlendTree::ConnectToRoot(uint32_t inputNodeID)
+void BlendTreeTemplate::InitState(const BlendInstruction& instruction, uint8_t* block) const
 {
-	v_Tree[0u]->SetInput(0u, v_Tree[inputNodeID]);
+	// The key cursors after the node state start at the first key
+	uint8_t* state = block + instruction.state;
+	std::fill(state, state + instruction.stateSize, 0u);
+
+	const BlendNode* node = instruction.node;
+	switch (instruction.op)
+	{
+	case BlendOp_::BlendOp_Sample:			static_cast<const ClipNode*>(node)->InitState(*reinterpret_cast<ClipNode::State*>(state));					break;
+	case BlendOp_::BlendOp_Blend:
+	case BlendOp_::BlendOp_MaskedBlend:		static_cast<const LinearBlendNode*>(node)->InitState(*reinterpret_cast<LinearBlendNode::State*>(state));	break;
+	case BlendOp_::BlendOp_SyncBlend:		static_cast<const LinearBlendNodeSync*>(node)->InitState(*reinterpret_cast<LinearBlendNodeSync::State*>(state));	break;
+	case BlendOp_::BlendOp_Transition:		static_cast<const TransitionNode*>(node)->InitState(*reinterpret_cast<TransitionNode::State*>(state));		break;
+	case BlendOp_::BlendOp_Ragdoll:			static_cast<const RagdollNode*>(node)->InitState(*reinterpret_cast<RagdollNode::State*>(state));			break;
+	case BlendOp_::BlendOp_BlendSpace:		static_cast<const BlendSpaceNode*>(node)->InitState(*reinterpret_cast<BlendSpaceNode::State*>(state));		break;
+	case BlendOp_::BlendOp_Additive:		static_cast<const AdditiveNode*>(node)->InitState(*reinterpret_cast<AdditiveNode::State*>(state));			break;
+	case BlendOp_::BlendOp_StateMachine:	static_cast<const StateMachineNode*>(node)->InitState(*reinterpret_cast<StateMachineNode::State*>(state));	break;
+	case BlendOp_::BlendOp_Mirror:			static_cast<const MirrorNode*>(node)->InitState(*reinterpret_cast<MirrorNode::State*>(state));				break;
+	}
 }
 
-void BlendTree::Update(float frameTime, bool& needsPhysicsUpdate)
+uint32_t BlendTreeTemplate::CreateInstance()
 {
-	// Call the update on the root node to commence a post-order traversal
-	v_Tree[0]->Update(frameTime, needsPhysicsUpdate);
-}
\ No newline at end of file
+	// Reuse the block of a destroyed instance before growing the storage
+	uint32_t instance;
+	if (!v_FreeInstances.empty())
+	{
+		instance = v_FreeInstances.back();
+		v_FreeInstances.pop_back();
+	}
+	else
+	{
+		instance = static_cast<uint32_t>(v_InstanceUsed.size());
+		v_InstanceUsed.push_back(0u);
+		v_States.resize(v_States.size() + m_StateSize);
+	}
+
+	if (v_ParameterValues.size() < v_InstanceUsed.size() * v_Parameters.size())
+		v_ParameterValues.resize(v_InstanceUsed.size() * v_Parameters.size());
+
+	// Spawning is a copy of the default state, nothing is built
+	v_InstanceUsed[instance] = 1u;
+	std::copy(v_DefaultState.begin(), v_DefaultState.end(), GetInstanceState(instance));
+	float* values = GetInstanceParameters(instance);
+	for (size_t i = 0u; i < v_Parameters.size(); ++i) values[i] = v_Parameters[i].defaultValue;
+	return instance;
+}
+
+void BlendTreeTemplate::DestroyInstance(uint32_t instance)
+{
+	// The blocks of the other instances do not move
+	v_InstanceUsed[instance] = 0u;
+	v_FreeInstances.push_back(instance);
+}
+
+uint32_t BlendTreeTemplate::FindInstruction(const BlendNode* node) const
+{
+	const auto it = map_Instructions.find(node->GetHandle());
+	return it != map_Instructions.end() ? it->second : UINT32_MAX;
+}
+
+bool BlendTreeTemplate::AddParameter(const std::string& name, ParameterType_ type, float defaultValue)
+{
+	const ParameterKey key = HashParameter(name);
+	if (key == BLEND_PARAMETER_NONE || FindParameter(key) != UINT32_MAX) return false;
+
+	const std::vector<BlendParameter> previousParameters = v_Parameters;
+	v_Parameters.push_back({ key, type, type == ParameterType_::ParameterType_Float ? defaultValue : (defaultValue != 0.f ? 1.f : 0.f), name });
+	ResizeParameterValues(previousParameters);
+	return true;
+}
+
+void BlendTreeTemplate::RemoveParameter(ParameterKey key)
+{
+	const uint32_t index = FindParameter(key);
+	if (index == UINT32_MAX) return;
+
+	const std::vector<BlendParameter> previousParameters = v_Parameters;
+	v_Parameters.erase(v_Parameters.begin() + index);
+	ResizeParameterValues(previousParameters);
+}
+
+uint32_t BlendTreeTemplate::FindParameter(ParameterKey key) const
+{
+	const auto it = map_Parameters.find(key);
+	return it != map_Parameters.end() ? it->second : UINT32_MAX;
+}
+
+void BlendTreeTemplate::SetParameter(ParameterKey key, float value, const uint32_t* instances, size_t count)
+{
+	const uint32_t index = FindParameter(key);
+	if (index == UINT32_MAX) return;
+
+	const size_t stride = v_Parameters.size();
+	float* values = v_ParameterValues.data() + index;
+	for (size_t i = 0u; i < count; ++i) values[instances[i] * stride] = value;
+}
+
+void BlendTreeTemplate::SetParameter(ParameterKey key, const float* values, const uint32_t* instances, size_t count)
+{
+	const uint32_t index = FindParameter(key);
+	if (index == UINT32_MAX) return;
+
+	const size_t stride = v_Parameters.size();
+	float* instanceValues = v_ParameterValues.data() + index;
+	for (size_t i = 0u; i < count; ++i) instanceValues[instances[i] * stride] = values[i];
+}
+
+void BlendTreeTemplate::ResizeParameterValues(const std::vector<BlendParameter>& previousParameters)
+{
+	map_Parameters.clear();
+	for (uint32_t i = 0u; i < v_Parameters.size(); ++i) map_Parameters[v_Parameters[i].key] = i;
+
+	// Instances keep the value of the parameters that are still declared, the others start from their default
+	const size_t count = v_Parameters.size();
+	const size_t previousCount = previousParameters.size();
+	std::vector<float> values(v_InstanceUsed.size() * count);
+	for (size_t instance = 0u; instance < v_InstanceUsed.size(); ++instance)
+		for (size_t i = 0u; i < count; ++i)
+		{
+			const auto previous = std::find_if(previousParameters.begin(), previousParameters.end(), [&](const BlendParameter& parameter) { return parameter.key == v_Parameters[i].key; });
+			values[instance * count + i] = previous != previousParameters.end() ? v_ParameterValues[instance * previousCount + (previous - previousParameters.begin())] : v_Parameters[i].defaultValue;
+		}
+	v_ParameterValues.swap(values);
+
+	// The indices the nodes are bound to moved
+	++m_GraphVersion;
+}
+
+void BlendTreeTemplate::BindParameters()
+{
+	for (BlendInstruction& instruction : v_Program)
+	{
+		for (uint32_t slot = 0u; slot < instruction.parameters.size(); ++slot)
+		{
+			instruction.parameters[slot] = UINT32_MAX;
+			if (slot >= instruction.node->GetParameterSlotCount()) continue;
+
+			const uint32_t index = FindParameter(instruction.node->a_Parameters[slot]);
+			if (index != UINT32_MAX && v_Parameters[index].type == instruction.node->GetParameterSlotType(slot))
+				instruction.parameters[slot] = index;
+		}
+		if (instruction.op == BlendOp_::BlendOp_StateMachine) static_cast<StateMachineNode*>(instruction.node)->BindConditions(*this);
+	}
+}
+
+uint32_t BlendTreeTemplate::CompileNode(BlendNode* node, std::unordered_map<BlendNode*, uint32_t>& compiled)
+{
+	const auto it = compiled.find(node);
+	if (it != compiled.end()) return it->second;
+
+	// Compile the inputs first, a missing input stays UINT32_MAX
+	// An input that failed to compile fails the whole branch, like a failed update did
+	// Only the state machines read more than two inputs
+	std::array<uint32_t, 4> inputs = { UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT32_MAX };
+	const uint32_t inputCount = node->m_Type == NodeType_::NodeType_StateMachine ? STATEMACHINE_MAXSTATES : 2u;
+	for (uint32_t i = 0u; i < inputCount; ++i)
+		if (node->a_Inputs[i])
+		{
+			inputs[i] = CompileNode(node->a_Inputs[i], compiled);
+			if (inputs[i] == UINT32_MAX) return UINT32_MAX;
+		}
+
+	// Blends with a single input have a constant weight, they are folded into the instruction of that input
+	const bool twoInputs = inputs[0] != UINT32_MAX && inputs[1] != UINT32_MAX;
+	const uint32_t singleInput = inputs[0] != UINT32_MAX ? inputs[0] : inputs[1];
+
+	uint32_t instruction = UINT32_MAX;
+	switch (node->m_Type)
+	{
+	case NodeType_::NodeType_Clip:
+		instruction = Emit(BlendOp_::BlendOp_Sample, node);
+		break;
+	case NodeType_::NodeType_LinearBlend:
+		// Blending a pose with itself gives the same pose whatever the weight
+		if (twoInputs && inputs[0] != inputs[1])
+			instruction = Emit(BlendOp_::BlendOp_Blend, node, inputs[0], inputs[1]);
+		else instruction = singleInput;
+		break;
+	case NodeType_::NodeType_LinearBlendSync:
+		// A clip shared by several synced blends plays at the speed assigned by the last one in the program
+		if (twoInputs)	instruction = Emit(BlendOp_::BlendOp_SyncBlend, node, inputs[0], inputs[1]);
+		else			instruction = singleInput;
+		break;
+	case NodeType_::NodeType_Transition:
+		if (twoInputs)	instruction = Emit(BlendOp_::BlendOp_Transition, node, inputs[0], inputs[1]);
+		else			instruction = singleInput;
+		break;
+	case NodeType_::NodeType_Ragdoll:
+		if (static_cast<RagdollNode*>(node)->IsRagdollValid()) instruction = Emit(BlendOp_::BlendOp_Ragdoll, node, inputs[0]);
+		break;
+	case NodeType_::NodeType_BlendSpace1D:
+	case NodeType_::NodeType_BlendSpace2D:
+		instruction = Emit(BlendOp_::BlendOp_BlendSpace, node);
+		break;
+	case NodeType_::NodeType_Additive:
+		// Without an input the difference is added to the bind pose
+		instruction = Emit(BlendOp_::BlendOp_Additive, node, inputs[0]);
+		break;
+	case NodeType_::NodeType_MaskedBlend:
+		// Without a mask nothing is taken from the layer
+		if (twoInputs && inputs[0] != inputs[1] && static_cast<MaskedBlendNode*>(node)->GetMask())
+			instruction = Emit(BlendOp_::BlendOp_MaskedBlend, node, inputs[0], inputs[1]);
+		else instruction = inputs[0] != UINT32_MAX ? inputs[0] : inputs[1];
+		break;
+	case NodeType_::NodeType_StateMachine:
+	{
+		// A machine with a single state always shows it, the smallest input is that state or UINT32_MAX without any
+		const uint32_t stateCount = static_cast<uint32_t>(std::count_if(inputs.begin(), inputs.end(), [](uint32_t input) { return input != UINT32_MAX; }));
+		if (stateCount > 1u)	instruction = Emit(BlendOp_::BlendOp_StateMachine, node, inputs);
+		else					instruction = *std::min_element(inputs.begin(), inputs.end());
+		break;
+	}
+	case NodeType_::NodeType_Mirror:
+		// The bind pose mirrors to itself, only an input needs mirroring
+		if (inputs[0] != UINT32_MAX && static_cast<MirrorNode*>(node)->GetMirrorMap())
+			instruction = Emit(BlendOp_::BlendOp_Mirror, node, inputs[0]);
+		else instruction = inputs[0];
+		break;
+	default:
+		break;
+	}
+
+	compiled[node] = instruction;
+	return instruction;
+}
+
+uint32_t BlendTreeTemplate::Emit(BlendOp_ op, BlendNode* node, uint32_t input1, uint32_t input2)
+{
+	return Emit(op, node, { input1, input2, UINT32_MAX, UINT32_MAX });
+}
+
+uint32_t BlendTreeTemplate::Emit(BlendOp_ op, BlendNode* node, const std::array<uint32_t, 4>& inputs)
+{
+	// The state is laid out once the whole program is known
+	v_Program.push_back({ op, node, node->GetHandle(), inputs, UINT32_MAX, 0u, UINT32_MAX, { UINT32_MAX, UINT32_MAX } });
+	return static_cast<uint32_t>(v_Program.size() - 1u);
+}
+
+/// <summary>
+/// Blend tree instance
+/// </summary>
+/// <param name="blendTreeTemplate"></param>
+BlendTree::BlendTree(BlendTreeTemplate& blendTreeTemplate) : r_Template(blendTreeTemplate), m_Instance(blendTreeTemplate.CreateInstance()), m_ProgramVersion(0u),
+m_BindSoaPose(blendTreeTemplate.GetBindPose().local_pose()), m_EvaluatedCount(0u), m_OutputPose(blendTreeTemplate.GetBindPose()), m_OutputValid(false),
+m_NextVersion(1u), m_OutputVersion(0u), m_ReusedCount(0u), m_TasksLeft(0u), m_FrameTime(0.f), m_Parallel(false)
+{
+}
+
+BlendTree::~BlendTree()
+{
+	r_Template.DestroyInstance(m_Instance);
+}
+
+void BlendTree::Prepare()
+{
+	m_ProgramVersion = r_Template.m_ProgramVersion;
+	m_OutputValid = false;
+
+	const size_t instructionCount = r_Template.v_Program.size();
+	v_Demands.assign(instructionCount, Demand_::Demand_None);
+	v_InputMasks.assign(instructionCount, 0u);
+	v_Consumers.assign(instructionCount, 0u);
+	v_ResultBuffers.assign(instructionCount, UINT32_MAX);
+	v_Results.assign(instructionCount, nullptr);
+	// The frozen snapshots and the inertialization history start over
+	v_TransitionPoses.assign(r_Template.m_TransitionCount, TransitionNode::Poses());
+	v_HistoryBuffers.assign(r_Template.m_TransitionCount, { UINT32_MAX, UINT32_MAX });
+
+	v_PosePool.assign(r_Template.m_PoseBufferCount, m_BindSoaPose);
+	v_BufferReferences.assign(r_Template.m_PoseBufferCount, 0u);
+	v_FreeBuffers.clear();
+	v_FreeBuffers.reserve(r_Template.m_PoseBufferCount);
+
+	// Nothing is kept from the previous program
+	v_Versions.assign(instructionCount, 0u);
+	v_CachedBuffers.assign(instructionCount, UINT32_MAX);
+	v_CacheKeys.assign(instructionCount, CacheKey());
+	m_NextVersion = 1u;
+
+	v_TaskCounters = std::vector<std::atomic<uint32_t>>(r_Template.v_Tasks.size());
+}
+
+uint8_t* BlendTree::GetStateOf(const BlendNode* node, uint32_t& instruction)
+{
+	instruction = r_Template.FindInstruction(node);
+	return instruction != UINT32_MAX ? r_Template.GetInstanceState(m_Instance) : nullptr;
+}
+
+LinearBlendNodeSync::ClipStates BlendTree::GetClipStates(uint8_t* block, uint32_t instruction) const
+{
+	LinearBlendNodeSync::ClipStates clips = { nullptr, nullptr };
+	const std::array<uint32_t, 4>& inputs = r_Template.v_Program[instruction].inputs;
+	for (uint32_t slot = 0u; slot < clips.size(); ++slot)
+		if (inputs[slot] != UINT32_MAX && r_Template.v_Program[inputs[slot]].op == BlendOp_::BlendOp_Sample)
+			clips[slot] = &GetState<ClipNode::State>(block, inputs[slot]);
+	return clips;
+}
+
+float* BlendTree::GetBlendValuePtr(LinearBlendNode* node)
+{
+	uint32_t instruction;
+	if (uint8_t* block = GetStateOf(node, instruction))
+	{
+		// A bound blend value is overwritten by its parameter at every update
+		if (float* value = GetBoundValue(instruction, 0u)) return value;
+		switch (r_Template.v_Program[instruction].op)
+		{
+		case BlendOp_::BlendOp_Blend:
+		case BlendOp_::BlendOp_SyncBlend:
+		case BlendOp_::BlendOp_MaskedBlend:	return &GetState<LinearBlendNode::State>(block, instruction).blendValue;
+		case BlendOp_::BlendOp_Additive:	return &GetState<AdditiveNode::State>(block, instruction).blendValue;
+		default:							break;
+		}
+	}
+	return node->GetBlendValuePtr();
+}
+
+float* BlendTree::GetParameterPtr(BlendSpaceNode* node)
+{
+	uint32_t instruction;
+	uint8_t* block = GetStateOf(node, instruction);
+	return block ? GetState<BlendSpaceNode::State>(block, instruction).parameter.data() : node->GetParameterPtr();
+}
+
+void BlendTree::StartTransition(TransitionNode* node)
+{
+	uint32_t instruction;
+	if (uint8_t* block = GetStateOf(node, instruction))
+		node->StartTransition(GetState<TransitionNode::State>(block, instruction), GetClipStates(block, instruction));
+}
+
+void BlendTree::ResetTransition(TransitionNode* node)
+{
+	uint32_t instruction;
+	if (uint8_t* block = GetStateOf(node, instruction))
+		node->Reset(GetState<TransitionNode::State>(block, instruction), GetClipStates(block, instruction));
+}
+
+float BlendTree::GetSampleWeight(BlendSpaceNode* node, uint32_t sample)
+{
+	uint32_t instruction;
+	uint8_t* block = GetStateOf(node, instruction);
+	return block ? BlendSpaceNode::GetSampleWeight(GetState<BlendSpaceNode::State>(block, instruction), sample) : 0.f;
+}
+
+uint32_t BlendTree::GetActiveState(StateMachineNode* node, uint32_t& outgoing)
+{
+	outgoing = UINT32_MAX;
+	uint32_t instruction;
+	uint8_t* block = GetStateOf(node, instruction);
+	if (!block) return node->GetEntryState();
+
+	const StateMachineNode::State& state = GetState<StateMachineNode::State>(block, instruction);
+	outgoing = state.source;
+	return state.current;
+}
+
+bool BlendTree::IsRagdollActive(RagdollNode* node)
+{
+	uint32_t instruction;
+	uint8_t* block = GetStateOf(node, instruction);
+	if (block && GetBoundValue(instruction, 0u)) return *GetBoundValue(instruction, 0u) != 0.f;
+	return block ? GetState<RagdollNode::State>(block, instruction).active : node->IsActive();
+}
+
+void BlendTree::SetRagdollActive(RagdollNode* node, bool active)
+{
+	uint32_t instruction;
+	uint8_t* block = GetStateOf(node, instruction);
+	if (block && GetBoundValue(instruction, 0u))	*GetBoundValue(instruction, 0u) = active ? 1.f : 0.f;
+	else if (block)									GetState<RagdollNode::State>(block, instruction).active = active;
+	else											node->SetActive(active);
+}
+
+bool BlendTree::IsMirrored(MirrorNode* node)
+{
+	uint32_t instruction;
+	uint8_t* block = GetStateOf(node, instruction);
+	if (block && GetBoundValue(instruction, 0u)) return *GetBoundValue(instruction, 0u) != 0.f;
+	return block ? GetState<MirrorNode::State>(block, instruction).mirrored : node->IsMirrored();
+}
+
+void BlendTree::SetMirrored(MirrorNode* node, bool mirrored)
+{
+	uint32_t instruction;
+	uint8_t* block = GetStateOf(node, instruction);
+	if (block && GetBoundValue(instruction, 0u))	*GetBoundValue(instruction, 0u) = mirrored ? 1.f : 0.f;
+	else if (block)									GetState<MirrorNode::State>(block, instruction).mirrored = mirrored;
+	else											node->SetMirrored(mirrored);
+}
+
+void BlendTree::SetFloat(ParameterKey key, float value)
+{
+	const uint32_t index = r_Template.FindParameter(key);
+	if (index != UINT32_MAX) r_Template.GetInstanceParameters(m_Instance)[index] = value;
+}
+
+float BlendTree::GetFloat(ParameterKey key) const
+{
+	const uint32_t index = r_Template.FindParameter(key);
+	return index != UINT32_MAX ? r_Template.GetInstanceParameters(m_Instance)[index] : 0.f;
+}
+
+float* BlendTree::GetBoundValue(uint32_t instruction, uint32_t slot) const
+{
+	const uint32_t index = r_Template.v_Program[instruction].parameters[slot];
+	return index != UINT32_MAX ? r_Template.GetInstanceParameters(m_Instance) + index : nullptr;
+}
+
+void BlendTree::ApplyParameters(uint8_t* block, uint32_t i)
+{
+	const BlendInstruction& instruction = r_Template.v_Program[i];
+	const std::array<uint32_t, 2>& parameters = instruction.parameters;
+	if (parameters[0] == UINT32_MAX && parameters[1] == UINT32_MAX) return;
+
+	const float* values = r_Template.GetInstanceParameters(m_Instance);
+	switch (instruction.op)
+	{
+	case BlendOp_::BlendOp_Blend:
+	case BlendOp_::BlendOp_SyncBlend:
+	case BlendOp_::BlendOp_MaskedBlend:
+		GetState<LinearBlendNode::State>(block, i).blendValue = values[parameters[0]];
+		break;
+	case BlendOp_::BlendOp_Additive:
+		GetState<AdditiveNode::State>(block, i).blendValue = values[parameters[0]];
+		break;
+	case BlendOp_::BlendOp_BlendSpace:
+		for (uint32_t slot = 0u; slot < parameters.size(); ++slot)
+			if (parameters[slot] != UINT32_MAX) GetState<BlendSpaceNode::State>(block, i).parameter[slot] = values[parameters[slot]];
+		break;
+	case BlendOp_::BlendOp_Ragdoll:
+		GetState<RagdollNode::State>(block, i).active = values[parameters[0]] != 0.f;
+		break;
+	case BlendOp_::BlendOp_Mirror:
+		GetState<MirrorNode::State>(block, i).mirrored = values[parameters[0]] != 0.f;
+		break;
+	case BlendOp_::BlendOp_Transition:
+		if (values[parameters[0]] != 0.f)
+			static_cast<TransitionNode*>(instruction.node)->StartTransition(GetState<TransitionNode::State>(block, i), GetClipStates(block, i));
+		break;
+	default:
+		break;
+	}
+}
+
+void BlendTree::RestartBranch(uint8_t* block, uint32_t instruction)
+{
+	// The bound parameters still drive the restarted nodes
+	const BlendInstruction& restarted = r_Template.v_Program[instruction];
+	r_Template.InitState(restarted, block);
+	ApplyParameters(block, instruction);
+	for (uint32_t input : restarted.inputs)
+		if (input != UINT32_MAX) RestartBranch(block, input);
+}
+
+uint32_t BlendTree::AcquireBuffer(uint32_t instruction)
+{
+	const std::unique_lock<std::mutex> lock = LockPool();
+
+	// The pose kept by the instruction is written over, none of its readers ran yet
+	// Unless a transition still holds it as one of its last outputs, the instruction then leaves it and takes another buffer
+	uint32_t buffer = v_CachedBuffers[instruction];
+	if (buffer != UINT32_MAX)
+	{
+		v_CachedBuffers[instruction] = UINT32_MAX;
+		if (v_BufferReferences[buffer] == 1u) return buffer;
+		--v_BufferReferences[buffer];
+	}
+
+	if (v_FreeBuffers.empty())
+	{
+		// The jobs index the pool without the lock, it is sized before they start and must not grow while they run
+		assert(!m_Parallel);
+		v_PosePool.push_back(m_BindSoaPose);
+		v_BufferReferences.push_back(0u);
+		return static_cast<uint32_t>(v_PosePool.size() - 1u);
+	}
+	buffer = v_FreeBuffers.back();
+	v_FreeBuffers.pop_back();
+	return buffer;
+}
+
+void BlendTree::ReleaseResult(uint32_t instruction)
+{
+	const std::unique_lock<std::mutex> lock = LockPool();
+	const uint32_t buffer = v_ResultBuffers[instruction];
+	if (buffer != UINT32_MAX && --v_BufferReferences[buffer] == 0u)
+		v_FreeBuffers.push_back(buffer);
+}
+
+uint32_t BlendTree::AcquireScratch()
+{
+	const std::unique_lock<std::mutex> lock = LockPool();
+	if (v_FreeBuffers.empty())
+	{
+		// The jobs index the pool without the lock, it is sized before they start and must not grow while they run
+		assert(!m_Parallel);
+		v_PosePool.push_back(m_BindSoaPose);
+		v_BufferReferences.push_back(0u);
+		return static_cast<uint32_t>(v_PosePool.size() - 1u);
+	}
+	const uint32_t buffer = v_FreeBuffers.back();
+	v_FreeBuffers.pop_back();
+	return buffer;
+}
+
+void BlendTree::ReleaseScratch(uint32_t buffer)
+{
+	const std::unique_lock<std::mutex> lock = LockPool();
+	v_FreeBuffers.push_back(buffer);
+}
+
+void BlendTree::SetResult(uint32_t instruction, uint32_t buffer, const CacheKey* key)
+{
+	// The kept pose holds a reference of its own, until the instruction writes over it or forwards another pose
+	const bool keep = key && r_Template.m_LazyEvaluation;
+	const std::unique_lock<std::mutex> lock = LockPool();
+	v_ResultBuffers[instruction] = buffer;
+	v_Results[instruction] = &v_PosePool[buffer];
+	v_BufferReferences[buffer] = v_Consumers[instruction] + (keep ? 1u : 0u);
+	v_Versions[instruction] = m_NextVersion++;
+	if (keep)
+	{
+		v_CachedBuffers[instruction] = buffer;
+		v_CacheKeys[instruction] = *key;
+	}
+}
+
+void BlendTree::ForwardResult(uint32_t instruction, const SoaPose* pose)
+{
+	DropCachedResult(instruction);
+	const std::unique_lock<std::mutex> lock = LockPool();
+
+	// Forwarding an input shares its buffer and its version, the readers of this instruction keep it alive
+	// A pose from outside the pool, the bind pose, keeps its version
+	v_ResultBuffers[instruction] = UINT32_MAX;
+	v_Results[instruction] = pose;
+	v_Versions[instruction] = pose == &m_BindSoaPose ? 0u : m_NextVersion++;
+	const std::array<uint32_t, 4>& inputs = r_Template.v_Program[instruction].inputs;
+	for (uint32_t slot = 0u; slot < inputs.size(); ++slot)
+	{
+		const uint32_t input = inputs[slot];
+		if (input != UINT32_MAX && (v_InputMasks[instruction] & (1u << slot)) && v_Results[input] == pose)
+		{
+			v_Versions[instruction] = v_Versions[input];
+			if (v_ResultBuffers[input] != UINT32_MAX)
+			{
+				v_ResultBuffers[instruction] = v_ResultBuffers[input];
+				v_BufferReferences[v_ResultBuffers[input]] += v_Consumers[instruction];
+			}
+			break;
+		}
+	}
+}
+
+BlendTree::CacheKey BlendTree::MakeKey(uint32_t instruction, float value1, float value2, float value3, uint32_t extra) const
+{
+	const BlendInstruction& compiled = r_Template.v_Program[instruction];
+	CacheKey key = { {}, { value1, value2, value3 }, extra, compiled.node->GetVersion() };
+	for (uint32_t slot = 0u; slot < key.inputs.size(); ++slot)
+		key.inputs[slot] = compiled.inputs[slot] != UINT32_MAX && (v_InputMasks[instruction] & (1u << slot)) ? v_Versions[compiled.inputs[slot]] : UINT32_MAX;
+	return key;
+}
+
+bool BlendTree::ReuseResult(uint32_t instruction, const CacheKey& key)
+{
+	const std::unique_lock<std::mutex> lock = LockPool();
+	const uint32_t buffer = v_CachedBuffers[instruction];
+	if (buffer == UINT32_MAX || !r_Template.m_LazyEvaluation || !(v_CacheKeys[instruction] == key)) return false;
+
+	// The version is the one the pose was computed with
+	v_ResultBuffers[instruction] = buffer;
+	v_Results[instruction] = &v_PosePool[buffer];
+	v_BufferReferences[buffer] += v_Consumers[instruction];
+	++m_ReusedCount;
+	return true;
+}
+
+void BlendTree::DropCachedResult(uint32_t instruction)
+{
+	const std::unique_lock<std::mutex> lock = LockPool();
+	const uint32_t buffer = v_CachedBuffers[instruction];
+	if (buffer == UINT32_MAX) return;
+	v_CachedBuffers[instruction] = UINT32_MAX;
+	if (--v_BufferReferences[buffer] == 0u) v_FreeBuffers.push_back(buffer);
+}
+
+void BlendTree::KeepHistory(uint32_t instruction)
+{
+	// The result stays in its buffer for two more updates, the bind pose lives outside the pool
+	const std::unique_lock<std::mutex> lock = LockPool();
+	const uint32_t poses = r_Template.v_Program[instruction].poses;
+	std::array<uint32_t, 2>& history = v_HistoryBuffers[poses];
+	if (history[1] != UINT32_MAX && --v_BufferReferences[history[1]] == 0u) v_FreeBuffers.push_back(history[1]);
+	history[1] = history[0];
+	history[0] = v_ResultBuffers[instruction];
+	if (history[0] != UINT32_MAX) ++v_BufferReferences[history[0]];
+	v_TransitionPoses[poses].secondLast = v_TransitionPoses[poses].last;
+	v_TransitionPoses[poses].last = v_Results[instruction];
+}
+
+void BlendTree::ReleaseHistory(uint32_t poses)
+{
+	const std::unique_lock<std::mutex> lock = LockPool();
+	for (uint32_t& buffer : v_HistoryBuffers[poses])
+	{
+		if (buffer != UINT32_MAX && --v_BufferReferences[buffer] == 0u) v_FreeBuffers.push_back(buffer);
+		buffer = UINT32_MAX;
+	}
+	v_TransitionPoses[poses].last = nullptr;
+	v_TransitionPoses[poses].secondLast = nullptr;
+}
+
+
+bool BlendTree::Execute(uint8_t* block, uint32_t i, float frameTime)
+{
+	const BlendInstruction& instruction = r_Template.v_Program[i];
+	if (v_Demands[i] == Demand_::Demand_None) return false;
+	if (v_Demands[i] == Demand_::Demand_Advance)
+	{
+		// Keep the clips moving without producing a pose
+		if (instruction.op == BlendOp_::BlendOp_Sample)				static_cast<ClipNode*>(instruction.node)->Advance(GetState<ClipNode::State>(block, i), frameTime);
+		else if (instruction.op == BlendOp_::BlendOp_BlendSpace)	static_cast<BlendSpaceNode*>(instruction.node)->Advance(GetState<BlendSpaceNode::State>(block, i), frameTime);
+		else if (instruction.op == BlendOp_::BlendOp_Additive)		static_cast<AdditiveNode*>(instruction.node)->Advance(GetState<AdditiveNode::State>(block, i), frameTime);
+		return true;
+	}
+
+	const SoaPose* input1 = instruction.inputs[0] != UINT32_MAX ? v_Results[instruction.inputs[0]] : nullptr;
+	const SoaPose* input2 = instruction.inputs[1] != UINT32_MAX ? v_Results[instruction.inputs[1]] : nullptr;
+
+	switch (instruction.op)
+	{
+	case BlendOp_::BlendOp_Sample:
+	{
+		ClipNode* clipNode = static_cast<ClipNode*>(instruction.node);
+		ClipNode::State& state = GetState<ClipNode::State>(block, i);
+		clipNode->Advance(state, frameTime);
+		if (clipNode->HasClip())
+		{
+			// A paused clip, or one held at its end, samples the same pose again
+			const CacheKey key = MakeKey(i, state.animationTime, 0.f, 0.f, static_cast<uint32_t>(clipNode->GetClip()->representation));
+			if (ReuseResult(i, key)) break;
+			const uint32_t buffer = AcquireBuffer(i);
+			clipNode->SamplePose(state, GetCursors<ClipNode::State>(block, i), v_PosePool[buffer], r_Template.v_Masks[i]);
+			SetResult(i, buffer, &key);
+		}
+		else ForwardResult(i, &m_BindSoaPose);
+		break;
+	}
+	case BlendOp_::BlendOp_SyncBlend:
+	case BlendOp_::BlendOp_Blend:
+	{
+		// A pruned blend forwards the only input that was sampled
+		if (v_InputMasks[i] != 0b11u)
+		{
+			ForwardResult(i, v_InputMasks[i] & 0b01u ? input1 : input2);
+			break;
+		}
+		const float weight = GetState<LinearBlendNode::State>(block, i).blendValue;
+		const CacheKey key = MakeKey(i, weight);
+		if (ReuseResult(i, key)) break;
+		const uint32_t buffer = AcquireBuffer(i);
+		BlendPoses(*input1, *input2, weight, v_PosePool[buffer]);
+		SetResult(i, buffer, &key);
+		break;
+	}
+	case BlendOp_::BlendOp_Transition:
+	{
+		TransitionNode::State& state = GetState<TransitionNode::State>(block, i);
+		const SoaPose* blendFrom = nullptr;
+		TransitionNode* transitionNode = static_cast<TransitionNode*>(instruction.node);
+		TransitionNode::Poses& poses = v_TransitionPoses[instruction.poses];
+		const SoaPose* forward = transitionNode->Evaluate(state, poses, GetClipStates(block, i), input1, input2, blendFrom);
+		if (forward) ForwardResult(i, forward);
+		else if (!blendFrom)
+		{
+			// The offset decays every frame, the pose is never kept
+			const uint32_t buffer = AcquireBuffer(i);
+			TransitionNode::ApplyOffset(poses.curves, state.currentTime, state.target ? *input2 : *input1, v_PosePool[buffer]);
+			SetResult(i, buffer);
+		}
+		else
+		{
+			// A frozen snapshot has no version, only the blends of two evaluated inputs are kept
+			const CacheKey key = MakeKey(i, state.blendValue);
+			const bool keep = blendFrom == input1;
+			if (keep && ReuseResult(i, key)) break;
+			const uint32_t buffer = AcquireBuffer(i);
+			BlendPoses(*blendFrom, *input2, state.blendValue, v_PosePool[buffer]);
+			SetResult(i, buffer, keep ? &key : nullptr);
+		}
+		if (transitionNode->KeepsHistory()) KeepHistory(i);
+		else ReleaseHistory(instruction.poses);
+		break;
+	}
+	case BlendOp_::BlendOp_Ragdoll:
+	{
+		const RagdollNode* ragdollNode = static_cast<RagdollNode*>(instruction.node);
+		if (ragdollNode->Drive(GetState<RagdollNode::State>(block, i), input1))
+		{
+			ForwardResult(i, input1);
+			break;
+		}
+		// The simulated pose changes every frame, it is never kept
+		const uint32_t buffer = AcquireBuffer(i);
+		ragdollNode->ReadPose(v_PosePool[buffer]);
+		SetResult(i, buffer);
+		break;
+	}
+	case BlendOp_::BlendOp_BlendSpace:
+	{
+		BlendSpaceNode* blendSpace = static_cast<BlendSpaceNode*>(instruction.node);
+		BlendSpaceNode::State& state = GetState<BlendSpaceNode::State>(block, i);
+		blendSpace->Advance(state, frameTime);
+		if (blendSpace->HasSamples())
+		{
+			const CacheKey key = MakeKey(i, state.parameter[0], state.parameter[1], state.phase.fraction, static_cast<uint32_t>(state.phase.step));
+			if (ReuseResult(i, key)) break;
+			const uint32_t buffer = AcquireBuffer(i);
+			std::array<uint32_t, BLENDSPACE_MAX_WEIGHTS - 1u> scratch;
+			std::array<SoaPose*, BLENDSPACE_MAX_WEIGHTS - 1u> scratchPoses;
+			for (size_t s = 0u; s < scratch.size(); ++s)
+			{
+				scratch[s] = AcquireScratch();
+				scratchPoses[s] = &v_PosePool[scratch[s]];
+			}
+			blendSpace->SamplePose(state, GetCursors<BlendSpaceNode::State>(block, i), scratchPoses.data(), v_PosePool[buffer]);
+			for (uint32_t s : scratch) ReleaseScratch(s);
+			SetResult(i, buffer, &key);
+		}
+		else ForwardResult(i, &m_BindSoaPose);
+		break;
+	}
+	case BlendOp_::BlendOp_Additive:
+	{
+		AdditiveNode* additiveNode = static_cast<AdditiveNode*>(instruction.node);
+		AdditiveNode::State& state = GetState<AdditiveNode::State>(block, i);
+		additiveNode->Advance(state, frameTime);
+		const SoaPose* base = input1 ? input1 : &m_BindSoaPose;
+		if (additiveNode->IsApplied(state))
+		{
+			const CacheKey key = MakeKey(i, state.blendValue, state.animationTime);
+			if (ReuseResult(i, key)) break;
+			const uint32_t buffer = AcquireBuffer(i);
+			additiveNode->Apply(state, *base, v_PosePool[buffer]);
+			SetResult(i, buffer, &key);
+		}
+		else ForwardResult(i, base);
+		break;
+	}
+	case BlendOp_::BlendOp_MaskedBlend:
+	{
+		// A layer with no weight was not sampled
+		if (v_InputMasks[i] != 0b11u)
+		{
+			ForwardResult(i, input1);
+			break;
+		}
+		const LinearBlendNode::State& state = GetState<LinearBlendNode::State>(block, i);
+		const CacheKey key = MakeKey(i, state.blendValue);
+		if (ReuseResult(i, key)) break;
+		const uint32_t buffer = AcquireBuffer(i);
+		static_cast<MaskedBlendNode*>(instruction.node)->Blend(state, *input1, *input2, v_PosePool[buffer]);
+		SetResult(i, buffer, &key);
+		break;
+	}
+	case BlendOp_::BlendOp_StateMachine:
+	{
+		StateMachineNode* stateMachine = static_cast<StateMachineNode*>(instruction.node);
+		StateMachineNode::State& state = GetState<StateMachineNode::State>(block, i);
+		TransitionNode::Poses& poses = v_TransitionPoses[instruction.poses];
+		std::array<const SoaPose*, STATEMACHINE_MAXSTATES> states = {};
+		for (uint32_t slot = 0u; slot < states.size(); ++slot)
+			if (v_InputMasks[i] & (1u << slot)) states[slot] = v_Results[instruction.inputs[slot]];
+
+		const SoaPose* blendFrom = nullptr;
+		const SoaPose* blendTo = nullptr;
+		const SoaPose* forward = stateMachine->Evaluate(state, poses, states, blendFrom, blendTo);
+		if (forward) ForwardResult(i, forward);
+		else if (!blendFrom)
+		{
+			// The offset decays every frame, the pose is never kept
+			const uint32_t buffer = AcquireBuffer(i);
+			TransitionNode::ApplyOffset(poses.curves, state.transitionTime, *blendTo, v_PosePool[buffer]);
+			SetResult(i, buffer);
+		}
+		else
+		{
+			// Like a transition, a blend from the last output has no version. The states read do not say which one is blended from
+			const CacheKey key = MakeKey(i, state.blendValue, 0.f, 0.f, state.current);
+			const bool keep = state.source != UINT32_MAX;
+			if (!keep || !ReuseResult(i, key))
+			{
+				const uint32_t buffer = AcquireBuffer(i);
+				BlendPoses(*blendFrom, *blendTo, state.blendValue, v_PosePool[buffer]);
+				SetResult(i, buffer, keep ? &key : nullptr);
+			}
+		}
+		stateMachine->RecordOutput(state);
+		if (stateMachine->KeepsHistory()) KeepHistory(i);
+		else ReleaseHistory(instruction.poses);
+		break;
+	}
+	case BlendOp_::BlendOp_Mirror:
+	{
+		const MirrorNode::State& state = GetState<MirrorNode::State>(block, i);
+		if (!state.mirrored)
+		{
+			ForwardResult(i, input1);
+			break;
+		}
+		const CacheKey key = MakeKey(i, 1.f);
+		if (ReuseResult(i, key)) break;
+		const uint32_t buffer = AcquireBuffer(i);
+		static_cast<MirrorNode*>(instruction.node)->Mirror(*input1, v_PosePool[buffer]);
+		SetResult(i, buffer, &key);
+		break;
+	}
+	}
+
+	// This instruction no longer needs its inputs
+	for (uint32_t slot = 0u; slot < instruction.inputs.size(); ++slot)
+		if (instruction.inputs[slot] != UINT32_MAX && (v_InputMasks[i] & (1u << slot)))
+			ReleaseResult(instruction.inputs[slot]);
+	return true;
+}
+
+void BlendTree::RunTasks(float frameTime)
+{
+	// The branches reading nothing start, the others are started by the last branch they wait for
+	const std::vector<BlendTreeTemplate::BlendTask>& tasks = r_Template.v_Tasks;
+	for (uint32_t task = 0u; task < tasks.size(); ++task) v_TaskCounters[task].store(tasks[task].dependencies);
+	m_TasksLeft.store(static_cast<uint32_t>(tasks.size()));
+	m_FrameTime = frameTime;
+	m_Parallel = true;
+
+	JobSystem& jobSystem = JobSystem::Get();
+	for (uint32_t task = 0u; task < tasks.size(); ++task)
+		if (!tasks[task].dependencies) jobSystem.Submit({ &BlendTree::RunTaskJob, this, task });
+	jobSystem.Wait(m_TasksLeft);
+	m_Parallel = false;
+}
+
+void BlendTree::RunTask(uint32_t task)
+{
+	const BlendTreeTemplate::BlendTask& blendTask = r_Template.v_Tasks[task];
+	uint8_t* block = r_Template.GetInstanceState(m_Instance);
+	uint32_t evaluated = 0u;
+	for (uint32_t k = 0u; k < blendTask.instructionCount; ++k)
+		if (Execute(block, r_Template.v_TaskInstructions[blendTask.firstInstruction + k], m_FrameTime)) ++evaluated;
+	{
+		const std::unique_lock<std::mutex> lock = LockPool();
+		m_EvaluatedCount += evaluated;
+	}
+
+	JobSystem& jobSystem = JobSystem::Get();
+	for (uint32_t k = 0u; k < blendTask.dependentCount; ++k)
+	{
+		const uint32_t dependent = r_Template.v_TaskDependents[blendTask.firstDependent + k];
+		if (v_TaskCounters[dependent].fetch_sub(1u) == 1u) jobSystem.Submit({ &BlendTree::RunTaskJob, this, dependent });
+	}
+	// Last, the update returns once every branch is done
+	m_TasksLeft.fetch_sub(1u);
+}
+
+void BlendTree::Update(float frameTime, bool& needsPhysicsUpdate)
+{
+	r_Template.Compile();
+	if (m_ProgramVersion != r_Template.m_ProgramVersion) Prepare();
+	if (!r_Template.m_ProgramValid) return;
+
+	const std::vector<BlendInstruction>& program = r_Template.v_Program;
+	uint8_t* block = r_Template.GetInstanceState(m_Instance);
+	float* values = r_Template.GetInstanceParameters(m_Instance);
+	for (uint32_t i = 0u; i < program.size(); ++i) ApplyParameters(block, i);
+
+	// Work out what each instruction has to do this frame, from the output down
+	// The program is in post-order so consumers always come after the instructions they read
+	std::fill(v_Demands.begin(), v_Demands.end(), Demand_::Demand_None);
+	std::fill(v_Consumers.begin(), v_Consumers.end(), 0u);
+	v_Demands.back() = Demand_::Demand_Pose;
+	v_Consumers.back() = 1u;		// The result of the tree is read after the update
+	for (uint32_t i = static_cast<uint32_t>(program.size()); i-- > 0u;)
+	{
+		const Demand_ demand = v_Demands[i];
+		if (demand == Demand_::Demand_None) continue;
+		const BlendInstruction& instruction = program[i];
+
+		// By default the inputs are needed as much as this instruction is
+		std::array<Demand_, 4> inputDemands = { demand, demand, demand, demand };
+		switch (instruction.op)
+		{
+		case BlendOp_::BlendOp_SyncBlend:
+		{
+			// The clips are placed at the shared phase before they run
+			LinearBlendNodeSync::State& state = GetState<LinearBlendNodeSync::State>(block, i);
+			static_cast<LinearBlendNodeSync*>(instruction.node)->Synchronise(state.phase, state.blendValue, GetClipStates(block, i), frameTime);
+		}
+		case BlendOp_::BlendOp_Blend:
+		{
+			// An input with no weight is not sampled, but its clips keep advancing so they stay in sync
+			const float weight = GetState<LinearBlendNode::State>(block, i).blendValue;
+			if (demand == Demand_::Demand_Pose)
+			{
+				if (weight <= BLENDTREE_WEIGHT_EPSILON)				inputDemands[1] = Demand_::Demand_Advance;
+				else if (weight >= 1.f - BLENDTREE_WEIGHT_EPSILON)	inputDemands[0] = Demand_::Demand_Advance;
+			}
+			break;
+		}
+		case BlendOp_::BlendOp_MaskedBlend:
+			// The base is always read outside of the mask
+			if (demand == Demand_::Demand_Pose && GetState<LinearBlendNode::State>(block, i).blendValue <= BLENDTREE_WEIGHT_EPSILON) inputDemands[1] = Demand_::Demand_Advance;
+			break;
+		case BlendOp_::BlendOp_Transition:
+		{
+			const uint32_t inputMask = static_cast<TransitionNode*>(instruction.node)->Advance(GetState<TransitionNode::State>(block, i),
+				v_TransitionPoses[instruction.poses], GetClipStates(block, i), frameTime);
+			for (uint32_t slot = 0u; slot < inputDemands.size(); ++slot)
+				if (!(inputMask & (1u << slot))) inputDemands[slot] = Demand_::Demand_None;
+			break;
+		}
+		case BlendOp_::BlendOp_StateMachine:
+		{
+			// The states that are not evaluated are suspended, one entered while suspended starts over
+			StateMachineNode::State& state = GetState<StateMachineNode::State>(block, i);
+			const uint32_t inputMask = static_cast<StateMachineNode*>(instruction.node)->Advance(state, v_TransitionPoses[instruction.poses], values, v_Events, frameTime);
+			if (state.restart) RestartBranch(block, instruction.inputs[state.current]);
+			for (uint32_t slot = 0u; slot < inputDemands.size(); ++slot)
+				if (!(inputMask & (1u << slot))) inputDemands[slot] = Demand_::Demand_None;
+			break;
+		}
+		case BlendOp_::BlendOp_Ragdoll:
+			// Ragdoll nodes will need a physics iteration
+			if (demand == Demand_::Demand_Pose) needsPhysicsUpdate |= GetState<RagdollNode::State>(block, i).active;
+			break;
+		default:
+			break;
+		}
+
+		v_InputMasks[i] = 0u;
+		for (uint32_t slot = 0u; slot < instruction.inputs.size(); ++slot)
+		{
+			const uint32_t input = instruction.inputs[slot];
+			if (input == UINT32_MAX) continue;
+
+			v_Demands[input] = std::max(v_Demands[input], inputDemands[slot]);
+			if (inputDemands[slot] == Demand_::Demand_Pose)
+			{
+				v_InputMasks[i] |= 1u << slot;
+				++v_Consumers[input];
+			}
+		}
+	}
+
+	// Triggers and events only last for the update that follows them, whether a node read them or not
+	const std::vector<BlendParameter>& declarations = r_Template.v_Parameters;
+	for (size_t i = 0u; i < declarations.size(); ++i)
+		if (declarations[i].type == ParameterType_::ParameterType_Trigger) values[i] = 0.f;
+	v_Events.clear();
+
+	// Branches running in parallel can hold every result and every scratch buffer at once, the pool does not grow while they run
+	const uint32_t parallelBufferCount = r_Template.m_ParallelBufferCount;
+	if (r_Template.IsEvaluatedInParallel() && v_PosePool.size() < parallelBufferCount)
+	{
+		v_PosePool.resize(parallelBufferCount, m_BindSoaPose);
+		v_BufferReferences.resize(parallelBufferCount, 0u);
+	}
+
+	// Run the instructions in order, every buffer is free at the start of the frame but those of the kept poses
+	if (!r_Template.m_LazyEvaluation) std::fill(v_CachedBuffers.begin(), v_CachedBuffers.end(), UINT32_MAX);
+	std::fill(v_BufferReferences.begin(), v_BufferReferences.end(), 0u);
+	for (uint32_t buffer : v_CachedBuffers)
+		if (buffer != UINT32_MAX) v_BufferReferences[buffer] = 1u;
+	for (const std::array<uint32_t, 2>& history : v_HistoryBuffers)
+		for (uint32_t buffer : history)
+			if (buffer != UINT32_MAX) ++v_BufferReferences[buffer];
+	v_FreeBuffers.clear();
+	for (uint32_t buffer = static_cast<uint32_t>(v_PosePool.size()); buffer-- > 0u;)
+		if (!v_BufferReferences[buffer]) v_FreeBuffers.push_back(buffer);
+	m_EvaluatedCount = 0u;
+	m_ReusedCount = 0u;
+	if (r_Template.IsEvaluatedInParallel()) RunTasks(frameTime);
+	else
+	{
+		for (uint32_t i = 0u; i < program.size(); ++i)
+			if (Execute(block, i, frameTime)) ++m_EvaluatedCount;
+	}
+
+	// The only conversion of the frame, and the only global pose calculation, skipped when the output pose did not change
+	if (m_OutputValid && v_Versions.back() == m_OutputVersion) return;
+	m_OutputVersion = v_Versions.back();
+	v_Results.back()->ToLocalPose(m_OutputPose.local_pose());
+	m_OutputPose.CalculateGlobalPose();
+	m_OutputValid = true;
+}
@@ -1,15 +1,32 @@
 #pragma once
 #include <stdint.h>
 #include <array>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <deque>
+#include <unordered_map>
 #include "animation/skeleton.h"
 #include "Animation.h"
+#include "ClipSampler.h"
+#include "SoaPose.h"
+#include "BoneMask.h"
+#include "BlendParameters.h"
+#include "NodeArena.h"
 #include "ragdoll.h"
 
-// Reserve space for up to 1000 nodes. It seems extreme to add more nodes than this.
-#define BLENDTREE_MAXNODES 1000
+// Blend inputs weighted less than this are not sampled, their clips only advance
+#define BLENDTREE_WEIGHT_EPSILON 1e-3f
+// Programs estimated to cost less than this, in pose blends, are evaluated on the calling thread
+#define BLENDTREE_PARALLEL_MIN_COST 32u
+// Smallest branch run as a job of its own, in pose blends, smaller subtrees run in the job of the node reading them
+#define BLENDTREE_PARALLEL_GRAIN 8u
 
 namespace AsdfAnim
 {
+	class MirrorMap;
+	class BlendSpaceNode;
+	class StateMachineNode;
 
 	enum class NodeType_
 	{
@@ -19,7 +36,28 @@ namespace AsdfAnim
 		NodeType_LinearBlend,
 		NodeType_LinearBlendSync,
 		NodeType_Transition,
-		NodeType_Ragdoll
+		NodeType_Ragdoll,
+		NodeType_BlendSpace1D,
+		NodeType_BlendSpace2D,
+		NodeType_Additive,
+		NodeType_MaskedBlend,
+		NodeType_StateMachine,
+		NodeType_Mirror
+	};
+
+	// Operations of a compiled blend tree, see BlendTree::Compile()
+	enum class BlendOp_ : uint8_t
+	{
+		BlendOp_Sample,			// Advance a clip and sample it
+		BlendOp_Blend,			// Blend two inputs with a weight
+		BlendOp_SyncBlend,		// Synchronise two clips then blend them
+		BlendOp_Transition,		// Blend or forward the inputs of a transition
+		BlendOp_Ragdoll,		// Drive a ragdoll from its input or read its pose back
+		BlendOp_BlendSpace,		// Advance a blend space and blend its clips in one pass
+		BlendOp_Additive,		// Add the difference of an additive clip to the input
+		BlendOp_MaskedBlend,	// Blend a layer over a base on the joints of a bone mask
+		BlendOp_StateMachine,	// Take the transitions whose conditions hold, then forward or blend the states
+		BlendOp_Mirror			// Swap the sides of the input pose and reflect it
 	};
 
 	enum class TransitionType_
@@ -28,127 +66,270 @@ namespace AsdfAnim
 		TransitionType_Frozen,
 		TransitionType_Frozen_Sync,
 		TransitionType_Smooth,
-		TransitionType_Smooth_Sync
+		TransitionType_Smooth_Sync,
+		TransitionType_Inertialized		// Switches to the other input at once and decays the difference, only the target is evaluated
 	};
 
 	class BlendNode
 	{
+		friend class BlendTreeTemplate;
+		friend class BlendTreeFile;
+
 	public:
 		BlendNode(const gef::SkeletonPose& bindPose);
+		virtual ~BlendNode() {}
 
-		virtual bool SetInput(uint32_t slot, BlendNode* input) { a_Inputs[slot] = input; return true; }
-		void SetInput(BlendNode* input1, BlendNode* input2) { a_Inputs = { input1, input2, nullptr, nullptr }; }
-		void SetInput(BlendNode* input1, BlendNode* input2, BlendNode* input3, BlendNode* input4) { a_Inputs = { input1, input2, input3, input4 }; }
+		// Any change to the inputs flags the owning tree for recompilation
+		// A node may feed several others, but an input that would create a cycle is refused
+		virtual bool SetInput(uint32_t slot, BlendNode* input);
+		bool SetInput(BlendNode* input1, BlendNode* input2) { return SetInput(input1, input2, nullptr, nullptr); }
+		bool SetInput(BlendNode* input1, BlendNode* input2, BlendNode* input3, BlendNode* input4);
 		void AddInput(BlendNode* input);
 		void RemoveInput(BlendNode* input);
+		void ClearInput(uint32_t slot) { Connect(slot, nullptr); GraphChanged(); }
 
-		virtual bool Update(float frameTime, bool& needPhysicsUpdate);
-		virtual bool ProcessData(float frameTime) = 0;
-
-		const gef::SkeletonPose& GetPose() const { return m_BlendedPose; }
 		const NodeType_& GetType() const { return m_Type; }
 		const std::array<BlendNode*, 4>& GetInputs() const { return a_Inputs; }
+		// Nodes reading this one, once per input slot
+		const std::vector<BlendNode*>& GetReaders() const { return v_Readers; }
+		// Set when the template adds the node
+		NodeHandle GetHandle() const { return m_Handle; }
+		// Whether the node is reachable from the inputs of this one
+		bool DependsOn(const BlendNode* node) const;
+
+		// Blackboard parameters driving the node, resolved by name hash when the tree is compiled
+		// Blends and layers bind their blend value, blend spaces each axis of their parameter, transitions a trigger starting them,
+		// ragdolls a bool activating them and mirrors a bool choosing the side. A parameter that does not exist or has another type leaves the slot unbound
+		void BindParameter(uint32_t slot, ParameterKey key) { a_Parameters[slot] = key; GraphChanged(); }
+		ParameterKey GetBoundParameter(uint32_t slot) const { return a_Parameters[slot]; }
+		uint32_t GetParameterSlotCount() const;
+		ParameterType_ GetParameterSlotType(uint32_t slot) const;
+
+		// Bumped by the edits that change the pose of the node for the same state, e.g. another clip, the instances then evaluate it again
+		uint32_t GetVersion() const { return m_Version; }
+
+	protected:
+		void GraphChanged() { if (p_GraphVersion) ++*p_GraphVersion; }
+		void Changed() { ++m_Version; }
+
+	private:
+		// Every input change goes through here so that the readers of the inputs stay up to date
+		void Connect(uint32_t slot, BlendNode* input);
 
 	protected:
 		std::array<BlendNode*, 4> a_Inputs; // Shouldnt need more than 4 inputs
+		std::vector<BlendNode*> v_Readers;
+		NodeHandle m_Handle;
+		std::array<ParameterKey, 2> a_Parameters;
 		const gef::SkeletonPose& r_BindPose;
-		gef::SkeletonPose m_BlendedPose;
 		NodeType_ m_Type;
+		uint32_t* p_GraphVersion;			// Set by the BlendTree owning the node
+		uint32_t m_Version;
 	};
 
 	struct OutputNode : public BlendNode
 	{
 		OutputNode(const gef::SkeletonPose& bindPose);
-		bool ProcessData(float frameTime) final override;
 	};
 
 	class ClipNode : public BlendNode
 	{
 	public:
+		// Playback of one instance, followed in the state block by the key cursors of the sampler
+		struct State
+		{
+			float animationTime;
+			bool synchronised;		// Placed by a synchronised blend or transition for this frame, the clip does not advance on its own
+		};
+
 		ClipNode(const gef::SkeletonPose& bindPose);
-		bool ProcessData(float frameTime) final override;
+
+		void InitState(State& state) const { state = { 0.f, false }; }
+		size_t GetCursorCount() const { return ClipSampler::GetMaxCursorCount(r_BindPose); }
+
+		// Advances the playback time, returns false once a non looping clip reached its end
+		bool Advance(State& state, float frameTime) const;
+		// Samples into the given buffer, there must be a clip
+		// With a mask only the joints of the mask are sampled
+		void SamplePose(const State& state, uint32_t* cursors, SoaPose& pose, const BoneMask* mask = nullptr) const;
+		bool HasClip() const { return p_Clip != nullptr; }
+		// Binds the sampler to the representation the clip uses now, never during an update
+		void RebindClip() { m_Sampler.SetClip(p_Clip, r_BindPose); }
 
 		void SetPlaybackSpeed(float speed) { m_ClipPlaybackSpeed = speed; }
 		void SetLooping(bool loop) { m_ClipLooping = loop; }
-		void SetClip(const AsdfAnim::Clip* clip) { p_Clip = clip; }
-		void SetAnimationTime(float time) { m_AnimationTime = time; }
+		void SetClip(const AsdfAnim::Clip* clip);
 
 		float GetPlaybackSpeed() const { return m_ClipPlaybackSpeed; }
 		bool IsLooping() const { return m_ClipLooping; }
 		const AsdfAnim::Clip* GetClip() const { return p_Clip; }
-		float GetAnimationTime() { return m_AnimationTime; }
-
-		void Reset() { m_AnimationTime = 0.f; m_ClipPlaybackSpeed = 1.f; m_ClipLooping = true; }
 
 	private:
-		float m_AnimationTime;
 		float m_ClipPlaybackSpeed;
 		bool m_ClipLooping;
 		const AsdfAnim::Clip* p_Clip;
+		ClipSampler m_Sampler;
 	};
 
 	class LinearBlendNode : public BlendNode
 	{
 	public:
+		struct State
+		{
+			float blendValue;
+		};
+
 		LinearBlendNode(const gef::SkeletonPose& bindPose);
-		bool ProcessData(float frameTime) override;
 
+		void InitState(State& state) const { state.blendValue = m_BlendValue; }
+
+		// Blend value new instances start with, a running instance is edited through BlendTree::GetBlendValuePtr()
 		void SetBlendValue(float pBlendVal) { m_BlendValue = pBlendVal; }
+		float GetBlendValue() const { return m_BlendValue; }
 		float* GetBlendValuePtr() { return &m_BlendValue; }
 
 	protected:
 		float m_BlendValue;
 	};
 
+	// Blends two clips kept in step by their sync markers, e.g. walk and run with their foot contacts matched
 	class LinearBlendNodeSync : public LinearBlendNode
 	{
 	public:
+		// State of the two input clips in the instance, null when an input is not a clip
+		typedef std::array<ClipNode::State*, 2> ClipStates;
+
+		struct State : public LinearBlendNode::State
+		{
+			SyncPhase phase;
+		};
+
 		LinearBlendNodeSync(const gef::SkeletonPose& bindPose);
-		bool ProcessData(float frameTime) override;
 		bool SetInput(uint32_t slot, BlendNode* input) override;
-		void CalculateClipsMaxMin();
-		void CalculateBlendedSyncPose();
-		void AssignNewClipSpeeds(ClipNode* input1, ClipNode* input2);
+
+		void InitState(State& state) const { state.blendValue = m_BlendValue; state.phase = {}; }
+		// Advances the phase by the step durations of the clips weighted by the blend value, and places both clips at it
+		// Must run before the clips, which then do not advance on their own this frame
+		void Synchronise(SyncPhase& phase, float blendValue, const ClipStates& clips, float frameTime) const;
+		// Takes the phase of the first clip and places the second one at it
+		void AlignClips(SyncPhase& phase, const ClipStates& clips) const;
 
 	protected:
-		std::array<float, 2> a_ClipsMaxMin;
-		std::array<uint32_t, 2> a_ClipIDs;
+		// The input clip node of the slot, null when it is another node or has no clip
+		const ClipNode* GetClipInput(uint32_t slot) const;
 	};
 
 	class TransitionNode : public LinearBlendNodeSync
 	{
 	public:
+		// Offset of one channel of a joint along a fixed direction, decayed to 0 by a quintic with no jerk at either end
+		struct InertializationCurve
+		{
+			std::array<float, 3> direction;
+			float x0, v0, a0, a, b, c;
+			float duration;
+
+			void Fit(float offset, float velocity, float maxDuration);
+			float Evaluate(float time) const;
+		};
+
+		// Clock of one instance
+		struct State
+		{
+			float currentTime;
+			float blendValue;
+			float frameTime;
+			uint32_t target;				// Input shown once an inertialized transition completes
+			uint32_t historyCount;			// Consecutive outputs in the history, up to 2
+			TransitionType_ type;			// Type the state was advanced with, switching to or from inertialized starts over
+			bool transitioning;
+			bool frozenPoseCaptured;
+			bool evaluated;
+			bool offsetCaptured;
+			SyncPhase phase;				// Of the clips, for the synchronised types
+		};
+
+		// Poses of one instance, kept outside of the state block
+		struct Poses
+		{
+			// Snapshot of the first input for the frozen transitions, local pose only. It is taken on the first frame of the transition,
+			// the first input is evaluated one last time for it then suspended for the whole transition, nested transitions and blends included
+			SoaPose frozen;
+			// Last two outputs of an inertialized transition, null without history. They stay in the pose pool of the instance, nothing is copied
+			const SoaPose* last;
+			const SoaPose* secondLast;
+			std::vector<InertializationCurve> curves;				// Rotation, translation and scale of each joint
+		};
+
 		TransitionNode(const gef::SkeletonPose& bindPose);
-		bool Update(float frameTime, bool& needPhysicsUpdate) final override;
-		bool ProcessData(float frameTime) final override;
 		bool SetInput(uint32_t slot, BlendNode* input) final override;
 
-		void StartTransition();
-		void Reset();
-
-		void SetTransitionType(const TransitionType_& type);
+		void InitState(State& state) const;
+		// Advances the transition clock, returns a mask of the inputs (bit 0 and 1) that need to be evaluated this frame
+		uint32_t Advance(State& state, Poses& poses, const ClipStates& clips, float frameTime) const;
+		// Works out how the inputs are combined this frame, only the poses of the inputs requested by Advance() are valid
+		// Returns the pose to forward as is, or nullptr when blendFrom has to be blended with the second input by the state blend value
+		// With no blendFrom, the output is the target with the offset applied by ApplyOffset() at the current time
+		const SoaPose* Evaluate(State& state, Poses& poses, const ClipStates& clips, const SoaPose* pose1, const SoaPose* pose2, const SoaPose*& blendFrom) const;
+		// The inertialized transition measures its offset from its last two outputs, the tree keeps them after each evaluation
+		bool KeepsHistory() const { return IsInertialized(); }
+
+		// An inertialized transition can be started again at any time, even halfway through, it then goes back to the other input
+		void StartTransition(State& state, const ClipStates& clips) const;
+		void Reset(State& state, const ClipStates& clips) const;
+
+		void SetTransitionType(const TransitionType_& type) { m_TransitionType = type; Changed(); }
 		const TransitionType_& GetTransitionType() const { return m_TransitionType; }
-		bool IsTransitioning() const { return m_Transitioning; }
 		void SetTransitionTime(float transitionTime) { m_TransitionTime = transitionTime; }
 		float GetTransitionTime() const { return m_TransitionTime; }
+		// The clip transitioned to starts on the frame whose pose best continues the clip transitioned from, rather than where it was
+		// Its pops are smaller, so the transition can be shorter. Only between two clips, the synchronised types align the phase instead
+		void SetPoseMatching(bool poseMatching) { m_PoseMatching = poseMatching; }
+		bool IsPoseMatching() const { return m_PoseMatching; }
+
+		// Offset and velocity of the last output relative to the target, from the last two outputs, decayed over the duration
+		// Without a second frame of history the previous output is taken as still
+		static void CaptureOffset(const SoaPose& last, const SoaPose& secondLast, float frameTime, float duration, const SoaPose& target, std::vector<InertializationCurve>& curves);
+		// The target with what is left of the offset at the time
+		static void ApplyOffset(const std::vector<InertializationCurve>& curves, float time, const SoaPose& target, SoaPose& pose);
+
+	private:
+		bool IsFrozen() const { return m_TransitionType == TransitionType_::TransitionType_Frozen || m_TransitionType == TransitionType_::TransitionType_Frozen_Sync; }
+		bool IsInertialized() const { return m_TransitionType == TransitionType_::TransitionType_Inertialized; }
+		bool HasClipInputs() const { return GetClipInput(0u) && GetClipInput(1u); }
+		// Only two clips can be synchronised, a synchronised type over other branches transitions without it
+		bool IsSynchronised() const { return (m_TransitionType == TransitionType_::TransitionType_Frozen_Sync || m_TransitionType == TransitionType_::TransitionType_Smooth_Sync) && HasClipInputs(); }
+		// Places the clip of an input where its pose is closest to the clip of the other input
+		void MatchPose(uint32_t from, uint32_t to, const ClipStates& clips) const;
 
 	private:
 		TransitionType_ m_TransitionType;
-		bool m_Transitioning;
-		float m_TransitionTime, m_CurrentTime;
+		float m_TransitionTime;
+		bool m_PoseMatching;
 	};
 
+	// The ragdoll is the physics body of a single character, a template with a ragdoll node is played by one instance
 	class RagdollNode : public BlendNode
 	{
 	public:
+		struct State
+		{
+			bool active;
+		};
+
 		RagdollNode(const gef::SkeletonPose& bindPose);
-		bool Update(float frameTime, bool& needPhysicsUpdate) final override;
-		bool ProcessData(float frameTime) final override;
 
+		void InitState(State& state) const { state.active = m_Active; }
+		// Drives the ragdoll with the input pose when inactive, the input is then forwarded
+		// Returns false when the simulated pose is to be read back with ReadPose() instead
+		bool Drive(const State& state, const SoaPose* input) const;
+		void ReadPose(SoaPose& pose) const;
+
+		// Whether new instances start with the ragdoll active
 		void SetActive(bool a) { m_Active = a; }
 		bool IsActive() const { return m_Active; }
 
-		void SetRagdoll(Ragdoll* pRagdoll) { p_Ragdoll = pRagdoll; }
+		void SetRagdoll(Ragdoll* pRagdoll) { p_Ragdoll = pRagdoll; GraphChanged(); }
 		bool IsRagdollValid() { return p_Ragdoll != nullptr; }
 
 	private:
@@ -156,31 +337,402 @@ namespace AsdfAnim
 		bool m_Active;
 	};
 
-	class BlendTree
+	// Plays an additive clip on top of its input, or of the bind pose without one
+	// The blend value is the weight of the difference, 1 by default
+	class AdditiveNode : public LinearBlendNode
 	{
 	public:
-		BlendTree(const gef::SkeletonPose& bindPose);
-		~BlendTree();
+		struct State
+		{
+			float blendValue;
+			float animationTime;
+		};
 
-		// Return the pose from the output node
-		const gef::SkeletonPose& GetOutputPose() const { return v_Tree.front()->GetPose(); }
+		AdditiveNode(const gef::SkeletonPose& bindPose);
 
-		uint32_t AddNode(BlendNode* node);
-		uint32_t AddNode(NodeType_ type);
-		void RemoveAndFreeNode(BlendNode* node);
+		void InitState(State& state) const { state = { m_BlendValue, 0.f }; }
 
-		BlendNode* GetNode(uint32_t ID);
-		void ConnectToRoot(uint32_t inputNodeID);
-		// Connecting nodes is done on each particular node. See UserInterface.cpp
+		// Only clips with additive data are accepted
+		bool SetClip(const AsdfAnim::Clip* clip);
+		const AsdfAnim::Clip* GetClip() const { return p_Clip; }
+		void SetPlaybackSpeed(float speed) { m_ClipPlaybackSpeed = speed; }
+		float GetPlaybackSpeed() const { return m_ClipPlaybackSpeed; }
 
-		void Update(float frameTime, bool& needsPhysicsUpdate);
+		// The clip always loops, layers such as breathing or lean have no end
+		void Advance(State& state, float frameTime) const;
+		// Whether there is anything to add this frame, the input is forwarded as is otherwise
+		bool IsApplied(const State& state) const { return p_Clip && state.blendValue > BLENDTREE_WEIGHT_EPSILON; }
+		// Adds the weighted difference to the input, in the pose. The difference is sampled in the pose first
+		void Apply(const State& state, const SoaPose& input, SoaPose& pose) const;
+
+	private:
+		float m_ClipPlaybackSpeed;
+		const AsdfAnim::Clip* p_Clip;
+	};
+
+	// Blends a layer over a base joint by joint, by the weights of a bone mask times the blend value
+	// The layer is only read on the joints of the mask, so the clips under it are only sampled for those
+	class MaskedBlendNode : public LinearBlendNode
+	{
+	public:
+		MaskedBlendNode(const gef::SkeletonPose& bindPose);
+
+		void SetMask(const BoneMask* mask) { p_Mask = mask; GraphChanged(); }
+		const BoneMask* GetMask() const { return p_Mask; }
+
+		void Blend(const State& state, const SoaPose& base, const SoaPose& layer, SoaPose& pose) const;
+
+	private:
+		const BoneMask* p_Mask;
+	};
+
+	// Plays its input as if authored for the other side, e.g. a left turn as a right turn, so only one side of each clip is stored
+	// The sides are swapped by the mirror map of the skeleton, without one the input is forwarded
+	class MirrorNode : public BlendNode
+	{
+	public:
+		struct State
+		{
+			bool mirrored;
+		};
+
+		MirrorNode(const gef::SkeletonPose& bindPose);
+
+		void InitState(State& state) const { state.mirrored = m_Mirrored; }
+		// The input reads the whole pose, whatever joints the readers of this node need, its sides are swapped
+		void Mirror(const SoaPose& input, SoaPose& pose) const;
+
+		// Whether new instances start mirrored, the input is forwarded as is otherwise
+		void SetMirrored(bool mirrored) { m_Mirrored = mirrored; }
+		bool IsMirrored() const { return m_Mirrored; }
+
+		void SetMirrorMap(const MirrorMap* mirrorMap) { p_MirrorMap = mirrorMap; GraphChanged(); }
+		const MirrorMap* GetMirrorMap() const { return p_MirrorMap; }
+
+	private:
+		const MirrorMap* p_MirrorMap;
+		bool m_Mirrored;
+	};
+
+	// The nodes form a DAG: a node can feed several parents, e.g. an upper body layer shared by two blends
+	// It is evaluated once per update and its pose is read by every parent
+	// The template holds the structure, the node parameters and the clip bindings, and is shared by every character playing it
+	// The runtime state of a character (clip times and cursors, blend values, transition clocks) is a POD block laid out when the graph
+	// is compiled. The blocks of all the instances are contiguous, and spawning an instance copies the default block
+	class BlendTreeTemplate
+	{
+		friend class BlendTree;
+		friend class BlendTreeFile;
+
+	public:
+		BlendTreeTemplate(const gef::SkeletonPose& bindPose);
 
-		const std::vector<BlendNode*>& GetTree() const { return v_Tree; }
+		// The nodes are created and owned by the template, the handles stay valid until their node is removed
+		NodeHandle AddNode(NodeType_ type);
+		// Disconnects the node from its inputs and readers first, returns false for a handle that is no longer valid or for the output node
+		bool RemoveAndFreeNode(NodeHandle handle);
+
+		// Null when the node was removed
+		BlendNode* GetNode(NodeHandle handle) const { return m_Nodes.Get(handle); }
+		void ConnectToRoot(NodeHandle input);
+		// Connecting nodes is done on each particular node. See UserInterface.cpp
+
+		// Gives the ragdoll of the character to every ragdoll node, e.g. those of a loaded graph
+		void SetRagdoll(Ragdoll* ragdoll);
+		// Rebinds the samplers of the clip after its representation was switched, between two updates
+		// The instances only read the samplers while updating, so none of them has to check the representation
+		void RebindClip(const Clip* clip);
+
+		// Recompiles if the graph changed since the last call
+		// The state of the instances is carried over for the nodes that are still compiled, new nodes start from their defaults
+		void Compile();
+
+		// Returns the index of the instance, its state is a copy of the default state
+		uint32_t CreateInstance();
+		void DestroyInstance(uint32_t instance);
+		uint8_t* GetInstanceState(uint32_t instance) { return v_States.data() + instance * m_StateSize; }
+		size_t GetStateSize() const { return m_StateSize; }
+
+		// Every node, the output node first
+		const std::vector<BlendNode*>& GetTree() const { return m_Nodes.GetNodes(); }
+		// Place of the node in GetTree(), UINT32_MAX when it was removed
+		uint32_t GetTreeIndex(const BlendNode* node) const { return m_Nodes.GetPosition(node->GetHandle()); }
 		const gef::SkeletonPose& GetBindPose() const { return m_BindPose; }
+		size_t GetInstructionCount() const { return v_Program.size(); }
+
+		// Blackboard, the values of all the instances are stored contiguously, one float per parameter
+		// Returns false if a parameter with the same key exists, names that hash to the same key are refused
+		bool AddParameter(const std::string& name, ParameterType_ type, float defaultValue = 0.f);
+		void RemoveParameter(ParameterKey key);
+		const std::vector<BlendParameter>& GetParameters() const { return v_Parameters; }
+		// Index in the values of an instance, UINT32_MAX when there is no such parameter
+		uint32_t FindParameter(ParameterKey key) const;
+		float* GetInstanceParameters(uint32_t instance) { return v_ParameterValues.data() + instance * v_Parameters.size(); }
+		// Batched setters: the key is looked up once, then there is a single store per instance
+		// The instances are the indices returned by CreateInstance(), see BlendTree::GetInstance()
+		void SetParameter(ParameterKey key, float value, const uint32_t* instances, size_t count);
+		void SetParameter(ParameterKey key, const float* values, const uint32_t* instances, size_t count);
+
+		// The instances reuse the pose an instruction kept from an earlier update when nothing it is computed from changed:
+		// its clip time, blend value or parameter, the versions of the poses it reads and the version of its node
+		// Each instance then keeps a pose buffer per instruction, held poses such as idle crowds cost little more than advancing their clips
+		void SetLazyEvaluation(bool lazy) { m_LazyEvaluation = lazy; }
+		bool IsLazyEvaluation() const { return m_LazyEvaluation; }
+
+		// The instances of a program estimated to cost at least BLENDTREE_PARALLEL_MIN_COST run its independent branches as jobs
+		// A branch is a subtree costing at least BLENDTREE_PARALLEL_GRAIN or a node read by several parents, and starts once the branches it reads are done
+		// Programs with a ragdoll are not split, the physics world is only touched from the thread stepping it
+		void SetParallelEvaluation(bool parallel) { m_ParallelEvaluation = parallel; }
+		bool IsParallelEvaluation() const { return m_ParallelEvaluation; }
+		// True when the program was split and parallel evaluation is on
+		bool IsEvaluatedInParallel() const { return m_ParallelEvaluation && !v_Tasks.empty(); }
+		uint32_t GetEstimatedCost() const { return m_EstimatedCost; }
+		size_t GetTaskCount() const { return v_Tasks.size(); }
+
+	private:
+		struct BlendInstruction
+		{
+			BlendOp_ op;
+			BlendNode* node;
+			NodeHandle handle;					// Of the node, the state of the instances is carried over by handle when the graph is recompiled
+			std::array<uint32_t, 4> inputs;		// Instructions producing the input poses, UINT32_MAX when unused
+			uint32_t state;						// Offset of the node state in the instance block
+			uint32_t stateSize;					// Key cursors included
+			uint32_t poses;						// Index of the transition poses in the instance, UINT32_MAX for other instructions
+			std::array<uint32_t, 2> parameters;	// Index of the parameters bound to the node slots, UINT32_MAX when unbound
+		};
+
+		// A branch of the program, run as one job
+		struct BlendTask
+		{
+			uint32_t firstInstruction;			// In v_TaskInstructions, in program order
+			uint32_t instructionCount;
+			uint32_t dependencies;				// Tasks producing the poses it reads
+			uint32_t firstDependent;			// In v_TaskDependents
+			uint32_t dependentCount;
+		};
+
+		// Creates the node in the arena, with the chunks of its type
+		BlendNode* CreateNode(NodeType_ type);
+		// Flattens the graph reachable from the output node into a post-order list of instructions
+		// Nodes with a single input are folded into their input, unreachable nodes are dropped
+		uint32_t CompileNode(BlendNode* node, std::unordered_map<BlendNode*, uint32_t>& compiled);
+		uint32_t Emit(BlendOp_ op, BlendNode* node, uint32_t input1 = UINT32_MAX, uint32_t input2 = UINT32_MAX);
+		uint32_t Emit(BlendOp_ op, BlendNode* node, const std::array<uint32_t, 4>& inputs);
+		// Counts the pose buffers for the worst case where every instruction is needed and none forwards its input
+		void CountPoseBuffers();
+		// Estimates the cost of the program and splits it into branches when it is worth it
+		void PlanTasks();
+		// Works out which joints the consumers of each instruction read, the layers of masked blends only need the joints of the mask
+		// A layer nested in another layer only needs the joints of both masks
+		void PropagateMasks();
+		// Mask of the joints of both, kept until the next compilation
+		const BoneMask* IntersectMasks(const BoneMask& mask, const BoneMask& other);
+		// Gives each instruction its place in the state block and rebuilds the default and instance blocks
+		void LayOutState(const std::vector<BlendInstruction>& previousProgram, size_t previousStateSize);
+		// Bytes of the state of an instruction in the block, key cursors included
+		static uint32_t GetStateSize(BlendOp_ op, const BlendNode* node);
+		void InitState(const BlendInstruction& instruction, uint8_t* block) const;
+		// Index of the instruction compiled from the node, UINT32_MAX when it was folded or is unreachable
+		uint32_t FindInstruction(const BlendNode* node) const;
+		// Resolves the parameter keys of the nodes of the program, and of the conditions of the state machines
+		void BindParameters();
+		// Carries the values of the instances over by key when parameters are added or removed
+		void ResizeParameterValues(const std::vector<BlendParameter>& previousParameters);
 
 	private:
 		const gef::SkeletonPose& m_BindPose;
-		std::vector<BlendNode*> v_Tree;
+		NodeArena m_Nodes;
+
+		// Compiled program
+		std::vector<BlendInstruction> v_Program;
+		std::vector<const BoneMask*> v_Masks;	// Per instruction, the joints its consumers read, null for the whole pose
+		std::deque<BoneMask> v_MaskIntersections;	// Read through v_Masks, a deque so that the masks stay in place
+		std::unordered_map<NodeHandle, uint32_t, NodeHandleHash> map_Instructions;
+		uint32_t m_PoseBufferCount;
+		uint32_t m_TransitionCount;
+		uint32_t m_GraphVersion;
+		uint32_t m_CompiledVersion;
+		uint32_t m_ProgramVersion;				// Bumped by every compilation, the instances resize their buffers when it changes
+		bool m_ProgramValid;
+		bool m_LazyEvaluation;
+		bool m_ParallelEvaluation;
+
+		// Branches, empty when the program is evaluated on the calling thread
+		std::vector<BlendTask> v_Tasks;
+		std::vector<uint32_t> v_TaskInstructions;
+		std::vector<uint32_t> v_TaskDependents;
+		uint32_t m_EstimatedCost;
+		uint32_t m_ParallelBufferCount;			// Every result plus the scratch of every blend space, the most the branches can hold at once
+
+		// Instance state, m_StateSize bytes per instance
+		std::vector<uint8_t> v_DefaultState;
+		std::vector<uint8_t> v_States;
+		std::vector<uint8_t> v_InstanceUsed;
+		std::vector<uint32_t> v_FreeInstances;
+		size_t m_StateSize;
+
+		// Blackboard
+		std::vector<BlendParameter> v_Parameters;
+		std::unordered_map<ParameterKey, uint32_t> map_Parameters;
+		std::vector<float> v_ParameterValues;	// v_Parameters.size() values per instance
+	};
+
+	// A character playing a template: its state block in the template, and the pose buffers of its update
+	class BlendTree
+	{
+	public:
+		BlendTree(BlendTreeTemplate& blendTreeTemplate);
+		~BlendTree();
+
+		// Return the pose from the output node, the bind pose until the tree has been updated with a valid graph
+		const gef::SkeletonPose& GetOutputPose() const { return m_OutputValid ? m_OutputPose : r_Template.m_BindPose; }
+
+		// Compiles the template if the graph changed since the last update, then runs the program on the state of this instance
+		void Update(float frameTime, bool& needsPhysicsUpdate);
+
+		// Runtime controls of this instance
+		// A node that is not part of the program has no state, the value new instances start with is edited instead
+		float* GetBlendValuePtr(LinearBlendNode* node);
+		float* GetParameterPtr(BlendSpaceNode* node);
+		void StartTransition(TransitionNode* node);
+		void ResetTransition(TransitionNode* node);
+		// Weight of the sample at the last update, 0 when the node has no state
+		float GetSampleWeight(BlendSpaceNode* node, uint32_t sample);
+		bool IsRagdollActive(RagdollNode* node);
+		void SetRagdollActive(RagdollNode* node, bool active);
+		bool IsMirrored(MirrorNode* node);
+		void SetMirrored(MirrorNode* node, bool mirrored);
+		// State the machine is in, and the state it is leaving when that one is still evaluated by a smooth transition (UINT32_MAX otherwise)
+		uint32_t GetActiveState(StateMachineNode* node, uint32_t& outgoing);
+
+		// Blackboard of this instance, the nodes bound to a parameter follow it at every update
+		// Unknown keys are ignored and read as 0
+		void SetFloat(ParameterKey key, float value);
+		void SetBool(ParameterKey key, bool value) { SetFloat(key, value ? 1.f : 0.f); }
+		// Consumed by the next update, whether a node reads it or not
+		void SetTrigger(ParameterKey key) { SetFloat(key, 1.f); }
+		float GetFloat(ParameterKey key) const;
+		bool GetBool(ParameterKey key) const { return GetFloat(key) != 0.f; }
+		uint32_t GetInstance() const { return m_Instance; }
+		// Queued for the next update, the state machines read the events in the order they were posted
+		// An event is the key of a trigger parameter, it satisfies the conditions on that trigger
+		void PostEvent(ParameterKey event) { v_Events.push_back(event); }
+
+		BlendTreeTemplate& GetTemplate() const { return r_Template; }
+		size_t GetPoseBufferCount() const { return v_PosePool.size(); }
+		// Instructions that ran on the last update, sampled or only advanced
+		uint32_t GetEvaluatedCount() const { return m_EvaluatedCount; }
+		// Instructions whose pose was reused on the last update, see BlendTreeTemplate::SetLazyEvaluation()
+		uint32_t GetReusedCount() const { return m_ReusedCount; }
+
+	private:
+		typedef BlendTreeTemplate::BlendInstruction BlendInstruction;
+
+		// What an instruction has to do this frame
+		enum class Demand_ : uint8_t
+		{
+			Demand_None,		// Suspended, e.g. the first input of a frozen transition
+			Demand_Advance,		// Only advance the clip times, the pose is not read
+			Demand_Pose
+		};
+
+		// What a pose was computed from, the instruction reuses it when it comes up with the same key
+		struct CacheKey
+		{
+			std::array<uint32_t, 4> inputs;		// Versions of the input poses read, UINT32_MAX for the others
+			std::array<float, 3> values;		// Clip time, blend value, or blend space parameter and phase
+			uint32_t extra;						// Clip representation, blend space step or current state
+			uint32_t nodeVersion;
+
+			bool operator==(const CacheKey& other) const { return inputs == other.inputs && values == other.values && extra == other.extra && nodeVersion == other.nodeVersion; }
+		};
+
+		// Sizes the buffers of the instance for the program of the template
+		void Prepare();
+		// Samples, blends or forwards the pose of the instruction, returns false when it is not needed this frame
+		bool Execute(uint8_t* block, uint32_t instruction, float frameTime);
+		// Runs the branches of the program as jobs and waits for them, the calling thread runs some of them too
+		void RunTasks(float frameTime);
+		// Runs the instructions of a branch, then starts the branches that were only waiting for it
+		void RunTask(uint32_t task);
+		static void RunTaskJob(void* blendTree, uint32_t task) { static_cast<BlendTree*>(blendTree)->RunTask(task); }
+		// Copies the bound parameters into the state of the instruction, a bound trigger starts a transition
+		void ApplyParameters(uint8_t* block, uint32_t instruction);
+		// Puts the instruction and every instruction it reads back to their default state, e.g. a state entered by a state machine
+		// A node shared with another branch starts over too
+		void RestartBranch(uint8_t* block, uint32_t instruction);
+		// Value of the parameter bound to the slot of the instruction, null when unbound
+		float* GetBoundValue(uint32_t instruction, uint32_t slot) const;
+		template<typename State>
+		State& GetState(uint8_t* block, uint32_t instruction) const { return *reinterpret_cast<State*>(block + r_Template.v_Program[instruction].state); }
+		// The key cursors of clips and blend spaces follow their state in the block
+		template<typename State>
+		uint32_t* GetCursors(uint8_t* block, uint32_t instruction) const { return reinterpret_cast<uint32_t*>(&GetState<State>(block, instruction) + 1); }
+		// Block of the instance when the node has a state, null otherwise
+		uint8_t* GetStateOf(const BlendNode* node, uint32_t& instruction);
+		// State of the clips read by a synchronised blend or transition
+		LinearBlendNodeSync::ClipStates GetClipStates(uint8_t* block, uint32_t instruction) const;
+
+		// Pose buffers are taken from the pool when an instruction writes a pose, and returned once all the instructions reading it ran
+		// With lazy evaluation the instruction keeps it afterwards, under the key it was computed from, and writes over it next time
+		uint32_t AcquireBuffer(uint32_t instruction);
+		void ReleaseResult(uint32_t instruction);
+		// A buffer an instruction works in while it runs, given back before it completes
+		uint32_t AcquireScratch();
+		void ReleaseScratch(uint32_t buffer);
+		// The pose is only kept when there is a key, e.g. not for a blend from a frozen snapshot, which has no version
+		void SetResult(uint32_t instruction, uint32_t buffer, const CacheKey* key = nullptr);
+		void ForwardResult(uint32_t instruction, const SoaPose* pose);
+		CacheKey MakeKey(uint32_t instruction, float value1, float value2 = 0.f, float value3 = 0.f, uint32_t extra = 0u) const;
+		// Takes the pose the instruction kept when it was computed from the same key, returns false when it has to be computed again
+		bool ReuseResult(uint32_t instruction, const CacheKey& key);
+		void DropCachedResult(uint32_t instruction);
+		// The result of a transition or a state machine is held for two updates, in place of its previous output, for an offset measured later
+		void KeepHistory(uint32_t instruction);
+		void ReleaseHistory(uint32_t poses);
+		// The pool is shared by the branches running in parallel, and only locked then
+		std::unique_lock<std::mutex> LockPool() { return m_Parallel ? std::unique_lock<std::mutex>(m_PoolMutex) : std::unique_lock<std::mutex>(); }
+
+	private:
+		BlendTreeTemplate& r_Template;
+		uint32_t m_Instance;
+		uint32_t m_ProgramVersion;
+		SoaPose m_BindSoaPose;
+
+		std::vector<Demand_> v_Demands;			// Per instruction, what it has to do this frame
+		std::vector<uint8_t> v_InputMasks;		// Per instruction, the inputs whose pose it reads this frame
+		std::vector<TransitionNode::Poses> v_TransitionPoses;	// Of the transitions and the state machines
+		std::vector<std::array<uint32_t, 2>> v_HistoryBuffers;	// Of the transitions and the state machines, buffers of their last two outputs
+		std::vector<ParameterKey> v_Events;
+		uint32_t m_EvaluatedCount;
+
+		// Pose pool, the results of the instructions live in it, or outside the tree for the bind pose
+		// The poses are only converted to a gef::SkeletonPose once, for the output
+		// It grows when the kept poses use up the buffers counted by the template, a deque so that the results stay in place
+		std::deque<SoaPose> v_PosePool;
+		std::vector<uint32_t> v_FreeBuffers;
+		std::vector<uint32_t> v_BufferReferences;		// Per buffer, number of reads left this frame, plus one for the kept pose and each history holding it
+		std::vector<uint32_t> v_Consumers;				// Per instruction, number of needed instructions reading its pose this frame
+		std::vector<uint32_t> v_ResultBuffers;			// Per instruction, buffer holding its pose or UINT32_MAX when it lives outside the pool
+		std::vector<const SoaPose*> v_Results;
+		gef::SkeletonPose m_OutputPose;
+		bool m_OutputValid;
+
+		// Lazy evaluation
+		std::vector<uint32_t> v_Versions;				// Per instruction, version of its pose, 0 is the bind pose
+		std::vector<uint32_t> v_CachedBuffers;			// Per instruction, buffer of the pose kept from an earlier update or UINT32_MAX
+		std::vector<CacheKey> v_CacheKeys;
+		uint32_t m_NextVersion;
+		uint32_t m_OutputVersion;						// Of the pose the output was converted from
+		uint32_t m_ReusedCount;
+
+		// Parallel evaluation
+		std::vector<std::atomic<uint32_t>> v_TaskCounters;	// Per branch, branches it reads that are not done yet
+		std::atomic<uint32_t> m_TasksLeft;
+		std::mutex m_PoolMutex;
+		float m_FrameTime;
+		bool m_Parallel;
 	};
 
 }
\ No newline at end of file
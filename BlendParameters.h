@@ -0,0 +1,35 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+
+// Key of a node input that is not bound to any parameter
+#define BLEND_PARAMETER_NONE 0u
+
+namespace AsdfAnim
+{
+	typedef uint32_t ParameterKey;
+
+	// FNV-1a hash of a parameter name, evaluated by the compiler when the name is a literal
+	// Gameplay code keeps the keys it drives, e.g. constexpr ParameterKey k_Speed = HashParameter("speed");
+	constexpr ParameterKey HashParameter(const char* name, ParameterKey hash = 2166136261u)
+	{
+		return *name ? HashParameter(name + 1, (hash ^ static_cast<uint8_t>(*name)) * 16777619u) : hash;
+	}
+	inline ParameterKey HashParameter(const std::string& name) { return HashParameter(name.c_str()); }
+
+	enum class ParameterType_ : uint8_t
+	{
+		ParameterType_Float,
+		ParameterType_Bool,
+		ParameterType_Trigger			// Set for a single update, e.g. to start a transition
+	};
+
+	// Declaration of a blackboard entry, the values are stored per instance as floats: bools and triggers are 0 or 1
+	struct BlendParameter
+	{
+		ParameterKey key;
+		ParameterType_ type;
+		float defaultValue;
+		std::string name;
+	};
+}
@@ -0,0 +1,271 @@
+#include "BlendSpaceNode.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+using namespace AsdfAnim;
+
+namespace
+{
+	typedef std::array<float, 2> Point;
+
+	// Twice the signed area of the triangle, positive when counter clockwise
+	float Cross(const Point& a, const Point& b, const Point& c)
+	{
+		return (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+	}
+
+	// Position along the segment of the closest point to p, and the squared distance to it
+	float ProjectOnSegment(const Point& p, const Point& a, const Point& b, float& distanceSq)
+	{
+		const float abX = b[0] - a[0], abY = b[1] - a[1];
+		const float lengthSq = abX * abX + abY * abY;
+		const float t = lengthSq > 0.f ? std::min(std::max(((p[0] - a[0]) * abX + (p[1] - a[1]) * abY) / lengthSq, 0.f), 1.f) : 0.f;
+		const float dX = a[0] + abX * t - p[0], dY = a[1] + abY * t - p[1];
+		distanceSq = dX * dX + dY * dY;
+		return t;
+	}
+
+	bool SegmentsCross(const Point& a, const Point& b, const Point& c, const Point& d)
+	{
+		return Cross(a, b, c) * Cross(a, b, d) < 0.f && Cross(c, d, a) * Cross(c, d, b) < 0.f;
+	}
+}
+
+///
+/// Blend space
+///
+BlendSpaceNode::BlendSpaceNode(const gef::SkeletonPose& bindPose) : BlendNode(bindPose),
+a_Parameter{ 0.f, 0.f },
+m_PlaybackSpeed(1.f)
+{
+}
+
+uint32_t BlendSpaceNode::AddSample(const Clip* clip, float x, float y)
+{
+	if (!clip) return UINT32_MAX;
+
+	v_Samples.push_back({ clip, { x, y }, ClipSampler() });
+	v_Samples.back().sampler.SetClip(clip, r_BindPose);
+	SamplesChanged();
+	GraphChanged();			// The state of the instances holds the cursors of every sample
+	return static_cast<uint32_t>(v_Samples.size() - 1u);
+}
+
+void BlendSpaceNode::RemoveSample(uint32_t index)
+{
+	v_Samples.erase(v_Samples.begin() + index);
+	SamplesChanged();
+	GraphChanged();
+}
+
+void BlendSpaceNode::SetSampleClip(uint32_t index, const Clip* clip)
+{
+	if (!clip) return;
+	v_Samples[index].clip = clip;
+	v_Samples[index].sampler.SetClip(clip, r_BindPose);
+	Changed();
+}
+
+void BlendSpaceNode::RebindClip(const Clip* clip)
+{
+	for (Sample& sample : v_Samples)
+		if (sample.clip == clip) sample.sampler.SetClip(clip, r_BindPose);
+}
+
+void BlendSpaceNode::SetSamplePosition(uint32_t index, float x, float y)
+{
+	v_Samples[index].position = { x, y };
+	SamplesChanged();
+	Changed();
+}
+
+float BlendSpaceNode::GetSampleWeight(const State& state, uint32_t index)
+{
+	for (uint32_t i = 0u; i < state.weightCount; ++i)
+		if (state.samples[i] == index) return state.weights[i];
+	return 0.f;
+}
+
+void BlendSpaceNode::AddWeight(State& state, uint32_t sample, float weight)
+{
+	state.samples[state.weightCount] = sample;
+	state.weights[state.weightCount++] = weight;
+}
+
+void BlendSpaceNode::Advance(State& state, float frameTime) const
+{
+	if (v_Samples.empty()) return;
+	state.weightCount = 0u;
+	CalculateWeights(state);
+
+	// A step lasts as long as the weighted average of the step durations, every clip covers its own step in that time
+	float duration = 0.f;
+	for (uint32_t i = 0u; i < state.weightCount; ++i) duration += state.weights[i] * SyncMarkers::GetStepDuration(*v_Samples[state.samples[i]].clip, state.phase.step);
+	SyncMarkers::Advance(state.phase, frameTime * m_PlaybackSpeed, duration);
+}
+
+void BlendSpaceNode::SamplePose(const State& state, uint32_t* cursors, SoaPose* const* scratch, SoaPose& pose) const
+{
+	const size_t cursorCount = ClipSampler::GetMaxCursorCount(r_BindPose);
+	std::array<const SoaPose*, BLENDSPACE_MAX_WEIGHTS> poses;
+	std::array<float, BLENDSPACE_MAX_WEIGHTS> weights;
+	uint32_t activeSamples = 0u;
+	for (uint32_t i = 0u; i < state.weightCount; ++i)
+	{
+		if (state.weights[i] <= BLENDTREE_WEIGHT_EPSILON) continue;
+
+		const Sample& sample = v_Samples[state.samples[i]];
+		SoaPose& samplePose = activeSamples ? *scratch[activeSamples - 1u] : pose;
+		sample.sampler.Sample(SyncMarkers::GetTime(*sample.clip, state.phase), samplePose, cursors + state.samples[i] * cursorCount);
+		poses[activeSamples] = &samplePose;
+		weights[activeSamples++] = state.weights[i];
+	}
+
+	// Right on a sample, nothing to blend
+	if (activeSamples > 1u) BlendPoses(poses.data(), weights.data(), activeSamples, pose);
+}
+
+///
+/// Blend space 1D
+///
+BlendSpace1DNode::BlendSpace1DNode(const gef::SkeletonPose& bindPose) : BlendSpaceNode(bindPose)
+{
+	m_Type = NodeType_::NodeType_BlendSpace1D;
+}
+
+void BlendSpace1DNode::CalculateWeights(State& state) const
+{
+	// Closest samples on each side of the parameter
+	const float parameter = state.parameter[0];
+	int32_t below = -1, above = -1;
+	for (int32_t i = 0; i < static_cast<int32_t>(v_Samples.size()); ++i)
+	{
+		const float x = v_Samples[i].position[0];
+		if (x <= parameter && (below < 0 || x > v_Samples[below].position[0])) below = i;
+		if (x > parameter && (above < 0 || x < v_Samples[above].position[0])) above = i;
+	}
+
+	// Past either end the closest sample plays alone
+	if (below < 0)		AddWeight(state, above, 1.f);
+	else if (above < 0)	AddWeight(state, below, 1.f);
+	else
+	{
+		const float t = (parameter - v_Samples[below].position[0]) / (v_Samples[above].position[0] - v_Samples[below].position[0]);
+		AddWeight(state, below, 1.f - t);
+		AddWeight(state, above, t);
+	}
+}
+
+///
+/// Blend space 2D
+///
+BlendSpace2DNode::BlendSpace2DNode(const gef::SkeletonPose& bindPose) : BlendSpaceNode(bindPose)
+{
+	m_Type = NodeType_::NodeType_BlendSpace2D;
+}
+
+void BlendSpace2DNode::SamplesChanged()
+{
+	v_Triangles.clear();
+	const uint32_t count = static_cast<uint32_t>(v_Samples.size());
+	for (uint32_t i = 0u; i < count; ++i)
+		for (uint32_t j = i + 1u; j < count; ++j)
+			for (uint32_t k = j + 1u; k < count; ++k)
+			{
+				const Point& a = v_Samples[i].position;
+				Point b = v_Samples[j].position, c = v_Samples[k].position;
+				std::array<uint32_t, 3> triangle = { i, j, k };
+				float area = Cross(a, b, c);
+				if (std::fabs(area) < 1e-6f) continue;
+				if (area < 0.f)
+				{
+					std::swap(b, c);
+					std::swap(triangle[1], triangle[2]);
+				}
+
+				// Delaunay: no other sample lies inside the circumcircle
+				bool empty = true;
+				for (uint32_t l = 0u; l < count && empty; ++l)
+				{
+					if (l == i || l == j || l == k) continue;
+					const Point& d = v_Samples[l].position;
+					const float adX = a[0] - d[0], adY = a[1] - d[1];
+					const float bdX = b[0] - d[0], bdY = b[1] - d[1];
+					const float cdX = c[0] - d[0], cdY = c[1] - d[1];
+					const float inCircle = (adX * adX + adY * adY) * (bdX * cdY - cdX * bdY)
+						- (bdX * bdX + bdY * bdY) * (adX * cdY - cdX * adY)
+						+ (cdX * cdX + cdY * cdY) * (adX * bdY - bdX * adY);
+					empty = inCircle <= 1e-6f;
+				}
+				if (!empty) continue;
+
+				// Samples on a common circle, e.g. the corners of a square, give overlapping triangles, keep the first ones
+				bool overlaps = false;
+				for (const std::array<uint32_t, 3>& other : v_Triangles)
+					for (uint32_t e = 0u; e < 3u && !overlaps; ++e)
+						for (uint32_t f = 0u; f < 3u && !overlaps; ++f)
+							overlaps = SegmentsCross(v_Samples[triangle[e]].position, v_Samples[triangle[(e + 1u) % 3u]].position,
+								v_Samples[other[f]].position, v_Samples[other[(f + 1u) % 3u]].position);
+				if (!overlaps) v_Triangles.push_back(triangle);
+			}
+}
+
+void BlendSpace2DNode::CalculateWeights(State& state) const
+{
+	if (v_Samples.size() == 1u)
+	{
+		AddWeight(state, 0u, 1.f);
+		return;
+	}
+
+	const Point& parameter = state.parameter;
+
+	// Barycentric coordinates in the triangle containing the parameter
+	for (const std::array<uint32_t, 3>& triangle : v_Triangles)
+	{
+		const Point& a = v_Samples[triangle[0]].position;
+		const Point& b = v_Samples[triangle[1]].position;
+		const Point& c = v_Samples[triangle[2]].position;
+		const float area = Cross(a, b, c);
+		const float wA = Cross(parameter, b, c) / area;
+		const float wB = Cross(a, parameter, c) / area;
+		const float wC = 1.f - wA - wB;
+		if (wA < -1e-5f || wB < -1e-5f || wC < -1e-5f) continue;
+
+		AddWeight(state, triangle[0], std::max(wA, 0.f));
+		AddWeight(state, triangle[1], std::max(wB, 0.f));
+		AddWeight(state, triangle[2], std::max(wC, 0.f));
+		return;
+	}
+
+	// Outside, blend the two ends of the closest edge. Without triangles the samples are on a line and any pair is an edge
+	float closest = FLT_MAX;
+	uint32_t edgeStart = 0u, edgeEnd = 0u;
+	float edgeT = 0.f;
+	auto testEdge = [&](uint32_t start, uint32_t end)
+	{
+		float distanceSq;
+		const float t = ProjectOnSegment(parameter, v_Samples[start].position, v_Samples[end].position, distanceSq);
+		if (distanceSq < closest)
+		{
+			closest = distanceSq;
+			edgeStart = start;
+			edgeEnd = end;
+			edgeT = t;
+		}
+	};
+	if (v_Triangles.empty())
+	{
+		for (uint32_t i = 0u; i < v_Samples.size(); ++i)
+			for (uint32_t j = i + 1u; j < v_Samples.size(); ++j)
+				testEdge(i, j);
+	}
+	else
+	{
+		for (const std::array<uint32_t, 3>& triangle : v_Triangles)
+			for (uint32_t e = 0u; e < 3u; ++e)
+				testEdge(triangle[e], triangle[(e + 1u) % 3u]);
+	}
+	AddWeight(state, edgeStart, 1.f - edgeT);
+	AddWeight(state, edgeEnd, edgeT);
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <stdint.h>
+#include <array>
+#include <vector>
+#include "BlendNode.h"
+
+// Samples blended at once, the corners of a triangle of a 2D space at most
+#define BLENDSPACE_MAX_WEIGHTS 3u
+
+namespace AsdfAnim
+{
+	// Blends any number of clips placed in a parameter space
+	// All the clips share a sync phase, so clips of different durations and numbers of steps stay in step like in a synced blend
+	class BlendSpaceNode : public BlendNode
+	{
+	public:
+		// Playback of one instance, followed in the state block by the key cursors of every sample
+		struct State
+		{
+			std::array<float, 2> parameter;
+			SyncPhase phase;
+			// Samples with a weight at the last Advance(), the first weightCount are used and their weights sum to 1
+			std::array<uint32_t, BLENDSPACE_MAX_WEIGHTS> samples;
+			std::array<float, BLENDSPACE_MAX_WEIGHTS> weights;
+			uint32_t weightCount;
+		};
+
+		BlendSpaceNode(const gef::SkeletonPose& bindPose);
+
+		void InitState(State& state) const { state = {}; state.parameter = a_Parameter; }
+		size_t GetCursorCount() const { return v_Samples.size() * ClipSampler::GetMaxCursorCount(r_BindPose); }
+
+		// Returns the index of the sample, or UINT32_MAX without a clip. The y coordinate is ignored by 1D spaces
+		uint32_t AddSample(const Clip* clip, float x, float y = 0.f);
+		void RemoveSample(uint32_t index);
+		void SetSampleClip(uint32_t index, const Clip* clip);
+		void SetSamplePosition(uint32_t index, float x, float y = 0.f);
+		// Binds the samplers of the clip to the representation it uses now, never during an update
+		void RebindClip(const Clip* clip);
+
+		size_t GetSampleCount() const { return v_Samples.size(); }
+		const Clip* GetSampleClip(uint32_t index) const { return v_Samples[index].clip; }
+		const std::array<float, 2>& GetSamplePosition(uint32_t index) const { return v_Samples[index].position; }
+		// Weight of the sample at the last update of the instance
+		static float GetSampleWeight(const State& state, uint32_t index);
+
+		// Parameter new instances start with, a running instance is edited through BlendTree::GetParameterPtr()
+		void SetParameter(float x, float y = 0.f) { a_Parameter = { x, y }; }
+		float* GetParameterPtr() { return a_Parameter.data(); }
+		const std::array<float, 2>& GetParameter() const { return a_Parameter; }
+		void SetPlaybackSpeed(float speed) { m_PlaybackSpeed = speed; }
+		float GetPlaybackSpeed() const { return m_PlaybackSpeed; }
+		bool HasSamples() const { return !v_Samples.empty(); }
+
+		// Works out the sample weights and advances the phase by the weighted step duration of their clips
+		void Advance(State& state, float frameTime) const;
+		// Samples every clip with a weight and blends them in a single pass, each joint is summed over the clips and normalised at once
+		// There are no intermediate poses like with a chain of two-way blends, there must be samples
+		// The weights are the ones of the last Advance() of the state. The first clip is sampled in the pose, the others in the
+		// BLENDSPACE_MAX_WEIGHTS - 1 scratch poses
+		void SamplePose(const State& state, uint32_t* cursors, SoaPose* const* scratch, SoaPose& pose) const;
+
+	protected:
+		// Fills the weights of the state from its parameter, the weights sum to 1
+		virtual void CalculateWeights(State& state) const = 0;
+		virtual void SamplesChanged() {}
+		static void AddWeight(State& state, uint32_t sample, float weight);
+
+	protected:
+		struct Sample
+		{
+			const Clip* clip;
+			std::array<float, 2> position;
+			ClipSampler sampler;
+		};
+
+		std::vector<Sample> v_Samples;
+		std::array<float, 2> a_Parameter;
+		float m_PlaybackSpeed;
+	};
+
+	// Samples on a line, the two around the parameter are blended
+	class BlendSpace1DNode : public BlendSpaceNode
+	{
+	public:
+		BlendSpace1DNode(const gef::SkeletonPose& bindPose);
+
+	protected:
+		void CalculateWeights(State& state) const override;
+	};
+
+	// Samples on a plane, triangulated so that at most three of them are blended
+	// A parameter outside of the triangles is clamped to the closest edge
+	class BlendSpace2DNode : public BlendSpaceNode
+	{
+	public:
+		BlendSpace2DNode(const gef::SkeletonPose& bindPose);
+
+		const std::vector<std::array<uint32_t, 3>>& GetTriangles() const { return v_Triangles; }
+
+	protected:
+		void CalculateWeights(State& state) const override;
+		// Delaunay triangulation, blend spaces only have a handful of samples so every triangle is tested
+		void SamplesChanged() override;
+
+	private:
+		std::vector<std::array<uint32_t, 3>> v_Triangles;
+	};
+}
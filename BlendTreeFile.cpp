@@ -0,0 +1,796 @@
+#include "BlendTreeFile.h"
+#include "BlendNode.h"
+#include "BlendSpaceNode.h"
+#include "StateMachineNode.h"
+#include "BoneMask.h"
+#include "animation/skeleton.h"
+#include "rapidjson/document.h"
+#include "rapidjson/prettywriter.h"
+#include "rapidjson/stringbuffer.h"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+using namespace AsdfAnim;
+
+#define BLENDTREE_FILE_VERSION 3
+// The graphs have no node limit, a count past this is taken for a corrupted file rather than allocated
+#define BLENDTREE_FILE_MAXNODES (1u << 20)
+
+namespace
+{
+	struct FileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t jointCount;			// The key cursors in the state depend on the skeleton
+		uint32_t stringCount;
+		uint32_t parameterCount;
+		uint32_t nodeCount;
+		uint32_t sampleCount;
+		uint32_t stateTransitionCount;
+		uint32_t conditionCount;
+		uint32_t instructionCount;
+		uint32_t poseBufferCount;
+		uint32_t transitionCount;
+		uint32_t stateSize;
+		uint32_t programValid;
+	};
+
+	struct InstructionRecord
+	{
+		uint32_t op;
+		uint32_t node;
+		std::array<uint32_t, 4> inputs;
+		uint32_t state;
+		uint32_t stateSize;
+		uint32_t poses;
+		uint32_t mask;					// Index in the string table, UINT32_MAX for the whole pose. Not read back, the masks follow from the program
+	};
+
+	// Indexed by NodeType_
+	const char* k_NodeTypeNames[] = { "output", "clip", "linear_blend", "linear_blend_sync", "transition", "ragdoll", "blend_space_1d", "blend_space_2d", "additive", "masked_blend", "state_machine", "mirror" };
+	const size_t k_NodeTypeCount = sizeof(k_NodeTypeNames) / sizeof(k_NodeTypeNames[0]);
+	// Indexed by TransitionType_ + 1
+	const char* k_TransitionTypeNames[] = { "undefined", "frozen", "frozen_sync", "smooth", "smooth_sync", "inertialized" };
+	const size_t k_TransitionTypeCount = sizeof(k_TransitionTypeNames) / sizeof(k_TransitionTypeNames[0]);
+	// Indexed by ParameterType_
+	const char* k_ParameterTypeNames[] = { "float", "bool", "trigger" };
+	const size_t k_ParameterTypeCount = sizeof(k_ParameterTypeNames) / sizeof(k_ParameterTypeNames[0]);
+	// Indexed by ConditionOp_
+	const char* k_ConditionOpNames[] = { "greater", "less", "true", "false", "trigger", "state_time" };
+	const size_t k_ConditionOpCount = sizeof(k_ConditionOpNames) / sizeof(k_ConditionOpNames[0]);
+
+	int32_t FindName(const char* const* names, size_t count, const char* name)
+	{
+		for (size_t i = 0u; i < count; ++i)
+			if (std::strcmp(names[i], name) == 0) return static_cast<int32_t>(i);
+		return -1;
+	}
+
+	const Clip* FindClip(const BlendTreeBindings& bindings, const std::string& name)
+	{
+		for (const Clip* clip : bindings.clips)
+			if (clip->name == name) return clip;
+		return nullptr;
+	}
+
+	const BoneMask* FindMask(const BlendTreeBindings& bindings, const std::string& name)
+	{
+		for (const BoneMask* mask : bindings.masks)
+			if (mask->GetName() == name) return mask;
+		return nullptr;
+	}
+
+	// Whether the node compiles to the operation, with the inputs the operation reads, see BlendTreeTemplate::CompileNode()
+	bool MatchesNode(BlendOp_ op, const std::array<uint32_t, 4>& inputs, const BlendNode& node)
+	{
+		const auto has = [&inputs](uint32_t slot) { return inputs[slot] != UINT32_MAX; };
+		if (op != BlendOp_::BlendOp_StateMachine && (has(2u) || has(3u))) return false;
+		switch (node.GetType())
+		{
+		case NodeType_::NodeType_Clip:				return op == BlendOp_::BlendOp_Sample;
+		case NodeType_::NodeType_LinearBlend:		return op == BlendOp_::BlendOp_Blend && has(0u) && has(1u);
+		case NodeType_::NodeType_LinearBlendSync:	return op == BlendOp_::BlendOp_SyncBlend && has(0u) && has(1u);
+		case NodeType_::NodeType_Transition:		return op == BlendOp_::BlendOp_Transition && has(0u) && has(1u);
+		case NodeType_::NodeType_BlendSpace1D:
+		case NodeType_::NodeType_BlendSpace2D:		return op == BlendOp_::BlendOp_BlendSpace;
+		case NodeType_::NodeType_Additive:			return op == BlendOp_::BlendOp_Additive;
+		case NodeType_::NodeType_MaskedBlend:		return op == BlendOp_::BlendOp_MaskedBlend && has(0u) && has(1u) && static_cast<const MaskedBlendNode&>(node).GetMask();
+		case NodeType_::NodeType_StateMachine:		return op == BlendOp_::BlendOp_StateMachine && std::count_if(inputs.begin(), inputs.end(), [](uint32_t input) { return input != UINT32_MAX; }) > 1;
+		case NodeType_::NodeType_Mirror:			return op == BlendOp_::BlendOp_Mirror && has(0u) && static_cast<const MirrorNode&>(node).GetMirrorMap();
+		default:									return false;		// The output node, and the ragdolls which are bound after loading
+		}
+	}
+
+	// Whether the inputs of the nodes loop back to them, a single depth first walk over the whole graph
+	bool HasCycle(const BlendTreeTemplate& blendTree)
+	{
+		const std::vector<BlendNode*>& tree = blendTree.GetTree();
+		std::vector<uint8_t> marks(tree.size(), 0u);				// 1 on the current path, 2 once all its inputs were walked
+		std::vector<std::pair<uint32_t, uint32_t>> path;			// Node and next input slot
+		for (uint32_t root = 0u; root < tree.size(); ++root)
+		{
+			if (marks[root]) continue;
+			marks[root] = 1u;
+			path.push_back({ root, 0u });
+			while (!path.empty())
+			{
+				const uint32_t node = path.back().first, slot = path.back().second++;
+				if (slot == tree[node]->GetInputs().size())
+				{
+					marks[node] = 2u;
+					path.pop_back();
+					continue;
+				}
+				const BlendNode* input = tree[node]->GetInputs()[slot];
+				if (!input) continue;
+				const uint32_t index = blendTree.GetTreeIndex(input);
+				if (marks[index] == 1u) return true;
+				if (marks[index] == 0u)
+				{
+					marks[index] = 1u;
+					path.push_back({ index, 0u });
+				}
+			}
+		}
+		return false;
+	}
+
+	void WriteString(std::ofstream& file, const std::string& string)
+	{
+		const uint32_t length = static_cast<uint32_t>(string.size());
+		file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+		file.write(string.data(), length);
+	}
+
+	bool ReadString(std::ifstream& file, std::string& string)
+	{
+		uint32_t length = 0u;
+		if (!file.read(reinterpret_cast<char*>(&length), sizeof(length))) return false;
+		string.resize(length);
+		return length == 0u || file.read(&string[0], length);
+	}
+}
+
+uint32_t BlendTreeFile::Graph::AddString(const std::string& string)
+{
+	for (uint32_t i = 0u; i < strings.size(); ++i)
+		if (strings[i] == string) return i;
+	strings.push_back(string);
+	return static_cast<uint32_t>(strings.size() - 1u);
+}
+
+void BlendTreeFile::Describe(const BlendTreeTemplate& blendTree, Graph& graph)
+{
+	const std::vector<BlendParameter>& parameters = blendTree.GetParameters();
+	for (const BlendParameter& parameter : parameters)
+		graph.parameters.push_back({ graph.AddString(parameter.name), static_cast<uint32_t>(parameter.type), parameter.defaultValue });
+
+	const std::vector<BlendNode*>& tree = blendTree.GetTree();
+	for (const BlendNode* node : tree)
+	{
+		NodeRecord record{ static_cast<int32_t>(node->GetType()), { -1, -1, -1, -1 }, { 0.f, 0.f, 0.f }, 0, UINT32_MAX, 0u, 0u, { UINT32_MAX, UINT32_MAX } };
+		for (size_t slot = 0u; slot < record.inputs.size(); ++slot)
+			if (node->GetInputs()[slot])
+				record.inputs[slot] = static_cast<int32_t>(blendTree.GetTreeIndex(node->GetInputs()[slot]));
+
+		// Bindings are saved by name, a binding to an undeclared parameter is dropped
+		for (uint32_t slot = 0u; slot < node->GetParameterSlotCount(); ++slot)
+		{
+			const uint32_t index = blendTree.FindParameter(node->GetBoundParameter(slot));
+			if (index != UINT32_MAX) record.parameters[slot] = graph.AddString(parameters[index].name);
+		}
+
+		switch (node->GetType())
+		{
+		case NodeType_::NodeType_Clip:
+		{
+			const ClipNode* clipNode = static_cast<const ClipNode*>(node);
+			if (clipNode->HasClip()) record.reference = graph.AddString(clipNode->GetClip()->name);
+			record.values[0] = clipNode->GetPlaybackSpeed();
+			record.setting = clipNode->IsLooping() ? 1 : 0;
+			break;
+		}
+		case NodeType_::NodeType_LinearBlend:
+		case NodeType_::NodeType_LinearBlendSync:
+			record.values[0] = static_cast<const LinearBlendNode*>(node)->GetBlendValue();
+			break;
+		case NodeType_::NodeType_Transition:
+		{
+			const TransitionNode* transition = static_cast<const TransitionNode*>(node);
+			record.values[0] = transition->GetTransitionTime();
+			record.values[1] = transition->IsPoseMatching() ? 1.f : 0.f;
+			record.setting = static_cast<int32_t>(transition->GetTransitionType());
+			break;
+		}
+		case NodeType_::NodeType_Ragdoll:
+			record.setting = static_cast<const RagdollNode*>(node)->IsActive() ? 1 : 0;
+			break;
+		case NodeType_::NodeType_BlendSpace1D:
+		case NodeType_::NodeType_BlendSpace2D:
+		{
+			const BlendSpaceNode* blendSpace = static_cast<const BlendSpaceNode*>(node);
+			record.values = { blendSpace->GetParameter()[0], blendSpace->GetParameter()[1], blendSpace->GetPlaybackSpeed() };
+			record.firstSample = static_cast<uint32_t>(graph.samples.size());
+			record.sampleCount = static_cast<uint32_t>(blendSpace->GetSampleCount());
+			for (uint32_t i = 0u; i < blendSpace->GetSampleCount(); ++i)
+			{
+				const std::array<float, 2>& position = blendSpace->GetSamplePosition(i);
+				graph.samples.push_back({ graph.AddString(blendSpace->GetSampleClip(i)->name), position[0], position[1] });
+			}
+			break;
+		}
+		case NodeType_::NodeType_Additive:
+		{
+			const AdditiveNode* additive = static_cast<const AdditiveNode*>(node);
+			if (additive->GetClip()) record.reference = graph.AddString(additive->GetClip()->name);
+			record.values[0] = additive->GetBlendValue();
+			record.values[1] = additive->GetPlaybackSpeed();
+			break;
+		}
+		case NodeType_::NodeType_MaskedBlend:
+		{
+			const MaskedBlendNode* masked = static_cast<const MaskedBlendNode*>(node);
+			if (masked->GetMask()) record.reference = graph.AddString(masked->GetMask()->GetName());
+			record.values[0] = masked->GetBlendValue();
+			break;
+		}
+		case NodeType_::NodeType_Mirror:
+			record.setting = static_cast<const MirrorNode*>(node)->IsMirrored() ? 1 : 0;
+			break;
+		case NodeType_::NodeType_StateMachine:
+		{
+			// A condition on an undeclared parameter is saved without one, it never holds
+			const StateMachineNode* stateMachine = static_cast<const StateMachineNode*>(node);
+			record.setting = static_cast<int32_t>(stateMachine->GetEntryState());
+			record.firstSample = static_cast<uint32_t>(graph.transitions.size());
+			record.sampleCount = static_cast<uint32_t>(stateMachine->GetTransitionCount());
+			for (uint32_t t = 0u; t < stateMachine->GetTransitionCount(); ++t)
+			{
+				const StateMachineNode::Transition& transition = stateMachine->GetTransition(t);
+				graph.transitions.push_back({ transition.from, transition.to, static_cast<int32_t>(transition.type), transition.duration,
+					static_cast<uint32_t>(graph.conditions.size()), static_cast<uint32_t>(transition.conditions.size()) });
+				for (const StateMachineNode::Condition& condition : transition.conditions)
+				{
+					const uint32_t index = blendTree.FindParameter(condition.parameter);
+					graph.conditions.push_back({ static_cast<uint32_t>(condition.op), index != UINT32_MAX ? graph.AddString(parameters[index].name) : UINT32_MAX, condition.threshold });
+				}
+			}
+			break;
+		}
+		default:
+			break;
+		}
+		graph.nodes.push_back(record);
+	}
+}
+
+BlendTreeTemplate* BlendTreeFile::Build(const Graph& graph, const gef::SkeletonPose& bindPose, const BlendTreeBindings& bindings)
+{
+	// The template creates the output node itself
+	if (graph.nodes.empty() || graph.nodes.size() > BLENDTREE_FILE_MAXNODES || graph.nodes.front().type != static_cast<int32_t>(NodeType_::NodeType_Output)) return nullptr;
+	for (const NodeRecord& record : graph.nodes)
+		if (record.type < 0 || record.type >= static_cast<int32_t>(k_NodeTypeCount)) return nullptr;
+
+	BlendTreeTemplate* blendTree = new BlendTreeTemplate(bindPose);
+	for (size_t i = 1u; i < graph.nodes.size(); ++i)
+		blendTree->CreateNode(static_cast<NodeType_>(graph.nodes[i].type));
+	const std::vector<BlendNode*>& tree = blendTree->GetTree();
+
+	bool valid = true;
+	for (const ParameterRecord& parameter : graph.parameters)
+		valid &= parameter.name < graph.strings.size() && parameter.type < k_ParameterTypeCount &&
+			blendTree->AddParameter(graph.strings[parameter.name], static_cast<ParameterType_>(parameter.type), parameter.defaultValue);
+	const auto findClip = [&](uint32_t reference) -> const Clip*
+	{
+		const Clip* clip = reference < graph.strings.size() ? FindClip(bindings, graph.strings[reference]) : nullptr;
+		valid &= clip != nullptr;
+		return clip;
+	};
+
+	// Settings first, the synchronised blends read the clips of their inputs
+	for (size_t i = 0u; i < graph.nodes.size() && valid; ++i)
+	{
+		const NodeRecord& record = graph.nodes[i];
+		BlendNode* node = tree[i];
+		for (uint32_t slot = 0u; slot < node->GetParameterSlotCount(); ++slot)
+			if (record.parameters[slot] < graph.strings.size()) node->a_Parameters[slot] = HashParameter(graph.strings[record.parameters[slot]]);
+
+		switch (node->GetType())
+		{
+		case NodeType_::NodeType_Clip:
+		{
+			ClipNode* clipNode = static_cast<ClipNode*>(node);
+			if (record.reference != UINT32_MAX) clipNode->SetClip(findClip(record.reference));
+			clipNode->SetPlaybackSpeed(record.values[0]);
+			clipNode->SetLooping(record.setting != 0);
+			break;
+		}
+		case NodeType_::NodeType_LinearBlend:
+		case NodeType_::NodeType_LinearBlendSync:
+			static_cast<LinearBlendNode*>(node)->SetBlendValue(record.values[0]);
+			break;
+		case NodeType_::NodeType_Transition:
+		{
+			TransitionNode* transition = static_cast<TransitionNode*>(node);
+			transition->SetTransitionTime(record.values[0]);
+			transition->SetPoseMatching(record.values[1] != 0.f);
+			if (record.setting >= -1 && record.setting < static_cast<int32_t>(k_TransitionTypeCount) - 1)
+				transition->SetTransitionType(static_cast<TransitionType_>(record.setting));
+			break;
+		}
+		case NodeType_::NodeType_Ragdoll:
+			static_cast<RagdollNode*>(node)->SetActive(record.setting != 0);
+			break;
+		case NodeType_::NodeType_BlendSpace1D:
+		case NodeType_::NodeType_BlendSpace2D:
+		{
+			BlendSpaceNode* blendSpace = static_cast<BlendSpaceNode*>(node);
+			blendSpace->SetParameter(record.values[0], record.values[1]);
+			blendSpace->SetPlaybackSpeed(record.values[2]);
+			if (static_cast<size_t>(record.firstSample) + record.sampleCount > graph.samples.size()) valid = false;
+			for (uint32_t s = 0u; s < record.sampleCount && valid; ++s)
+			{
+				const SampleRecord& sample = graph.samples[record.firstSample + s];
+				const Clip* clip = findClip(sample.clip);
+				if (clip) blendSpace->AddSample(clip, sample.x, sample.y);
+			}
+			break;
+		}
+		case NodeType_::NodeType_Additive:
+		{
+			AdditiveNode* additive = static_cast<AdditiveNode*>(node);
+			if (record.reference != UINT32_MAX) valid &= additive->SetClip(findClip(record.reference));
+			additive->SetBlendValue(record.values[0]);
+			additive->SetPlaybackSpeed(record.values[1]);
+			break;
+		}
+		case NodeType_::NodeType_MaskedBlend:
+		{
+			MaskedBlendNode* masked = static_cast<MaskedBlendNode*>(node);
+			if (record.reference != UINT32_MAX)
+			{
+				const BoneMask* mask = record.reference < graph.strings.size() ? FindMask(bindings, graph.strings[record.reference]) : nullptr;
+				valid &= mask != nullptr;
+				masked->SetMask(mask);
+			}
+			masked->SetBlendValue(record.values[0]);
+			break;
+		}
+		case NodeType_::NodeType_Mirror:
+		{
+			MirrorNode* mirror = static_cast<MirrorNode*>(node);
+			mirror->SetMirrorMap(bindings.mirrorMap);
+			mirror->SetMirrored(record.setting != 0);
+			break;
+		}
+		case NodeType_::NodeType_StateMachine:
+		{
+			StateMachineNode* stateMachine = static_cast<StateMachineNode*>(node);
+			stateMachine->SetEntryState(static_cast<uint32_t>(std::max(record.setting, 0)));
+			if (static_cast<size_t>(record.firstSample) + record.sampleCount > graph.transitions.size()) valid = false;
+			for (uint32_t t = 0u; t < record.sampleCount && valid; ++t)
+			{
+				const TransitionRecord& transition = graph.transitions[record.firstSample + t];
+				valid = (transition.from == STATEMACHINE_ANY_STATE || transition.from < STATEMACHINE_MAXSTATES) && transition.to < STATEMACHINE_MAXSTATES &&
+					transition.type >= -1 && transition.type < static_cast<int32_t>(k_TransitionTypeCount) - 1 &&
+					static_cast<size_t>(transition.firstCondition) + transition.conditionCount <= graph.conditions.size();
+				if (!valid) break;
+
+				const uint32_t index = stateMachine->AddTransition(transition.from, transition.to, transition.duration, static_cast<TransitionType_>(transition.type));
+				for (uint32_t c = 0u; c < transition.conditionCount && valid; ++c)
+				{
+					const ConditionRecord& condition = graph.conditions[transition.firstCondition + c];
+					valid = condition.op < k_ConditionOpCount && (condition.parameter == UINT32_MAX || condition.parameter < graph.strings.size());
+					if (valid) stateMachine->AddCondition(index, static_cast<ConditionOp_>(condition.op),
+						condition.parameter != UINT32_MAX ? HashParameter(graph.strings[condition.parameter]) : BLEND_PARAMETER_NONE, condition.threshold);
+				}
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	// The nodes are connected directly, the editor checks would walk the graph on every connection
+	// A hand edited file still cannot feed a synchronised blend with another node than a clip, or create a cycle, checked once the graph is complete
+	for (size_t i = 0u; i < graph.nodes.size() && valid; ++i)
+	{
+		BlendNode* node = tree[i];
+		for (uint32_t slot = 0u; slot < node->a_Inputs.size() && valid; ++slot)
+		{
+			const int32_t input = graph.nodes[i].inputs[slot];
+			if (input < 0) continue;
+			valid = static_cast<size_t>(input) < graph.nodes.size() &&
+				(node->GetType() != NodeType_::NodeType_LinearBlendSync || tree[input]->GetType() == NodeType_::NodeType_Clip);
+			if (valid) node->Connect(slot, tree[input]);
+		}
+	}
+	valid = valid && !HasCycle(*blendTree);
+	++blendTree->m_GraphVersion;
+
+	if (!valid)
+	{
+		delete blendTree;
+		return nullptr;
+	}
+	return blendTree;
+}
+
+bool BlendTreeFile::Save(BlendTreeTemplate& blendTree, const std::string& filepath)
+{
+	blendTree.Compile();
+	Graph graph;
+	Describe(blendTree, graph);
+
+	std::vector<InstructionRecord> program;
+	for (size_t i = 0u; i < blendTree.v_Program.size(); ++i)
+	{
+		const BlendTreeTemplate::BlendInstruction& instruction = blendTree.v_Program[i];
+		const BoneMask* mask = blendTree.v_Masks[i];
+		program.push_back({ static_cast<uint32_t>(instruction.op), blendTree.GetTreeIndex(instruction.node),
+			instruction.inputs, instruction.state, instruction.stateSize, instruction.poses, mask ? graph.AddString(mask->GetName()) : UINT32_MAX });
+	}
+
+	std::ofstream file(filepath, std::ios::binary | std::ios::trunc);
+	if (!file) return false;
+
+	FileHeader header = { { 'A', 'B', 'T', 'R' }, BLENDTREE_FILE_VERSION, static_cast<uint32_t>(blendTree.GetBindPose().local_pose().size()),
+		static_cast<uint32_t>(graph.strings.size()), static_cast<uint32_t>(graph.parameters.size()), static_cast<uint32_t>(graph.nodes.size()), static_cast<uint32_t>(graph.samples.size()),
+		static_cast<uint32_t>(graph.transitions.size()), static_cast<uint32_t>(graph.conditions.size()), static_cast<uint32_t>(program.size()), blendTree.m_PoseBufferCount, blendTree.m_TransitionCount, static_cast<uint32_t>(blendTree.m_StateSize),
+		blendTree.m_ProgramValid ? 1u : 0u };
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	for (const std::string& string : graph.strings) WriteString(file, string);
+	file.write(reinterpret_cast<const char*>(graph.parameters.data()), sizeof(ParameterRecord) * graph.parameters.size());
+	file.write(reinterpret_cast<const char*>(graph.nodes.data()), sizeof(NodeRecord) * graph.nodes.size());
+	file.write(reinterpret_cast<const char*>(graph.samples.data()), sizeof(SampleRecord) * graph.samples.size());
+	file.write(reinterpret_cast<const char*>(graph.transitions.data()), sizeof(TransitionRecord) * graph.transitions.size());
+	file.write(reinterpret_cast<const char*>(graph.conditions.data()), sizeof(ConditionRecord) * graph.conditions.size());
+	file.write(reinterpret_cast<const char*>(program.data()), sizeof(InstructionRecord) * program.size());
+	file.write(reinterpret_cast<const char*>(blendTree.v_DefaultState.data()), blendTree.v_DefaultState.size());
+	return file.good();
+}
+
+BlendTreeTemplate* BlendTreeFile::Load(const std::string& filepath, const gef::SkeletonPose& bindPose, const BlendTreeBindings& bindings)
+{
+	std::ifstream file(filepath, std::ios::binary);
+	if (!file) return nullptr;
+
+	FileHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) return nullptr;
+	if (std::string(header.magic, 4u) != "ABTR" || header.version != BLENDTREE_FILE_VERSION) return nullptr;
+	if (header.nodeCount > BLENDTREE_FILE_MAXNODES) return nullptr;
+
+	Graph graph;
+	graph.strings.resize(header.stringCount);
+	for (std::string& string : graph.strings)
+		if (!ReadString(file, string)) return nullptr;
+	graph.parameters.resize(header.parameterCount);
+	graph.nodes.resize(header.nodeCount);
+	graph.samples.resize(header.sampleCount);
+	graph.transitions.resize(header.stateTransitionCount);
+	graph.conditions.resize(header.conditionCount);
+	std::vector<InstructionRecord> program(header.instructionCount);
+	std::vector<uint8_t> defaultState(header.stateSize);
+	file.read(reinterpret_cast<char*>(graph.parameters.data()), sizeof(ParameterRecord) * graph.parameters.size());
+	file.read(reinterpret_cast<char*>(graph.nodes.data()), sizeof(NodeRecord) * graph.nodes.size());
+	file.read(reinterpret_cast<char*>(graph.samples.data()), sizeof(SampleRecord) * graph.samples.size());
+	file.read(reinterpret_cast<char*>(graph.transitions.data()), sizeof(TransitionRecord) * graph.transitions.size());
+	file.read(reinterpret_cast<char*>(graph.conditions.data()), sizeof(ConditionRecord) * graph.conditions.size());
+	file.read(reinterpret_cast<char*>(program.data()), sizeof(InstructionRecord) * program.size());
+	file.read(reinterpret_cast<char*>(defaultState.data()), defaultState.size());
+	if (!file) return nullptr;
+
+	BlendTreeTemplate* blendTree = Build(graph, bindPose, bindings);
+	if (!blendTree) return nullptr;
+
+	// The program is only valid for the skeleton it was compiled against, and for the graph it was compiled from
+	// Each instruction must be the operation its node compiles to, with the inputs and the state size of that operation, it is compiled again otherwise
+	// Ragdolls are bound after loading, a program that drives one is compiled once it is there
+	// A program mirroring poses needs the mirror map of the skeleton, it is compiled again without one
+	bool usable = header.jointCount == bindPose.local_pose().size();
+	std::vector<BlendTreeTemplate::BlendInstruction> instructions;
+	for (const InstructionRecord& record : program)
+	{
+		if (!usable) break;
+		const BlendOp_ op = static_cast<BlendOp_>(record.op);
+		const size_t index = instructions.size();
+		usable = record.node < blendTree->GetTree().size() && MatchesNode(op, record.inputs, *blendTree->GetTree()[record.node]) &&
+			std::all_of(record.inputs.begin(), record.inputs.end(), [index](uint32_t input) { return input == UINT32_MAX || input < index; }) &&
+			record.stateSize == BlendTreeTemplate::GetStateSize(op, blendTree->GetTree()[record.node]) && record.state + static_cast<size_t>(record.stateSize) <= header.stateSize &&
+			(record.poses == UINT32_MAX || record.poses < header.transitionCount);
+		BlendNode* node = usable ? blendTree->GetTree()[record.node] : nullptr;
+		instructions.push_back({ op, node, node ? node->GetHandle() : NodeHandle{ UINT32_MAX, 0u }, record.inputs, record.state, record.stateSize, record.poses, { UINT32_MAX, UINT32_MAX } });
+	}
+
+	if (usable)
+	{
+		blendTree->v_Program.swap(instructions);
+		for (uint32_t i = 0u; i < blendTree->v_Program.size(); ++i) blendTree->map_Instructions[blendTree->v_Program[i].handle] = i;
+		blendTree->BindParameters();
+		blendTree->PropagateMasks();	// The masks follow from the program as well, the intersections of nested layers are not bound masks
+		blendTree->PlanTasks();			// The branches are not saved, they follow from the program
+		blendTree->m_PoseBufferCount = header.poseBufferCount;
+		blendTree->m_TransitionCount = header.transitionCount;
+		blendTree->m_StateSize = header.stateSize;
+		blendTree->v_DefaultState.swap(defaultState);
+		blendTree->m_ProgramValid = header.programValid != 0u;
+		blendTree->m_CompiledVersion = blendTree->m_GraphVersion;
+		++blendTree->m_ProgramVersion;
+	}
+	return blendTree;
+}
+
+bool BlendTreeFile::SaveJson(const BlendTreeTemplate& blendTree, const std::string& filepath)
+{
+	Graph graph;
+	Describe(blendTree, graph);
+
+	rapidjson::StringBuffer buffer;
+	rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+	writer.StartObject();
+	writer.Key("version");
+	writer.Uint(BLENDTREE_FILE_VERSION);
+
+	const auto writeReference = [&](const char* key, uint32_t reference)
+	{
+		if (reference == UINT32_MAX) return;
+		writer.Key(key);	writer.String(graph.strings[reference].c_str());
+	};
+
+	writer.Key("parameters");
+	writer.StartArray();
+	for (const ParameterRecord& parameter : graph.parameters)
+	{
+		writer.StartObject();
+		writer.Key("name");		writer.String(graph.strings[parameter.name].c_str());
+		writer.Key("type");		writer.String(k_ParameterTypeNames[parameter.type]);
+		writer.Key("default");	writer.Double(parameter.defaultValue);
+		writer.EndObject();
+	}
+	writer.EndArray();
+
+	// Nodes in tree order, the inputs are indices in this array
+	writer.Key("nodes");
+	writer.StartArray();
+	for (const NodeRecord& record : graph.nodes)
+	{
+		writer.StartObject();
+		writer.Key("type");		writer.String(k_NodeTypeNames[record.type]);
+		writer.Key("inputs");
+		writer.StartArray();
+		for (int32_t input : record.inputs) writer.Int(input);
+		writer.EndArray();
+		if (record.parameters[0] != UINT32_MAX || record.parameters[1] != UINT32_MAX)
+		{
+			// Bound parameters by slot, an empty name leaves the slot unbound
+			writer.Key("parameters");
+			writer.StartArray();
+			for (uint32_t parameter : record.parameters) writer.String(parameter != UINT32_MAX ? graph.strings[parameter].c_str() : "");
+			writer.EndArray();
+		}
+
+		switch (static_cast<NodeType_>(record.type))
+		{
+		case NodeType_::NodeType_Clip:
+			writeReference("clip", record.reference);
+			writer.Key("speed");	writer.Double(record.values[0]);
+			writer.Key("looping");	writer.Bool(record.setting != 0);
+			break;
+		case NodeType_::NodeType_LinearBlend:
+		case NodeType_::NodeType_LinearBlendSync:
+			writer.Key("blend");	writer.Double(record.values[0]);
+			break;
+		case NodeType_::NodeType_Transition:
+			writer.Key("time");			writer.Double(record.values[0]);
+			writer.Key("transition");	writer.String(k_TransitionTypeNames[record.setting + 1]);
+			writer.Key("poseMatching");	writer.Bool(record.values[1] != 0.f);
+			break;
+		case NodeType_::NodeType_Ragdoll:
+			writer.Key("active");	writer.Bool(record.setting != 0);
+			break;
+		case NodeType_::NodeType_BlendSpace1D:
+		case NodeType_::NodeType_BlendSpace2D:
+			writer.Key("parameter");
+			writer.StartArray();	writer.Double(record.values[0]);	writer.Double(record.values[1]);	writer.EndArray();
+			writer.Key("speed");	writer.Double(record.values[2]);
+			writer.Key("samples");
+			writer.StartArray();
+			for (uint32_t s = 0u; s < record.sampleCount; ++s)
+			{
+				const SampleRecord& sample = graph.samples[record.firstSample + s];
+				writer.StartObject();
+				writeReference("clip", sample.clip);
+				writer.Key("x");	writer.Double(sample.x);
+				writer.Key("y");	writer.Double(sample.y);
+				writer.EndObject();
+			}
+			writer.EndArray();
+			break;
+		case NodeType_::NodeType_Additive:
+			writeReference("clip", record.reference);
+			writer.Key("blend");	writer.Double(record.values[0]);
+			writer.Key("speed");	writer.Double(record.values[1]);
+			break;
+		case NodeType_::NodeType_MaskedBlend:
+			writeReference("mask", record.reference);
+			writer.Key("blend");	writer.Double(record.values[0]);
+			break;
+		case NodeType_::NodeType_Mirror:
+			writer.Key("mirrored");	writer.Bool(record.setting != 0);
+			break;
+		case NodeType_::NodeType_StateMachine:
+			// The states are the inputs, a transition from any state has no "from"
+			writer.Key("entry");	writer.Int(record.setting);
+			writer.Key("transitions");
+			writer.StartArray();
+			for (uint32_t t = 0u; t < record.sampleCount; ++t)
+			{
+				const TransitionRecord& transition = graph.transitions[record.firstSample + t];
+				writer.StartObject();
+				if (transition.from != STATEMACHINE_ANY_STATE)
+				{
+					writer.Key("from");	writer.Uint(transition.from);
+				}
+				writer.Key("to");			writer.Uint(transition.to);
+				writer.Key("transition");	writer.String(k_TransitionTypeNames[transition.type + 1]);
+				writer.Key("time");			writer.Double(transition.duration);
+				writer.Key("conditions");
+				writer.StartArray();
+				for (uint32_t c = 0u; c < transition.conditionCount; ++c)
+				{
+					const ConditionRecord& condition = graph.conditions[transition.firstCondition + c];
+					writer.StartObject();
+					writer.Key("op");			writer.String(k_ConditionOpNames[condition.op]);
+					writeReference("parameter", condition.parameter);
+					writer.Key("threshold");	writer.Double(condition.threshold);
+					writer.EndObject();
+				}
+				writer.EndArray();
+				writer.EndObject();
+			}
+			writer.EndArray();
+			break;
+		default:
+			break;
+		}
+		writer.EndObject();
+	}
+	writer.EndArray();
+	writer.EndObject();
+
+	std::ofstream file(filepath, std::ios::binary | std::ios::trunc);
+	if (!file) return false;
+	file.write(buffer.GetString(), buffer.GetSize());
+	return file.good();
+}
+
+BlendTreeTemplate* BlendTreeFile::LoadJson(const std::string& filepath, const gef::SkeletonPose& bindPose, const BlendTreeBindings& bindings)
+{
+	std::ifstream file(filepath, std::ios::binary);
+	if (!file) return nullptr;
+	std::stringstream content;
+	content << file.rdbuf();
+
+	rapidjson::Document doc;
+	doc.Parse(content.str().c_str());
+	if (doc.HasParseError() || !doc.IsObject()) return nullptr;
+	if (!doc.HasMember("version") || doc["version"].GetUint() != BLENDTREE_FILE_VERSION) return nullptr;
+	if (!doc.HasMember("nodes") || !doc["nodes"].IsArray()) return nullptr;
+
+	// Missing members keep the defaults of the nodes
+	Graph graph;
+	const auto readFloat = [](const rapidjson::Value& value, const char* key, float fallback) { return value.HasMember(key) ? value[key].GetFloat() : fallback; };
+	const auto readReference = [&graph](const rapidjson::Value& value, const char* key) { return value.HasMember(key) ? graph.AddString(value[key].GetString()) : UINT32_MAX; };
+
+	if (doc.HasMember("parameters"))
+	{
+		const rapidjson::Value& parameters = doc["parameters"];
+		for (unsigned i = 0u; i < parameters.Size(); ++i)
+		{
+			const rapidjson::Value& value = parameters[i];
+			const int32_t type = value.HasMember("type") ? FindName(k_ParameterTypeNames, k_ParameterTypeCount, value["type"].GetString()) : 0;
+			graph.parameters.push_back({ readReference(value, "name"), static_cast<uint32_t>(type), readFloat(value, "default", 0.f) });
+		}
+	}
+
+	const rapidjson::Value& nodes = doc["nodes"];
+	for (unsigned i = 0u; i < nodes.Size(); ++i)
+	{
+		const rapidjson::Value& value = nodes[i];
+		NodeRecord record{ -1, { -1, -1, -1, -1 }, { 0.f, 0.f, 0.f }, 0, UINT32_MAX, 0u, 0u, { UINT32_MAX, UINT32_MAX } };
+		if (value.HasMember("type")) record.type = FindName(k_NodeTypeNames, k_NodeTypeCount, value["type"].GetString());
+		if (value.HasMember("inputs"))
+		{
+			const rapidjson::Value& inputs = value["inputs"];
+			for (unsigned slot = 0u; slot < inputs.Size() && slot < record.inputs.size(); ++slot) record.inputs[slot] = inputs[slot].GetInt();
+		}
+		if (value.HasMember("parameters"))
+		{
+			const rapidjson::Value& parameters = value["parameters"];
+			for (unsigned slot = 0u; slot < parameters.Size() && slot < record.parameters.size(); ++slot)
+				if (parameters[slot].GetStringLength()) record.parameters[slot] = graph.AddString(parameters[slot].GetString());
+		}
+
+		switch (static_cast<NodeType_>(record.type))
+		{
+		case NodeType_::NodeType_Clip:
+			record.reference = readReference(value, "clip");
+			record.values[0] = readFloat(value, "speed", 1.f);
+			record.setting = !value.HasMember("looping") || value["looping"].GetBool() ? 1 : 0;
+			break;
+		case NodeType_::NodeType_LinearBlend:
+		case NodeType_::NodeType_LinearBlendSync:
+			record.values[0] = readFloat(value, "blend", 0.f);
+			break;
+		case NodeType_::NodeType_Transition:
+			record.values[0] = readFloat(value, "time", 1.f);
+			record.values[1] = value.HasMember("poseMatching") && value["poseMatching"].GetBool() ? 1.f : 0.f;
+			record.setting = value.HasMember("transition") ? FindName(k_TransitionTypeNames, k_TransitionTypeCount, value["transition"].GetString()) - 1 : -1;
+			break;
+		case NodeType_::NodeType_Ragdoll:
+			record.setting = value.HasMember("active") && value["active"].GetBool() ? 1 : 0;
+			break;
+		case NodeType_::NodeType_BlendSpace1D:
+		case NodeType_::NodeType_BlendSpace2D:
+			if (value.HasMember("parameter") && value["parameter"].Size() >= 2u)
+				record.values = { value["parameter"][0u].GetFloat(), value["parameter"][1u].GetFloat(), 1.f };
+			record.values[2] = readFloat(value, "speed", 1.f);
+			record.firstSample = static_cast<uint32_t>(graph.samples.size());
+			if (value.HasMember("samples"))
+			{
+				const rapidjson::Value& samples = value["samples"];
+				for (unsigned s = 0u; s < samples.Size(); ++s)
+					graph.samples.push_back({ readReference(samples[s], "clip"), readFloat(samples[s], "x", 0.f), readFloat(samples[s], "y", 0.f) });
+			}
+			record.sampleCount = static_cast<uint32_t>(graph.samples.size()) - record.firstSample;
+			break;
+		case NodeType_::NodeType_Additive:
+			record.reference = readReference(value, "clip");
+			record.values[0] = readFloat(value, "blend", 1.f);
+			record.values[1] = readFloat(value, "speed", 1.f);
+			break;
+		case NodeType_::NodeType_MaskedBlend:
+			record.reference = readReference(value, "mask");
+			record.values[0] = readFloat(value, "blend", 1.f);
+			break;
+		case NodeType_::NodeType_Mirror:
+			record.setting = !value.HasMember("mirrored") || value["mirrored"].GetBool() ? 1 : 0;
+			break;
+		case NodeType_::NodeType_StateMachine:
+			record.setting = value.HasMember("entry") ? value["entry"].GetInt() : 0;
+			record.firstSample = static_cast<uint32_t>(graph.transitions.size());
+			if (value.HasMember("transitions"))
+			{
+				const rapidjson::Value& transitions = value["transitions"];
+				for (unsigned t = 0u; t < transitions.Size(); ++t)
+				{
+					const rapidjson::Value& transition = transitions[t];
+					TransitionRecord transitionRecord{ transition.HasMember("from") ? transition["from"].GetUint() : STATEMACHINE_ANY_STATE,
+						transition.HasMember("to") ? transition["to"].GetUint() : 0u,
+						transition.HasMember("transition") ? FindName(k_TransitionTypeNames, k_TransitionTypeCount, transition["transition"].GetString()) - 1 : -1,
+						readFloat(transition, "time", 0.f), static_cast<uint32_t>(graph.conditions.size()), 0u };
+					if (transition.HasMember("conditions"))
+					{
+						const rapidjson::Value& conditions = transition["conditions"];
+						for (unsigned c = 0u; c < conditions.Size(); ++c)
+						{
+							const int32_t op = conditions[c].HasMember("op") ? FindName(k_ConditionOpNames, k_ConditionOpCount, conditions[c]["op"].GetString()) : -1;
+							graph.conditions.push_back({ static_cast<uint32_t>(op), readReference(conditions[c], "parameter"), readFloat(conditions[c], "threshold", 0.f) });
+						}
+					}
+					transitionRecord.conditionCount = static_cast<uint32_t>(graph.conditions.size()) - transitionRecord.firstCondition;
+					graph.transitions.push_back(transitionRecord);
+				}
+			}
+			record.sampleCount = static_cast<uint32_t>(graph.transitions.size()) - record.firstSample;
+			break;
+		default:
+			break;
+		}
+		graph.nodes.push_back(record);
+	}
+	return Build(graph, bindPose, bindings);
+}
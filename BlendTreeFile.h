@@ -0,0 +1,106 @@
+#pragma once
+#include <stdint.h>
+#include <array>
+#include <vector>
+#include <string>
+
+// Graph of a character, saved next to its scene, and the JSON mirror of it for diffing and hand editing
+#define BLENDTREE_FILE_EXTENSION ".blendtree"
+#define BLENDTREE_JSON_EXTENSION ".blendtree.json"
+
+namespace gef
+{
+	class SkeletonPose;
+}
+
+namespace AsdfAnim
+{
+	struct Clip;
+	class BoneMask;
+	class MirrorMap;
+	class BlendTreeTemplate;
+
+	// What the clip and mask names of a file are resolved against when it is loaded
+	struct BlendTreeBindings
+	{
+		std::vector<const Clip*> clips;
+		std::vector<const BoneMask*> masks;
+		const MirrorMap* mirrorMap = nullptr;		// Of the skeleton, given to every mirror node
+	};
+
+	// Saves and loads the graph of a blend tree template: the blackboard, the nodes in tree order, their inputs, settings and bound parameters,
+	// their clips and masks by name, and the transitions of the state machines
+	// The binary file also holds the compiled program and the default instance state, a template loaded from it plays without being compiled
+	// The JSON mirror only holds the graph, the template is compiled on its first update
+	// Ragdolls are created after the scene, ragdoll nodes are bound with BlendTreeTemplate::SetRagdoll() and always compiled
+	class BlendTreeFile
+	{
+	public:
+		// Compiles the template first so that the program matches the graph
+		static bool Save(BlendTreeTemplate& blendTree, const std::string& filepath);
+		static bool SaveJson(const BlendTreeTemplate& blendTree, const std::string& filepath);
+		// Return nullptr if the file is missing, of another version, malformed, or names a clip or mask that is not bound
+		static BlendTreeTemplate* Load(const std::string& filepath, const gef::SkeletonPose& bindPose, const BlendTreeBindings& bindings);
+		static BlendTreeTemplate* LoadJson(const std::string& filepath, const gef::SkeletonPose& bindPose, const BlendTreeBindings& bindings);
+
+	private:
+		// The same fields are used by every type, their meaning depends on it, see Describe()
+		struct NodeRecord
+		{
+			int32_t type;
+			std::array<int32_t, 4> inputs;		// Index of the input nodes, -1 when unused
+			std::array<float, 3> values;
+			int32_t setting;					// Looping, ragdoll active, transition type, entry state or mirrored
+			uint32_t reference;					// Clip or mask, index in the string table or UINT32_MAX
+			uint32_t firstSample;				// Blend space samples or state machine transitions
+			uint32_t sampleCount;
+			std::array<uint32_t, 2> parameters;	// Name of the bound parameters, index in the string table or UINT32_MAX
+		};
+
+		struct SampleRecord
+		{
+			uint32_t clip;
+			float x, y;
+		};
+
+		struct ParameterRecord
+		{
+			uint32_t name;
+			uint32_t type;
+			float defaultValue;
+		};
+
+		struct TransitionRecord
+		{
+			uint32_t from;						// State or STATEMACHINE_ANY_STATE
+			uint32_t to;
+			int32_t type;
+			float duration;
+			uint32_t firstCondition;
+			uint32_t conditionCount;
+		};
+
+		struct ConditionRecord
+		{
+			uint32_t op;
+			uint32_t parameter;					// Index in the string table, UINT32_MAX for none
+			float threshold;
+		};
+
+		struct Graph
+		{
+			std::vector<ParameterRecord> parameters;
+			std::vector<NodeRecord> nodes;
+			std::vector<SampleRecord> samples;
+			std::vector<TransitionRecord> transitions;
+			std::vector<ConditionRecord> conditions;
+			std::vector<std::string> strings;
+
+			uint32_t AddString(const std::string& string);
+		};
+
+		static void Describe(const BlendTreeTemplate& blendTree, Graph& graph);
+		// Creates the nodes all at once, the template still has to be compiled
+		static BlendTreeTemplate* Build(const Graph& graph, const gef::SkeletonPose& bindPose, const BlendTreeBindings& bindings);
+	};
+}
@@ -0,0 +1,50 @@
+#include "BoneMask.h"
+#include "animation/skeleton.h"
+#include "system/string_id.h"
+using namespace AsdfAnim;
+
+BoneMask::BoneMask(const std::string& name, const gef::Skeleton& skeleton) : s_Name(name), p_Skeleton(&skeleton),
+v_Weights((skeleton.joint_count() + SOA_POSE_LANES - 1u) / SOA_POSE_LANES * SOA_POSE_LANES, 0.f)
+{
+}
+
+bool BoneMask::AddSubtree(const std::string& jointName, float weight)
+{
+	const Int32 root = p_Skeleton->FindJointIndex(gef::GetStringId(jointName));
+	if (root < 0) return false;
+
+	// Parents come before their children in a gef skeleton, a single pass finds the whole subtree
+	std::vector<bool> inSubtree(p_Skeleton->joint_count(), false);
+	inSubtree[root] = true;
+	v_Weights[root] = weight;
+	for (Int32 joint = root + 1; joint < p_Skeleton->joint_count(); ++joint)
+	{
+		const Int32 parent = p_Skeleton->joint(joint).parent;
+		if (parent < 0 || !inSubtree[parent]) continue;
+		inSubtree[joint] = true;
+		v_Weights[joint] = weight;
+	}
+	UpdateJoints();
+	return true;
+}
+
+void BoneMask::SetJointWeight(int32_t joint, float weight)
+{
+	v_Weights[joint] = weight;
+	UpdateJoints();
+}
+
+void BoneMask::Intersect(const BoneMask& other)
+{
+	s_Name += " & " + other.s_Name;
+	for (int32_t joint : v_Joints)
+		if (!other.Contains(joint)) v_Weights[joint] = 0.f;
+	UpdateJoints();
+}
+
+void BoneMask::UpdateJoints()
+{
+	v_Joints.clear();
+	for (int32_t joint = 0; joint < p_Skeleton->joint_count(); ++joint)
+		if (v_Weights[joint] > 0.f) v_Joints.push_back(joint);
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "SoaPose.h"
+
+namespace gef
+{
+	class Skeleton;
+}
+
+namespace AsdfAnim
+{
+	// Per joint weights of a layer, e.g. 1 on the upper body and 0 everywhere else
+	// The joints with a weight are listed, blending and sampling through a mask only touch those
+	class BoneMask
+	{
+	public:
+		BoneMask(const std::string& name, const gef::Skeleton& skeleton);
+
+		// Sets the weight of the joint and of all its children, returns false when the skeleton has no such joint
+		bool AddSubtree(const std::string& jointName, float weight = 1.f);
+		void SetJointWeight(int32_t joint, float weight);
+		// Keeps only the joints the other mask contains as well, e.g. for a layer nested in another layer
+		void Intersect(const BoneMask& other);
+
+		const std::string& GetName() const { return s_Name; }
+		float GetWeight(int32_t joint) const { return v_Weights[joint]; }
+		bool Contains(int32_t joint) const { return v_Weights[joint] > 0.f; }
+		// Padded like a SoaPose stream, for the per joint weight BlendPoses()
+		const float* GetWeightStream() const { return v_Weights.data(); }
+		// Joints with a weight, sorted
+		const std::vector<int32_t>& GetJoints() const { return v_Joints; }
+		bool IsEmpty() const { return v_Joints.empty(); }
+
+	private:
+		void UpdateJoints();
+
+	private:
+		std::string s_Name;
+		const gef::Skeleton* p_Skeleton;
+		AlignedFloats v_Weights;			// One per joint of the skeleton, 0 in the padding
+		std::vector<int32_t> v_Joints;
+	};
+}
@@ -0,0 +1,477 @@
+#include "ClipCompression.h"
+#include "ClipSampler.h"
+#include "SoaPose.h"
+#include "BoneMask.h"
+#include "animation/animation.h"
+#include "animation/skeleton.h"
+#include <algorithm>
+#include <fstream>
+#include <cmath>
+using namespace AsdfAnim;
+
+#define CLIP_COMPRESSION_CACHE_VERSION 1
+
+namespace
+{
+	const float k_Sqrt2 = 1.41421356f;
+
+	// A key of any channel, rotations use the 4 components, translations and scales the first 3
+	struct Sample
+	{
+		float time;
+		float v[4];
+	};
+
+	float QuatDot(const float* a, const float* b)
+	{
+		return a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+	}
+
+	float QuatAngle(const float* a, const float* b)
+	{
+		return 2.f * std::acos(std::min(1.f, std::fabs(QuatDot(a, b))));
+	}
+
+	void Nlerp(const float* a, const float* b, float alpha, float* out)
+	{
+		// Take the shortest path, the decoded keys are all in the positive hemisphere of their largest component
+		const float sign = QuatDot(a, b) < 0.f ? -1.f : 1.f;
+		float lengthSqr = 0.f;
+		for (int i = 0; i < 4; ++i)
+		{
+			out[i] = a[i] + (b[i] * sign - a[i]) * alpha;
+			lengthSqr += out[i] * out[i];
+		}
+		const float invLength = 1.f / std::sqrt(lengthSqr);
+		for (int i = 0; i < 4; ++i) out[i] *= invLength;
+	}
+
+	float Distance3(const float* a, const float* b)
+	{
+		const float x = a[0] - b[0], y = a[1] - b[1], z = a[2] - b[2];
+		return std::sqrt(x * x + y * y + z * z);
+	}
+
+	void Lerp3(const float* a, const float* b, float alpha, float* out)
+	{
+		for (int i = 0; i < 3; ++i) out[i] = a[i] + (b[i] - a[i]) * alpha;
+	}
+
+	float SampleError(const Sample& a, const Sample& b, const Sample& original, bool isRotation)
+	{
+		const float span = b.time - a.time;
+		const float alpha = span > 0.f ? (original.time - a.time) / span : 0.f;
+		float interpolated[4];
+		if (isRotation)
+		{
+			Nlerp(a.v, b.v, alpha, interpolated);
+			return QuatAngle(interpolated, original.v);
+		}
+		Lerp3(a.v, b.v, alpha, interpolated);
+		return Distance3(interpolated, original.v);
+	}
+
+	// Greedy error bounded reduction: each segment is extended for as long as every key it skips stays within tolerance of the linear fit
+	// Returns the indices of the kept keys, or nothing when the whole channel matches the bind pose
+	std::vector<uint32_t> ReduceChannel(const std::vector<Sample>& samples, float tolerance, bool isRotation, const float* bindValue)
+	{
+		std::vector<uint32_t> kept;
+		if (samples.empty()) return kept;
+
+		// Constant channels keep a single key, or none if that key is the bind pose
+		bool constant = true;
+		for (const Sample& sample : samples)
+			if ((isRotation ? QuatAngle(sample.v, samples[0].v) : Distance3(sample.v, samples[0].v)) > tolerance)
+			{
+				constant = false;
+				break;
+			}
+		if (constant)
+		{
+			if ((isRotation ? QuatAngle(samples[0].v, bindValue) : Distance3(samples[0].v, bindValue)) > tolerance)
+				kept.push_back(0u);
+			return kept;
+		}
+
+		kept.push_back(0u);
+		uint32_t anchor = 0u;
+		const uint32_t count = static_cast<uint32_t>(samples.size());
+		while (anchor < count - 1u)
+		{
+			uint32_t end = anchor + 1u;
+			for (uint32_t candidate = anchor + 2u; candidate < count; ++candidate)
+			{
+				bool fits = true;
+				for (uint32_t skipped = anchor + 1u; skipped < candidate && fits; ++skipped)
+					fits = SampleError(samples[anchor], samples[candidate], samples[skipped], isRotation) <= tolerance;
+				if (!fits) break;
+				end = candidate;
+			}
+			kept.push_back(end);
+			anchor = end;
+		}
+		return kept;
+	}
+
+	uint16_t QuantiseUnit(float value, float maxValue)
+	{
+		return static_cast<uint16_t>(std::min(std::max(std::round(value * maxValue), 0.f), maxValue));
+	}
+
+	// Smallest three: the largest component is dropped and rebuilt from the unit length, its index is stored in the top bits of the first two words
+	void EncodeRotation(const float* q, uint16_t* out)
+	{
+		int largest = 0;
+		for (int i = 1; i < 4; ++i)
+			if (std::fabs(q[i]) > std::fabs(q[largest])) largest = i;
+
+		const float sign = q[largest] < 0.f ? -1.f : 1.f;
+		uint16_t components[3];
+		for (int i = 0, c = 0; i < 4; ++i)
+			if (i != largest)
+				components[c++] = QuantiseUnit((q[i] * sign * k_Sqrt2 + 1.f) * .5f, 32767.f);	// [-1/sqrt2, 1/sqrt2] -> [0, 32767]
+
+		out[0] = components[0] | static_cast<uint16_t>((largest & 1) << 15);
+		out[1] = components[1] | static_cast<uint16_t>((largest >> 1) << 15);
+		out[2] = components[2];
+	}
+
+	void DecodeRotation(const uint16_t* in, float* q)
+	{
+		const int largest = (in[0] >> 15) | ((in[1] >> 15) << 1);
+		float sumSqr = 0.f;
+		for (int i = 0, c = 0; i < 4; ++i)
+		{
+			if (i == largest) continue;
+			q[i] = ((in[c++] & 0x7fff) / 32767.f * 2.f - 1.f) / k_Sqrt2;
+			sumSqr += q[i] * q[i];
+		}
+		q[largest] = std::sqrt(std::max(0.f, 1.f - sumSqr));
+	}
+
+	struct CacheHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t sourceHash;
+		float errorBudget;
+		float duration;
+		uint32_t trackCount;
+		uint32_t keyCount;
+		ClipCompressionStats stats;
+	};
+}
+
+CompressedClip* CompressedClip::Compress(const gef::Animation& clip, const gef::SkeletonPose& bindPose, float errorBudget)
+{
+	const gef::Skeleton* skeleton = bindPose.skeleton();
+	if (!skeleton) return nullptr;
+
+	// The reach of a joint is the distance to its furthest descendant in the bind pose
+	// A rotation error on that joint moves its descendants by at most angle * reach
+	const Int32 jointCount = skeleton->joint_count();
+	std::vector<float> reach(jointCount, 0.f);
+	float maxReach = 0.f;
+	for (Int32 descendant = 0; descendant < jointCount; ++descendant)
+	{
+		const gef::Vector4 descendantPosition = bindPose.global_pose()[descendant].GetTranslation();
+		for (Int32 ancestor = skeleton->joint(descendant).parent; ancestor != -1; ancestor = skeleton->joint(ancestor).parent)
+		{
+			const float distance = (descendantPosition - bindPose.global_pose()[ancestor].GetTranslation()).Length();
+			reach[ancestor] = std::max(reach[ancestor], distance);
+			maxReach = std::max(maxReach, distance);
+		}
+	}
+	// Leaves still deform the skin around them, give them a tenth of the skeleton size
+	const float minReach = std::max(maxReach * .1f, errorBudget);
+
+	// Errors accumulate down the hierarchy and through quantisation, so the channels start with half of the budget
+	// The result is measured in world space and the tolerances are tightened until it fits
+	CompressedClip* result = new CompressedClip();
+	result->m_ErrorBudget = errorBudget;
+	std::vector<float> angularTolerances(jointCount), positionTolerances(jointCount);
+	float share = .5f;
+	float error = 0.f;
+	int32_t worstJoint = -1;
+	for (uint32_t attempt = 0u; attempt < 8u; ++attempt, share *= .5f)
+	{
+		for (Int32 joint = 0; joint < jointCount; ++joint)
+		{
+			angularTolerances[joint] = share * errorBudget / std::max(reach[joint], minReach);
+			positionTolerances[joint] = share * errorBudget;
+		}
+
+		result->Build(clip, bindPose, angularTolerances, positionTolerances);
+		error = MeasureClipError(clip, bindPose, [result, &bindPose](float time, gef::SkeletonPose& pose) { result->SamplePose(time, bindPose, pose); }, worstJoint);
+		if (error <= errorBudget) break;
+	}
+
+	// A clip the tolerances cannot bring within the budget is left uncompressed, its source keys are kept
+	if (error > errorBudget)
+	{
+		delete result;
+		return nullptr;
+	}
+
+	result->m_Stats.sourceBytes = GetSourceBytes(clip);
+	result->m_Stats.compressedBytes = result->GetBytes();
+	result->m_Stats.maxError = error;
+	result->m_Stats.maxErrorJoint = worstJoint;
+	return result;
+}
+
+void CompressedClip::Build(const gef::Animation& clip, const gef::SkeletonPose& bindPose, const std::vector<float>& angularTolerances, const std::vector<float>& positionTolerances)
+{
+	v_Tracks.clear();
+	v_Keys.clear();
+	m_Duration = clip.duration();
+	const float startTime = clip.start_time();
+	const float timeScale = m_Duration > 0.f ? 1.f / m_Duration : 0.f;
+	const gef::Skeleton* skeleton = bindPose.skeleton();
+
+	std::vector<Sample> samples;
+	for (Int32 joint = 0; joint < skeleton->joint_count(); ++joint)
+	{
+		// Same lookup as gef::SkeletonPose::SetPoseFromAnim
+		const auto nodeIt = clip.anim_nodes().find(skeleton->joint(joint).name_id);
+		if (nodeIt == clip.anim_nodes().end()) continue;
+		const gef::TransformAnimNode* node = static_cast<const gef::TransformAnimNode*>(nodeIt->second);
+		const gef::JointPose& bindJoint = bindPose.local_pose()[joint];
+
+		Track track = {};
+		track.joint = joint;
+
+		// Rotations, kept in the same hemisphere as the previous key so the fit never takes the long way round
+		const gef::Quaternion& bindRotation = bindJoint.rotation();
+		const float bindRotationValue[4] = { bindRotation.x, bindRotation.y, bindRotation.z, bindRotation.w };
+		samples.clear();
+		for (const gef::QuaternionKey& key : node->rotation_keys())
+		{
+			Sample sample = { key.time - startTime, { key.value.x, key.value.y, key.value.z, key.value.w } };
+			const float length = std::sqrt(QuatDot(sample.v, sample.v));
+			for (float& v : sample.v) v /= length;
+			if (!samples.empty() && QuatDot(samples.back().v, sample.v) < 0.f)
+				for (float& v : sample.v) v = -v;
+			samples.push_back(sample);
+		}
+		std::vector<uint32_t> kept = ReduceChannel(samples, angularTolerances[joint], true, bindRotationValue);
+		track.rotationOffset = static_cast<uint32_t>(v_Keys.size());
+		track.rotationCount = static_cast<uint32_t>(kept.size());
+		for (uint32_t index : kept)
+		{
+			QuantisedKey key;
+			key.time = QuantiseUnit(samples[index].time * timeScale, 65535.f);
+			EncodeRotation(samples[index].v, key.value);
+			v_Keys.push_back(key);
+		}
+
+		// Translations and scales share the same range relative encoding
+		for (int channel = 0; channel < 2; ++channel)
+		{
+			const bool isTranslation = channel == 0;
+			const std::vector<gef::Vector3Key>& keys = isTranslation ? node->translation_keys() : node->scale_keys();
+			const gef::Vector4& bindVector = isTranslation ? bindJoint.translation() : bindJoint.scale();
+			const float bindValue[4] = { bindVector.x(), bindVector.y(), bindVector.z(), 0.f };
+
+			samples.clear();
+			for (const gef::Vector3Key& key : keys)
+				samples.push_back({ key.time - startTime, { key.value.x(), key.value.y(), key.value.z(), 0.f } });
+			kept = ReduceChannel(samples, isTranslation ? positionTolerances[joint] : angularTolerances[joint], false, bindValue);
+
+			float* minimum = isTranslation ? track.translationMin : track.scaleMin;
+			float* extent = isTranslation ? track.translationExtent : track.scaleExtent;
+			for (int i = 0; i < 3; ++i)
+			{
+				float maximum = -INFINITY;
+				minimum[i] = INFINITY;
+				for (uint32_t index : kept)
+				{
+					minimum[i] = std::min(minimum[i], samples[index].v[i]);
+					maximum = std::max(maximum, samples[index].v[i]);
+				}
+				extent[i] = kept.empty() ? 0.f : maximum - minimum[i];
+			}
+
+			(isTranslation ? track.translationOffset : track.scaleOffset) = static_cast<uint32_t>(v_Keys.size());
+			(isTranslation ? track.translationCount : track.scaleCount) = static_cast<uint32_t>(kept.size());
+			for (uint32_t index : kept)
+			{
+				QuantisedKey key;
+				key.time = QuantiseUnit(samples[index].time * timeScale, 65535.f);
+				for (int i = 0; i < 3; ++i)
+					key.value[i] = extent[i] > 0.f ? QuantiseUnit((samples[index].v[i] - minimum[i]) / extent[i], 65535.f) : 0u;
+				v_Keys.push_back(key);
+			}
+		}
+
+		// A track that only holds the bind pose does not need to be stored at all
+		if (track.rotationCount || track.translationCount || track.scaleCount)
+			v_Tracks.push_back(track);
+	}
+}
+
+uint32_t CompressedClip::FindKey(uint32_t offset, uint32_t count, float time, float& alpha, uint32_t& cursor) const
+{
+	alpha = 0.f;
+	if (count < 2u) return offset;
+
+	// Search on the quantised times directly
+	const float normalisedTime = m_Duration > 0.f ? time / m_Duration * 65535.f : 0.f;
+	const QuantisedKey* first = v_Keys.data() + offset;
+	const uint32_t index = SeekKey(first, count, normalisedTime, cursor);
+
+	const float t0 = first[index].time, t1 = first[index + 1u].time;
+	alpha = t1 > t0 ? std::min(std::max((normalisedTime - t0) / (t1 - t0), 0.f), 1.f) : 0.f;
+	return offset + index;
+}
+
+void CompressedClip::SamplePose(float time, const gef::SkeletonPose& bindPose, gef::SkeletonPose& pose) const
+{
+	// Joints without a track use the bind pose, like gef::SkeletonPose::SetPoseFromAnim
+	SoaPose decoded(bindPose.local_pose());
+	SampleTracks(time, decoded, nullptr);
+	decoded.ToLocalPose(pose.local_pose());
+	pose.CalculateGlobalPose();
+}
+
+void CompressedClip::SampleTracks(float time, SoaPose& pose, uint32_t* cursors, const SoaPose* bindPose, const BoneMask* mask) const
+{
+	time = std::min(std::max(time, 0.f), m_Duration);
+
+	float* rotation[4] = { pose.GetStream(SoaPose::Stream_RotationX), pose.GetStream(SoaPose::Stream_RotationY), pose.GetStream(SoaPose::Stream_RotationZ), pose.GetStream(SoaPose::Stream_RotationW) };
+	float* translation[3] = { pose.GetStream(SoaPose::Stream_TranslationX), pose.GetStream(SoaPose::Stream_TranslationY), pose.GetStream(SoaPose::Stream_TranslationZ) };
+	float* scale[3] = { pose.GetStream(SoaPose::Stream_ScaleX), pose.GetStream(SoaPose::Stream_ScaleY), pose.GetStream(SoaPose::Stream_ScaleZ) };
+
+	float alpha, a[4], b[4], value[4];
+	uint32_t noCursors[3] = { 0u, 0u, 0u };
+	for (size_t trackIndex = 0u; trackIndex < v_Tracks.size(); ++trackIndex)
+	{
+		const Track& track = v_Tracks[trackIndex];
+		if (mask && !mask->Contains(track.joint)) continue;
+		uint32_t* trackCursors = cursors ? cursors + trackIndex * 3u : noCursors;
+
+		if (track.rotationCount)
+		{
+			const uint32_t key = FindKey(track.rotationOffset, track.rotationCount, time, alpha, trackCursors[0]);
+			DecodeRotation(v_Keys[key].value, a);
+			if (alpha > 0.f)
+			{
+				DecodeRotation(v_Keys[key + 1u].value, b);
+				Nlerp(a, b, alpha, value);
+			}
+			else std::copy(a, a + 4, value);
+			for (int c = 0; c < 4; ++c) rotation[c][track.joint] = value[c];
+		}
+		else if (bindPose) pose.CopyRotation(track.joint, *bindPose);
+
+		for (int channel = 0; channel < 2; ++channel)
+		{
+			const bool isTranslation = channel == 0;
+			const uint32_t count = isTranslation ? track.translationCount : track.scaleCount;
+			if (!count)
+			{
+				if (bindPose && isTranslation)	pose.CopyTranslation(track.joint, *bindPose);
+				else if (bindPose)				pose.CopyScale(track.joint, *bindPose);
+				continue;
+			}
+
+			const float* minimum = isTranslation ? track.translationMin : track.scaleMin;
+			const float* extent = isTranslation ? track.translationExtent : track.scaleExtent;
+			const uint32_t key = FindKey(isTranslation ? track.translationOffset : track.scaleOffset, count, time, alpha, trackCursors[1 + channel]);
+			const uint16_t* keyA = v_Keys[key].value;
+			const uint16_t* keyB = v_Keys[alpha > 0.f ? key + 1u : key].value;
+			for (int i = 0; i < 3; ++i)
+			{
+				a[i] = minimum[i] + keyA[i] / 65535.f * extent[i];
+				b[i] = minimum[i] + keyB[i] / 65535.f * extent[i];
+			}
+			Lerp3(a, b, alpha, value);
+
+			float** streams = isTranslation ? translation : scale;
+			for (int c = 0; c < 3; ++c) streams[c][track.joint] = value[c];
+		}
+	}
+}
+
+CompressedClip* CompressedClip::LoadOrCompress(const std::string& cachePath, uint64_t sourceHash, const gef::Animation& clip, const gef::SkeletonPose& bindPose, float errorBudget)
+{
+	CompressedClip* result = Load(cachePath, sourceHash, bindPose, errorBudget);
+	if (result) return result;
+
+	result = Compress(clip, bindPose, errorBudget);
+	if (result) result->Save(cachePath, sourceHash);
+	return result;
+}
+
+CompressedClip* CompressedClip::Load(const std::string& filepath, uint64_t sourceHash, const gef::SkeletonPose& bindPose, float errorBudget)
+{
+	std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+	if (!file) return nullptr;
+	const uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+	file.seekg(0);
+
+	// The cache is only valid for the exact source content and budget it was built with
+	CacheHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) return nullptr;
+	if (std::string(header.magic, 4u) != "CCLP" || header.version != CLIP_COMPRESSION_CACHE_VERSION) return nullptr;
+	if (header.sourceHash != sourceHash || header.errorBudget != errorBudget || !(header.stats.maxError <= errorBudget)) return nullptr;
+	// The counts are checked against the size of the file before anything is allocated from them
+	if (sizeof(header) + sizeof(Track) * static_cast<uint64_t>(header.trackCount) + sizeof(QuantisedKey) * static_cast<uint64_t>(header.keyCount) != fileSize) return nullptr;
+
+	CompressedClip* result = new CompressedClip();
+	result->m_Duration = header.duration;
+	result->m_ErrorBudget = header.errorBudget;
+	result->m_Stats = header.stats;
+	result->v_Tracks.resize(header.trackCount);
+	result->v_Keys.resize(header.keyCount);
+	file.read(reinterpret_cast<char*>(result->v_Tracks.data()), sizeof(Track) * header.trackCount);
+	file.read(reinterpret_cast<char*>(result->v_Keys.data()), sizeof(QuantisedKey) * header.keyCount);
+
+	// The decoders write the joint of each track and read its keys without checking them
+	bool valid = file.good();
+	const int32_t jointCount = bindPose.skeleton()->joint_count();
+	for (const Track& track : result->v_Tracks)
+	{
+		valid &= track.joint >= 0 && track.joint < jointCount;
+		valid &= static_cast<uint64_t>(track.rotationOffset) + track.rotationCount <= header.keyCount;
+		valid &= static_cast<uint64_t>(track.translationOffset) + track.translationCount <= header.keyCount;
+		valid &= static_cast<uint64_t>(track.scaleOffset) + track.scaleCount <= header.keyCount;
+	}
+	if (!valid)
+	{
+		delete result;
+		return nullptr;
+	}
+	return result;
+}
+
+bool CompressedClip::Save(const std::string& filepath, uint64_t sourceHash) const
+{
+	std::ofstream file(filepath, std::ios::binary | std::ios::trunc);
+	if (!file) return false;
+
+	CacheHeader header = { { 'C', 'C', 'L', 'P' }, CLIP_COMPRESSION_CACHE_VERSION, sourceHash, m_ErrorBudget, m_Duration,
+		static_cast<uint32_t>(v_Tracks.size()), static_cast<uint32_t>(v_Keys.size()), m_Stats };
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(v_Tracks.data()), sizeof(Track) * v_Tracks.size());
+	file.write(reinterpret_cast<const char*>(v_Keys.data()), sizeof(QuantisedKey) * v_Keys.size());
+	return file.good();
+}
+
+uint64_t CompressedClip::GetBytes() const
+{
+	return sizeof(CompressedClip) + sizeof(Track) * v_Tracks.size() + sizeof(QuantisedKey) * v_Keys.size();
+}
+
+uint64_t CompressedClip::GetSourceBytes(const gef::Animation& clip)
+{
+	uint64_t bytes = sizeof(gef::Animation);
+	for (const auto& node : clip.anim_nodes())
+	{
+		const gef::TransformAnimNode* transformNode = static_cast<const gef::TransformAnimNode*>(node.second);
+		bytes += transformNode->rotation_keys().size() * sizeof(gef::QuaternionKey);
+		bytes += transformNode->translation_keys().size() * sizeof(gef::Vector3Key);
+		bytes += transformNode->scale_keys().size() * sizeof(gef::Vector3Key);
+	}
+	return bytes;
+}
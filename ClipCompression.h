@@ -0,0 +1,93 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include <string>
+
+// Maximum world space position error allowed on any joint, in skeleton units (the mixamo characters are authored in centimetres)
+#define CLIP_COMPRESSION_DEFAULT_ERROR 0.1f
+// Extension of the compressed clip cache written next to the source clip
+#define CLIP_COMPRESSION_CACHE_EXTENSION ".cclip"
+
+namespace gef
+{
+	class Animation;
+	class SkeletonPose;
+	class JointPose;
+}
+
+namespace AsdfAnim
+{
+	class SoaPose;
+	class BoneMask;
+
+	struct ClipCompressionStats
+	{
+		uint64_t sourceBytes;
+		uint64_t compressedBytes;
+		float maxError;				// Largest world space joint position error measured over the clip
+		int32_t maxErrorJoint;
+
+		float GetRatio() const { return compressedBytes ? static_cast<float>(sourceBytes) / compressedBytes : 0.f; }
+	};
+
+	// A gef::Animation with error bounded keyframe reduction and quantised keys
+	// Rotations are packed with the smallest three method on 48 bits, translations and scales are stored relative to their track range on 16 bits per component
+	class CompressedClip
+	{
+	public:
+		// Compress at load time, or offline through Save()
+		// Returns nullptr when the clip cannot be brought within the error budget
+		static CompressedClip* Compress(const gef::Animation& clip, const gef::SkeletonPose& bindPose, float errorBudget = CLIP_COMPRESSION_DEFAULT_ERROR);
+		// Reads the cache if it was built from the same source with the same budget, compresses and writes it otherwise
+		static CompressedClip* LoadOrCompress(const std::string& cachePath, uint64_t sourceHash, const gef::Animation& clip, const gef::SkeletonPose& bindPose, float errorBudget = CLIP_COMPRESSION_DEFAULT_ERROR);
+		// Returns nullptr when the cache is out of date, or does not fit the skeleton of the bind pose
+		static CompressedClip* Load(const std::string& filepath, uint64_t sourceHash, const gef::SkeletonPose& bindPose, float errorBudget);
+		bool Save(const std::string& filepath, uint64_t sourceHash) const;
+
+		// Decodes the clip straight into the pose, joints without data are set to the bind pose
+		// The time is relative to the start of the clip
+		void SamplePose(float time, const gef::SkeletonPose& bindPose, gef::SkeletonPose& pose) const;
+		// Only writes the joints with a track, straight into the streams, with a rotation, translation and scale cursor per track (see ClipSampler)
+		// Channels of those joints without data are taken from the bind pose when it is given
+		// With a mask only the tracks of the joints of the mask are sampled
+		void SampleTracks(float time, SoaPose& pose, uint32_t* cursors, const SoaPose* bindPose = nullptr, const BoneMask* mask = nullptr) const;
+
+		float GetDuration() const { return m_Duration; }
+		const ClipCompressionStats& GetStats() const { return m_Stats; }
+		uint64_t GetBytes() const;
+		size_t GetTrackCount() const { return v_Tracks.size(); }
+		int32_t GetTrackJoint(size_t track) const { return v_Tracks[track].joint; }
+
+		static uint64_t GetSourceBytes(const gef::Animation& clip);
+
+	private:
+		struct QuantisedKey
+		{
+			uint16_t time;			// Normalised over the clip duration
+			uint16_t value[3];
+		};
+
+		struct Track
+		{
+			int32_t joint;
+			// Offsets and counts in v_Keys, a count of 0 means the channel is the bind pose
+			uint32_t rotationOffset, rotationCount;
+			uint32_t translationOffset, translationCount;
+			uint32_t scaleOffset, scaleCount;
+			float translationMin[3], translationExtent[3];
+			float scaleMin[3], scaleExtent[3];
+		};
+
+		CompressedClip() : m_Duration(0.f), m_ErrorBudget(0.f), m_Stats{} {}
+		// Angular tolerances apply to rotations (radians) and scales (relative), position tolerances to translations
+		void Build(const gef::Animation& clip, const gef::SkeletonPose& bindPose, const std::vector<float>& angularTolerances, const std::vector<float>& positionTolerances);
+		uint32_t FindKey(uint32_t offset, uint32_t count, float time, float& alpha, uint32_t& cursor) const;
+
+	private:
+		std::vector<Track> v_Tracks;
+		std::vector<QuantisedKey> v_Keys;
+		float m_Duration;
+		float m_ErrorBudget;
+		ClipCompressionStats m_Stats;
+	};
+}
@@ -0,0 +1,202 @@
+#include "ClipSampler.h"
+#include "ClipCompression.h"
+#include "ResampledClip.h"
+#include "BoneMask.h"
+#include "SoaPose.h"
+#include "animation/animation.h"
+#include "animation/skeleton.h"
+using namespace AsdfAnim;
+
+ClipSampler::ClipSampler() : p_Animation(nullptr), p_Compressed(nullptr), p_Resampled(nullptr), p_Clip(nullptr), p_BindPose(nullptr)
+{
+}
+
+void ClipSampler::SetClip(const Clip* clip, const gef::SkeletonPose& bindPose)
+{
+	SetAnimation(clip && clip->representation == ClipRepresentation::Clip_Representation_Source ? clip->clip : nullptr, bindPose);
+	p_Clip = clip;
+	if (!clip) return;
+
+	if (clip->representation == ClipRepresentation::Clip_Representation_Compressed)
+	{
+		p_Compressed = clip->compressed;
+		v_Cursors.assign(p_Compressed->GetTrackCount() * 3u, 0u);
+
+		v_TrackJoints.resize(p_Compressed->GetTrackCount());
+		for (size_t track = 0u; track < v_TrackJoints.size(); ++track)
+			v_TrackJoints[track] = p_Compressed->GetTrackJoint(track);
+		FindBindJoints();
+	}
+	else if (clip->representation == ClipRepresentation::Clip_Representation_Resampled)
+	{
+		p_Resampled = clip->resampled;
+		v_TrackJoints = p_Resampled->GetJoints();
+		FindBindJoints();
+	}
+}
+
+void ClipSampler::FindBindJoints()
+{
+	// Both lists are sorted by joint index
+	v_BindJoints.clear();
+	auto animated = v_TrackJoints.begin();
+	for (int32_t joint = 0; joint < p_BindPose->skeleton()->joint_count(); ++joint)
+	{
+		if (animated != v_TrackJoints.end() && *animated == joint) ++animated;
+		else v_BindJoints.push_back(joint);
+	}
+}
+
+void ClipSampler::SetAnimation(const gef::Animation* animation, const gef::SkeletonPose& bindPose)
+{
+	p_Animation = animation;
+	p_Compressed = nullptr;
+	p_Resampled = nullptr;
+	p_Clip = nullptr;
+	p_BindPose = &bindPose;
+	m_BindPose.FromLocalPose(bindPose.local_pose());
+	m_Pose = m_BindPose;
+	v_SourceTracks.clear();
+	v_TrackJoints.clear();
+	v_BindJoints.clear();
+	v_Cursors.clear();
+	if (!animation) return;
+
+	// Resolve the joint of each track once, SetPoseFromAnim looks them up on every call
+	const gef::Skeleton* skeleton = bindPose.skeleton();
+	for (Int32 joint = 0; joint < skeleton->joint_count(); ++joint)
+	{
+		const auto nodeIt = animation->anim_nodes().find(skeleton->joint(joint).name_id);
+		if (nodeIt == animation->anim_nodes().end()) continue;
+
+		const gef::TransformAnimNode* node = static_cast<const gef::TransformAnimNode*>(nodeIt->second);
+		v_SourceTracks.push_back({ joint, &node->rotation_keys(), &node->translation_keys(), &node->scale_keys() });
+		v_TrackJoints.push_back(joint);
+	}
+	v_Cursors.assign(v_SourceTracks.size() * 3u, 0u);
+	FindBindJoints();
+}
+
+void ClipSampler::Sample(float time, gef::SkeletonPose& pose)
+{
+	if (!p_BindPose) return;
+	Sample(time, m_Pose, v_Cursors.data());
+
+	// The only conversion, at the output
+	m_Pose.ToLocalPose(pose.local_pose());
+}
+
+void ClipSampler::Sample(float time, SoaPose& pose)
+{
+	Sample(time, pose, v_Cursors.data());
+}
+
+size_t ClipSampler::GetMaxCursorCount(const gef::SkeletonPose& bindPose)
+{
+	// Every representation has at most a track per joint
+	return bindPose.local_pose().size() * 3u;
+}
+
+void ClipSampler::Sample(float time, SoaPose& pose, uint32_t* cursors, const BoneMask* mask) const
+{
+	if (!p_BindPose) return;
+	if (pose.GetJointCount() != m_BindPose.GetJointCount()) pose = m_BindPose;
+
+	for (int32_t joint : v_BindJoints)
+		if (!mask || mask->Contains(joint)) pose.CopyJoint(joint, m_BindPose);
+
+	if (p_Resampled)
+	{
+		p_Resampled->SampleTracks(time, pose, &m_BindPose, mask);
+		return;
+	}
+	if (p_Compressed)
+	{
+		p_Compressed->SampleTracks(time, pose, cursors, &m_BindPose, mask);
+		return;
+	}
+	if (!p_Animation) return;
+
+	float* rotation[4] = { pose.GetStream(SoaPose::Stream_RotationX), pose.GetStream(SoaPose::Stream_RotationY), pose.GetStream(SoaPose::Stream_RotationZ), pose.GetStream(SoaPose::Stream_RotationW) };
+	float* translation[3] = { pose.GetStream(SoaPose::Stream_TranslationX), pose.GetStream(SoaPose::Stream_TranslationY), pose.GetStream(SoaPose::Stream_TranslationZ) };
+	float* scale[3] = { pose.GetStream(SoaPose::Stream_ScaleX), pose.GetStream(SoaPose::Stream_ScaleY), pose.GetStream(SoaPose::Stream_ScaleZ) };
+
+	time += p_Animation->start_time();
+	for (size_t trackIndex = 0u; trackIndex < v_SourceTracks.size(); ++trackIndex)
+	{
+		const SourceTrack& track = v_SourceTracks[trackIndex];
+		const int32_t joint = track.joint;
+		if (mask && !mask->Contains(joint)) continue;
+		uint32_t* trackCursors = cursors + trackIndex * 3u;
+
+		if (!track.rotationKeys->empty())
+		{
+			const std::vector<gef::QuaternionKey>& keys = *track.rotationKeys;
+			const uint32_t key = SeekKey(keys.data(), static_cast<uint32_t>(keys.size()), time, trackCursors[0]);
+			gef::Quaternion value = keys[key].value;
+			if (keys.size() > 1u)
+			{
+				const float span = keys[key + 1u].time - keys[key].time;
+				const float alpha = span > 0.f ? std::min(std::max((time - keys[key].time) / span, 0.f), 1.f) : 0.f;
+				value.Slerp(keys[key].value, keys[key + 1u].value, alpha);
+			}
+			rotation[0][joint] = value.x;
+			rotation[1][joint] = value.y;
+			rotation[2][joint] = value.z;
+			rotation[3][joint] = value.w;
+		}
+		else pose.CopyRotation(joint, m_BindPose);
+
+		for (int channel = 0; channel < 2; ++channel)
+		{
+			const bool isTranslation = channel == 0;
+			const std::vector<gef::Vector3Key>& keys = isTranslation ? *track.translationKeys : *track.scaleKeys;
+			if (keys.empty())
+			{
+				if (isTranslation)	pose.CopyTranslation(joint, m_BindPose);
+				else				pose.CopyScale(joint, m_BindPose);
+				continue;
+			}
+
+			const uint32_t key = SeekKey(keys.data(), static_cast<uint32_t>(keys.size()), time, trackCursors[1 + channel]);
+			gef::Vector4 value = keys[key].value;
+			if (keys.size() > 1u)
+			{
+				const float span = keys[key + 1u].time - keys[key].time;
+				const float alpha = span > 0.f ? std::min(std::max((time - keys[key].time) / span, 0.f), 1.f) : 0.f;
+				value.Lerp(keys[key].value, keys[key + 1u].value, alpha);
+			}
+
+			float** streams = isTranslation ? translation : scale;
+			streams[0][joint] = value.x();
+			streams[1][joint] = value.y();
+			streams[2][joint] = value.z();
+		}
+	}
+}
+
+float AsdfAnim::MeasureClipError(const gef::Animation& clip, const gef::SkeletonPose& bindPose, const std::function<void(float, gef::SkeletonPose&)>& sample, int32_t& worstJoint)
+{
+	gef::SkeletonPose source = bindPose, decoded = bindPose;
+	const Int32 jointCount = bindPose.skeleton()->joint_count();
+	const float duration = clip.duration();
+	float maxError = 0.f;
+	worstJoint = -1;
+	for (float time = 0.f; ; time += 1.f / 60.f)
+	{
+		time = std::min(time, duration);
+		source.SetPoseFromAnim(clip, bindPose, time + clip.start_time());
+		sample(time, decoded);
+		for (Int32 joint = 0; joint < jointCount; ++joint)
+		{
+			const float error = (source.global_pose()[joint].GetTranslation() - decoded.global_pose()[joint].GetTranslation()).Length();
+			if (error > maxError)
+			{
+				maxError = error;
+				worstJoint = joint;
+			}
+		}
+		if (time >= duration) break;
+	}
+	return maxError;
+}
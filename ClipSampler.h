@@ -0,0 +1,105 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include "Animation.h"
+#include "SoaPose.h"
+
+// Keys the cursor is allowed to walk forward before falling back to a binary search
+#define CLIP_SAMPLER_MAX_CURSOR_STEPS 4u
+
+namespace gef
+{
+	class Animation;
+	class SkeletonPose;
+	class JointPose;
+	struct QuaternionKey;
+	struct Vector3Key;
+}
+
+namespace AsdfAnim
+{
+	class CompressedClip;
+	class ResampledClip;
+	class BoneMask;
+
+	// Index of the last key at or before the time, clamped so that there always is a next key to interpolate with
+	// The cursor caches the previous result: playback moves forward by a key or two per frame, only seeks and loops need a search
+	template<typename Key>
+	uint32_t SeekKey(const Key* keys, uint32_t count, float time, uint32_t& cursor)
+	{
+		if (count < 2u) return cursor = 0u;
+
+		uint32_t index = cursor;
+		if (index < count - 1u && keys[index].time <= time)
+		{
+			uint32_t steps = 0u;
+			while (index < count - 2u && keys[index + 1u].time <= time && steps++ < CLIP_SAMPLER_MAX_CURSOR_STEPS) ++index;
+			if (index < count - 2u && keys[index + 1u].time <= time) index = count;
+		}
+		else index = count;
+
+		if (index == count)
+		{
+			const Key* next = std::upper_bound(keys, keys + count, time, [](float t, const Key& key) { return t < key.time; });
+			index = static_cast<uint32_t>(std::min<ptrdiff_t>(std::max<ptrdiff_t>(next - keys - 1, 0), count - 2u));
+		}
+		return cursor = index;
+	}
+
+	// Largest world space joint position error between the source clip and another representation of it, measured at 60Hz
+	// The sample function receives the time relative to the clip start and must output a complete pose, global pose included
+	float MeasureClipError(const gef::Animation& clip, const gef::SkeletonPose& bindPose, const std::function<void(float, gef::SkeletonPose&)>& sample, int32_t& worstJoint);
+
+	// Samples a clip with a cursor per track
+	// The whole local pose is written, joints and channels without animation data are copied from the bind pose, so any pose buffer can be sampled into
+	// With a bone mask only the joints of the mask are written, the tracks of the other joints are skipped
+	// The caller calculates the global pose
+	class ClipSampler
+	{
+	public:
+		ClipSampler();
+
+		// Binds the representation the clip uses now, call it again after switching the representation
+		void SetClip(const Clip* clip, const gef::SkeletonPose& bindPose);
+		void SetAnimation(const gef::Animation* animation, const gef::SkeletonPose& bindPose);
+		const gef::Animation* GetAnimation() const { return p_Animation; }
+
+		// The time is relative to the start of the clip
+		void Sample(float time, gef::SkeletonPose& pose);
+		// Same, decoded straight into the streams of a structure of arrays pose. Only the sampled joints are written
+		// A pose of another joint count is set to the bind pose first
+		void Sample(float time, SoaPose& pose);
+		// Same, with the cursors of the caller so that a sampler can be shared by instances playing at different times
+		// There must be GetMaxCursorCount() of them, any value is valid, they are only where the key search starts
+		// Nothing of the sampler is written, instances can sample it concurrently. With a mask only the joints of the mask are written
+		void Sample(float time, SoaPose& pose, uint32_t* cursors, const BoneMask* mask = nullptr) const;
+		static size_t GetMaxCursorCount(const gef::SkeletonPose& bindPose);
+		void ResetCursors() { std::fill(v_Cursors.begin(), v_Cursors.end(), 0u); }
+
+	private:
+		struct SourceTrack
+		{
+			int32_t joint;
+			const std::vector<gef::QuaternionKey>* rotationKeys;
+			const std::vector<gef::Vector3Key>* translationKeys;
+			const std::vector<gef::Vector3Key>* scaleKeys;
+		};
+
+		void FindBindJoints();
+
+	private:
+		std::vector<SourceTrack> v_SourceTracks;
+		std::vector<int32_t> v_TrackJoints;			// Joint of each track, whatever the representation
+		std::vector<int32_t> v_BindJoints;			// Joints without any animation data, usually few or none
+		std::vector<uint32_t> v_Cursors;			// Rotation, translation and scale cursor of each track
+		SoaPose m_BindPose;							// Fills the joints and channels without data
+		SoaPose m_Pose;								// Decoded into for the gef::SkeletonPose output, converted once at the end
+		const gef::Animation* p_Animation;
+		const CompressedClip* p_Compressed;
+		const ResampledClip* p_Resampled;
+		const Clip* p_Clip;
+		const gef::SkeletonPose* p_BindPose;
+	};
+}
@@ -0,0 +1,117 @@
+#include "JobSystem.h"
+#include <algorithm>
+using namespace AsdfAnim;
+
+namespace
+{
+	// Queue of the calling thread, set on the workers of a job system
+	thread_local const JobSystem* t_JobSystem = nullptr;
+	thread_local uint32_t t_Queue = 0u;
+}
+
+///
+/// Job system
+///
+JobSystem::JobSystem(uint32_t workerCount) : m_QueuedCount(0), m_Quit(false)
+{
+	for (uint32_t i = 0u; i <= workerCount; ++i) v_Queues.emplace_back(new Queue());
+	for (uint32_t i = 0u; i < workerCount; ++i) v_Workers.emplace_back(&JobSystem::WorkerLoop, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_SleepMutex);
+		m_Quit = true;
+	}
+	m_WakeUp.notify_all();
+	for (std::thread& worker : v_Workers) worker.join();
+}
+
+JobSystem& JobSystem::Get()
+{
+	static JobSystem s_JobSystem(JOBSYSTEM_WORKERS ? JOBSYSTEM_WORKERS : std::max(std::thread::hardware_concurrency(), 2u) - 1u);
+	return s_JobSystem;
+}
+
+void JobSystem::Submit(const Job& job)
+{
+	Queue& queue = *v_Queues[GetQueueIndex()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(job);
+	}
+
+	// Counted under the sleep mutex so that a worker about to sleep sees it
+	{
+		std::lock_guard<std::mutex> lock(m_SleepMutex);
+		++m_QueuedCount;
+	}
+	m_WakeUp.notify_one();
+}
+
+void JobSystem::Wait(const std::atomic<uint32_t>& counter)
+{
+	const uint32_t queue = GetQueueIndex();
+	while (counter.load() != 0u)
+	{
+		Job job;
+		if (TakeJob(queue, job)) job.function(job.data, job.index);
+		else std::this_thread::yield();
+	}
+}
+
+uint32_t JobSystem::GetQueueIndex() const
+{
+	return t_JobSystem == this ? t_Queue : static_cast<uint32_t>(v_Queues.size() - 1u);
+}
+
+bool JobSystem::TakeJob(uint32_t queue, Job& job)
+{
+	// The newest job of the queue is the most likely to read what was just written
+	{
+		Queue& own = *v_Queues[queue];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.jobs.empty())
+		{
+			job = own.jobs.back();
+			own.jobs.pop_back();
+			--m_QueuedCount;
+			return true;
+		}
+	}
+
+	// The oldest job of another queue is the root of the most work
+	for (size_t offset = 1u; offset < v_Queues.size(); ++offset)
+	{
+		Queue& victim = *v_Queues[(queue + offset) % v_Queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.jobs.empty())
+		{
+			job = victim.jobs.front();
+			victim.jobs.pop_front();
+			--m_QueuedCount;
+			return true;
+		}
+	}
+	return false;
+}
+
+void JobSystem::WorkerLoop(uint32_t queue)
+{
+	t_JobSystem = this;
+	t_Queue = queue;
+	for (;;)
+	{
+		Job job;
+		if (TakeJob(queue, job))
+		{
+			job.function(job.data, job.index);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_SleepMutex);
+		m_WakeUp.wait(lock, [this] { return m_Quit || m_QueuedCount.load() > 0; });
+		if (m_Quit) return;
+	}
+}
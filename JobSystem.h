@@ -0,0 +1,61 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Workers of the shared job system, 0 for one per hardware thread but the one waiting on the jobs
+#define JOBSYSTEM_WORKERS 0u
+
+namespace AsdfAnim
+{
+	// Runs the function with its data and index, e.g. a branch of a blend tree update
+	struct Job
+	{
+		void (*function)(void* data, uint32_t index);
+		void* data;
+		uint32_t index;
+	};
+
+	// Worker threads, each with a queue of its own
+	// A worker runs the newest job of its queue first, and steals the oldest job of another queue when its own is empty
+	// The threads that are not workers, e.g. the main thread, share one more queue and run jobs while they wait
+	class JobSystem
+	{
+	public:
+		explicit JobSystem(uint32_t workerCount);
+		~JobSystem();
+
+		// Started on first use
+		static JobSystem& Get();
+
+		uint32_t GetWorkerCount() const { return static_cast<uint32_t>(v_Workers.size()); }
+		// Queues the job on the queue of the calling thread, a job can submit others
+		void Submit(const Job& job);
+		// Runs jobs on the calling thread until the counter drops to 0, the jobs decrement it when they are done
+		void Wait(const std::atomic<uint32_t>& counter);
+
+	private:
+		struct Queue
+		{
+			std::mutex mutex;
+			std::deque<Job> jobs;
+		};
+
+		uint32_t GetQueueIndex() const;
+		bool TakeJob(uint32_t queue, Job& job);
+		void WorkerLoop(uint32_t queue);
+
+	private:
+		std::vector<std::unique_ptr<Queue>> v_Queues;	// One per worker, then the one of the other threads
+		std::vector<std::thread> v_Workers;
+		std::mutex m_SleepMutex;
+		std::condition_variable m_WakeUp;
+		std::atomic<int32_t> m_QueuedCount;				// Can drop below 0 for a moment, a job is taken before it is counted
+		bool m_Quit;
+	};
+}
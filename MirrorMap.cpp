@@ -0,0 +1,225 @@
+#include "MirrorMap.h"
+#include "animation/skeleton.h"
+#include "system/string_id.h"
+using namespace AsdfAnim;
+
+namespace
+{
+	struct Rotation
+	{
+		float x, y, z, w;
+	};
+
+	Rotation Multiply(const Rotation& a, const Rotation& b)
+	{
+		return {
+			a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+			a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+			a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+			a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z
+		};
+	}
+
+	Rotation Conjugate(const Rotation& r)
+	{
+		return { -r.x, -r.y, -r.z, r.w };
+	}
+
+	// The reflection R -> M R M of a rotation keeps its component along the axis and flips the other two
+	Rotation Reflect(const Rotation& r, MirrorAxis_ axis)
+	{
+		Rotation reflected = { -r.x, -r.y, -r.z, r.w };
+		if (axis == MirrorAxis_::MirrorAxis_X) reflected.x = r.x;
+		else if (axis == MirrorAxis_::MirrorAxis_Y) reflected.y = r.y;
+		else reflected.z = r.z;
+		return reflected;
+	}
+
+	void StoreRotation(const Rotation& r, size_t joint, size_t n, AlignedFloats& streams)
+	{
+		streams[joint] = r.x;
+		streams[n + joint] = r.y;
+		streams[2u * n + joint] = r.z;
+		streams[3u * n + joint] = r.w;
+	}
+}
+
+///
+/// Mirror map
+///
+MirrorMap::MirrorMap(const gef::SkeletonPose& bindPose, const gef::StringIdTable& names, MirrorAxis_ axis, const std::string& leftPattern, const std::string& rightPattern) :
+m_Axis(axis), m_JointCount(bindPose.local_pose().size()), m_PaddedCount((m_JointCount + SOA_POSE_LANES - 1u) / SOA_POSE_LANES * SOA_POSE_LANES), m_PairCount(0u)
+{
+	const gef::Skeleton* skeleton = bindPose.skeleton();
+	v_Sources.resize(m_PaddedCount);
+	for (size_t joint = 0u; joint < m_PaddedCount; ++joint) v_Sources[joint] = static_cast<int32_t>(joint);
+
+	// A joint named after the left side is paired with the joint named after the right side, the lookup goes one way only
+	for (Int32 joint = 0; skeleton && joint < skeleton->joint_count(); ++joint)
+	{
+		const auto name = names.table().find(skeleton->joint(joint).name_id);
+		if (name == names.table().end()) continue;
+		const size_t side = name->second.find(leftPattern);
+		if (side == std::string::npos) continue;
+
+		std::string other = name->second;
+		other.replace(side, leftPattern.size(), rightPattern);
+		const Int32 otherJoint = skeleton->FindJointIndex(gef::GetStringId(other));
+		if (otherJoint < 0 || otherJoint == joint || v_Sources[otherJoint] != otherJoint) continue;
+		v_Sources[joint] = otherJoint;
+		v_Sources[otherJoint] = joint;
+	}
+
+	// The pose of a joint is rebuilt in the frame of its parent, which must be the mirror of the parent of its source
+	// Parents come before their children in a gef skeleton, a pair broken here is seen broken by the children of either side
+	auto parentOf = [skeleton](int32_t joint) { return skeleton ? skeleton->joint(joint).parent : -1; };
+	auto mirrorOf = [this](int32_t joint) { return joint < 0 ? joint : v_Sources[joint]; };
+	for (int32_t joint = 0; joint < static_cast<int32_t>(m_JointCount); ++joint)
+	{
+		const int32_t source = v_Sources[joint];
+		if (source != joint && parentOf(source) != mirrorOf(parentOf(joint)))
+		{
+			v_Sources[source] = source;
+			v_Sources[joint] = joint;
+		}
+	}
+	for (size_t joint = 0u; joint < m_JointCount; ++joint)
+		if (v_Sources[joint] != static_cast<int32_t>(joint)) ++m_PairCount;
+	m_PairCount /= 2u;
+
+	// Model space rotations of the bind pose
+	std::vector<Rotation> global(m_JointCount);
+	for (size_t joint = 0u; joint < m_JointCount; ++joint)
+	{
+		const gef::Quaternion& local = bindPose.local_pose()[joint].rotation();
+		const int32_t parent = parentOf(static_cast<int32_t>(joint));
+		global[joint] = parent < 0 ? Rotation{ local.x, local.y, local.z, local.w } : Multiply(global[parent], { local.x, local.y, local.z, local.w });
+	}
+
+	// The reflected change of the source from its bind pose, taken to the frame of the joint:
+	// before = inverse(bind of the parent) * reflected bind of the parent of the source, after = inverse(reflected bind of the source) * bind of the joint
+	v_Before.assign(4u * m_PaddedCount, 0.f);
+	v_After.assign(4u * m_PaddedCount, 0.f);
+	const Rotation identity = { 0.f, 0.f, 0.f, 1.f };
+	for (size_t joint = 0u; joint < m_PaddedCount; ++joint)
+	{
+		if (joint >= m_JointCount)
+		{
+			StoreRotation(identity, joint, m_PaddedCount, v_Before);
+			StoreRotation(identity, joint, m_PaddedCount, v_After);
+			continue;
+		}
+		const int32_t source = v_Sources[joint];
+		const int32_t parent = parentOf(static_cast<int32_t>(joint));
+		const Rotation before = parent < 0 ? identity : Multiply(Conjugate(global[parent]), Reflect(global[mirrorOf(parent)], axis));
+		StoreRotation(before, joint, m_PaddedCount, v_Before);
+		StoreRotation(Multiply(Conjugate(Reflect(global[source], axis)), global[joint]), joint, m_PaddedCount, v_After);
+	}
+
+	// A reflection flips the translation along the axis, and the rotation components across it
+	a_Signs.fill(1.f);
+	const uint32_t axisIndex = static_cast<uint32_t>(axis);
+	for (uint32_t c = 0u; c < 3u; ++c)
+		if (c != axisIndex) a_Signs[SoaPose::Stream_RotationX + c] = -1.f;
+	a_Signs[SoaPose::Stream_TranslationX + axisIndex] = -1.f;
+}
+
+void MirrorMap::Mirror(const SoaPose& pose, SoaPose& mirrored) const
+{
+#if SOA_POSE_SIMD
+	MirrorSimd(pose, mirrored);
+#else
+	MirrorScalar(pose, mirrored);
+#endif
+}
+
+void MirrorMap::MirrorScalar(const SoaPose& pose, SoaPose& mirrored) const
+{
+	if (mirrored.GetJointCount() != pose.GetJointCount()) mirrored.Resize(pose.GetJointCount());
+	const size_t n = m_PaddedCount;
+	for (size_t joint = 0u; joint < n; ++joint)
+	{
+		const float* in = pose.GetStream(SoaPose::Stream_RotationX) + v_Sources[joint];
+		float* out = mirrored.GetStream(SoaPose::Stream_RotationX) + joint;
+		const Rotation before = { v_Before[joint], v_Before[n + joint], v_Before[2u * n + joint], v_Before[3u * n + joint] };
+		const Rotation after = { v_After[joint], v_After[n + joint], v_After[2u * n + joint], v_After[3u * n + joint] };
+
+		const Rotation reflected = { in[0] * a_Signs[0], in[n] * a_Signs[1], in[2u * n] * a_Signs[2], in[3u * n] * a_Signs[3] };
+		const Rotation rotation = Multiply(Multiply(before, reflected), after);
+		out[0] = rotation.x, out[n] = rotation.y, out[2u * n] = rotation.z, out[3u * n] = rotation.w;
+
+		// The translation is in the frame of the parent, rotated like the rotation: v + w * t + cross(q, t) with t = 2 * cross(q, v)
+		const float vx = in[4u * n] * a_Signs[4], vy = in[5u * n] * a_Signs[5], vz = in[6u * n] * a_Signs[6];
+		const float tx = 2.f * (before.y * vz - before.z * vy), ty = 2.f * (before.z * vx - before.x * vz), tz = 2.f * (before.x * vy - before.y * vx);
+		out[4u * n] = vx + before.w * tx + before.y * tz - before.z * ty;
+		out[5u * n] = vy + before.w * ty + before.z * tx - before.x * tz;
+		out[6u * n] = vz + before.w * tz + before.x * ty - before.y * tx;
+
+		for (size_t c = SoaPose::Stream_ScaleX; c < SoaPose::Stream_Count; ++c) out[c * n] = in[c * n];
+	}
+}
+
+///
+/// SSE kernel, four joints per instruction
+///
+#if SOA_POSE_SIMD
+namespace
+{
+	inline void Multiply(const __m128* a, const __m128* b, __m128* out)
+	{
+		out[0] = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a[3], b[0]), _mm_mul_ps(a[0], b[3])), _mm_mul_ps(a[1], b[2])), _mm_mul_ps(a[2], b[1]));
+		out[1] = _mm_add_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(a[3], b[1]), _mm_mul_ps(a[0], b[2])), _mm_mul_ps(a[1], b[3])), _mm_mul_ps(a[2], b[0]));
+		out[2] = _mm_add_ps(_mm_sub_ps(_mm_add_ps(_mm_mul_ps(a[3], b[2]), _mm_mul_ps(a[0], b[1])), _mm_mul_ps(a[1], b[0])), _mm_mul_ps(a[2], b[3]));
+		out[3] = _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(_mm_mul_ps(a[3], b[3]), _mm_mul_ps(a[0], b[0])), _mm_mul_ps(a[1], b[1])), _mm_mul_ps(a[2], b[2]));
+	}
+
+	inline void Cross(const __m128* a, const __m128* b, __m128* out)
+	{
+		out[0] = _mm_sub_ps(_mm_mul_ps(a[1], b[2]), _mm_mul_ps(a[2], b[1]));
+		out[1] = _mm_sub_ps(_mm_mul_ps(a[2], b[0]), _mm_mul_ps(a[0], b[2]));
+		out[2] = _mm_sub_ps(_mm_mul_ps(a[0], b[1]), _mm_mul_ps(a[1], b[0]));
+	}
+}
+
+void MirrorMap::MirrorSimd(const SoaPose& pose, SoaPose& mirrored) const
+{
+	if (mirrored.GetJointCount() != pose.GetJointCount()) mirrored.Resize(pose.GetJointCount());
+	const size_t n = m_PaddedCount;
+	const float* in = pose.GetStream(SoaPose::Stream_RotationX);
+	const float* before = v_Before.data();
+	const float* after = v_After.data();
+	const __m128 two = _mm_set1_ps(2.f);
+	for (size_t joint = 0u; joint < n; joint += SOA_POSE_LANES)
+	{
+		float* out = mirrored.GetStream(SoaPose::Stream_RotationX) + joint;
+
+		// The sources are gathered lane by lane and reflected on the way in, the rest runs on four joints at a time
+		const int32_t* sources = v_Sources.data() + joint;
+		__m128 channels[SoaPose::Stream_Count];
+		for (size_t c = 0u; c < SoaPose::Stream_Count; ++c)
+		{
+			const float* stream = in + c * n;
+			channels[c] = _mm_mul_ps(_mm_setr_ps(stream[sources[0]], stream[sources[1]], stream[sources[2]], stream[sources[3]]), _mm_set1_ps(a_Signs[c]));
+		}
+
+		__m128 rb[4], ra[4], rotation[4], result[4];
+		for (size_t c = 0u; c < 4u; ++c)
+		{
+			rb[c] = _mm_load_ps(before + c * n + joint);
+			ra[c] = _mm_load_ps(after + c * n + joint);
+		}
+		Multiply(rb, channels, rotation);
+		Multiply(rotation, ra, result);
+		for (size_t c = 0u; c < 4u; ++c) _mm_store_ps(out + c * n, result[c]);
+
+		__m128 t[3], bt[3];
+		Cross(rb, channels + SoaPose::Stream_TranslationX, t);
+		for (size_t c = 0u; c < 3u; ++c) t[c] = _mm_mul_ps(t[c], two);
+		Cross(rb, t, bt);
+		for (size_t c = 0u; c < 3u; ++c)
+			_mm_store_ps(out + (SoaPose::Stream_TranslationX + c) * n, _mm_add_ps(_mm_add_ps(channels[SoaPose::Stream_TranslationX + c], _mm_mul_ps(rb[3], t[c])), bt[c]));
+
+		for (size_t c = SoaPose::Stream_ScaleX; c < SoaPose::Stream_Count; ++c) _mm_store_ps(out + c * n, channels[c]);
+	}
+}
+#endif
@@ -0,0 +1,66 @@
+#pragma once
+#include <stdint.h>
+#include <array>
+#include <string>
+#include <vector>
+#include "SoaPose.h"
+
+// Parts of the joint names telling the sides apart, a joint is paired with the joint whose name has the other one instead
+#define MIRRORMAP_LEFT "Left"
+#define MIRRORMAP_RIGHT "Right"
+
+namespace gef
+{
+	class SkeletonPose;
+	class StringIdTable;
+}
+
+namespace AsdfAnim
+{
+	// Model space axis across which the poses are mirrored, the one going from one side of the character to the other
+	enum class MirrorAxis_
+	{
+		MirrorAxis_X,
+		MirrorAxis_Y,
+		MirrorAxis_Z
+	};
+
+	// Which joint each joint takes its mirrored pose from, worked out once per skeleton when it is loaded
+	// The joints whose names differ only by the side patterns swap their poses, e.g. mixamorig:LeftArm and mixamorig:RightArm,
+	// the others mirror their own. The joint axes of the two sides need not be mirror images, the bind pose is used to
+	// correct each joint, so that the bind pose mirrors to itself and mirroring twice gives the pose back
+	class MirrorMap
+	{
+	public:
+		// The names are those of the scene the skeleton was loaded from
+		// A pair whose parents are not mirror images of each other, or a joint named after a side missing from the skeleton, mirrors itself
+		MirrorMap(const gef::SkeletonPose& bindPose, const gef::StringIdTable& names, MirrorAxis_ axis = MirrorAxis_::MirrorAxis_X,
+			const std::string& leftPattern = MIRRORMAP_LEFT, const std::string& rightPattern = MIRRORMAP_RIGHT);
+
+		MirrorAxis_ GetAxis() const { return m_Axis; }
+		size_t GetJointCount() const { return m_JointCount; }
+		// Joint the pose of the joint is taken from, the joint itself for the middle of the body
+		int32_t GetMirrorJoint(int32_t joint) const { return v_Sources[joint]; }
+		size_t GetPairCount() const { return m_PairCount; }
+
+		// Mirrored copy of the pose, the pose and the result cannot be the same
+		void Mirror(const SoaPose& pose, SoaPose& mirrored) const;
+		// Scalar version, the reference the SIMD kernel is checked against in Benchmarks::PoseMirroring()
+		void MirrorScalar(const SoaPose& pose, SoaPose& mirrored) const;
+#if SOA_POSE_SIMD
+		void MirrorSimd(const SoaPose& pose, SoaPose& mirrored) const;
+#endif
+
+	private:
+		MirrorAxis_ m_Axis;
+		size_t m_JointCount;
+		size_t m_PaddedCount;
+		size_t m_PairCount;
+		std::vector<int32_t> v_Sources;						// Per joint, padded like a SoaPose stream, the padding takes its own identity
+		std::array<float, SoaPose::Stream_Count> a_Signs;	// Per stream, -1 for the channels a reflection flips
+		// Per joint, the rotations the reflected pose of the source is put between, padded like the poses
+		// Rotation X, Y, Z and W streams of each. Identity for a rig whose two sides are mirror images
+		AlignedFloats v_Before;
+		AlignedFloats v_After;
+	};
+}
@@ -0,0 +1,82 @@
+#include "NodeArena.h"
+#include "BlendNode.h"
+using namespace AsdfAnim;
+
+///
+/// Node arena
+///
+NodeArena::~NodeArena()
+{
+	// The chunks are freed with the pools
+	for (BlendNode* node : v_Nodes) node->~BlendNode();
+}
+
+bool NodeArena::Destroy(NodeHandle handle)
+{
+	if (!IsValid(handle)) return false;
+
+	Slot& slot = v_Slots[handle.index];
+	slot.node->~BlendNode();
+	v_Pools[slot.pool].freeNodes.push_back(slot.node);
+
+	// The last node takes the place of the removed one
+	const uint32_t position = slot.position;
+	v_Nodes[position] = v_Nodes.back();
+	v_Handles[position] = v_Handles.back();
+	v_Slots[v_Handles[position].index].position = position;
+	v_Nodes.pop_back();
+	v_Handles.pop_back();
+
+	slot.node = nullptr;
+	++slot.generation;
+	v_FreeSlots.push_back(handle.index);
+	return true;
+}
+
+size_t NodeArena::GetChunkCount() const
+{
+	size_t count = 0u;
+	for (const Pool& pool : v_Pools) count += pool.chunks.size();
+	return count;
+}
+
+void* NodeArena::Allocate(uint32_t pool, size_t nodeSize)
+{
+	if (pool >= v_Pools.size()) v_Pools.resize(pool + 1u);
+	Pool& nodes = v_Pools[pool];
+	if (nodes.freeNodes.empty())
+	{
+		// Pushed in reverse so that the nodes are used in address order
+		nodes.nodeSize = (nodeSize + NODEARENA_ALIGNMENT - 1u) / NODEARENA_ALIGNMENT * NODEARENA_ALIGNMENT;
+		nodes.chunks.emplace_back(new uint8_t[nodes.nodeSize * NODEARENA_CHUNK_NODES]);
+		for (uint32_t i = NODEARENA_CHUNK_NODES; i-- > 0u;) nodes.freeNodes.push_back(nodes.chunks.back().get() + i * nodes.nodeSize);
+	}
+
+	void* memory = nodes.freeNodes.back();
+	nodes.freeNodes.pop_back();
+	return memory;
+}
+
+NodeHandle NodeArena::Insert(BlendNode* node, uint32_t pool)
+{
+	uint32_t index;
+	if (v_FreeSlots.empty())
+	{
+		index = static_cast<uint32_t>(v_Slots.size());
+		v_Slots.push_back({ nullptr, 0u, 0u, 0u });
+	}
+	else
+	{
+		index = v_FreeSlots.back();
+		v_FreeSlots.pop_back();
+	}
+
+	Slot& slot = v_Slots[index];
+	slot.node = node;
+	slot.pool = pool;
+	slot.position = static_cast<uint32_t>(v_Nodes.size());
+	const NodeHandle handle = { index, slot.generation };
+	v_Nodes.push_back(node);
+	v_Handles.push_back(handle);
+	return handle;
+}
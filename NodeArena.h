@@ -0,0 +1,94 @@
+#pragma once
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Nodes per chunk, a type gets a new chunk when all of its nodes are used
+#define NODEARENA_CHUNK_NODES 32u
+// Alignment of the nodes in their chunk, that of operator new
+#define NODEARENA_ALIGNMENT __STDCPP_DEFAULT_NEW_ALIGNMENT__
+
+namespace AsdfAnim
+{
+	class BlendNode;
+
+	// Reference to a node of a template that stays valid while the rest of the graph is edited
+	// A removed node bumps the generation of its slot, the handles to it no longer match and reach nothing
+	struct NodeHandle
+	{
+		uint32_t index;
+		uint32_t generation;
+
+		bool operator==(const NodeHandle& other) const { return index == other.index && generation == other.generation; }
+		bool operator!=(const NodeHandle& other) const { return !(*this == other); }
+	};
+
+	// Lets the handles key the maps of the template, a node added in the slot of a removed one never finds the entries of the old node
+	struct NodeHandleHash
+	{
+		size_t operator()(const NodeHandle& handle) const { return std::hash<uint64_t>()(static_cast<uint64_t>(handle.generation) << 32u | handle.index); }
+	};
+
+	// Storage of the nodes of a template, each type in chunks of its own so that e.g. the clip nodes sit next to each other
+	// The nodes never move, the memory of a removed node is reused by the next node of its type
+	// Adding and removing are constant time. Removing a node moves the last node of the list to its place, the other nodes keep theirs
+	class NodeArena
+	{
+	public:
+		NodeArena() {}
+		~NodeArena();
+		NodeArena(const NodeArena&) = delete;
+		NodeArena& operator=(const NodeArena&) = delete;
+
+		// Constructs the node in the chunks of the pool, one pool per type
+		template<typename Node, typename... Args>
+		Node* Create(uint32_t pool, NodeHandle& handle, Args&&... args)
+		{
+			static_assert(alignof(Node) <= NODEARENA_ALIGNMENT, "Nodes are aligned like operator new aligns");
+			Node* node = new (Allocate(pool, sizeof(Node))) Node(std::forward<Args>(args)...);
+			handle = Insert(node, pool);
+			return node;
+		}
+		// Returns false for a handle that is no longer valid
+		bool Destroy(NodeHandle handle);
+
+		// Null when the handle is no longer valid
+		BlendNode* Get(NodeHandle handle) const { return IsValid(handle) ? v_Slots[handle.index].node : nullptr; }
+		bool IsValid(NodeHandle handle) const { return handle.index < v_Slots.size() && v_Slots[handle.index].node && v_Slots[handle.index].generation == handle.generation; }
+		// Place of the node in GetNodes(), UINT32_MAX when the handle is no longer valid
+		uint32_t GetPosition(NodeHandle handle) const { return IsValid(handle) ? v_Slots[handle.index].position : UINT32_MAX; }
+		// Live nodes, in the order they were added but for the places of the removed ones
+		const std::vector<BlendNode*>& GetNodes() const { return v_Nodes; }
+		const std::vector<NodeHandle>& GetHandles() const { return v_Handles; }
+		size_t GetChunkCount() const;
+
+	private:
+		struct Slot
+		{
+			BlendNode* node;			// Null when free
+			uint32_t generation;
+			uint32_t pool;
+			uint32_t position;			// In v_Nodes
+		};
+
+		struct Pool
+		{
+			size_t nodeSize;
+			std::vector<std::unique_ptr<uint8_t[]>> chunks;
+			std::vector<void*> freeNodes;
+		};
+
+		void* Allocate(uint32_t pool, size_t nodeSize);
+		NodeHandle Insert(BlendNode* node, uint32_t pool);
+
+	private:
+		std::vector<Slot> v_Slots;
+		std::vector<uint32_t> v_FreeSlots;
+		std::vector<Pool> v_Pools;
+		std::vector<BlendNode*> v_Nodes;
+		std::vector<NodeHandle> v_Handles;		// Of v_Nodes
+	};
+}
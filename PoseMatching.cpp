@@ -0,0 +1,119 @@
+#include "PoseMatching.h"
+#include "SyncMarkers.h"
+#include "ClipSampler.h"
+#include "animation/animation.h"
+#include "animation/skeleton.h"
+#include "system/string_id.h"
+#include <algorithm>
+#include <cmath>
+using namespace AsdfAnim;
+
+///
+/// Pose matching
+///
+PoseFeatures PoseMatching::Extract(const gef::Animation& clip, const gef::SkeletonPose& bindPose)
+{
+	PoseFeatures index = { 1.f / POSEMATCHING_SAMPLE_RATE, {}, {} };
+	const gef::Skeleton* skeleton = bindPose.skeleton();
+	if (!skeleton) return index;
+
+	const Int32 root = skeleton->FindJointIndex(gef::GetStringId(POSEMATCHING_ROOT));
+	const std::array<Int32, POSEMATCHING_JOINTS> joints = {
+		skeleton->FindJointIndex(gef::GetStringId(SYNCMARKERS_LEFT_FOOT)),
+		skeleton->FindJointIndex(gef::GetStringId(SYNCMARKERS_RIGHT_FOOT)),
+		skeleton->FindJointIndex(gef::GetStringId(POSEMATCHING_LEFT_HAND)),
+		skeleton->FindJointIndex(gef::GetStringId(POSEMATCHING_RIGHT_HAND))
+	};
+	if (root < 0 || std::any_of(joints.begin(), joints.end(), [](Int32 joint) { return joint < 0; })) return index;
+
+	// Positions relative to the root on every frame, the last one at most at the end of the clip
+	const uint32_t frameCount = static_cast<uint32_t>(std::floor(std::max(clip.duration(), 0.f) * POSEMATCHING_SAMPLE_RATE)) + 1u;
+	std::vector<gef::Vector4> positions;
+	positions.reserve(frameCount * POSEMATCHING_JOINTS);
+	ClipSampler sampler;
+	sampler.SetAnimation(&clip, bindPose);
+	gef::SkeletonPose pose = bindPose;
+	for (uint32_t frame = 0u; frame < frameCount; ++frame)
+	{
+		sampler.Sample(frame * index.frameTime, pose);
+		pose.CalculateGlobalPose();
+		const gef::Vector4 origin = pose.global_pose()[root].GetTranslation();
+		for (Int32 joint : joints) positions.push_back(pose.global_pose()[joint].GetTranslation() - origin);
+	}
+
+	// Velocities from the frames around, one sided at the ends
+	index.features.resize(frameCount * POSEMATCHING_FEATURE_SIZE);
+	for (uint32_t frame = 0u; frame < frameCount; ++frame)
+	{
+		const uint32_t previous = frame > 0u ? frame - 1u : frame;
+		const uint32_t next = std::min(frame + 1u, frameCount - 1u);
+		const float interval = std::max(next - previous, 1u) * index.frameTime;
+		float* feature = &index.features[frame * POSEMATCHING_FEATURE_SIZE];
+		for (uint32_t joint = 0u; joint < POSEMATCHING_JOINTS; ++joint, feature += 6)
+		{
+			const gef::Vector4& position = positions[frame * POSEMATCHING_JOINTS + joint];
+			const gef::Vector4 velocity = (positions[next * POSEMATCHING_JOINTS + joint] - positions[previous * POSEMATCHING_JOINTS + joint]) / interval;
+			feature[0] = position.x(); feature[1] = position.y(); feature[2] = position.z();
+			feature[3] = velocity.x(); feature[4] = velocity.y(); feature[5] = velocity.z();
+		}
+	}
+
+	// Each group is scaled by its spread over the clip, a group that barely moves, e.g. the velocities of an idle, is left as is
+	for (uint32_t group = 0u; group < 2u; ++group)
+	{
+		float deviation = 0.f;
+		for (uint32_t dimension = 0u; dimension < POSEMATCHING_FEATURE_SIZE; ++dimension)
+		{
+			if ((dimension % 6u) / 3u != group) continue;
+			float mean = 0.f, squares = 0.f;
+			for (uint32_t frame = 0u; frame < frameCount; ++frame) mean += index.features[frame * POSEMATCHING_FEATURE_SIZE + dimension];
+			mean /= frameCount;
+			for (uint32_t frame = 0u; frame < frameCount; ++frame)
+			{
+				const float offset = index.features[frame * POSEMATCHING_FEATURE_SIZE + dimension] - mean;
+				squares += offset * offset;
+			}
+			deviation += std::sqrt(squares / frameCount);
+		}
+		deviation /= POSEMATCHING_JOINTS * 3u;
+
+		const float weight = (deviation > 1e-4f ? 1.f / deviation : 1.f) * (group ? POSEMATCHING_VELOCITY_WEIGHT : 1.f);
+		for (uint32_t dimension = 0u; dimension < POSEMATCHING_FEATURE_SIZE; ++dimension)
+			if ((dimension % 6u) / 3u == group) index.weights[dimension] = weight;
+	}
+	return index;
+}
+
+bool PoseMatching::FindBestTime(const PoseFeatures& from, float fromTime, const PoseFeatures& to, float maxTime, float& time)
+{
+	if (from.IsEmpty() || to.IsEmpty()) return false;
+
+	// The query is the frame of the first clip closest to its time, weighted like the frames it is compared to
+	const size_t fromFrame = std::min(static_cast<size_t>(std::max(fromTime, 0.f) / from.frameTime + 0.5f), from.GetFrameCount() - 1u);
+	std::array<float, POSEMATCHING_FEATURE_SIZE> query;
+	for (uint32_t dimension = 0u; dimension < POSEMATCHING_FEATURE_SIZE; ++dimension)
+		query[dimension] = from.features[fromFrame * POSEMATCHING_FEATURE_SIZE + dimension] * to.weights[dimension];
+
+	// A frame is dropped as soon as it is further than the best one so far
+	const size_t frameCount = std::min(static_cast<size_t>(std::max(maxTime, 0.f) / to.frameTime) + 1u, to.GetFrameCount());
+	size_t bestFrame = 0u;
+	float bestDistance = INFINITY;
+	for (size_t frame = 0u; frame < frameCount; ++frame)
+	{
+		const float* feature = &to.features[frame * POSEMATCHING_FEATURE_SIZE];
+		float distance = 0.f;
+		for (uint32_t dimension = 0u; dimension < POSEMATCHING_FEATURE_SIZE && distance < bestDistance; ++dimension)
+		{
+			const float offset = query[dimension] - feature[dimension] * to.weights[dimension];
+			distance += offset * offset;
+		}
+		if (distance < bestDistance)
+		{
+			bestDistance = distance;
+			bestFrame = frame;
+		}
+	}
+
+	time = bestFrame * to.frameTime;
+	return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <stdint.h>
+#include <array>
+#include <vector>
+
+// Rate the features are taken at when a clip is indexed, in frames per second
+#define POSEMATCHING_SAMPLE_RATE 30.f
+// The joints are measured from the root, the feet are those of the sync markers
+#define POSEMATCHING_ROOT "mixamorig:Hips"
+#define POSEMATCHING_LEFT_HAND "mixamorig:LeftHand"
+#define POSEMATCHING_RIGHT_HAND "mixamorig:RightHand"
+#define POSEMATCHING_JOINTS 4u
+// Position then velocity of each joint
+#define POSEMATCHING_FEATURE_SIZE (POSEMATCHING_JOINTS * 6u)
+// Of the velocities against the positions, once both are normalised
+#define POSEMATCHING_VELOCITY_WEIGHT 0.5f
+
+namespace gef
+{
+	class Animation;
+	class SkeletonPose;
+}
+
+namespace AsdfAnim
+{
+	// Feature vectors of a clip at a fixed rate: the positions of the hands and feet relative to the root, and their velocities
+	struct PoseFeatures
+	{
+		float frameTime;
+		std::vector<float> features;								// POSEMATCHING_FEATURE_SIZE floats per frame
+		std::array<float, POSEMATCHING_FEATURE_SIZE> weights;		// Normalise the positions and the velocities of the clip, each as a group
+
+		size_t GetFrameCount() const { return features.size() / POSEMATCHING_FEATURE_SIZE; }
+		bool IsEmpty() const { return features.empty(); }
+	};
+
+	// Picks the time a clip starts at so that its pose continues the pose of another clip, e.g. when a transition starts
+	// The poses are compared by their feature vectors, indexed once per clip, a search reads a few hundred floats
+	class PoseMatching
+	{
+	public:
+		// Returns no features when the skeleton is missing one of the joints
+		static PoseFeatures Extract(const gef::Animation& clip, const gef::SkeletonPose& bindPose);
+
+		// Time of the frame of the second clip, up to the max time, closest to the first clip at its time, by the weights of the second clip
+		// Returns false when a clip has no features
+		static bool FindBestTime(const PoseFeatures& from, float fromTime, const PoseFeatures& to, float maxTime, float& time);
+	};
+}
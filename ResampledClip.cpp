@@ -0,0 +1,298 @@
+#include "ResampledClip.h"
+#include "ClipSampler.h"
+#include "ClipCompression.h"
+#include "SoaPose.h"
+#include "BoneMask.h"
+#include "animation/animation.h"
+#include "animation/skeleton.h"
+#include <cmath>
+using namespace AsdfAnim;
+
+ResampledClip* ResampledClip::Resample(const gef::Animation& clip, const gef::SkeletonPose& bindPose, float sampleRate)
+{
+	const gef::Skeleton* skeleton = bindPose.skeleton();
+	if (!skeleton || sampleRate <= 0.f) return nullptr;
+
+	ResampledClip* result = new ResampledClip();
+	result->m_Duration = clip.duration();
+	result->m_SampleRate = sampleRate;
+	result->m_FrameCount = static_cast<uint32_t>(std::ceil(result->m_Duration * sampleRate)) + 1u;
+
+	// Only the joints animated by the clip get a column, the others stay in the bind pose
+	for (Int32 joint = 0; joint < skeleton->joint_count(); ++joint)
+		if (clip.anim_nodes().find(skeleton->joint(joint).name_id) != clip.anim_nodes().end())
+			result->v_Joints.push_back(joint);
+	const size_t columns = result->v_Joints.size();
+	result->v_Rotations.resize(columns * result->m_FrameCount);
+	result->v_Translations.resize(columns * result->m_FrameCount);
+	result->v_Scales.resize(columns * result->m_FrameCount);
+
+	// Sample the source with a cursor sampler, the times only move forward
+	ClipSampler sampler;
+	sampler.SetAnimation(&clip, bindPose);
+	gef::SkeletonPose pose = bindPose;
+	bool hasScale = false;
+	for (uint32_t frame = 0u; frame < result->m_FrameCount; ++frame)
+	{
+		sampler.Sample(std::min(frame / sampleRate, result->m_Duration), pose);
+		for (size_t column = 0u; column < columns; ++column)
+		{
+			const size_t index = frame * columns + column;
+			const gef::JointPose& jointPose = pose.local_pose()[result->v_Joints[column]];
+			const gef::Quaternion& rotation = jointPose.rotation();
+			Rotation& stored = result->v_Rotations[index];
+			stored = { rotation.x, rotation.y, rotation.z, rotation.w };
+
+			// Keep consecutive frames in the same hemisphere so the sampler can nlerp without checking
+			if (frame)
+			{
+				const Rotation& previous = result->v_Rotations[index - columns];
+				if (previous.x * stored.x + previous.y * stored.y + previous.z * stored.z + previous.w * stored.w < 0.f)
+					stored = { -stored.x, -stored.y, -stored.z, -stored.w };
+			}
+
+			const gef::Vector4& translation = jointPose.translation();
+			const gef::Vector4& scale = jointPose.scale();
+			result->v_Translations[index] = { translation.x(), translation.y(), translation.z() };
+			result->v_Scales[index] = { scale.x(), scale.y(), scale.z() };
+			hasScale = hasScale || (scale - bindPose.local_pose()[result->v_Joints[column]].scale()).Length() > 1e-5f;
+		}
+	}
+	if (!hasScale)
+	{
+		result->v_Scales.clear();
+		result->v_Scales.shrink_to_fit();
+	}
+
+	result->m_Stats.sourceBytes = CompressedClip::GetSourceBytes(clip);
+	result->m_Stats.resampledBytes = result->GetBytes();
+	result->m_Stats.maxError = MeasureClipError(clip, bindPose, [result, &bindPose](float time, gef::SkeletonPose& pose) { result->SamplePose(time, bindPose, pose); }, result->m_Stats.maxErrorJoint);
+	return result;
+}
+
+ResampledClip* ResampledClip::ResampleAdditive(const gef::Animation& clip, const gef::SkeletonPose& bindPose, AdditiveReference reference, float sampleRate)
+{
+	if (reference == AdditiveReference::Additive_Reference_None) return nullptr;
+	ResampledClip* result = Resample(clip, bindPose, sampleRate);
+	if (!result) return nullptr;
+
+	gef::SkeletonPose referencePose = bindPose;
+	if (reference == AdditiveReference::Additive_Reference_First_Frame)
+	{
+		ClipSampler sampler;
+		sampler.SetAnimation(&clip, bindPose);
+		sampler.Sample(0.f, referencePose);
+	}
+	referencePose.CalculateGlobalPose();
+
+	// Turn every frame into its difference with the reference
+	const size_t columns = result->v_Joints.size();
+	for (uint32_t frame = 0u; frame < result->m_FrameCount; ++frame)
+		for (size_t column = 0u; column < columns; ++column)
+		{
+			const size_t index = frame * columns + column;
+			const gef::JointPose& referenceJoint = referencePose.local_pose()[result->v_Joints[column]];
+
+			gef::Quaternion inverse = referenceJoint.rotation();
+			inverse.Conjugate();
+			const Rotation& stored = result->v_Rotations[index];
+			gef::Quaternion delta = inverse * gef::Quaternion(stored.x, stored.y, stored.z, stored.w);
+			if (delta.w < 0.f) delta = delta * -1.f;
+			result->v_Rotations[index] = { delta.x, delta.y, delta.z, delta.w };
+
+			Vector& translation = result->v_Translations[index];
+			translation = { translation.x - referenceJoint.translation().x(), translation.y - referenceJoint.translation().y(), translation.z - referenceJoint.translation().z() };
+			if (!result->v_Scales.empty())
+			{
+				Vector& scale = result->v_Scales[index];
+				scale = { scale.x - referenceJoint.scale().x(), scale.y - referenceJoint.scale().y(), scale.z - referenceJoint.scale().z() };
+			}
+		}
+	result->m_Additive = true;
+
+	// Applied on the reference the clip must give the source back
+	result->m_Stats.maxError = MeasureClipError(clip, bindPose, [result, &referencePose](float time, gef::SkeletonPose& pose)
+	{
+		pose.local_pose() = referencePose.local_pose();
+		result->ApplyAdditive(time, 1.f, pose.local_pose());
+		pose.CalculateGlobalPose();
+	}, result->m_Stats.maxErrorJoint);
+	return result;
+}
+
+void ResampledClip::SamplePose(float time, const gef::SkeletonPose& bindPose, gef::SkeletonPose& pose) const
+{
+	// Joints without a column use the bind pose, like gef::SkeletonPose::SetPoseFromAnim
+	SoaPose decoded(bindPose.local_pose());
+	SampleTracks(time, decoded);
+	decoded.ToLocalPose(pose.local_pose());
+	pose.CalculateGlobalPose();
+}
+
+void ResampledClip::SampleTracks(float time, SoaPose& pose, const SoaPose* bindPose, const BoneMask* mask) const
+{
+	const size_t columns = v_Joints.size();
+	if (!columns) return;
+
+	float alpha;
+	const uint32_t frame = FindFrame(time, alpha);
+	const uint32_t nextFrame = std::min(frame + 1u, m_FrameCount - 1u);
+	const Rotation* rotationsA = v_Rotations.data() + frame * columns;
+	const Rotation* rotationsB = v_Rotations.data() + nextFrame * columns;
+	const Vector* translationsA = v_Translations.data() + frame * columns;
+	const Vector* translationsB = v_Translations.data() + nextFrame * columns;
+	const Vector* scalesA = v_Scales.empty() ? nullptr : v_Scales.data() + frame * columns;
+	const Vector* scalesB = v_Scales.empty() ? nullptr : v_Scales.data() + nextFrame * columns;
+	float* rotationX = pose.GetStream(SoaPose::Stream_RotationX);
+	float* rotationY = pose.GetStream(SoaPose::Stream_RotationY);
+	float* rotationZ = pose.GetStream(SoaPose::Stream_RotationZ);
+	float* rotationW = pose.GetStream(SoaPose::Stream_RotationW);
+	float* translationX = pose.GetStream(SoaPose::Stream_TranslationX);
+	float* translationY = pose.GetStream(SoaPose::Stream_TranslationY);
+	float* translationZ = pose.GetStream(SoaPose::Stream_TranslationZ);
+	float* scaleX = pose.GetStream(SoaPose::Stream_ScaleX);
+	float* scaleY = pose.GetStream(SoaPose::Stream_ScaleY);
+	float* scaleZ = pose.GetStream(SoaPose::Stream_ScaleZ);
+	for (size_t column = 0u; column < columns; ++column)
+	{
+		const int32_t joint = v_Joints[column];
+		if (mask && !mask->Contains(joint)) continue;
+
+		// Consecutive frames are in the same hemisphere, the nlerp needs no flip
+		const Rotation& a = rotationsA[column];
+		const Rotation& b = rotationsB[column];
+		const float x = a.x + (b.x - a.x) * alpha, y = a.y + (b.y - a.y) * alpha, z = a.z + (b.z - a.z) * alpha, w = a.w + (b.w - a.w) * alpha;
+		const float lengthSquared = x * x + y * y + z * z + w * w;
+		const float inverseLength = lengthSquared > 0.f ? 1.f / std::sqrt(lengthSquared) : 0.f;
+		rotationX[joint] = x * inverseLength;
+		rotationY[joint] = y * inverseLength;
+		rotationZ[joint] = z * inverseLength;
+		rotationW[joint] = lengthSquared > 0.f ? w * inverseLength : 1.f;
+
+		const Vector& ta = translationsA[column];
+		const Vector& tb = translationsB[column];
+		translationX[joint] = ta.x + (tb.x - ta.x) * alpha;
+		translationY[joint] = ta.y + (tb.y - ta.y) * alpha;
+		translationZ[joint] = ta.z + (tb.z - ta.z) * alpha;
+
+		if (scalesA)
+		{
+			const Vector& sa = scalesA[column];
+			const Vector& sb = scalesB[column];
+			scaleX[joint] = sa.x + (sb.x - sa.x) * alpha;
+			scaleY[joint] = sa.y + (sb.y - sa.y) * alpha;
+			scaleZ[joint] = sa.z + (sb.z - sa.z) * alpha;
+		}
+		else if (bindPose) pose.CopyScale(joint, *bindPose);
+	}
+}
+
+void ResampledClip::ApplyAdditive(float time, float weight, std::vector<gef::JointPose>& localPose) const
+{
+	const size_t columns = v_Joints.size();
+	if (!columns) return;
+
+	float alpha;
+	const uint32_t frame = FindFrame(time, alpha);
+	const uint32_t nextFrame = std::min(frame + 1u, m_FrameCount - 1u);
+	const Rotation* rotationsA = v_Rotations.data() + frame * columns;
+	const Rotation* rotationsB = v_Rotations.data() + nextFrame * columns;
+	const Vector* translationsA = v_Translations.data() + frame * columns;
+	const Vector* translationsB = v_Translations.data() + nextFrame * columns;
+	const Vector* scalesA = v_Scales.empty() ? nullptr : v_Scales.data() + frame * columns;
+	const Vector* scalesB = v_Scales.empty() ? nullptr : v_Scales.data() + nextFrame * columns;
+	for (size_t column = 0u; column < columns; ++column)
+	{
+		gef::JointPose& jointPose = localPose[v_Joints[column]];
+
+		// Interpolate between the frames then from the identity by the weight, the deltas have a positive w so both are nlerps
+		const Rotation& a = rotationsA[column];
+		const Rotation& b = rotationsB[column];
+		gef::Quaternion delta((a.x + (b.x - a.x) * alpha) * weight, (a.y + (b.y - a.y) * alpha) * weight, (a.z + (b.z - a.z) * alpha) * weight,
+			1.f - weight + (a.w + (b.w - a.w) * alpha) * weight);
+		delta.Normalise();
+		jointPose.set_rotation(jointPose.rotation() * delta);
+
+		const Vector& ta = translationsA[column];
+		const Vector& tb = translationsB[column];
+		jointPose.set_translation(jointPose.translation() + gef::Vector4(ta.x + (tb.x - ta.x) * alpha, ta.y + (tb.y - ta.y) * alpha, ta.z + (tb.z - ta.z) * alpha) * weight);
+
+		if (scalesA)
+		{
+			const Vector& sa = scalesA[column];
+			const Vector& sb = scalesB[column];
+			jointPose.set_scale(jointPose.scale() + gef::Vector4(sa.x + (sb.x - sa.x) * alpha, sa.y + (sb.y - sa.y) * alpha, sa.z + (sb.z - sa.z) * alpha) * weight);
+		}
+	}
+}
+
+void ResampledClip::SampleAdditive(float time, SoaPose& delta) const
+{
+	const size_t columns = v_Joints.size();
+	if (!columns) return;
+
+	float alpha;
+	const uint32_t frame = FindFrame(time, alpha);
+	const uint32_t nextFrame = std::min(frame + 1u, m_FrameCount - 1u);
+	const Rotation* rotationsA = v_Rotations.data() + frame * columns;
+	const Rotation* rotationsB = v_Rotations.data() + nextFrame * columns;
+	const Vector* translationsA = v_Translations.data() + frame * columns;
+	const Vector* translationsB = v_Translations.data() + nextFrame * columns;
+	const Vector* scalesA = v_Scales.empty() ? nullptr : v_Scales.data() + frame * columns;
+	const Vector* scalesB = v_Scales.empty() ? nullptr : v_Scales.data() + nextFrame * columns;
+	float* rotationX = delta.GetStream(SoaPose::Stream_RotationX);
+	float* rotationY = delta.GetStream(SoaPose::Stream_RotationY);
+	float* rotationZ = delta.GetStream(SoaPose::Stream_RotationZ);
+	float* rotationW = delta.GetStream(SoaPose::Stream_RotationW);
+	float* translationX = delta.GetStream(SoaPose::Stream_TranslationX);
+	float* translationY = delta.GetStream(SoaPose::Stream_TranslationY);
+	float* translationZ = delta.GetStream(SoaPose::Stream_TranslationZ);
+	float* scaleX = delta.GetStream(SoaPose::Stream_ScaleX);
+	float* scaleY = delta.GetStream(SoaPose::Stream_ScaleY);
+	float* scaleZ = delta.GetStream(SoaPose::Stream_ScaleZ);
+	for (size_t column = 0u; column < columns; ++column)
+	{
+		const int32_t joint = v_Joints[column];
+
+		// Only interpolated between the frames, AddPose() weights and normalises the rotation
+		const Rotation& a = rotationsA[column];
+		const Rotation& b = rotationsB[column];
+		rotationX[joint] = a.x + (b.x - a.x) * alpha;
+		rotationY[joint] = a.y + (b.y - a.y) * alpha;
+		rotationZ[joint] = a.z + (b.z - a.z) * alpha;
+		rotationW[joint] = a.w + (b.w - a.w) * alpha;
+
+		const Vector& ta = translationsA[column];
+		const Vector& tb = translationsB[column];
+		translationX[joint] = ta.x + (tb.x - ta.x) * alpha;
+		translationY[joint] = ta.y + (tb.y - ta.y) * alpha;
+		translationZ[joint] = ta.z + (tb.z - ta.z) * alpha;
+
+		if (scalesA)
+		{
+			const Vector& sa = scalesA[column];
+			const Vector& sb = scalesB[column];
+			scaleX[joint] = sa.x + (sb.x - sa.x) * alpha;
+			scaleY[joint] = sa.y + (sb.y - sa.y) * alpha;
+			scaleZ[joint] = sa.z + (sb.z - sa.z) * alpha;
+		}
+	}
+}
+
+uint32_t ResampledClip::FindFrame(float time, float& alpha) const
+{
+	// The last frame sits on the clip end, so the last interval can be shorter than the others
+	time = std::min(std::max(time, 0.f), m_Duration);
+	const uint32_t frame = m_FrameCount > 1u ? std::min(static_cast<uint32_t>(time * m_SampleRate), m_FrameCount - 2u) : 0u;
+	const uint32_t nextFrame = std::min(frame + 1u, m_FrameCount - 1u);
+	const float frameTime = frame / m_SampleRate;
+	const float span = std::min(nextFrame / m_SampleRate, m_Duration) - frameTime;
+	alpha = span > 0.f ? std::min((time - frameTime) / span, 1.f) : 0.f;
+	return frame;
+}
+
+uint64_t ResampledClip::GetBytes() const
+{
+	return sizeof(ResampledClip) + sizeof(int32_t) * v_Joints.size() + sizeof(Rotation) * v_Rotations.size()
+		+ sizeof(Vector) * (v_Translations.size() + v_Scales.size());
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "Animation.h"
+
+// Rate the clips are resampled at, in frames per second
+#define CLIP_RESAMPLING_DEFAULT_RATE 30.f
+
+namespace gef
+{
+	class Animation;
+	class SkeletonPose;
+	class JointPose;
+}
+
+namespace AsdfAnim
+{
+	class SoaPose;
+	class BoneMask;
+
+	struct ClipResamplingStats
+	{
+		uint64_t sourceBytes;
+		uint64_t resampledBytes;
+		float maxError;				// Largest world space joint position error measured over the clip
+		int32_t maxErrorJoint;
+	};
+
+	// A gef::Animation resampled at a fixed rate
+	// Every frame stores the animated joints contiguously, so sampling is two indexed reads and an nlerp per joint without any key search
+	class ResampledClip
+	{
+	public:
+		static ResampledClip* Resample(const gef::Animation& clip, const gef::SkeletonPose& bindPose, float sampleRate = CLIP_RESAMPLING_DEFAULT_RATE);
+		// Stores the difference between the clip and the reference instead, so that playback never has to subtract poses
+		// Rotations are reference^-1 * rotation, translations and scales are offsets. Additive clips are played with ApplyAdditive()
+		static ResampledClip* ResampleAdditive(const gef::Animation& clip, const gef::SkeletonPose& bindPose, AdditiveReference reference, float sampleRate = CLIP_RESAMPLING_DEFAULT_RATE);
+
+		// Decodes the clip straight into the pose, joints without data are set to the bind pose
+		// The time is relative to the start of the clip
+		void SamplePose(float time, const gef::SkeletonPose& bindPose, gef::SkeletonPose& pose) const;
+		// Only writes the animated joints, straight into the streams. Their scale is taken from the bind pose when it is given and the clip has none
+		// With a mask only the joints of the mask are sampled
+		void SampleTracks(float time, SoaPose& pose, const SoaPose* bindPose = nullptr, const BoneMask* mask = nullptr) const;
+		// Adds the weighted difference to the animated joints of the local pose in a single pass, the caller calculates the global pose
+		void ApplyAdditive(float time, float weight, std::vector<gef::JointPose>& localPose) const;
+		// Writes the unweighted difference of the animated joints to the delta, for AddPose(). The other joints are left as is
+		void SampleAdditive(float time, SoaPose& delta) const;
+
+		float GetDuration() const { return m_Duration; }
+		float GetSampleRate() const { return m_SampleRate; }
+		uint32_t GetFrameCount() const { return m_FrameCount; }
+		const ClipResamplingStats& GetStats() const { return m_Stats; }
+		uint64_t GetBytes() const;
+		const std::vector<int32_t>& GetJoints() const { return v_Joints; }
+		bool IsAdditive() const { return m_Additive; }
+
+	private:
+		struct Rotation { float x, y, z, w; };
+		struct Vector { float x, y, z; };
+
+		ResampledClip() : m_Duration(0.f), m_SampleRate(0.f), m_FrameCount(0u), m_Stats{}, m_Additive(false) {}
+		// Index of the frame before the time and the interpolation factor to the next one
+		uint32_t FindFrame(float time, float& alpha) const;
+
+	private:
+		std::vector<int32_t> v_Joints;				// Skeleton joint of each column
+		// Frame major, joint minor: the value of column j at frame f is at [f * v_Joints.size() + j]
+		std::vector<Rotation> v_Rotations;
+		std::vector<Vector> v_Translations;
+		std::vector<Vector> v_Scales;				// Empty when no joint is scaled
+		float m_Duration;
+		float m_SampleRate;
+		uint32_t m_FrameCount;
+		ClipResamplingStats m_Stats;
+		bool m_Additive;
+	};
+}
@@ -0,0 +1,337 @@
+#include "SoaPose.h"
+#include "animation/skeleton.h"
+#include <algorithm>
+#include <cmath>
+using namespace AsdfAnim;
+
+namespace
+{
+	// The translation and scale streams follow the rotation, they are all lerped the same way
+	const size_t k_Translation = SoaPose::Stream_TranslationX;
+
+	void MatchJointCount(const SoaPose& source, SoaPose& pose)
+	{
+		if (pose.GetJointCount() != source.GetJointCount()) pose.Resize(source.GetJointCount());
+	}
+}
+
+///
+/// Pose
+///
+void SoaPose::Resize(size_t jointCount)
+{
+	m_JointCount = jointCount;
+	m_PaddedCount = (jointCount + SOA_POSE_LANES - 1u) / SOA_POSE_LANES * SOA_POSE_LANES;
+	v_Data.assign(Stream_Count * m_PaddedCount, 0.f);
+	std::fill(GetStream(Stream_RotationW), GetStream(Stream_RotationW) + m_PaddedCount, 1.f);
+	std::fill(GetStream(Stream_ScaleX), GetStream(Stream_ScaleX) + m_PaddedCount * 3u, 1.f);
+}
+
+void SoaPose::SetJoint(size_t joint, const gef::JointPose& jointPose)
+{
+	float* data = v_Data.data() + joint;
+	const size_t n = m_PaddedCount;
+	const gef::Quaternion& rotation = jointPose.rotation();
+	const gef::Vector4& translation = jointPose.translation();
+	const gef::Vector4& scale = jointPose.scale();
+	data[Stream_RotationX * n] = rotation.x;
+	data[Stream_RotationY * n] = rotation.y;
+	data[Stream_RotationZ * n] = rotation.z;
+	data[Stream_RotationW * n] = rotation.w;
+	data[Stream_TranslationX * n] = translation.x();
+	data[Stream_TranslationY * n] = translation.y();
+	data[Stream_TranslationZ * n] = translation.z();
+	data[Stream_ScaleX * n] = scale.x();
+	data[Stream_ScaleY * n] = scale.y();
+	data[Stream_ScaleZ * n] = scale.z();
+}
+
+void SoaPose::GetJoint(size_t joint, gef::JointPose& jointPose) const
+{
+	const float* data = v_Data.data() + joint;
+	const size_t n = m_PaddedCount;
+	jointPose.set_rotation(gef::Quaternion(data[Stream_RotationX * n], data[Stream_RotationY * n], data[Stream_RotationZ * n], data[Stream_RotationW * n]));
+	jointPose.set_translation(gef::Vector4(data[Stream_TranslationX * n], data[Stream_TranslationY * n], data[Stream_TranslationZ * n]));
+	jointPose.set_scale(gef::Vector4(data[Stream_ScaleX * n], data[Stream_ScaleY * n], data[Stream_ScaleZ * n]));
+}
+
+void SoaPose::FromLocalPose(const std::vector<gef::JointPose>& localPose)
+{
+	if (m_JointCount != localPose.size()) Resize(localPose.size());
+	for (size_t joint = 0u; joint < localPose.size(); ++joint) SetJoint(joint, localPose[joint]);
+}
+
+void SoaPose::ToLocalPose(std::vector<gef::JointPose>& localPose) const
+{
+	localPose.resize(m_JointCount);
+	for (size_t joint = 0u; joint < m_JointCount; ++joint) GetJoint(joint, localPose[joint]);
+}
+
+///
+/// Kernels
+///
+void AsdfAnim::BlendPoses(const SoaPose& a, const SoaPose& b, float weight, SoaPose& pose)
+{
+#if SOA_POSE_SIMD
+	BlendPosesSimd(a, b, weight, pose);
+#else
+	BlendPosesScalar(a, b, weight, pose);
+#endif
+}
+
+void AsdfAnim::BlendPoses(const SoaPose& a, const SoaPose& b, const float* weights, float scale, SoaPose& pose)
+{
+#if SOA_POSE_SIMD
+	BlendPosesSimd(a, b, weights, scale, pose);
+#else
+	BlendPosesScalar(a, b, weights, scale, pose);
+#endif
+}
+
+void AsdfAnim::BlendPoses(const SoaPose* const* poses, const float* weights, size_t count, SoaPose& pose)
+{
+#if SOA_POSE_SIMD
+	BlendPosesSimd(poses, weights, count, pose);
+#else
+	BlendPosesScalar(poses, weights, count, pose);
+#endif
+}
+
+void AsdfAnim::AddPose(const SoaPose& base, const SoaPose& delta, float weight, SoaPose& pose)
+{
+#if SOA_POSE_SIMD
+	AddPoseSimd(base, delta, weight, pose);
+#else
+	AddPoseScalar(base, delta, weight, pose);
+#endif
+}
+
+///
+/// Scalar kernels
+/// The operations are done in the same order as the SIMD kernels so that both give the same results
+///
+namespace
+{
+	// Blends one joint, every pointer is at the joint in the rotation x stream
+	inline void BlendJoint(const float* a, const float* b, float weight, size_t n, float* out)
+	{
+		const float dot = a[0] * b[0] + a[n] * b[n] + a[2 * n] * b[2 * n] + a[3 * n] * b[3 * n];
+		const float sign = dot < 0.f ? -1.f : 1.f;
+		float rotation[4];
+		for (size_t c = 0u; c < 4u; ++c) rotation[c] = a[c * n] + (b[c * n] * sign - a[c * n]) * weight;
+		const float inverseLength = 1.f / std::sqrt(rotation[0] * rotation[0] + rotation[1] * rotation[1] + rotation[2] * rotation[2] + rotation[3] * rotation[3]);
+		for (size_t c = 0u; c < 4u; ++c) out[c * n] = rotation[c] * inverseLength;
+
+		for (size_t c = k_Translation; c < SoaPose::Stream_Count; ++c) out[c * n] = a[c * n] + (b[c * n] - a[c * n]) * weight;
+	}
+}
+
+void AsdfAnim::BlendPosesScalar(const SoaPose& a, const SoaPose& b, float weight, SoaPose& pose)
+{
+	MatchJointCount(a, pose);
+	const size_t n = a.GetPaddedCount();
+	for (size_t joint = 0u; joint < n; ++joint)
+		BlendJoint(a.GetStream(SoaPose::Stream_RotationX) + joint, b.GetStream(SoaPose::Stream_RotationX) + joint, weight, n, pose.GetStream(SoaPose::Stream_RotationX) + joint);
+}
+
+void AsdfAnim::BlendPosesScalar(const SoaPose& a, const SoaPose& b, const float* weights, float scale, SoaPose& pose)
+{
+	MatchJointCount(a, pose);
+	const size_t n = a.GetPaddedCount();
+	for (size_t joint = 0u; joint < n; ++joint)
+		BlendJoint(a.GetStream(SoaPose::Stream_RotationX) + joint, b.GetStream(SoaPose::Stream_RotationX) + joint, weights[joint] * scale, n, pose.GetStream(SoaPose::Stream_RotationX) + joint);
+}
+
+void AsdfAnim::BlendPosesScalar(const SoaPose* const* poses, const float* weights, size_t count, SoaPose& pose)
+{
+	MatchJointCount(*poses[0], pose);
+	float totalWeight = 0.f;
+	for (size_t i = 0u; i < count; ++i) totalWeight += weights[i];
+	const float inverseWeight = totalWeight > 0.f ? 1.f / totalWeight : 0.f;
+	const size_t n = poses[0]->GetPaddedCount();
+	for (size_t joint = 0u; joint < n; ++joint)
+	{
+		// Every input is read before the output is written, the output may be one of them
+		float sum[SoaPose::Stream_Count] = {};
+		for (size_t i = 0u; i < count; ++i)
+		{
+			const float* q = poses[i]->GetStream(SoaPose::Stream_RotationX) + joint;
+
+			// q and -q are the same rotation
+			const float dot = sum[0] * q[0] + sum[1] * q[n] + sum[2] * q[2 * n] + sum[3] * q[3 * n];
+			const float sign = dot < 0.f ? -1.f : 1.f;
+			for (size_t c = 0u; c < 4u; ++c) sum[c] += q[c * n] * sign * weights[i];
+			for (size_t c = k_Translation; c < SoaPose::Stream_Count; ++c) sum[c] += q[c * n] * weights[i];
+		}
+
+		float* out = pose.GetStream(SoaPose::Stream_RotationX) + joint;
+		const float lengthSq = sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2] + sum[3] * sum[3];
+		if (lengthSq > 0.f)
+		{
+			const float inverseLength = 1.f / std::sqrt(lengthSq);
+			for (size_t c = 0u; c < 4u; ++c) out[c * n] = sum[c] * inverseLength;
+		}
+		else
+		{
+			out[0] = out[n] = out[2 * n] = 0.f;
+			out[3 * n] = 1.f;
+		}
+		for (size_t c = k_Translation; c < SoaPose::Stream_Count; ++c) out[c * n] = sum[c] * inverseWeight;
+	}
+}
+
+void AsdfAnim::AddPoseScalar(const SoaPose& base, const SoaPose& delta, float weight, SoaPose& pose)
+{
+	MatchJointCount(base, pose);
+	const size_t n = base.GetPaddedCount();
+	for (size_t joint = 0u; joint < n; ++joint)
+	{
+		const float* b = base.GetStream(SoaPose::Stream_RotationX) + joint;
+		const float* d = delta.GetStream(SoaPose::Stream_RotationX) + joint;
+		float* out = pose.GetStream(SoaPose::Stream_RotationX) + joint;
+
+		// The deltas have a positive w, nlerp from the identity without any hemisphere check
+		float dx = d[0] * weight, dy = d[n] * weight, dz = d[2 * n] * weight, dw = 1.f - weight + d[3 * n] * weight;
+		const float inverseLength = 1.f / std::sqrt(dx * dx + dy * dy + dz * dz + dw * dw);
+		dx *= inverseLength, dy *= inverseLength, dz *= inverseLength, dw *= inverseLength;
+
+		const float bx = b[0], by = b[n], bz = b[2 * n], bw = b[3 * n];
+		out[0] = bw * dx + bx * dw + by * dz - bz * dy;
+		out[n] = bw * dy - bx * dz + by * dw + bz * dx;
+		out[2 * n] = bw * dz + bx * dy - by * dx + bz * dw;
+		out[3 * n] = bw * dw - bx * dx - by * dy - bz * dz;
+
+		for (size_t c = k_Translation; c < SoaPose::Stream_Count; ++c) out[c * n] = b[c * n] + d[c * n] * weight;
+	}
+}
+
+///
+/// SSE kernels, four joints per instruction
+///
+#if SOA_POSE_SIMD
+namespace
+{
+	inline __m128 Dot4(const __m128* a, const __m128* b)
+	{
+		return _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])), _mm_mul_ps(a[2], b[2])), _mm_mul_ps(a[3], b[3]));
+	}
+
+	// Sign bit set in the lanes where the dot product is negative, xor it to flip a rotation into the other hemisphere
+	inline __m128 NegativeSign(__m128 dot)
+	{
+		return _mm_and_ps(_mm_cmplt_ps(dot, _mm_setzero_ps()), _mm_set1_ps(-0.f));
+	}
+
+	inline __m128 Lerp(__m128 a, __m128 b, __m128 weight)
+	{
+		return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), weight));
+	}
+
+	inline __m128 InverseLength(const __m128* q)
+	{
+		return _mm_div_ps(_mm_set1_ps(1.f), _mm_sqrt_ps(Dot4(q, q)));
+	}
+
+	inline void BlendJoints(const float* a, const float* b, __m128 weight, size_t n, float* out)
+	{
+		__m128 ra[4], rb[4];
+		for (size_t c = 0u; c < 4u; ++c)
+		{
+			ra[c] = _mm_load_ps(a + c * n);
+			rb[c] = _mm_load_ps(b + c * n);
+		}
+		const __m128 sign = NegativeSign(Dot4(ra, rb));
+		__m128 rotation[4];
+		for (size_t c = 0u; c < 4u; ++c) rotation[c] = Lerp(ra[c], _mm_xor_ps(rb[c], sign), weight);
+		const __m128 inverseLength = InverseLength(rotation);
+		for (size_t c = 0u; c < 4u; ++c) _mm_store_ps(out + c * n, _mm_mul_ps(rotation[c], inverseLength));
+
+		for (size_t c = k_Translation; c < SoaPose::Stream_Count; ++c)
+			_mm_store_ps(out + c * n, Lerp(_mm_load_ps(a + c * n), _mm_load_ps(b + c * n), weight));
+	}
+}
+
+void AsdfAnim::BlendPosesSimd(const SoaPose& a, const SoaPose& b, float weight, SoaPose& pose)
+{
+	MatchJointCount(a, pose);
+	const size_t n = a.GetPaddedCount();
+	const __m128 weights = _mm_set1_ps(weight);
+	for (size_t joint = 0u; joint < n; joint += SOA_POSE_LANES)
+		BlendJoints(a.GetStream(SoaPose::Stream_RotationX) + joint, b.GetStream(SoaPose::Stream_RotationX) + joint, weights, n, pose.GetStream(SoaPose::Stream_RotationX) + joint);
+}
+
+void AsdfAnim::BlendPosesSimd(const SoaPose& a, const SoaPose& b, const float* weights, float scale, SoaPose& pose)
+{
+	MatchJointCount(a, pose);
+	const size_t n = a.GetPaddedCount();
+	const __m128 scales = _mm_set1_ps(scale);
+	for (size_t joint = 0u; joint < n; joint += SOA_POSE_LANES)
+		BlendJoints(a.GetStream(SoaPose::Stream_RotationX) + joint, b.GetStream(SoaPose::Stream_RotationX) + joint, _mm_mul_ps(_mm_load_ps(weights + joint), scales), n,
+			pose.GetStream(SoaPose::Stream_RotationX) + joint);
+}
+
+void AsdfAnim::BlendPosesSimd(const SoaPose* const* poses, const float* weights, size_t count, SoaPose& pose)
+{
+	MatchJointCount(*poses[0], pose);
+	float totalWeight = 0.f;
+	for (size_t i = 0u; i < count; ++i) totalWeight += weights[i];
+	const __m128 inverseWeight = _mm_set1_ps(totalWeight > 0.f ? 1.f / totalWeight : 0.f);
+	const __m128 one = _mm_set1_ps(1.f);
+	const size_t n = poses[0]->GetPaddedCount();
+	for (size_t joint = 0u; joint < n; joint += SOA_POSE_LANES)
+	{
+		__m128 sum[SoaPose::Stream_Count];
+		for (size_t c = 0u; c < SoaPose::Stream_Count; ++c) sum[c] = _mm_setzero_ps();
+		for (size_t i = 0u; i < count; ++i)
+		{
+			const float* q = poses[i]->GetStream(SoaPose::Stream_RotationX) + joint;
+			const __m128 weight = _mm_set1_ps(weights[i]);
+
+			__m128 rq[4];
+			for (size_t c = 0u; c < 4u; ++c) rq[c] = _mm_load_ps(q + c * n);
+			const __m128 sign = NegativeSign(Dot4(sum, rq));
+			for (size_t c = 0u; c < 4u; ++c) sum[c] = _mm_add_ps(sum[c], _mm_mul_ps(_mm_xor_ps(rq[c], sign), weight));
+			for (size_t c = k_Translation; c < SoaPose::Stream_Count; ++c) sum[c] = _mm_add_ps(sum[c], _mm_mul_ps(_mm_load_ps(q + c * n), weight));
+		}
+
+		// An empty sum gives the identity
+		float* out = pose.GetStream(SoaPose::Stream_RotationX) + joint;
+		const __m128 lengthSq = Dot4(sum, sum);
+		const __m128 valid = _mm_cmpgt_ps(lengthSq, _mm_setzero_ps());
+		const __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSq));
+		for (size_t c = 0u; c < 3u; ++c) _mm_store_ps(out + c * n, _mm_and_ps(valid, _mm_mul_ps(sum[c], inverseLength)));
+		_mm_store_ps(out + 3u * n, _mm_or_ps(_mm_and_ps(valid, _mm_mul_ps(sum[3], inverseLength)), _mm_andnot_ps(valid, one)));
+
+		for (size_t c = k_Translation; c < SoaPose::Stream_Count; ++c) _mm_store_ps(out + c * n, _mm_mul_ps(sum[c], inverseWeight));
+	}
+}
+
+void AsdfAnim::AddPoseSimd(const SoaPose& base, const SoaPose& delta, float weight, SoaPose& pose)
+{
+	MatchJointCount(base, pose);
+	const size_t n = base.GetPaddedCount();
+	const __m128 weights = _mm_set1_ps(weight);
+	const __m128 identityW = _mm_set1_ps(1.f - weight);
+	for (size_t joint = 0u; joint < n; joint += SOA_POSE_LANES)
+	{
+		const float* b = base.GetStream(SoaPose::Stream_RotationX) + joint;
+		const float* d = delta.GetStream(SoaPose::Stream_RotationX) + joint;
+		float* out = pose.GetStream(SoaPose::Stream_RotationX) + joint;
+
+		__m128 rd[4];
+		for (size_t c = 0u; c < 3u; ++c) rd[c] = _mm_mul_ps(_mm_load_ps(d + c * n), weights);
+		rd[3] = _mm_add_ps(identityW, _mm_mul_ps(_mm_load_ps(d + 3u * n), weights));
+		const __m128 inverseLength = InverseLength(rd);
+		const __m128 dx = _mm_mul_ps(rd[0], inverseLength), dy = _mm_mul_ps(rd[1], inverseLength), dz = _mm_mul_ps(rd[2], inverseLength), dw = _mm_mul_ps(rd[3], inverseLength);
+
+		const __m128 bx = _mm_load_ps(b), by = _mm_load_ps(b + n), bz = _mm_load_ps(b + 2u * n), bw = _mm_load_ps(b + 3u * n);
+		_mm_store_ps(out, _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(bw, dx), _mm_mul_ps(bx, dw)), _mm_mul_ps(by, dz)), _mm_mul_ps(bz, dy)));
+		_mm_store_ps(out + n, _mm_add_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(bw, dy), _mm_mul_ps(bx, dz)), _mm_mul_ps(by, dw)), _mm_mul_ps(bz, dx)));
+		_mm_store_ps(out + 2u * n, _mm_add_ps(_mm_sub_ps(_mm_add_ps(_mm_mul_ps(bw, dz), _mm_mul_ps(bx, dy)), _mm_mul_ps(by, dx)), _mm_mul_ps(bz, dw)));
+		_mm_store_ps(out + 3u * n, _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(_mm_mul_ps(bw, dw), _mm_mul_ps(bx, dx)), _mm_mul_ps(by, dy)), _mm_mul_ps(bz, dz)));
+
+		for (size_t c = k_Translation; c < SoaPose::Stream_Count; ++c)
+			_mm_store_ps(out + c * n, _mm_add_ps(_mm_load_ps(b + c * n), _mm_mul_ps(_mm_load_ps(d + c * n), weights)));
+	}
+}
+#endif
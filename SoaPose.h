@@ -0,0 +1,120 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <xmmintrin.h>
+
+// 1 to run the pose kernels with SSE on four joints at a time, 0 for the scalar reference kernels
+#define SOA_POSE_SIMD 1
+// Joints processed per instruction, the streams are padded to a multiple of it
+#define SOA_POSE_LANES 4u
+
+namespace gef
+{
+	class JointPose;
+}
+
+namespace AsdfAnim
+{
+	// std::vector allocator for the 16 byte aligned loads of the kernels
+	template<typename T, size_t Alignment>
+	struct AlignedAllocator
+	{
+		typedef T value_type;
+		template<typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+		AlignedAllocator() {}
+		template<typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+		T* allocate(size_t count) { return static_cast<T*>(_mm_malloc(count * sizeof(T), Alignment)); }
+		void deallocate(T* p, size_t) { _mm_free(p); }
+
+		template<typename U> bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+		template<typename U> bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+	};
+
+	typedef std::vector<float, AlignedAllocator<float, 16u>> AlignedFloats;
+
+	// Local pose stored channel by channel: every rotation x, then every rotation y, and so on
+	// Each stream is aligned and padded to a multiple of SOA_POSE_LANES joints, the padding holds identity joints
+	// The blend tree only works on these, gef::SkeletonPose is only used at its boundaries
+	class SoaPose
+	{
+	public:
+		enum Stream_
+		{
+			Stream_RotationX,
+			Stream_RotationY,
+			Stream_RotationZ,
+			Stream_RotationW,
+			Stream_TranslationX,
+			Stream_TranslationY,
+			Stream_TranslationZ,
+			Stream_ScaleX,
+			Stream_ScaleY,
+			Stream_ScaleZ,
+			Stream_Count
+		};
+
+		SoaPose() : m_JointCount(0u), m_PaddedCount(0u) {}
+		explicit SoaPose(const std::vector<gef::JointPose>& localPose) : SoaPose() { FromLocalPose(localPose); }
+
+		// Every joint is reset to the identity
+		void Resize(size_t jointCount);
+		size_t GetJointCount() const { return m_JointCount; }
+		size_t GetPaddedCount() const { return m_PaddedCount; }
+		// Every stream to 0
+		void SetZero() { std::fill(v_Data.begin(), v_Data.end(), 0.f); }
+
+		float* GetStream(Stream_ stream) { return v_Data.data() + stream * m_PaddedCount; }
+		const float* GetStream(Stream_ stream) const { return v_Data.data() + stream * m_PaddedCount; }
+
+		void SetJoint(size_t joint, const gef::JointPose& jointPose);
+		void GetJoint(size_t joint, gef::JointPose& jointPose) const;
+		// Copies the channels of the joint from a pose of the same skeleton, the samplers fill the joints without data from the bind pose this way
+		void CopyJoint(size_t joint, const SoaPose& source) { CopyStreams(joint, source, Stream_RotationX, Stream_Count); }
+		void CopyRotation(size_t joint, const SoaPose& source) { CopyStreams(joint, source, Stream_RotationX, Stream_TranslationX); }
+		void CopyTranslation(size_t joint, const SoaPose& source) { CopyStreams(joint, source, Stream_TranslationX, Stream_ScaleX); }
+		void CopyScale(size_t joint, const SoaPose& source) { CopyStreams(joint, source, Stream_ScaleX, Stream_Count); }
+		// Conversions at the boundaries, the pose is resized to the local pose
+		void FromLocalPose(const std::vector<gef::JointPose>& localPose);
+		// Only the local pose is written, the caller calculates the global pose
+		void ToLocalPose(std::vector<gef::JointPose>& localPose) const;
+
+	private:
+		void CopyStreams(size_t joint, const SoaPose& source, int first, int last)
+		{
+			for (int stream = first; stream < last; ++stream)
+				v_Data[stream * m_PaddedCount + joint] = source.v_Data[stream * source.m_PaddedCount + joint];
+		}
+
+	private:
+		AlignedFloats v_Data;
+		size_t m_JointCount;
+		size_t m_PaddedCount;
+	};
+
+	// Kernels, all the poses have the same joint count and the output may be one of the inputs
+	// Rotations are nlerped on the shortest path, translations and scales are lerped
+	void BlendPoses(const SoaPose& a, const SoaPose& b, float weight, SoaPose& pose);
+	// Per joint weight of b, read from a stream padded like the poses, times the scale
+	void BlendPoses(const SoaPose& a, const SoaPose& b, const float* weights, float scale, SoaPose& pose);
+	// Weighted average of the poses, in a single pass: each joint is summed over the poses and normalised before the next joint
+	// Each rotation is flipped into the hemisphere of the sum so far. There must be at least one pose
+	void BlendPoses(const SoaPose* const* poses, const float* weights, size_t count, SoaPose& pose);
+	// Composes the delta, weighted from the identity, on top of the base: rotation * nlerp(identity, delta), translation and scale offsets
+	void AddPose(const SoaPose& base, const SoaPose& delta, float weight, SoaPose& pose);
+
+	// Scalar versions, the reference the SIMD kernels are checked against in Benchmarks::PoseBlending()
+	void BlendPosesScalar(const SoaPose& a, const SoaPose& b, float weight, SoaPose& pose);
+	void BlendPosesScalar(const SoaPose& a, const SoaPose& b, const float* weights, float scale, SoaPose& pose);
+	void BlendPosesScalar(const SoaPose* const* poses, const float* weights, size_t count, SoaPose& pose);
+	void AddPoseScalar(const SoaPose& base, const SoaPose& delta, float weight, SoaPose& pose);
+
+#if SOA_POSE_SIMD
+	void BlendPosesSimd(const SoaPose& a, const SoaPose& b, float weight, SoaPose& pose);
+	void BlendPosesSimd(const SoaPose& a, const SoaPose& b, const float* weights, float scale, SoaPose& pose);
+	void BlendPosesSimd(const SoaPose* const* poses, const float* weights, size_t count, SoaPose& pose);
+	void AddPoseSimd(const SoaPose& base, const SoaPose& delta, float weight, SoaPose& pose);
+#endif
+}
@@ -0,0 +1,225 @@
+#include "StateMachineNode.h"
+#include <algorithm>
+using namespace AsdfAnim;
+
+///
+/// State machine
+///
+StateMachineNode::StateMachineNode(const gef::SkeletonPose& bindPose) : BlendNode(bindPose),
+m_EntryState(0u)
+{
+	m_Type = NodeType_::NodeType_StateMachine;
+}
+
+void StateMachineNode::InitState(State& state) const
+{
+	state = {};
+	state.current = m_EntryState;
+	for (uint32_t i = 0u; i < STATEMACHINE_MAXSTATES && !HasState(state.current); ++i) state.current = i;
+	state.source = UINT32_MAX;
+}
+
+uint32_t StateMachineNode::Advance(State& state, TransitionNode::Poses& poses, const float* parameters, const std::vector<ParameterKey>& events, float frameTime) const
+{
+	// The history is not kept when the template is recompiled, and is out of date when the node was not evaluated
+	if (!poses.last || !state.evaluated) state.historyCount = 0u;
+	state.evaluated = false;
+	state.restart = false;
+	state.frameTime = frameTime;
+
+	// The graph may have changed under the instance
+	if (!HasState(state.current))
+	{
+		InitState(state);
+		state.restart = true;
+	}
+	if (state.transition >= v_Transitions.size() || (state.source != UINT32_MAX && !HasState(state.source))) state.transitioning = false;
+
+	state.stateTime += frameTime;
+	if (state.transitioning)
+	{
+		state.transitionTime += frameTime;
+		state.transitioning = state.transitionTime < v_Transitions[state.transition].duration;
+	}
+	if (!state.transitioning) state.source = UINT32_MAX;
+
+	// A transition is taken at most once per pass, a state entered in one pass can be left in the next
+	for (size_t pass = 0u; pass <= events.size(); ++pass)
+	{
+		const ParameterKey event = pass ? events[pass - 1u] : BLEND_PARAMETER_NONE;
+		for (uint32_t t = 0u; t < v_Transitions.size(); ++t)
+			if (Holds(v_Transitions[t], state, parameters, event))
+			{
+				StartTransition(state, poses, t);
+				break;
+			}
+	}
+
+	state.blendValue = state.transitioning ? state.transitionTime / v_Transitions[state.transition].duration : 1.f;
+	uint32_t mask = 1u << state.current;
+	if (state.source != UINT32_MAX) mask |= 1u << state.source;
+	return mask;
+}
+
+const SoaPose* StateMachineNode::Evaluate(State& state, TransitionNode::Poses& poses, const std::array<const SoaPose*, STATEMACHINE_MAXSTATES>& states,
+	const SoaPose*& blendFrom, const SoaPose*& blendTo) const
+{
+	const SoaPose& target = *states[state.current];
+	if (!state.transitioning) return &target;
+
+	// The inertialized transitions only evaluate the target, the offset to the last output decays over the transition
+	const Transition& transition = v_Transitions[state.transition];
+	blendTo = &target;
+	if (transition.type == TransitionType_::TransitionType_Inertialized)
+	{
+		if (!state.offsetCaptured)
+		{
+			TransitionNode::CaptureOffset(*poses.last, state.historyCount > 1u ? *poses.secondLast : *poses.last, state.frameTime, transition.duration, target, poses.curves);
+			state.offsetCaptured = true;
+		}
+		return nullptr;
+	}
+
+	blendFrom = state.source != UINT32_MAX ? states[state.source] : &poses.frozen;
+	return nullptr;
+}
+
+void StateMachineNode::RecordOutput(State& state) const
+{
+	state.historyCount = KeepsHistory() ? std::min(state.historyCount + 1u, 2u) : 0u;
+	state.evaluated = true;
+}
+
+bool StateMachineNode::KeepsHistory() const
+{
+	uint32_t smoothCount = 0u;
+	for (const Transition& transition : v_Transitions)
+	{
+		switch (transition.type)
+		{
+		case TransitionType_::TransitionType_Frozen:
+		case TransitionType_::TransitionType_Frozen_Sync:
+		case TransitionType_::TransitionType_Inertialized:
+			return true;
+		case TransitionType_::TransitionType_Smooth:
+		case TransitionType_::TransitionType_Smooth_Sync:
+			if (++smoothCount > 1u) return true;
+			break;
+		default:
+			break;
+		}
+	}
+	return false;
+}
+
+bool StateMachineNode::Holds(const Transition& transition, const State& state, const float* parameters, ParameterKey event) const
+{
+	if (transition.to == state.current || !HasState(transition.to)) return false;
+	if (transition.from != STATEMACHINE_ANY_STATE && transition.from != state.current) return false;
+
+	for (const Condition& condition : transition.conditions)
+	{
+		const bool bound = condition.index != UINT32_MAX;
+		const float value = bound ? parameters[condition.index] : 0.f;
+		switch (condition.op)
+		{
+		case ConditionOp_::ConditionOp_Greater:		if (!bound || !(value > condition.threshold)) return false;		break;
+		case ConditionOp_::ConditionOp_Less:		if (!bound || !(value < condition.threshold)) return false;		break;
+		case ConditionOp_::ConditionOp_True:		if (!bound || value == 0.f) return false;						break;
+		case ConditionOp_::ConditionOp_False:		if (!bound || value != 0.f) return false;						break;
+		case ConditionOp_::ConditionOp_Trigger:		if (value == 0.f && event != condition.parameter) return false;	break;
+		case ConditionOp_::ConditionOp_StateTime:	if (!(state.stateTime > condition.threshold)) return false;		break;
+		}
+	}
+	return true;
+}
+
+void StateMachineNode::StartTransition(State& state, TransitionNode::Poses& poses, uint32_t index) const
+{
+	const Transition& transition = v_Transitions[index];
+	const bool interrupted = state.transitioning;
+	const uint32_t previous = state.current;
+
+	// The state entered starts over, unless a running smooth transition still evaluates it
+	state.restart = !(interrupted && state.source == transition.to);
+	state.current = transition.to;
+	state.transition = index;
+	state.stateTime = 0.f;
+	state.transitionTime = 0.f;
+	state.source = UINT32_MAX;
+	state.offsetCaptured = false;
+
+	// Without a last output to start from, e.g. when the machine was suspended on the last frame, the switch is immediate
+	state.transitioning = transition.duration > 0.f && transition.type != TransitionType_::TransitionType_Undefined;
+	switch (transition.type)
+	{
+	case TransitionType_::TransitionType_Smooth:
+	case TransitionType_::TransitionType_Smooth_Sync:
+		// Both states are evaluated while it runs
+		if (!interrupted)
+		{
+			state.source = previous;
+			break;
+		}
+		// An interrupted transition blends from where its output was, like a frozen one
+	case TransitionType_::TransitionType_Frozen:
+	case TransitionType_::TransitionType_Frozen_Sync:
+		// The state left is suspended, the transition blends from its last output
+		state.transitioning &= state.historyCount > 0u;
+		if (state.transitioning) poses.frozen = *poses.last;
+		break;
+	case TransitionType_::TransitionType_Inertialized:
+		state.transitioning &= state.historyCount > 0u;
+		break;
+	default:
+		break;
+	}
+}
+
+uint32_t StateMachineNode::AddTransition(uint32_t from, uint32_t to, float duration, TransitionType_ type)
+{
+	v_Transitions.push_back({ from, to, duration, type, {} });
+	GraphChanged();
+	return static_cast<uint32_t>(v_Transitions.size() - 1u);
+}
+
+void StateMachineNode::RemoveTransition(uint32_t index)
+{
+	v_Transitions.erase(v_Transitions.begin() + index);
+	GraphChanged();
+}
+
+void StateMachineNode::AddCondition(uint32_t transition, ConditionOp_ op, ParameterKey parameter, float threshold)
+{
+	v_Transitions[transition].conditions.push_back({ op, op == ConditionOp_::ConditionOp_StateTime ? BLEND_PARAMETER_NONE : parameter, threshold, UINT32_MAX });
+	GraphChanged();
+}
+
+void StateMachineNode::RemoveCondition(uint32_t transition, uint32_t condition)
+{
+	std::vector<Condition>& conditions = v_Transitions[transition].conditions;
+	conditions.erase(conditions.begin() + condition);
+	GraphChanged();
+}
+
+ParameterType_ StateMachineNode::GetConditionType(ConditionOp_ op)
+{
+	switch (op)
+	{
+	case ConditionOp_::ConditionOp_True:
+	case ConditionOp_::ConditionOp_False:	return ParameterType_::ParameterType_Bool;
+	case ConditionOp_::ConditionOp_Trigger:	return ParameterType_::ParameterType_Trigger;
+	default:								return ParameterType_::ParameterType_Float;
+	}
+}
+
+void StateMachineNode::BindConditions(const BlendTreeTemplate& blendTree)
+{
+	const std::vector<BlendParameter>& parameters = blendTree.GetParameters();
+	for (Transition& transition : v_Transitions)
+		for (Condition& condition : transition.conditions)
+		{
+			condition.index = blendTree.FindParameter(condition.parameter);
+			if (condition.index != UINT32_MAX && parameters[condition.index].type != GetConditionType(condition.op)) condition.index = UINT32_MAX;
+		}
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <stdint.h>
+#include <array>
+#include <vector>
+#include "BlendNode.h"
+
+// The states of a machine are its inputs
+#define STATEMACHINE_MAXSTATES 4u
+// Source of a transition that can be taken from any state
+#define STATEMACHINE_ANY_STATE UINT32_MAX
+
+namespace AsdfAnim
+{
+	enum class ConditionOp_ : uint8_t
+	{
+		ConditionOp_Greater,		// Float parameter above the threshold
+		ConditionOp_Less,			// Float parameter below the threshold
+		ConditionOp_True,			// Bool parameter
+		ConditionOp_False,
+		ConditionOp_Trigger,		// Trigger parameter set, or an event with its key posted, since the last update
+		ConditionOp_StateTime		// Time in the current state above the threshold, reads no parameter
+	};
+
+	// Picks one of its inputs, the states, e.g. idle, locomotion and jump, and transitions between them when the conditions of a transition hold
+	// Only the current state is evaluated, plus the state being left during a smooth transition, the other states are suspended
+	// A state entered while suspended starts over
+	class StateMachineNode : public BlendNode
+	{
+	public:
+		struct Condition
+		{
+			ConditionOp_ op;
+			ParameterKey parameter;
+			float threshold;
+			uint32_t index;				// In the blackboard, resolved when the tree is compiled
+		};
+
+		// Taken when all the conditions hold, the first one in the list wins
+		// The types are those of the transition node, the synchronised ones transition like the others since the states are whole branches
+		struct Transition
+		{
+			uint32_t from;				// State, or STATEMACHINE_ANY_STATE
+			uint32_t to;
+			float duration;
+			TransitionType_ type;
+			std::vector<Condition> conditions;
+		};
+
+		// Of one instance
+		struct State
+		{
+			uint32_t current;
+			uint32_t source;			// State blended from by a smooth transition, UINT32_MAX when blending from the last output
+			uint32_t transition;		// Running transition
+			uint32_t historyCount;		// Consecutive outputs in the history, up to 2
+			float stateTime;			// Since the current state was entered
+			float transitionTime;
+			float blendValue;
+			float frameTime;
+			bool transitioning;
+			bool evaluated;
+			bool offsetCaptured;
+			bool restart;				// The current state was entered while suspended, its branch starts over
+		};
+
+		StateMachineNode(const gef::SkeletonPose& bindPose);
+
+		void InitState(State& state) const;
+		// Takes the transitions whose conditions hold, once without any event then once per event in the order they were posted, and advances the clocks
+		// Returns a mask of the states (bit per input) that need to be evaluated this frame
+		uint32_t Advance(State& state, TransitionNode::Poses& poses, const float* parameters, const std::vector<ParameterKey>& events, float frameTime) const;
+		// Only the poses of the states requested by Advance() are valid
+		// Returns the pose to forward as is, or nullptr when blendFrom has to be blended with blendTo by the state blend value
+		// With no blendFrom, the output is blendTo with the offset applied by TransitionNode::ApplyOffset() at the transition time
+		const SoaPose* Evaluate(State& state, TransitionNode::Poses& poses, const std::array<const SoaPose*, STATEMACHINE_MAXSTATES>& states,
+			const SoaPose*& blendFrom, const SoaPose*& blendTo) const;
+		// Counts the output of the frame in the history, the tree keeps it, a transition starting on the next frame blends from it or measures its offset from it
+		void RecordOutput(State& state) const;
+		// Only the frozen and inertialized transitions start from the last output, and the smooth ones interrupting each other
+		bool KeepsHistory() const;
+
+		// Returns the index of the transition
+		uint32_t AddTransition(uint32_t from, uint32_t to, float duration, TransitionType_ type);
+		void RemoveTransition(uint32_t index);
+		void SetTransitionDuration(uint32_t index, float duration) { v_Transitions[index].duration = duration; }
+		void SetTransitionType(uint32_t index, TransitionType_ type) { v_Transitions[index].type = type; }
+		void AddCondition(uint32_t transition, ConditionOp_ op, ParameterKey parameter, float threshold = 0.f);
+		void RemoveCondition(uint32_t transition, uint32_t condition);
+		void SetConditionThreshold(uint32_t transition, uint32_t condition, float threshold) { v_Transitions[transition].conditions[condition].threshold = threshold; }
+		size_t GetTransitionCount() const { return v_Transitions.size(); }
+		const Transition& GetTransition(uint32_t index) const { return v_Transitions[index]; }
+		// Type of the parameter a condition reads
+		static ParameterType_ GetConditionType(ConditionOp_ op);
+
+		// State new instances start in, the first state when it has no input
+		void SetEntryState(uint32_t state) { m_EntryState = state; }
+		uint32_t GetEntryState() const { return m_EntryState; }
+		bool HasState(uint32_t state) const { return state < STATEMACHINE_MAXSTATES && a_Inputs[state]; }
+
+		// Resolves the parameters of the conditions, a parameter that does not exist or has another type never holds
+		void BindConditions(const BlendTreeTemplate& blendTree);
+
+	private:
+		bool Holds(const Transition& transition, const State& state, const float* parameters, ParameterKey event) const;
+		void StartTransition(State& state, TransitionNode::Poses& poses, uint32_t transition) const;
+
+	private:
+		std::vector<Transition> v_Transitions;
+		uint32_t m_EntryState;
+	};
+}
@@ -0,0 +1,148 @@
+#include "SyncMarkers.h"
+#include "Animation.h"
+#include "ClipSampler.h"
+#include "animation/animation.h"
+#include "animation/skeleton.h"
+#include "system/string_id.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+using namespace AsdfAnim;
+
+namespace
+{
+	// Steps are counted from the first left foot contact, so that step 0 of every clip is on the same foot
+	size_t GetFirstStepMarker(const std::vector<SyncMarker>& markers)
+	{
+		for (size_t i = 0u; i < markers.size(); ++i)
+			if (markers[i].foot == SyncFoot_::SyncFoot_Left) return i;
+		return 0u;
+	}
+
+	// Marker the step starts on, the steps before step 0 wrap around to the last markers
+	size_t GetStepMarker(const std::vector<SyncMarker>& markers, int32_t step)
+	{
+		if (markers.empty()) return 0u;
+		const int32_t count = static_cast<int32_t>(markers.size());
+		return (static_cast<size_t>((step % count + count) % count) + GetFirstStepMarker(markers)) % markers.size();
+	}
+
+	// Start and duration of the step, the last one wraps around the end of the clip
+	void GetStep(const Clip& clip, size_t marker, float& start, float& duration)
+	{
+		const std::vector<SyncMarker>& markers = clip.markers;
+		if (markers.empty())
+		{
+			start = 0.f;
+			duration = clip.duration;
+			return;
+		}
+
+		start = markers[marker].time;
+		duration = marker + 1u < markers.size() ? markers[marker + 1u].time - start : markers.front().time + clip.duration - start;
+	}
+}
+
+///
+/// Sync markers
+///
+std::vector<SyncMarker> SyncMarkers::Extract(const gef::Animation& clip, const gef::SkeletonPose& bindPose)
+{
+	std::vector<SyncMarker> markers;
+	const gef::Skeleton* skeleton = bindPose.skeleton();
+	const float duration = clip.duration();
+	if (!skeleton || duration <= 0.f) return markers;
+
+	const std::array<Int32, 2> feet = {
+		skeleton->FindJointIndex(gef::GetStringId(SYNCMARKERS_LEFT_FOOT)),
+		skeleton->FindJointIndex(gef::GetStringId(SYNCMARKERS_RIGHT_FOOT))
+	};
+	if (feet[0] < 0 || feet[1] < 0) return markers;
+
+	// Height of both feet over one loop of the clip
+	const uint32_t frameCount = std::max(static_cast<uint32_t>(std::ceil(duration * SYNCMARKERS_SAMPLE_RATE)), 2u);
+	std::array<std::vector<float>, 2> heights;
+	ClipSampler sampler;
+	sampler.SetAnimation(&clip, bindPose);
+	gef::SkeletonPose pose = bindPose;
+	for (uint32_t frame = 0u; frame < frameCount; ++frame)
+	{
+		sampler.Sample(frame * duration / frameCount, pose);
+		pose.CalculateGlobalPose();
+		for (size_t foot = 0u; foot < feet.size(); ++foot) heights[foot].push_back(pose.global_pose()[feet[foot]].GetTranslation().y());
+	}
+
+	// A contact starts on the frame a foot gets below its threshold, the clip loops so the first frame follows the last one
+	for (size_t foot = 0u; foot < feet.size(); ++foot)
+	{
+		const auto range = std::minmax_element(heights[foot].begin(), heights[foot].end());
+		if (*range.second - *range.first < SYNCMARKERS_MIN_FOOT_RANGE) continue;
+
+		const float threshold = *range.first + (*range.second - *range.first) * SYNCMARKERS_CONTACT_THRESHOLD;
+		for (uint32_t frame = 0u; frame < frameCount; ++frame)
+			if (heights[foot][frame] <= threshold && heights[foot][(frame + frameCount - 1u) % frameCount] > threshold)
+				markers.push_back({ frame * duration / frameCount, static_cast<SyncFoot_>(foot) });
+	}
+
+	std::sort(markers.begin(), markers.end(), [](const SyncMarker& a, const SyncMarker& b) { return a.time < b.time; });
+
+	// Contacts of both feet within a frame of each other are the same step, e.g. landing a jump, keep the first one
+	// The last marker is also measured against the first one of the next loop
+	const float frameDuration = duration / frameCount;
+	std::vector<SyncMarker> merged;
+	for (const SyncMarker& marker : markers)
+		if (merged.empty() || marker.time - merged.back().time > frameDuration) merged.push_back(marker);
+	if (merged.size() > 1u && merged.front().time + duration - merged.back().time <= frameDuration) merged.pop_back();
+	return merged;
+}
+
+float SyncMarkers::GetStepDuration(const Clip& clip, int32_t step)
+{
+	const std::vector<SyncMarker>& markers = clip.markers;
+	float start, duration;
+	GetStep(clip, GetStepMarker(markers, step), start, duration);
+	return duration;
+}
+
+float SyncMarkers::GetTime(const Clip& clip, const SyncPhase& phase)
+{
+	const std::vector<SyncMarker>& markers = clip.markers;
+	float start, duration;
+	GetStep(clip, GetStepMarker(markers, phase.step), start, duration);
+	const float time = start + phase.fraction * duration;
+	return clip.duration > 0.f ? std::fmodf(time, clip.duration) : 0.f;
+}
+
+SyncPhase SyncMarkers::GetPhase(const Clip& clip, float time)
+{
+	const std::vector<SyncMarker>& markers = clip.markers;
+	if (markers.empty()) return { 0, clip.duration > 0.f ? time / clip.duration : 0.f };
+
+	// Before the first marker the clip is still in the last step of the previous loop
+	size_t marker = markers.size() - 1u;
+	for (size_t i = 0u; i < markers.size() && markers[i].time <= time; ++i) marker = i;
+	float start, duration;
+	GetStep(clip, marker, start, duration);
+	if (time < start) time += clip.duration;
+
+	const size_t count = markers.size();
+	const int32_t step = static_cast<int32_t>((marker + count - GetFirstStepMarker(markers)) % count);
+	return { step, duration > 0.f ? std::min((time - start) / duration, 1.f) : 0.f };
+}
+
+void SyncMarkers::Advance(SyncPhase& phase, float frameTime, float stepDuration)
+{
+	// A step of no length is skipped, the phase moves on to the start of the next one or the end of the previous one
+	if (stepDuration <= 0.f)
+	{
+		if (frameTime > 0.f) ++phase.step, phase.fraction = 0.f;
+		else if (frameTime < 0.f) --phase.step, phase.fraction = std::nextafter(1.f, 0.f);
+		return;
+	}
+
+	// Playing backwards goes back through the steps, below step 0 each clip wraps to its last steps
+	phase.fraction += frameTime / stepDuration;
+	const float steps = std::floor(phase.fraction);
+	phase.step += static_cast<int32_t>(steps);
+	phase.fraction -= steps;
+}
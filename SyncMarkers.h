@@ -0,0 +1,65 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+
+// Rate the foot heights are measured at when the markers are extracted, in frames per second
+#define SYNCMARKERS_SAMPLE_RATE 60.f
+// A foot is in contact below this fraction of its height range over the clip
+#define SYNCMARKERS_CONTACT_THRESHOLD 0.2f
+// Below this height range, in scene units, a foot never leaves the ground and gives no marker
+#define SYNCMARKERS_MIN_FOOT_RANGE 0.01f
+#define SYNCMARKERS_LEFT_FOOT "mixamorig:LeftFoot"
+#define SYNCMARKERS_RIGHT_FOOT "mixamorig:RightFoot"
+
+namespace gef
+{
+	class Animation;
+	class SkeletonPose;
+}
+
+namespace AsdfAnim
+{
+	struct Clip;
+
+	enum class SyncFoot_ : uint8_t
+	{
+		SyncFoot_Left,
+		SyncFoot_Right
+	};
+
+	// A foot getting down on the ground
+	struct SyncMarker
+	{
+		float time;
+		SyncFoot_ foot;
+	};
+
+	// Position shared by synchronised clips: the steps taken so far and how far into the current one
+	// A step goes from a marker to the next, step n of every clip starts on the same foot
+	// The steps are signed, playing backwards from the start goes to the negative steps rather than wrapping the count
+	struct SyncPhase
+	{
+		int32_t step;
+		float fraction;			// 0 to 1
+	};
+
+	// Maps the shared phase to the time of each clip, so that clips with any number of steps stay in step
+	// A clip without markers is a single step over its whole duration, like a sync on the ratio of the durations
+	class SyncMarkers
+	{
+	public:
+		// Foot contacts found from the height of the feet over the clip, sorted by time
+		// Contacts within a frame of each other give a single marker, so that no step is shorter than a frame
+		// Returns no markers when the skeleton has no feet or they never leave the ground
+		static std::vector<SyncMarker> Extract(const gef::Animation& clip, const gef::SkeletonPose& bindPose);
+
+		// Duration of the step of the clip at the phase
+		static float GetStepDuration(const Clip& clip, int32_t step);
+		static float GetTime(const Clip& clip, const SyncPhase& phase);
+		// Phase of the clip at the time, in the first cycle of its markers
+		static SyncPhase GetPhase(const Clip& clip, float time);
+		// Moves the phase on by the time, over steps lasting the duration, e.g. the weighted step durations of the clips blended
+		// A duration of zero moves the phase past the step
+		static void Advance(SyncPhase& phase, float frameTime, float stepDuration);
+	};
+}
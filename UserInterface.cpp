@@ -1,4 +1,6 @@
 #include "UserInterface.h"
+#include "BlendSpaceNode.h"
+#include "StateMachineNode.h"
 using namespace AsdfAnim;
 
 UI_NodeEditor::UINode* UI_NodeEditor::FindUINodeFromAnimationNode(BlendNode* const& itemToSearch)
@@ -46,6 +48,42 @@ UI_NodeEditor::UINode* UI_NodeEditor::FindUINodeFromNodeID(const ed::NodeId& ite
     return nullptr;
 }
 
+void UI_NodeEditor::DrawParameterBinding(BlendNode* node, uint32_t slot, BlendTreeTemplate* blendTree)
+{
+    // Only the parameters of the type the slot reads are listed
+    const std::vector<BlendParameter>& parameters = blendTree->GetParameters();
+    const uint32_t bound = blendTree->FindParameter(node->GetBoundParameter(slot));
+    ImGui::PushID(static_cast<int>(slot));
+    ImGui::Text(slot ? "Parameter Y:" : "Parameter:");
+    ImGui::SameLine();
+    if (ImGui::Button(bound != UINT32_MAX ? parameters[bound].name.c_str() : "None"))
+    {
+        ed::Suspend();      // This gets out of the canvas coordinates and we can open the popup on screen coords instead
+        ImGui::OpenPopup("parameter");
+        ed::Resume();
+    }
+
+    ed::Suspend();
+    if (ImGui::BeginPopup("parameter")) {
+        ImGui::TextDisabled("Pick One:");
+        if (ImGui::Button("None")) {
+            node->BindParameter(slot, BLEND_PARAMETER_NONE);
+            ImGui::CloseCurrentPopup();
+        }
+        for (const BlendParameter& parameter : parameters)
+        {
+            if (parameter.type != node->GetParameterSlotType(slot)) continue;
+            if (ImGui::Button(parameter.name.c_str())) {
+                node->BindParameter(slot, parameter.key);
+                ImGui::CloseCurrentPopup();
+            }
+        }
+        ImGui::EndPopup();
+    }
+    ed::Resume();
+    ImGui::PopID();
+}
+
 void UI_NodeEditor::AssignDrawFunctionToUINode(UINode& node)
 {
     switch (node.animationNode->GetType())
@@ -76,7 +114,7 @@ void UI_NodeEditor::AssignDrawFunctionToUINode(UINode& node)
                 return;
             }
 
-            ClipNode* clipNode = reinterpret_cast<ClipNode*>(thisPtr->animationNode);
+            ClipNode* clipNode = static_cast<ClipNode*>(thisPtr->animationNode);
             const char* clipName = clipNode->GetClip()->name.c_str();
             ImGui::BeginGroup();
             ImGui::PushItemWidth(200);
@@ -140,9 +178,10 @@ void UI_NodeEditor::AssignDrawFunctionToUINode(UINode& node)
             ImGui::Text("-> In2");
             ed::EndPin();
 
-            LinearBlendNode* blendNode = reinterpret_cast<LinearBlendNode*>(thisPtr->animationNode);
+            LinearBlendNode* blendNode = static_cast<LinearBlendNode*>(thisPtr->animationNode);
             ImGui::PushItemWidth(200);
-            ImGui::SliderFloat("Blend Factor", blendNode->GetBlendValuePtr(), 0.f, 1.f);
+            ImGui::SliderFloat("Blend Factor", sentAnim->GetBlendTree()->GetBlendValuePtr(blendNode), 0.f, 1.f);
+            DrawParameterBinding(blendNode, 0u, sentAnim->GetBlendTreeTemplate());
             ImGui::PopItemWidth();
 
             ImGui::EndGroup();
@@ -168,9 +207,10 @@ void UI_NodeEditor::AssignDrawFunctionToUINode(UINode& node)
             ImGui::Text("-> In2");
             ed::EndPin();
 
-            LinearBlendNodeSync* blendNode = reinterpret_cast<LinearBlendNodeSync*>(thisPtr->animationNode);
+            LinearBlendNodeSync* blendNode = static_cast<LinearBlendNodeSync*>(thisPtr->animationNode);
             ImGui::PushItemWidth(200);
-            ImGui::SliderFloat("Blend Factor", blendNode->GetBlendValuePtr(), 0.f, 1.f);
+            ImGui::SliderFloat("Blend Factor", sentAnim->GetBlendTree()->GetBlendValuePtr(blendNode), 0.f, 1.f);
+            DrawParameterBinding(blendNode, 0u, sentAnim->GetBlendTreeTemplate());
             ImGui::PopItemWidth();
 
             ImGui::EndGroup();
@@ -196,12 +236,12 @@ void UI_NodeEditor::AssignDrawFunctionToUINode(UINode& node)
             ImGui::Text("-> In2");
             ed::EndPin();
 
-            TransitionNode* blendNode = reinterpret_cast<TransitionNode*>(thisPtr->animationNode);
+            TransitionNode* blendNode = static_cast<TransitionNode*>(thisPtr->animationNode);
 
             ImGui::Text("Transition Type:");
             ImGui::SameLine();
             const TransitionType_& transitionType = blendNode->GetTransitionType();
-            static std::array<std::string, 5> transitionTypeNames = { "None", "Frozen", "Frozen Sync", "Smooth", "Smooth Sync"};
+            static std::array<std::string, 6> transitionTypeNames = { "None", "Frozen", "Frozen Sync", "Smooth", "Smooth Sync", "Inertialized"};
             if (ImGui::Button(transitionTypeNames[(size_t)transitionType + 1u].c_str()))
             {
                 ed::Suspend();      // This gets out of the canvas coordinates and we can open the popup on screen coords instead
@@ -214,12 +254,17 @@ void UI_NodeEditor::AssignDrawFunctionToUINode(UINode& node)
             if (ImGui::SliderFloat("Transiton Max Time", &transiTime, 0.f, 4.f))
                 blendNode->SetTransitionTime(transiTime);
             ImGui::PopItemWidth();
+            // Starts the clip transitioned to on its closest pose, not used by the sync types
+            bool poseMatching = blendNode->IsPoseMatching();
+            if (ImGui::Checkbox("Match Pose", &poseMatching))
+                blendNode->SetPoseMatching(poseMatching);
 
             ImGui::PushItemWidth(100);
             if (ImGui::Button("Start"))
-                blendNode->StartTransition();
+                sentAnim->GetBlendTree()->StartTransition(blendNode);
             if (ImGui::Button("Reset"))
-                blendNode->Reset();
+                sentAnim->GetBlendTree()->ResetTransition(blendNode);
+            DrawParameterBinding(blendNode, 0u, sentAnim->GetBlendTreeTemplate());
             ImGui::PopItemWidth();
 
             ImGui::EndGroup();
@@ -254,7 +299,7 @@ void UI_NodeEditor::AssignDrawFunctionToUINode(UINode& node)
         node.Draw = [](UINode* const thisPtr, Animation3D*& sentAnim) -> void {
             ed::BeginNode(thisPtr->nodeID);
             ImGui::Text("Ragdoll Node");
-            RagdollNode* node = reinterpret_cast<RagdollNode*>(thisPtr->animationNode);
+            RagdollNode* node = static_cast<RagdollNode*>(thisPtr->animationNode);
 
             if (!node->IsRagdollValid())
             {
@@ -270,9 +315,162 @@ void UI_NodeEditor::AssignDrawFunctionToUINode(UINode& node)
             ImGui::Text("-> In1");
             ed::EndPin();
 
-            bool r = node->IsActive();
+            bool r = sentAnim->GetBlendTree()->IsRagdollActive(node);
             if (ImGui::Checkbox("Activate Ragdoll", &r))
-                node->SetActive(r);
+                sentAnim->GetBlendTree()->SetRagdollActive(node, r);
+            DrawParameterBinding(node, 0u, sentAnim->GetBlendTreeTemplate());
+
+            ImGui::EndGroup();
+            ImGui::SameLine();
+            ImGui::BeginGroup();
+
+            ed::BeginPin(thisPtr->outputPinID, ed::PinKind::Output);
+            ImGui::Text("Out ->");
+            ed::EndPin();
+            ImGui::EndGroup();
+            ed::EndNode();
+        };
+        break;
+    case NodeType_::NodeType_BlendSpace1D:
+    case NodeType_::NodeType_BlendSpace2D:
+        node.Draw = [](UINode* const thisPtr, Animation3D*& sentAnim) -> void {
+            // The sample whose clip is being picked, shared by all blend space nodes since only one popup can be open
+            static BlendSpaceNode* pickingNode = nullptr;
+            static uint32_t pickingSample = 0u;
+
+            BlendSpaceNode* blendSpace = static_cast<BlendSpaceNode*>(thisPtr->animationNode);
+            const bool is2D = blendSpace->GetType() == NodeType_::NodeType_BlendSpace2D;
+            ed::BeginNode(thisPtr->nodeID);
+            ImGui::Text(is2D ? "Blend Space 2D Node" : "Blend Space 1D Node");
+
+            const std::vector<std::string>& availableAnims = sentAnim->AvailableClips();
+            if (availableAnims.empty())
+            {
+                ImGui::NewLine();
+                ImGui::Text("No animation file was found or assigned for this model.");
+                ImGui::Text("Animation is unavailable.");
+                ed::EndNode();
+                return;
+            }
+
+            ImGui::BeginGroup();
+            ImGui::PushItemWidth(200);
+
+            // The parameter slider covers the area of the samples
+            float minValue = 0.f, maxValue = 1.f;
+            for (uint32_t i = 0u; i < blendSpace->GetSampleCount(); ++i)
+                for (uint32_t axis = 0u; axis < (is2D ? 2u : 1u); ++axis)
+                {
+                    const float value = blendSpace->GetSamplePosition(i)[axis];
+                    if (i == 0u && axis == 0u) minValue = maxValue = value;
+                    minValue = std::min(minValue, value);
+                    maxValue = std::max(maxValue, value);
+                }
+            float* parameter = sentAnim->GetBlendTree()->GetParameterPtr(blendSpace);
+            if (is2D)   ImGui::SliderFloat2("Parameter", parameter, minValue, maxValue);
+            else        ImGui::SliderFloat("Parameter", parameter, minValue, maxValue);
+            for (uint32_t slot = 0u; slot < blendSpace->GetParameterSlotCount(); ++slot)
+                DrawParameterBinding(blendSpace, slot, sentAnim->GetBlendTreeTemplate());
+
+            float s = blendSpace->GetPlaybackSpeed();
+            if (ImGui::SliderFloat("Playback Speed", &s, 0.f, 4.f))
+                blendSpace->SetPlaybackSpeed(s);
+            ImGui::PopItemWidth();
+
+            // One line per sample: clip, position and current weight
+            for (uint32_t i = 0u; i < blendSpace->GetSampleCount(); ++i)
+            {
+                ImGui::PushID(static_cast<int>(i));
+                if (ImGui::Button(blendSpace->GetSampleClip(i)->name.c_str()))
+                {
+                    pickingNode = blendSpace;
+                    pickingSample = i;
+                    ed::Suspend();
+                    ImGui::OpenPopup("blendspaceclip");
+                    ed::Resume();
+                }
+                ImGui::SameLine();
+                ImGui::PushItemWidth(is2D ? 100 : 50);
+                std::array<float, 2> position = blendSpace->GetSamplePosition(i);
+                if (is2D ? ImGui::DragFloat2("##position", position.data(), 0.01f) : ImGui::DragFloat("##position", position.data(), 0.01f))
+                    blendSpace->SetSamplePosition(i, position[0], position[1]);
+                ImGui::PopItemWidth();
+                ImGui::SameLine();
+                ImGui::Text("%.2f", sentAnim->GetBlendTree()->GetSampleWeight(blendSpace, i));
+                ImGui::SameLine();
+                const bool removed = ImGui::Button("X");
+                ImGui::PopID();
+                if (removed)
+                {
+                    blendSpace->RemoveSample(i);
+                    break;
+                }
+            }
+
+            if (ImGui::Button("Add Sample"))
+            {
+                // Place it past the last sample so that it does not overlap any
+                float x = 0.f;
+                for (uint32_t i = 0u; i < blendSpace->GetSampleCount(); ++i)
+                    x = std::max(x, blendSpace->GetSamplePosition(i)[0] + 1.f);
+                blendSpace->AddSample(sentAnim->GetDefaultClip(), x, 0.f);
+            }
+
+            ImGui::EndGroup();
+            ImGui::SameLine();
+            ImGui::BeginGroup();
+
+            ed::BeginPin(thisPtr->outputPinID, ed::PinKind::Output);
+            ImGui::Text("Out ->");
+            ed::EndPin();
+            ImGui::EndGroup();
+            ed::EndNode();
+
+            if (pickingNode != blendSpace) return;
+            ed::Suspend();
+            if (ImGui::BeginPopup("blendspaceclip")) {
+                ImGui::TextDisabled("Pick One:");
+                ImGui::BeginChild("popup_scroller", ImVec2(200, 100), true, ImGuiWindowFlags_AlwaysVerticalScrollbar);
+                for (size_t j = 0u; j < availableAnims.size(); ++j)
+                {
+                    if (ImGui::Button(availableAnims[j].c_str())) {
+                        if (pickingSample < blendSpace->GetSampleCount())
+                            blendSpace->SetSampleClip(pickingSample, sentAnim->GetClip(j));
+                        ImGui::CloseCurrentPopup();
+                    }
+                }
+                ImGui::EndChild();
+                ImGui::EndPopup();
+            }
+            ed::Resume();
+        };
+        break;
+    case NodeType_::NodeType_Additive:
+        node.Draw = [](UINode* const thisPtr, Animation3D*& sentAnim) -> void {
+            ed::BeginNode(thisPtr->nodeID);
+            ImGui::Text("Additive Node");
+            AdditiveNode* additiveNode = static_cast<AdditiveNode*>(thisPtr->animationNode);
+
+            ImGui::BeginGroup();
+            ed::BeginPin(thisPtr->inputPinIDs[0], ed::PinKind::Input);
+            ImGui::Text("-> Base");
+            ed::EndPin();
+
+            ImGui::PushItemWidth(200);
+            ImGui::Text("Clip:");
+            ImGui::SameLine();
+            if (ImGui::Button(additiveNode->GetClip() ? additiveNode->GetClip()->name.c_str() : "None"))
+            {
+                ed::Suspend();      // This gets out of the canvas coordinates and we can open the popup on screen coords instead
+                ImGui::OpenPopup("additiveclip");
+                ed::Resume();
+            }
+            ImGui::SliderFloat("Weight", sentAnim->GetBlendTree()->GetBlendValuePtr(additiveNode), 0.f, 1.f);
+            DrawParameterBinding(additiveNode, 0u, sentAnim->GetBlendTreeTemplate());
+            float s = additiveNode->GetPlaybackSpeed();
+            if (ImGui::SliderFloat("Playback Speed", &s, 0.f, 4.f))
+                additiveNode->SetPlaybackSpeed(s);
+            ImGui::PopItemWidth();
 
             ImGui::EndGroup();
             ImGui::SameLine();
@@ -283,6 +481,266 @@ void UI_NodeEditor::AssignDrawFunctionToUINode(UINode& node)
             ed::EndPin();
             ImGui::EndGroup();
             ed::EndNode();
+
+            // Only the clips made additive when they were loaded can be picked
+            ed::Suspend();
+            if (ImGui::BeginPopup("additiveclip")) {
+                ImGui::TextDisabled("Pick One:");
+                ImGui::BeginChild("popup_scroller", ImVec2(200, 100), true, ImGuiWindowFlags_AlwaysVerticalScrollbar);
+                bool anyAdditive = false;
+                for (size_t j = 0u; j < sentAnim->GetClipCount(); ++j)
+                {
+                    const Clip* clip = sentAnim->GetClip(j);
+                    if (!clip->additive) continue;
+                    anyAdditive = true;
+                    if (ImGui::Button(sentAnim->AvailableClips()[j].c_str())) {
+                        additiveNode->SetClip(clip);
+                        ImGui::CloseCurrentPopup();
+                    }
+                }
+                if (!anyAdditive)
+                    ImGui::Text("No additive clip, name a clip\n\"*additive*\" or set its\n\"additive\" in the manifest.");
+                ImGui::EndChild();
+                ImGui::EndPopup();
+            }
+            ed::Resume();
+        };
+        break;
+    case NodeType_::NodeType_MaskedBlend:
+        node.Draw = [](UINode* const thisPtr, Animation3D*& sentAnim) -> void {
+            ed::BeginNode(thisPtr->nodeID);
+            ImGui::Text("Masked Blend Node");
+            MaskedBlendNode* blendNode = static_cast<MaskedBlendNode*>(thisPtr->animationNode);
+
+            ImGui::BeginGroup();
+            ed::BeginPin(thisPtr->inputPinIDs[0], ed::PinKind::Input);
+            ImGui::Text("-> Base");
+            ed::EndPin();
+            ed::BeginPin(thisPtr->inputPinIDs[1], ed::PinKind::Input);
+            ImGui::Text("-> Layer");
+            ed::EndPin();
+
+            ImGui::PushItemWidth(200);
+            ImGui::Text("Mask:");
+            ImGui::SameLine();
+            if (ImGui::Button(blendNode->GetMask() ? blendNode->GetMask()->GetName().c_str() : "None"))
+            {
+                ed::Suspend();      // This gets out of the canvas coordinates and we can open the popup on screen coords instead
+                ImGui::OpenPopup("mask");
+                ed::Resume();
+            }
+            ImGui::SliderFloat("Blend Factor", sentAnim->GetBlendTree()->GetBlendValuePtr(blendNode), 0.f, 1.f);
+            DrawParameterBinding(blendNode, 0u, sentAnim->GetBlendTreeTemplate());
+            ImGui::PopItemWidth();
+
+            ImGui::EndGroup();
+            ImGui::SameLine();
+            ImGui::BeginGroup();
+
+            ed::BeginPin(thisPtr->outputPinID, ed::PinKind::Output);
+            ImGui::Text("Out ->");
+            ed::EndPin();
+            ImGui::EndGroup();
+            ed::EndNode();
+
+            ed::Suspend();
+            if (ImGui::BeginPopup("mask")) {
+                ImGui::TextDisabled("Pick One:");
+                ImGui::BeginChild("popup_scroller", ImVec2(200, 100), true, ImGuiWindowFlags_AlwaysVerticalScrollbar);
+                for (size_t j = 0u; j < sentAnim->GetBoneMaskCount(); ++j)
+                {
+                    if (ImGui::Button(sentAnim->GetBoneMask(j)->GetName().c_str())) {
+                        blendNode->SetMask(sentAnim->GetBoneMask(j));
+                        ImGui::CloseCurrentPopup();
+                    }
+                }
+                ImGui::EndChild();
+                ImGui::EndPopup();
+            }
+            ed::Resume();
+        };
+        break;
+    case NodeType_::NodeType_Mirror:
+        node.Draw = [](UINode* const thisPtr, Animation3D*& sentAnim) -> void {
+            ed::BeginNode(thisPtr->nodeID);
+            ImGui::Text("Mirror Node");
+            MirrorNode* node = static_cast<MirrorNode*>(thisPtr->animationNode);
+
+            ImGui::BeginGroup();
+            ed::BeginPin(thisPtr->inputPinIDs[0], ed::PinKind::Input);
+            ImGui::Text("-> In1");
+            ed::EndPin();
+
+            bool m = sentAnim->GetBlendTree()->IsMirrored(node);
+            if (ImGui::Checkbox("Mirror", &m))
+                sentAnim->GetBlendTree()->SetMirrored(node, m);
+            DrawParameterBinding(node, 0u, sentAnim->GetBlendTreeTemplate());
+            if (node->GetMirrorMap())
+                ImGui::Text("%zu joint pairs", node->GetMirrorMap()->GetPairCount());
+
+            ImGui::EndGroup();
+            ImGui::SameLine();
+            ImGui::BeginGroup();
+
+            ed::BeginPin(thisPtr->outputPinID, ed::PinKind::Output);
+            ImGui::Text("Out ->");
+            ed::EndPin();
+            ImGui::EndGroup();
+            ed::EndNode();
+        };
+        break;
+    case NodeType_::NodeType_StateMachine:
+        node.Draw = [](UINode* const thisPtr, Animation3D*& sentAnim) -> void {
+            // The transition being edited, shared by all state machine nodes since only one popup can be open
+            static StateMachineNode* pickingNode = nullptr;
+            static uint32_t pickingTransition = 0u;
+            // States of the next transition added, -1 for any state
+            static int newFrom = -1, newTo = 0;
+            static const std::array<std::string, 6> transitionTypeNames = { "None", "Frozen", "Frozen Sync", "Smooth", "Smooth Sync", "Inertialized" };
+            static const std::array<std::string, 6> conditionOpNames = { ">", "<", "is true", "is false", "triggered", "Time in state >" };
+
+            StateMachineNode* stateMachine = static_cast<StateMachineNode*>(thisPtr->animationNode);
+            BlendTreeTemplate* blendTree = sentAnim->GetBlendTreeTemplate();
+            const std::vector<BlendParameter>& parameters = blendTree->GetParameters();
+            uint32_t outgoing;
+            const uint32_t active = sentAnim->GetBlendTree()->GetActiveState(stateMachine, outgoing);
+            ed::BeginNode(thisPtr->nodeID);
+            ImGui::Text("State Machine Node");
+
+            ImGui::BeginGroup();
+            for (uint32_t i = 0u; i < STATEMACHINE_MAXSTATES; ++i)
+            {
+                ed::BeginPin(thisPtr->inputPinIDs[i], ed::PinKind::Input);
+                ImGui::Text(i == active ? "-> State %u (active)" : i == outgoing ? "-> State %u (leaving)" : "-> State %u", i);
+                ed::EndPin();
+            }
+
+            ImGui::PushItemWidth(100);
+            int entry = static_cast<int>(stateMachine->GetEntryState());
+            if (ImGui::SliderInt("Entry State", &entry, 0, STATEMACHINE_MAXSTATES - 1))
+                stateMachine->SetEntryState(static_cast<uint32_t>(entry));
+
+            // One line per transition, then one per condition
+            for (uint32_t t = 0u; t < stateMachine->GetTransitionCount(); ++t)
+            {
+                const StateMachineNode::Transition& transition = stateMachine->GetTransition(t);
+                ImGui::PushID(static_cast<int>(t));
+                if (transition.from == STATEMACHINE_ANY_STATE)  ImGui::Text("Any -> %u", transition.to);
+                else                                            ImGui::Text("%u -> %u", transition.from, transition.to);
+                ImGui::SameLine();
+                if (ImGui::Button(transitionTypeNames[(size_t)transition.type + 1u].c_str()))
+                {
+                    pickingNode = stateMachine;
+                    pickingTransition = t;
+                    ed::Suspend();
+                    ImGui::OpenPopup("statetransition");
+                    ed::Resume();
+                }
+                ImGui::SameLine();
+                float duration = transition.duration;
+                if (ImGui::DragFloat("##duration", &duration, 0.01f, 0.f, 4.f))
+                    stateMachine->SetTransitionDuration(t, duration);
+                ImGui::SameLine();
+                bool removed = ImGui::Button("X");
+
+                for (uint32_t c = 0u; c < transition.conditions.size() && !removed; ++c)
+                {
+                    const StateMachineNode::Condition& condition = transition.conditions[c];
+                    const uint32_t index = blendTree->FindParameter(condition.parameter);
+                    ImGui::PushID(static_cast<int>(c));
+                    ImGui::Text("    %s %s", condition.op == ConditionOp_::ConditionOp_StateTime ? "" : index != UINT32_MAX ? parameters[index].name.c_str() : "None",
+                        conditionOpNames[(size_t)condition.op].c_str());
+                    if (condition.op == ConditionOp_::ConditionOp_Greater || condition.op == ConditionOp_::ConditionOp_Less || condition.op == ConditionOp_::ConditionOp_StateTime)
+                    {
+                        ImGui::SameLine();
+                        float threshold = condition.threshold;
+                        if (ImGui::DragFloat("##threshold", &threshold, 0.01f))
+                            stateMachine->SetConditionThreshold(t, c, threshold);
+                    }
+                    ImGui::SameLine();
+                    const bool conditionRemoved = ImGui::Button("X");
+                    ImGui::PopID();
+                    if (conditionRemoved)
+                    {
+                        stateMachine->RemoveCondition(t, c);
+                        break;
+                    }
+                }
+                if (!removed && ImGui::Button("Add Condition"))
+                {
+                    pickingNode = stateMachine;
+                    pickingTransition = t;
+                    ed::Suspend();
+                    ImGui::OpenPopup("statecondition");
+                    ed::Resume();
+                }
+                ImGui::PopID();
+                if (removed)
+                {
+                    stateMachine->RemoveTransition(t);
+                    break;
+                }
+            }
+
+            ImGui::SliderInt("From", &newFrom, -1, STATEMACHINE_MAXSTATES - 1, newFrom < 0 ? "Any" : "%d");
+            ImGui::SliderInt("To", &newTo, 0, STATEMACHINE_MAXSTATES - 1);
+            if (ImGui::Button("Add Transition"))
+                stateMachine->AddTransition(newFrom < 0 ? STATEMACHINE_ANY_STATE : static_cast<uint32_t>(newFrom), static_cast<uint32_t>(newTo), 0.25f, TransitionType_::TransitionType_Smooth);
+            ImGui::PopItemWidth();
+
+            ImGui::EndGroup();
+            ImGui::SameLine();
+            ImGui::BeginGroup();
+
+            ed::BeginPin(thisPtr->outputPinID, ed::PinKind::Output);
+            ImGui::Text("Out ->");
+            ed::EndPin();
+            ImGui::EndGroup();
+            ed::EndNode();
+
+            if (pickingNode != stateMachine || pickingTransition >= stateMachine->GetTransitionCount()) return;
+            ed::Suspend();
+            if (ImGui::BeginPopup("statetransition")) {
+                ImGui::TextDisabled("Pick One:");
+                ImGui::BeginChild("popup_scroller", ImVec2(200, 100), true, ImGuiWindowFlags_AlwaysVerticalScrollbar);
+                for (size_t j = 0u; j < transitionTypeNames.size(); ++j)
+                {
+                    if (ImGui::Button(transitionTypeNames[j].c_str())) {
+                        stateMachine->SetTransitionType(pickingTransition, (TransitionType_)(j - 1));
+                        ImGui::CloseCurrentPopup();
+                    }
+                }
+                ImGui::EndChild();
+                ImGui::EndPopup();
+            }
+            // The conditions each parameter can take, the thresholds start at 0.5
+            if (ImGui::BeginPopup("statecondition")) {
+                ImGui::TextDisabled("Pick One:");
+                ImGui::BeginChild("popup_scroller", ImVec2(200, 100), true, ImGuiWindowFlags_AlwaysVerticalScrollbar);
+                for (size_t j = 0u; j < conditionOpNames.size(); ++j)
+                {
+                    const ConditionOp_ op = (ConditionOp_)j;
+                    if (op == ConditionOp_::ConditionOp_StateTime)
+                    {
+                        if (ImGui::Button(conditionOpNames[j].c_str())) {
+                            stateMachine->AddCondition(pickingTransition, op, BLEND_PARAMETER_NONE, 0.5f);
+                            ImGui::CloseCurrentPopup();
+                        }
+                        continue;
+                    }
+                    for (const BlendParameter& parameter : parameters)
+                    {
+                        if (parameter.type != StateMachineNode::GetConditionType(op)) continue;
+                        if (ImGui::Button((parameter.name + " " + conditionOpNames[j]).c_str())) {
+                            stateMachine->AddCondition(pickingTransition, op, parameter.key, 0.5f);
+                            ImGui::CloseCurrentPopup();
+                        }
+                    }
+                }
+                ImGui::EndChild();
+                ImGui::EndPopup();
+            }
+            ed::Resume();
         };
         break;
     default:
@@ -292,8 +750,10 @@ void UI_NodeEditor::AssignDrawFunctionToUINode(UINode& node)
 
 void UI_NodeEditor::RemoveLink(const LinkInfo & link)
 {
-    // Remove animation input
-    link.nodeWithInputPin->animationNode->RemoveInput(link.nodeWithOutputPin->animationNode);
+    // Remove animation input, from the slot of this link as the same node can be linked to several slots
+    for (uint8_t i = 0u; i < link.nodeWithInputPin->inputPinIDs.size(); ++i)
+        if (link.nodeWithInputPin->inputPinIDs[i] == link.endPinId)
+            link.nodeWithInputPin->animationNode->ClearInput(i);
 
     // Delete link
     v_Links.erase(&link);
@@ -339,11 +799,10 @@ void UI_NodeEditor::ResetFor(Animation3D* anim)
     p_SentAnim = anim;
     v_Links.clear();
     v_Nodes.clear();
-    v_Nodes.reserve(BLENDTREE_MAXNODES);
 
     // Build the nodes from the blend tree
     uintptr_t uniqueId = 1;
-    const std::vector<BlendNode*>& treeToDraw = p_SentAnim->GetBlendTree()->GetTree();
+    const std::vector<BlendNode*>& treeToDraw = p_SentAnim->GetBlendTreeTemplate()->GetTree();
     for (size_t i = 0u; i < treeToDraw.size(); ++i)
     {
         UINode currentNode = {
@@ -375,12 +834,7 @@ void UI_NodeEditor::ResetFor(Animation3D* anim)
             UINode* startNode = FindUINodeFromAnimationNode(input);     // This node starts the link from its output slot
             assert(endNode && startNode);                               // If they couldn't be found there is a logic error, it's not possible to link inexistant nodes
 
-            // Check if no link exist with this output
-            for (const auto& link : v_Links)
-            {
-                // If the node with the output is the same as the start (i.e. the node with output in this link), terminate
-                if (link.nodeWithOutputPin == startNode) return;
-            }
+            // An output can feed several inputs, every input slot has at most one link
 
             ed::PinId startPinID, endPinID;
             // The link starts at the output of the start node
@@ -415,10 +869,10 @@ void UI_NodeEditor::OnFrame(float deltaTime)
     // 1) Commit known data to editor
     //
 
-    for (uint32_t i = 0u; i < v_Nodes.size(); ++i)
+    int drawID = 0;
+    for (UINode& node : v_Nodes)
     {
-        UINode& node = v_Nodes[i];
-        ImGui::PushID(i);
+        ImGui::PushID(drawID++);
         node.Draw(&node, p_SentAnim);
         ImGui::PopID();
     }
@@ -542,9 +996,9 @@ void UI_NodeEditor::OnFrame(float deltaTime)
         if (ImGui::MenuItem("Clip Node"))
         {
             // Create a clip node
-            BlendTree* blendTree = p_SentAnim->GetBlendTree();
-            uint32_t nodeID = blendTree->AddNode(NodeType_::NodeType_Clip);
-            ClipNode* clipNode = reinterpret_cast<ClipNode*>(blendTree->GetNode(nodeID));
+            BlendTreeTemplate* blendTree = p_SentAnim->GetBlendTreeTemplate();
+            NodeHandle nodeID = blendTree->AddNode(NodeType_::NodeType_Clip);
+            ClipNode* clipNode = static_cast<ClipNode*>(blendTree->GetNode(nodeID));
             clipNode->SetClip(p_SentAnim->GetDefaultClip());
 
             // Create the UI node
@@ -564,8 +1018,8 @@ void UI_NodeEditor::OnFrame(float deltaTime)
         if (ImGui::MenuItem("Linear Blend Node"))
         {
             // Create a clip node
-            BlendTree* blendTree = p_SentAnim->GetBlendTree();
-            uint32_t nodeID = blendTree->AddNode(NodeType_::NodeType_LinearBlend);
+            BlendTreeTemplate* blendTree = p_SentAnim->GetBlendTreeTemplate();
+            NodeHandle nodeID = blendTree->AddNode(NodeType_::NodeType_LinearBlend);
 
             // Create the UI node
             int uniqueId = v_Nodes.back().outputPinID.Get() + 1;    // The last node has the biggest ID number in its outputPinID
@@ -584,8 +1038,8 @@ void UI_NodeEditor::OnFrame(float deltaTime)
         if (ImGui::MenuItem("Linear Blend Node Synchornised"))
         {
             // Create a clip node
-            BlendTree* blendTree = p_SentAnim->GetBlendTree();
-            uint32_t nodeID = blendTree->AddNode(NodeType_::NodeType_LinearBlendSync);
+            BlendTreeTemplate* blendTree = p_SentAnim->GetBlendTreeTemplate();
+            NodeHandle nodeID = blendTree->AddNode(NodeType_::NodeType_LinearBlendSync);
 
             // Create the UI node
             int uniqueId = v_Nodes.back().outputPinID.Get() + 1;    // The last node has the biggest ID number in its outputPinID
@@ -604,8 +1058,8 @@ void UI_NodeEditor::OnFrame(float deltaTime)
         if (ImGui::MenuItem("Transition Node"))
         {
             // Create a transition node
-            BlendTree* blendTree = p_SentAnim->GetBlendTree();
-            uint32_t nodeID = blendTree->AddNode(NodeType_::NodeType_Transition);
+            BlendTreeTemplate* blendTree = p_SentAnim->GetBlendTreeTemplate();
+            NodeHandle nodeID = blendTree->AddNode(NodeType_::NodeType_Transition);
 
             // Create the UI node
             int uniqueId = v_Nodes.back().outputPinID.Get() + 1;    // The last node has the biggest ID number in its outputPinID
@@ -624,9 +1078,9 @@ void UI_NodeEditor::OnFrame(float deltaTime)
         if (ImGui::MenuItem("Ragdoll Node"))
         {
             // Create a ragdoll node
-            BlendTree* blendTree = p_SentAnim->GetBlendTree();
-            uint32_t nodeID = blendTree->AddNode(NodeType_::NodeType_Ragdoll);
-            RagdollNode* node = reinterpret_cast<RagdollNode*>(blendTree->GetNode(nodeID));
+            BlendTreeTemplate* blendTree = p_SentAnim->GetBlendTreeTemplate();
+            NodeHandle nodeID = blendTree->AddNode(NodeType_::NodeType_Ragdoll);
+            RagdollNode* node = static_cast<RagdollNode*>(blendTree->GetNode(nodeID));
             node->SetRagdoll(p_SentAnim->GetRagdoll());
 
             // Create the UI node
@@ -643,6 +1097,118 @@ void UI_NodeEditor::OnFrame(float deltaTime)
             v_Nodes.push_back(std::move(currentNode));
             ImGui::CloseCurrentPopup();
         }
+        if (ImGui::MenuItem("Masked Blend Node"))
+        {
+            // Create a masked blend node with the first mask of the skeleton
+            BlendTreeTemplate* blendTree = p_SentAnim->GetBlendTreeTemplate();
+            NodeHandle nodeID = blendTree->AddNode(NodeType_::NodeType_MaskedBlend);
+            MaskedBlendNode* node = static_cast<MaskedBlendNode*>(blendTree->GetNode(nodeID));
+            if (p_SentAnim->GetBoneMaskCount()) node->SetMask(p_SentAnim->GetBoneMask(0u));
+
+            // Create the UI node
+            int uniqueId = v_Nodes.back().outputPinID.Get() + 1;    // The last node has the biggest ID number in its outputPinID
+            UINode currentNode = {
+                node,
+                uniqueId++,
+                {uniqueId++, uniqueId++, uniqueId++, uniqueId++},
+                uniqueId,
+                0
+            };
+            AssignDrawFunctionToUINode(currentNode);
+            ed::SetNodePosition(currentNode.nodeID, ed::ScreenToCanvas(mousePos));
+            v_Nodes.push_back(std::move(currentNode));
+            ImGui::CloseCurrentPopup();
+        }
+        if (ImGui::MenuItem("Additive Node"))
+        {
+            // Create an additive node playing the first additive clip
+            BlendTreeTemplate* blendTree = p_SentAnim->GetBlendTreeTemplate();
+            NodeHandle nodeID = blendTree->AddNode(NodeType_::NodeType_Additive);
+            AdditiveNode* node = static_cast<AdditiveNode*>(blendTree->GetNode(nodeID));
+            for (size_t j = 0u; j < p_SentAnim->GetClipCount() && !node->GetClip(); ++j)
+                node->SetClip(p_SentAnim->GetClip(j));
+
+            // Create the UI node
+            int uniqueId = v_Nodes.back().outputPinID.Get() + 1;    // The last node has the biggest ID number in its outputPinID
+            UINode currentNode = {
+                node,
+                uniqueId++,
+                {uniqueId++, uniqueId++, uniqueId++, uniqueId++},
+                uniqueId,
+                0
+            };
+            AssignDrawFunctionToUINode(currentNode);
+            ed::SetNodePosition(currentNode.nodeID, ed::ScreenToCanvas(mousePos));
+            v_Nodes.push_back(std::move(currentNode));
+            ImGui::CloseCurrentPopup();
+        }
+        if (ImGui::MenuItem("Mirror Node"))
+        {
+            // Create a mirror node swapping the sides of the skeleton
+            BlendTreeTemplate* blendTree = p_SentAnim->GetBlendTreeTemplate();
+            NodeHandle nodeID = blendTree->AddNode(NodeType_::NodeType_Mirror);
+            MirrorNode* node = static_cast<MirrorNode*>(blendTree->GetNode(nodeID));
+            node->SetMirrorMap(p_SentAnim->GetMirrorMap());
+
+            // Create the UI node
+            int uniqueId = v_Nodes.back().outputPinID.Get() + 1;    // The last node has the biggest ID number in its outputPinID
+            UINode currentNode = {
+                node,
+                uniqueId++,
+                {uniqueId++, uniqueId++, uniqueId++, uniqueId++},
+                uniqueId,
+                0
+            };
+            AssignDrawFunctionToUINode(currentNode);
+            ed::SetNodePosition(currentNode.nodeID, ed::ScreenToCanvas(mousePos));
+            v_Nodes.push_back(std::move(currentNode));
+            ImGui::CloseCurrentPopup();
+        }
+        if (ImGui::MenuItem("State Machine Node"))
+        {
+            // Create a state machine, its states are connected like any other input
+            BlendTreeTemplate* blendTree = p_SentAnim->GetBlendTreeTemplate();
+            NodeHandle nodeID = blendTree->AddNode(NodeType_::NodeType_StateMachine);
+
+            // Create the UI node
+            int uniqueId = v_Nodes.back().outputPinID.Get() + 1;    // The last node has the biggest ID number in its outputPinID
+            UINode currentNode = {
+                blendTree->GetNode(nodeID),
+                uniqueId++,
+                {uniqueId++, uniqueId++, uniqueId++, uniqueId++},
+                uniqueId,
+                0
+            };
+            AssignDrawFunctionToUINode(currentNode);
+            ed::SetNodePosition(currentNode.nodeID, ed::ScreenToCanvas(mousePos));
+            v_Nodes.push_back(std::move(currentNode));
+            ImGui::CloseCurrentPopup();
+        }
+        for (const NodeType_ type : { NodeType_::NodeType_BlendSpace1D, NodeType_::NodeType_BlendSpace2D })
+        {
+            const bool is2D = type == NodeType_::NodeType_BlendSpace2D;
+            if (!ImGui::MenuItem(is2D ? "Blend Space 2D Node" : "Blend Space 1D Node")) continue;
+
+            // Create a blend space with the default clip as its first sample
+            BlendTreeTemplate* blendTree = p_SentAnim->GetBlendTreeTemplate();
+            NodeHandle nodeID = blendTree->AddNode(type);
+            BlendSpaceNode* node = static_cast<BlendSpaceNode*>(blendTree->GetNode(nodeID));
+            node->AddSample(p_SentAnim->GetDefaultClip(), 0.f, 0.f);
+
+            // Create the UI node
+            int uniqueId = v_Nodes.back().outputPinID.Get() + 1;    // The last node has the biggest ID number in its outputPinID
+            UINode currentNode = {
+                node,
+                uniqueId++,
+                {uniqueId++, uniqueId++, uniqueId++, uniqueId++},
+                uniqueId,
+                0
+            };
+            AssignDrawFunctionToUINode(currentNode);
+            ed::SetNodePosition(currentNode.nodeID, ed::ScreenToCanvas(mousePos));
+            v_Nodes.push_back(std::move(currentNode));
+            ImGui::CloseCurrentPopup();
+        }
         ImGui::EndPopup();
     }
     if (ImGui::BeginPopup("NDM")) // Node Deletion Menu (less characters)
@@ -681,8 +1247,8 @@ void UI_NodeEditor::OnFrame(float deltaTime)
             }
 
             // Remove the node
-            p_SentAnim->GetBlendTree()->RemoveAndFreeNode(node->animationNode);
-            // TODO: Replace with ImVector and use v_Node.erase(node);
+            p_SentAnim->GetBlendTreeTemplate()->RemoveAndFreeNode(node->animationNode->GetHandle());
+            // The other nodes stay in place, the links point to them
             for (auto it = v_Nodes.begin(); it != v_Nodes.end(); ++it)
                 if (&*it == node)
                 {
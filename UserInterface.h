@@ -6,6 +6,7 @@
 #include <unordered_map>
 #include <functional>
 #include <array>
+#include <list>
 
 namespace ed = ax::NodeEditor;
 
@@ -40,6 +41,8 @@ struct UI_NodeEditor :
     UINode* FindUINodeFromInputPinID(const ed::PinId& itemToSearch);
     UINode* FindUINodeFromNodeID(const ed::NodeId& itemToSearch);
     void AssignDrawFunctionToUINode(UINode& node);
+    // Button picking the blackboard parameter bound to a slot of the node, drawn inside the node
+    static void DrawParameterBinding(AsdfAnim::BlendNode* node, uint32_t slot, AsdfAnim::BlendTreeTemplate* blendTree);
 
     // Struct to hold basic information about connection between
     // pins. Note that connection (aka. link) has its own ID.
@@ -68,6 +71,6 @@ struct UI_NodeEditor :
     ImVector<LinkInfo>      v_Links;                // List of live links. It is dynamic unless you want to create read-only view over nodes.
     int                     m_NextLinkId = 100;     // Counter to help generate link ids. In real application this will probably based on pointer to user data structure.
     AsdfAnim::Animation3D*  p_SentAnim = nullptr;
-    std::vector<UINode>     v_Nodes;
+    std::list<UINode>       v_Nodes;                // A list so that the links to the nodes stay valid when one is removed
     std::unordered_map<std::string, ed::EditorContext*> map_Contexts;
 };
\ No newline at end of file
@@ -38,19 +38,23 @@ bool MotionClipPlayer::Update(const float delta_time, const gef::SkeletonPose& b
 			}
 		}
 
-		// add the clip start time to the playback time to calculate the final time
-		// that will be used to sample the animation data
-		float time = anim_time_+clip_->start_time();
+		// bind the sampler to the new clip, any bones that don't have animation data are set to the bind pose once here
+		if(sampler_.GetAnimation() != clip_)
+		{
+			pose_ = bind_pose;
+			sampler_.SetAnimation(clip_, bind_pose);
+		}
 
-		// sample the animation data at the calculated time
-		// any bones that don't have animation data are set to the bind pose
-		pose_.SetPoseFromAnim(*clip_, bind_pose, time);
+		// sample the animation data at the playback time, the sampler adds the clip start time
+		sampler_.Sample(anim_time_, pose_);
+		pose_.CalculateGlobalPose();
 	}
 	else
 	{
 		// no animation associated with this player
 		// just set the pose to the bind pose
 		pose_ = bind_pose;
+		sampler_.SetAnimation(NULL, bind_pose);
 	}
 
 	// return true if we have reached the end of the animation, always false when playback is looped
@@ -2,6 +2,7 @@
 #define _MOTION_CLIP_PLAYER_H
 
 #include <animation/skeleton.h>
+#include "ClipSampler.h"
 
 namespace gef
 {
@@ -43,6 +44,9 @@ private:
 	/// A pointer to the animation clip to be sampled
 	const gef::Animation* clip_;
 
+	/// The per track key cursors used to sample the clip, rebuilt when the clip changes
+	AsdfAnim::ClipSampler sampler_;
+
 	/// The current playback time the animation clip is being sampled at
 	float anim_time_;
 
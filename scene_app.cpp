@@ -16,6 +16,9 @@
 #include "animation/animation.h"
 #include "Animation.h"
 #include "Animation3D.h"
+#include "ClipCompression.h"
+#include "ResampledClip.h"
+#include "Benchmarks.h"
 #include "Animation2D.h"
 #include "AnimatedSprite.h"
 
@@ -65,6 +68,9 @@ void SceneApp::Init()
 	// Load example animations
 	animation_manager_.LoadAllGef3DFromFolder("", true);			// This will load all 3D animations within the media folder
 	animation_manager_.LoadAllDragonbone2DJsonFromFolder("", true);	// This will load all 2D animations within the media folder (DragonBone)
+#if ASDFANIM_BENCHMARKS
+	AsdfAnim::Benchmarks::Run(platform_, animation_manager_.GetManifest());
+#endif
 	// Add a floor mesh
 	btVector3 floor_halfsize = { 50.f, 1.f, 50.f };
 	const btRigidBody* floor_body = physics_engine_.CreateBoxBody(floor_halfsize);
@@ -244,6 +250,110 @@ void SceneApp::DrawHUD()
 				{
 					AsdfAnim::Animation3D* current3D = reinterpret_cast<AsdfAnim::Animation3D*>(currentAnim);
 
+					// Memory used by this character, the render data only exists once it has been activated
+					ImGui::Text("Resident: %.2f MB (peak %.2f MB)%s", current3D->GetResidentBytes() / 1048576.f, current3D->GetPeakResidentBytes() / 1048576.f, current3D->IsResident() ? "" : " - render data evicted");
+					ImGui::Text("All characters: %.2f MB (peak %.2f MB)", animation_manager_.GetResidentBytes() / 1048576.f, animation_manager_.GetPeakResidentBytes() / 1048576.f);
+					float budget = animation_manager_.GetResidencyBudget() / 1048576.f;
+					if (ImGui::DragFloat("Budget (MB)", &budget, 1.f, 0.f, 4096.f))
+						animation_manager_.SetResidencyBudget(static_cast<size_t>(budget * 1048576.f));
+					ImGui::Text("Blend tree: %zu nodes, %zu instructions, %zu pose buffers", current3D->GetBlendTreeTemplate()->GetTree().size(),
+						current3D->GetBlendTreeTemplate()->GetInstructionCount(), current3D->GetBlendTree()->GetPoseBufferCount());
+					bool lazyEvaluation = current3D->GetBlendTreeTemplate()->IsLazyEvaluation();
+					if (ImGui::Checkbox("Reuse unchanged poses", &lazyEvaluation))
+						current3D->GetBlendTreeTemplate()->SetLazyEvaluation(lazyEvaluation);
+					ImGui::SameLine();
+					ImGui::Text("%u of %u instructions reused", current3D->GetBlendTree()->GetReusedCount(), current3D->GetBlendTree()->GetEvaluatedCount());
+					bool parallelEvaluation = current3D->GetBlendTreeTemplate()->IsParallelEvaluation();
+					if (ImGui::Checkbox("Evaluate branches in parallel", &parallelEvaluation))
+						current3D->GetBlendTreeTemplate()->SetParallelEvaluation(parallelEvaluation);
+					ImGui::SameLine();
+					ImGui::Text("cost %u, %zu branches%s", current3D->GetBlendTreeTemplate()->GetEstimatedCost(), current3D->GetBlendTreeTemplate()->GetTaskCount(),
+						current3D->GetBlendTreeTemplate()->IsEvaluatedInParallel() ? "" : ", serial");
+					if (ImGui::Button("Save blend tree"))
+						current3D->SaveBlendTree();
+					if (ImGui::TreeNode("Parameters"))
+					{
+						// The blackboard is declared on the template, the values shown are those of this character
+						AsdfAnim::BlendTreeTemplate* blendTree = current3D->GetBlendTreeTemplate();
+						AsdfAnim::BlendTree* instance = current3D->GetBlendTree();
+						static const char* parameterTypeNames[] = { "Float", "Bool", "Trigger" };
+						for (size_t parameterIndex = 0; parameterIndex < blendTree->GetParameters().size(); ++parameterIndex)
+						{
+							const AsdfAnim::BlendParameter& parameter = blendTree->GetParameters()[parameterIndex];
+							const AsdfAnim::ParameterKey key = parameter.key;
+							ImGui::PushID(static_cast<int>(parameterIndex));
+							if (parameter.type == AsdfAnim::ParameterType_::ParameterType_Float)
+							{
+								float value = instance->GetFloat(key);
+								if (ImGui::DragFloat(parameter.name.c_str(), &value, 0.01f))
+									instance->SetFloat(key, value);
+							}
+							else if (parameter.type == AsdfAnim::ParameterType_::ParameterType_Bool)
+							{
+								bool value = instance->GetBool(key);
+								if (ImGui::Checkbox(parameter.name.c_str(), &value))
+									instance->SetBool(key, value);
+							}
+							else if (ImGui::Button(parameter.name.c_str()))
+								instance->SetTrigger(key);
+							ImGui::SameLine();
+							const bool removed = ImGui::Button("X");
+							ImGui::PopID();
+							if (removed)
+							{
+								blendTree->RemoveParameter(key);
+								break;
+							}
+						}
+
+						static char parameterName[64] = "";
+						static int parameterType = 0;
+						ImGui::InputText("Name", parameterName, sizeof(parameterName));
+						if (ImGui::BeginCombo("Type", parameterTypeNames[parameterType]))
+						{
+							for (int t = 0; t < 3; ++t)
+								if (ImGui::Selectable(parameterTypeNames[t], parameterType == t))
+									parameterType = t;
+							ImGui::EndCombo();
+						}
+						if (ImGui::Button("Add parameter") && parameterName[0] && blendTree->AddParameter(parameterName, static_cast<AsdfAnim::ParameterType_>(parameterType)))
+							parameterName[0] = '\0';
+						ImGui::TreePop();
+					}
+					if (ImGui::TreeNode("Clip data"))
+					{
+						static const char* representationNames[] = { "Source", "Compressed", "Resampled" };
+						for (size_t clipIndex = 0; clipIndex < current3D->GetClipCount(); ++clipIndex)
+						{
+							const AsdfAnim::Clip* clip = current3D->GetClip(clipIndex);
+							ImGui::PushID(static_cast<int>(clipIndex));
+							if (ImGui::BeginCombo(clip->name.c_str(), representationNames[static_cast<int>(clip->representation)]))
+							{
+								for (int r = 0; r < 3; ++r)
+								{
+									const AsdfAnim::ClipRepresentation representation = static_cast<AsdfAnim::ClipRepresentation>(r);
+									if (!AsdfAnim::Animation3D::HasClipRepresentation(*clip, representation)) continue;
+									if (ImGui::Selectable(representationNames[r], clip->representation == representation))
+										current3D->SetClipRepresentation(clipIndex, representation);
+								}
+								ImGui::EndCombo();
+							}
+							if (clip->compressed)
+							{
+								const AsdfAnim::ClipCompressionStats& stats = clip->compressed->GetStats();
+								ImGui::Text("Compressed: %.1f KB -> %.1f KB (%.2fx), max error %.4f", stats.sourceBytes / 1024.f, stats.compressedBytes / 1024.f, stats.GetRatio(), stats.maxError);
+							}
+							if (clip->resampled)
+							{
+								const AsdfAnim::ClipResamplingStats& stats = clip->resampled->GetStats();
+								ImGui::Text("Resampled at %.0fHz: %.1f KB, max error %.4f", clip->resampled->GetSampleRate(), stats.resampledBytes / 1024.f, stats.maxError);
+							}
+							ImGui::PopID();
+						}
+						ImGui::TreePop();
+					}
+					ImGui::Separator();
+
 					// The transform of the mesh
 					ImGui::Text("Translation XYZ");
 					if (ImGui::DragFloat3("Translation XYZ", &gui_animation_translations_[i].x, .1f))